@@ -6,14 +6,14 @@ LOCAL_PATH := $(call my-dir)
 
 include $(CLEAR_VARS)
 LOCAL_MODULE	:= libwrap
-LOCAL_SRC_FILES	:= wrap/wrap-util.c wrap/wrap-syscall.c
+LOCAL_SRC_FILES	:= wrap/wrap-util.c wrap/wrap-syscall.c util/rdz.c util/rdidx.c
 LOCAL_C_INCLUDES := $(LOCAL_PATH)/includes $(LOCAL_PATH)/util
 LOCAL_LDLIBS := -llog -lc -ldl
 include $(BUILD_SHARED_LIBRARY)
 
 include $(CLEAR_VARS)
 LOCAL_MODULE    := libwrapfake
-LOCAL_SRC_FILES := wrap/wrap-util.c wrap/wrap-syscall-fake.c
+LOCAL_SRC_FILES := wrap/wrap-util.c wrap/wrap-syscall-fake.c util/rdz.c util/rdidx.c
 LOCAL_C_INCLUDES := $(LOCAL_PATH)/includes $(LOCAL_PATH)/util
 LOCAL_LDLIBS := -llog -lc -ldl
 include $(BUILD_SHARED_LIBRARY)
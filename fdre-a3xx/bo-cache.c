@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2012 Rob Clark <robdclark@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <time.h>
+
+#include "bo-cache.h"
+
+/* seconds a bo can sit unused in the cache before it is freed: */
+#define IDLE_TIME  1
+
+#define MAX_BUCKETS 64
+
+struct fd_bo_entry {
+	struct fd_bo *bo;
+	/* freed by the batch currently being recorded: */
+	bool pending;
+	/* otherwise, busy until this timestamp retires: */
+	uint32_t timestamp;
+	time_t time;
+	struct fd_bo_entry *next;
+};
+
+struct fd_bo_bucket {
+	uint32_t size;
+	/* most recently freed first: */
+	struct fd_bo_entry *list;
+};
+
+struct fd_bo_cache {
+	struct fd_device *dev;
+	struct fd_bo_bucket buckets[MAX_BUCKETS];
+	uint32_t nbuckets, npending;
+	uint32_t retired;
+	struct fd_bo_cache_stats stats;
+};
+
+static time_t now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+static void add_bucket(struct fd_bo_cache *cache, uint32_t size)
+{
+	assert(cache->nbuckets < ARRAY_SIZE(cache->buckets));
+	cache->buckets[cache->nbuckets++].size = size;
+}
+
+struct fd_bo_cache * fd_bo_cache_new(struct fd_device *dev)
+{
+	struct fd_bo_cache *cache = calloc(1, sizeof(*cache));
+	uint32_t size;
+
+	cache->dev = dev;
+
+	/* 4K, 8K, 12K, and then four buckets per power of two, ie. 16K,
+	 * 20K, 24K, 28K, 32K, 40K, 48K, 56K, 64K, ... up to 64M:
+	 */
+	add_bucket(cache, 0x1000);
+	add_bucket(cache, 0x2000);
+	add_bucket(cache, 0x3000);
+	for (size = 0x4000; size <= 0x4000000; size *= 2) {
+		add_bucket(cache, size);
+		add_bucket(cache, size + size / 4);
+		add_bucket(cache, size + size / 2);
+		add_bucket(cache, size + 3 * size / 4);
+	}
+
+	return cache;
+}
+
+static void free_entry(struct fd_bo_cache *cache,
+		struct fd_bo_bucket *bucket, struct fd_bo_entry *e)
+{
+	cache->stats.frees++;
+	cache->stats.bytes_cached -= bucket->size;
+	cache->stats.nbos_cached--;
+	fd_bo_del(e->bo);
+	free(e);
+}
+
+void fd_bo_cache_del(struct fd_bo_cache *cache)
+{
+	uint32_t i;
+
+	if (!cache)
+		return;
+
+	for (i = 0; i < cache->nbuckets; i++) {
+		struct fd_bo_bucket *bucket = &cache->buckets[i];
+		while (bucket->list) {
+			struct fd_bo_entry *e = bucket->list;
+			bucket->list = e->next;
+			free_entry(cache, bucket, e);
+		}
+	}
+
+	free(cache);
+}
+
+static struct fd_bo_bucket * get_bucket(struct fd_bo_cache *cache,
+		uint32_t size)
+{
+	uint32_t i;
+
+	for (i = 0; i < cache->nbuckets; i++)
+		if (cache->buckets[i].size >= size)
+			return &cache->buckets[i];
+
+	return NULL;
+}
+
+static bool is_idle(struct fd_bo_cache *cache, struct fd_bo_entry *e)
+{
+	/* timestamps can wrap: */
+	return !e->pending && ((int32_t)(cache->retired - e->timestamp) >= 0);
+}
+
+struct fd_bo * fd_bo_cache_alloc(struct fd_bo_cache *cache, uint32_t size)
+{
+	struct fd_bo_bucket *bucket = get_bucket(cache, size);
+
+	if (bucket) {
+		struct fd_bo_entry **pe;
+
+		for (pe = &bucket->list; *pe; pe = &(*pe)->next) {
+			struct fd_bo_entry *e = *pe;
+			struct fd_bo *bo = e->bo;
+
+			if (!is_idle(cache, e))
+				continue;
+
+			*pe = e->next;
+			free(e);
+
+			cache->stats.hits++;
+			cache->stats.bytes_cached -= bucket->size;
+			cache->stats.nbos_cached--;
+
+			/* callers expect zeroed memory, like from fd_bo_new(): */
+			memset(fd_bo_map(bo), 0, bucket->size);
+
+			return bo;
+		}
+
+		size = bucket->size;
+	}
+
+	cache->stats.misses++;
+	cache->stats.allocs++;
+
+	return fd_bo_new(cache->dev, size, DRM_FREEDRENO_GEM_TYPE_KMEM);
+}
+
+void fd_bo_cache_free(struct fd_bo_cache *cache, struct fd_bo *bo)
+{
+	uint32_t size = fd_bo_size(bo);
+	struct fd_bo_bucket *bucket = get_bucket(cache, size);
+	struct fd_bo_entry *e;
+
+	/* too big to cache, or not allocated from the cache: */
+	if (!bucket || (bucket->size != size)) {
+		cache->stats.frees++;
+		fd_bo_del(bo);
+		return;
+	}
+
+	e = calloc(1, sizeof(*e));
+	e->bo = bo;
+	e->pending = true;
+	e->time = now();
+	e->next = bucket->list;
+	bucket->list = e;
+
+	cache->npending++;
+	cache->stats.bytes_cached += size;
+	cache->stats.nbos_cached++;
+}
+
+void fd_bo_cache_flushed(struct fd_bo_cache *cache, uint32_t timestamp)
+{
+	uint32_t i;
+
+	for (i = 0; (i < cache->nbuckets) && cache->npending; i++) {
+		struct fd_bo_entry *e;
+		for (e = cache->buckets[i].list; e; e = e->next) {
+			if (e->pending) {
+				e->pending = false;
+				e->timestamp = timestamp;
+				cache->npending--;
+			}
+		}
+	}
+}
+
+void fd_bo_cache_retired(struct fd_bo_cache *cache, uint32_t timestamp)
+{
+	time_t t = now();
+	uint32_t i;
+
+	cache->retired = timestamp;
+
+	/* and get rid of what has not been reused for a while: */
+	for (i = 0; i < cache->nbuckets; i++) {
+		struct fd_bo_bucket *bucket = &cache->buckets[i];
+		struct fd_bo_entry **pe = &bucket->list;
+
+		while (*pe) {
+			struct fd_bo_entry *e = *pe;
+			if (is_idle(cache, e) && ((t - e->time) > IDLE_TIME)) {
+				*pe = e->next;
+				free_entry(cache, bucket, e);
+			} else {
+				pe = &e->next;
+			}
+		}
+	}
+}
+
+void fd_bo_cache_stats(struct fd_bo_cache *cache,
+		struct fd_bo_cache_stats *stats)
+{
+	*stats = cache->stats;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2012 Rob Clark <robdclark@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BO_CACHE_H_
+#define BO_CACHE_H_
+
+#include <freedreno_drmif.h>
+
+#include "util.h"
+
+/* A cache of bo's in size buckets, so that fdre doesn't have to go to
+ * the kernel for every allocation.  A bo which is freed may still be
+ * referenced by the batch being recorded, so it only becomes reusable
+ * once the ring timestamp of the flush which submitted that batch has
+ * retired.  Cached bo's which stay unused for a while are freed.
+ */
+
+struct fd_bo_cache;
+
+struct fd_bo_cache_stats {
+	uint64_t hits, misses;        /* allocations served from cache or not */
+	uint64_t allocs, frees;       /* calls to fd_bo_new()/fd_bo_del() */
+	uint64_t bytes_cached;        /* currently sitting in the cache */
+	uint32_t nbos_cached;
+};
+
+struct fd_bo_cache * fd_bo_cache_new(struct fd_device *dev);
+void fd_bo_cache_del(struct fd_bo_cache *cache);
+
+/* returns a zeroed bo, same as a fresh one from the kernel: */
+struct fd_bo * fd_bo_cache_alloc(struct fd_bo_cache *cache, uint32_t size);
+void fd_bo_cache_free(struct fd_bo_cache *cache, struct fd_bo *bo);
+
+/* the bo's freed since the last flush are busy until 'timestamp': */
+void fd_bo_cache_flushed(struct fd_bo_cache *cache, uint32_t timestamp);
+/* everything up to and including 'timestamp' has completed: */
+void fd_bo_cache_retired(struct fd_bo_cache *cache, uint32_t timestamp);
+
+void fd_bo_cache_stats(struct fd_bo_cache *cache,
+		struct fd_bo_cache_stats *stats);
+
+#endif /* BO_CACHE_H_ */
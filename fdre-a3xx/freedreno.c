@@ -30,6 +30,7 @@
 #include "freedreno.h"
 #include "program.h"
 #include "ring.h"
+#include "bo-cache.h"
 #include "ir-a3xx.h"
 #include "ws.h"
 #include "bmp.h"
@@ -42,6 +43,36 @@ emit_marker(struct fd_ringbuffer *ring, int scratch_idx)
 	OUT_RING(ring, ++marker_cnt);
 }
 
+/* groups of state which draw_impl() re-emits only when changed: */
+enum fd_dirty {
+	FD_DIRTY_PROGRAM  = (1 << 0),
+	FD_DIRTY_VTX      = (1 << 1),
+	FD_DIRTY_RASTER   = (1 << 2),
+	FD_DIRTY_ZSA      = (1 << 3),
+	FD_DIRTY_RENDER   = (1 << 4),
+	FD_DIRTY_VIEWPORT = (1 << 5),
+	FD_DIRTY_TEXTURES = (1 << 6),
+	FD_DIRTY_BLEND    = (1 << 7),
+	FD_DIRTY_ALL      = ~0,
+};
+
+/* number of batches which can be in flight at once: */
+#define NUM_BATCHES 3
+
+struct fd_batch {
+	struct fd_ringbuffer *ring;
+	struct fd_ringmarker *draw_start, *draw_end;
+
+	/* upload heap bo's referenced by the batch: */
+	struct fd_bo **upload;
+	uint32_t nupload, maxupload;
+
+	/* fence and ring timestamp of the submit, fence is 0 when the
+	 * batch is being recorded or has retired:
+	 */
+	uint32_t fence, timestamp;
+};
+
 struct fd_state {
 
 	struct fd_winsys *ws;
@@ -52,10 +83,24 @@ struct fd_state {
 	uint32_t gmemsize_bytes;
 	uint32_t device_id;
 
-	/* cmdstream buffer with render commands: */
+	/* all of our bo's are allocated from here: */
+	struct fd_bo_cache *bo_cache;
+
+	/* batches are recorded round-robin into a pool of rings, so the
+	 * next batch can be recorded while the gpu executes the previous
+	 * ones.  The ring/markers of the batch being recorded:
+	 */
+	struct fd_batch batch[NUM_BATCHES];
+	uint32_t cur_batch;
 	struct fd_ringbuffer *ring;
 	struct fd_ringmarker *draw_start, *draw_end;
 
+	/* last fence handed out, and the bo the gpu writes the fence to
+	 * as each batch completes:
+	 */
+	uint32_t fence;
+	struct fd_bo *fence_bo;
+
 	struct {
 		struct fd_bo *bo;
 	} vsc_pipe[8];
@@ -89,6 +134,17 @@ struct fd_state {
 	/* buffer related params: */
 	struct fd_parameters bufs;
 
+	/* upload heap for vertex/index data passed by pointer: 'cur' is
+	 * suballocated linearly, and 'free' are the bo's whose batch has
+	 * retired:
+	 */
+	struct {
+		struct fd_bo *cur;
+		uint32_t offset;
+		struct fd_bo **free;
+		uint32_t nfree, maxfree;
+	} upload;
+
 	struct {
 		/* render target: */
 		struct fd_surface *surface;
@@ -108,6 +164,12 @@ struct fd_state {
 	/* have there been any render cmds since last flush? */
 	bool dirty;
 
+	/* state groups (FD_DIRTY_x) not yet emitted in the current batch,
+	 * and the 'first' vertex the vertex fetch state was emitted for:
+	 */
+	uint32_t dirty_state;
+	uint32_t vtx_first;
+
 	struct {
 		struct {
 			float x, y, z;
@@ -246,18 +308,27 @@ struct fd_state * fd_init(void)
 	fd_pipe_get_param(state->pipe, FD_DEVICE_ID, &val);
 	state->device_id = val;
 
-	state->ring = fd_ringbuffer_new(state->pipe, 0x10000);
-	state->draw_start = fd_ringmarker_new(state->ring);
-	state->draw_end = fd_ringmarker_new(state->ring);
+	for (i = 0; i < NUM_BATCHES; i++) {
+		struct fd_batch *batch = &state->batch[i];
+		batch->ring = fd_ringbuffer_new(state->pipe, 0x10000);
+		batch->draw_start = fd_ringmarker_new(batch->ring);
+		batch->draw_end = fd_ringmarker_new(batch->ring);
+	}
+
+	state->ring = state->batch[0].ring;
+	state->draw_start = state->batch[0].draw_start;
+	state->draw_end = state->batch[0].draw_end;
+
+	state->bo_cache = fd_bo_cache_new(state->dev);
 
-	state->solid_const = fd_bo_new(state->dev, 0x1000,
-			DRM_FREEDRENO_GEM_TYPE_KMEM);
+	state->fence_bo = fd_bo_cache_alloc(state->bo_cache, 0x1000);
+	memset(fd_bo_map(state->fence_bo), 0, 4);
 
-	state->vs_pvt_mem = fd_bo_new(state->dev, 0x2000,
-			DRM_FREEDRENO_GEM_TYPE_KMEM);
+	state->solid_const = fd_bo_cache_alloc(state->bo_cache, 0x1000);
 
-	state->fs_pvt_mem = fd_bo_new(state->dev, 0x102000,
-			DRM_FREEDRENO_GEM_TYPE_KMEM);
+	state->vs_pvt_mem = fd_bo_cache_alloc(state->bo_cache, 0x2000);
+
+	state->fs_pvt_mem = fd_bo_cache_alloc(state->bo_cache, 0x102000);
 
 	state->program = fd_program_new(state);
 
@@ -312,6 +383,8 @@ struct fd_state * fd_init(void)
 	state->clear.depth = 1;
 	state->clear.stencil = 0;
 
+	state->dirty_state = FD_DIRTY_ALL;
+
 	for (i = 0; i < ARRAY_SIZE(state->rb_mrt); i++) {
 		state->rb_mrt[i].blendcontrol =
 				A3XX_RB_MRT_BLEND_CONTROL_RGB_SRC_FACTOR(FACTOR_ONE) |
@@ -337,8 +410,34 @@ fail:
 
 void fd_fini(struct fd_state *state)
 {
+	unsigned i;
+
+	/* nothing can be freed while the gpu may still be using it: */
+	fd_fence_wait(state, state->fence);
+
+	for (i = 0; i < NUM_BATCHES; i++) {
+		struct fd_batch *batch = &state->batch[i];
+		uint32_t j;
+
+		for (j = 0; j < batch->nupload; j++)
+			fd_bo_cache_free(state->bo_cache, batch->upload[j]);
+		free(batch->upload);
+
+		if (batch->ring) {
+			fd_ringmarker_del(batch->draw_start);
+			fd_ringmarker_del(batch->draw_end);
+			fd_ringbuffer_del(batch->ring);
+		}
+	}
+
+	for (i = 0; i < state->upload.nfree; i++)
+		fd_bo_cache_free(state->bo_cache, state->upload.free[i]);
+	free(state->upload.free);
+
 	fd_surface_del(state, state->render_target.surface);
-	fd_ringbuffer_del(state->ring);
+
+	fd_bo_cache_del(state->bo_cache);
+
 	if (state->ws)
 		state->ws->destroy(state->ws);
 	free(state);
@@ -348,11 +447,13 @@ void fd_fini(struct fd_state *state)
 
 int fd_vertex_shader_attach_asm(struct fd_state *state, const char *src)
 {
+	state->dirty_state |= FD_DIRTY_PROGRAM | FD_DIRTY_VTX | FD_DIRTY_RASTER;
 	return fd_program_attach_asm(state->program, FD_SHADER_VERTEX, src);
 }
 
 int fd_fragment_shader_attach_asm(struct fd_state *state, const char *src)
 {
+	state->dirty_state |= FD_DIRTY_PROGRAM | FD_DIRTY_TEXTURES;
 	return fd_program_attach_asm(state->program, FD_SHADER_FRAGMENT, src);
 }
 
@@ -365,15 +466,193 @@ int fd_link(struct fd_state *state)
 int fd_set_program(struct fd_state *state, struct fd_program *program)
 {
 	state->program = program;
+	state->dirty_state |= FD_DIRTY_PROGRAM | FD_DIRTY_VTX |
+			FD_DIRTY_RASTER | FD_DIRTY_TEXTURES;
 	return fd_link(state);
 }
 
+#define UPLOAD_BO_SIZE  0x40000
+#define UPLOAD_ALIGN    32
+
+/* copy data into the upload heap, returns the bo and sets *offset: */
+static struct fd_bo * upload(struct fd_state *state, const void *data,
+		uint32_t size, uint32_t *offset)
+{
+	uint32_t off = ALIGN(state->upload.offset, UPLOAD_ALIGN);
+	struct fd_bo *bo = state->upload.cur;
+
+	if (!bo || ((off + size) > fd_bo_size(bo))) {
+		struct fd_batch *batch = &state->batch[state->cur_batch];
+
+		if (batch->nupload == batch->maxupload) {
+			batch->maxupload = max(2 * batch->nupload, 16);
+			batch->upload = realloc(batch->upload,
+					batch->maxupload * sizeof(bo));
+		}
+
+		/* oversized uploads get a bo of their own, which is not
+		 * recycled:
+		 */
+		if ((size <= UPLOAD_BO_SIZE) && state->upload.nfree)
+			bo = state->upload.free[--state->upload.nfree];
+		else
+			bo = fd_bo_cache_alloc(state->bo_cache,
+					max(size, UPLOAD_BO_SIZE));
+
+		batch->upload[batch->nupload++] = bo;
+		state->upload.cur = bo;
+		off = 0;
+	}
+
+	memcpy((uint8_t *)fd_bo_map(bo) + off, data, size);
+	state->upload.offset = off + size;
+	*offset = off;
+
+	return bo;
+}
+
+/* the batch has completed, so its upload bo's can be recycled: */
+static void batch_retire(struct fd_state *state, struct fd_batch *batch)
+{
+	uint32_t i;
+
+	for (i = 0; i < batch->nupload; i++) {
+		struct fd_bo *bo = batch->upload[i];
+
+		/* oversized uploads had a bo of their own: */
+		if (fd_bo_size(bo) > UPLOAD_BO_SIZE) {
+			fd_bo_cache_free(state->bo_cache, bo);
+			continue;
+		}
+
+		if (state->upload.nfree == state->upload.maxfree) {
+			state->upload.maxfree = max(2 * state->upload.nfree, 16);
+			state->upload.free = realloc(state->upload.free,
+					state->upload.maxfree * sizeof(bo));
+		}
+
+		state->upload.free[state->upload.nfree++] = bo;
+	}
+
+	batch->nupload = 0;
+	batch->fence = 0;
+}
+
+/* wrap-safe a <= b, for fences and timestamps: */
+static bool fence_before_eq(uint32_t a, uint32_t b)
+{
+	return (int32_t)(a - b) <= 0;
+}
+
+/* retire the batches up to and including 'fence'.  Without 'wait' this
+ * only happens if the gpu has already written back the fence, and
+ * returns false otherwise:
+ */
+static bool retire_fence(struct fd_state *state, uint32_t fence, bool wait)
+{
+	uint32_t i, timestamp = 0;
+	bool busy = false;
+
+	for (i = 0; i < NUM_BATCHES; i++) {
+		struct fd_batch *batch = &state->batch[i];
+		if (batch->fence && fence_before_eq(batch->fence, fence)) {
+			if (!busy || fence_before_eq(timestamp, batch->timestamp))
+				timestamp = batch->timestamp;
+			busy = true;
+		}
+	}
+
+	if (!busy)
+		return true;
+
+	if (wait) {
+		fd_pipe_wait(state->pipe, timestamp);
+	} else {
+		volatile uint32_t *done = fd_bo_map(state->fence_bo);
+		if (!fence_before_eq(fence, *done))
+			return false;
+	}
+
+	for (i = 0; i < NUM_BATCHES; i++) {
+		struct fd_batch *batch = &state->batch[i];
+		if (batch->fence && fence_before_eq(batch->fence, fence))
+			batch_retire(state, batch);
+	}
+
+	fd_bo_cache_retired(state->bo_cache, timestamp);
+
+	return true;
+}
+
+/* submit the batch being recorded and start recording the next one,
+ * returns the fence of the submitted batch:
+ */
+static uint32_t batch_submit(struct fd_state *state)
+{
+	struct fd_batch *batch = &state->batch[state->cur_batch];
+	struct fd_parameters *attr = &state->attributes;
+	uint32_t i;
+
+	/* 0 means no fence: */
+	if (++state->fence == 0)
+		state->fence++;
+
+	/* have the gpu write back the fence when it gets this far: */
+	emit_mem_write(state, state->fence_bo, &state->fence, 1);
+
+	fd_ringbuffer_flush(batch->ring);
+	batch->fence = state->fence;
+	batch->timestamp = fd_ringbuffer_timestamp(batch->ring);
+	fd_bo_cache_flushed(state->bo_cache, batch->timestamp);
+
+	/* the oldest batch has to complete before its ring is reused: */
+	state->cur_batch = (state->cur_batch + 1) % NUM_BATCHES;
+	batch = &state->batch[state->cur_batch];
+	if (batch->fence)
+		retire_fence(state, batch->fence, true);
+
+	fd_ringbuffer_reset(batch->ring);
+	state->ring = batch->ring;
+	state->draw_start = batch->draw_start;
+	state->draw_end = batch->draw_end;
+	fd_ringmarker_mark(state->draw_start);
+
+	/* attributes which are still bound point into the upload heap of
+	 * the submitted batch, so copy their data into the new batch's:
+	 */
+	state->upload.cur = NULL;
+	for (i = 0; i < attr->nparams; i++) {
+		struct fd_param *p = &attr->params[i];
+		if (p->upload) {
+			void *data = (uint8_t *)fd_bo_map(p->bo) + p->offset;
+			p->bo = upload(state, data, p->upload, &p->offset);
+		}
+	}
+
+	state->dirty_state = FD_DIRTY_ALL;
+
+	return state->fence;
+}
+
+bool fd_fence_signaled(struct fd_state *state, uint32_t fence)
+{
+	if (!fence)
+		return true;
+	return retire_fence(state, fence, false);
+}
+
+int fd_fence_wait(struct fd_state *state, uint32_t fence)
+{
+	if (fence)
+		retire_fence(state, fence, true);
+	return 0;
+}
+
 /* for VBO's */
 struct fd_bo * fd_attribute_bo_new(struct fd_state *state,
 		uint32_t size, const void *data)
 {
-	struct fd_bo *bo = fd_bo_new(state->dev, size,
-			DRM_FREEDRENO_GEM_TYPE_KMEM);
+	struct fd_bo *bo = fd_bo_cache_alloc(state->bo_cache, size);
 	if (data)
 		memcpy(fd_bo_map(bo), data, size);
 	return bo;
@@ -387,17 +666,24 @@ int fd_attribute_bo(struct fd_state *state, const char *name,
 		return -1;
 	p->fmt  = fmt;
 	p->bo   = bo;
+	p->offset = 0;
+	p->upload = 0;
+	state->dirty_state |= FD_DIRTY_VTX;
 	return 0;
 }
 
 int fd_attribute_pointer(struct fd_state *state, const char *name,
 		enum a3xx_vtx_fmt fmt, uint32_t count, const void *data)
 {
+	struct fd_param *p = find_param(&state->attributes, name);
 	uint32_t size = fmt2size(fmt) * count;
-	struct fd_bo *bo = fd_bo_new(state->dev, size,
-			DRM_FREEDRENO_GEM_TYPE_KMEM);
-	memcpy(fd_bo_map(bo), data, size);
-	return fd_attribute_bo(state, name, fmt, bo);
+	if (!p)
+		return -1;
+	p->fmt  = fmt;
+	p->bo   = upload(state, data, size, &p->offset);
+	p->upload = size;
+	state->dirty_state |= FD_DIRTY_VTX;
+	return 0;
 }
 
 int fd_uniform_attach(struct fd_state *state, const char *name,
@@ -421,6 +707,7 @@ int fd_set_texture(struct fd_state *state, const char *name,
 	if (!p)
 		return -1;
 	p->tex = tex;
+	state->dirty_state |= FD_DIRTY_TEXTURES;
 	return 0;
 }
 
@@ -649,6 +936,11 @@ int fd_clear(struct fd_state *state, GLbitfield mask)
 
 	emit_draw_indx(ring, DI_PT_RECTLIST, INDEX_SIZE_IGN, 2, NULL, 0, 0);
 
+	/* the next draw has to restore what we clobbered: */
+	state->dirty_state |= FD_DIRTY_PROGRAM | FD_DIRTY_VTX |
+			FD_DIRTY_ZSA | FD_DIRTY_RENDER | FD_DIRTY_VIEWPORT |
+			FD_DIRTY_BLEND;
+
 	return 0;
 }
 
@@ -662,6 +954,7 @@ int fd_depth_func(struct fd_state *state, GLenum depth_func)
 {
 	state->rb_depth_control &= ~A3XX_RB_DEPTH_CONTROL_ZFUNC__MASK;
 	state->rb_depth_control |= A3XX_RB_DEPTH_CONTROL_ZFUNC(g2a(depth_func));
+	state->dirty_state |= FD_DIRTY_ZSA;
 	return 0;
 }
 
@@ -683,23 +976,29 @@ int fd_enable(struct fd_state *state, GLenum cap)
 				(state->cull_mode == GL_FRONT_AND_BACK)) {
 			state->gras_su_mode_control |= A3XX_GRAS_SU_MODE_CONTROL_CULL_BACK;
 		}
+		state->dirty_state |= FD_DIRTY_RASTER;
 		return 0;
 	case GL_POLYGON_OFFSET_FILL:
 		state->gras_su_mode_control |= A3XX_GRAS_SU_MODE_CONTROL_POLY_OFFSET;
+		state->dirty_state |= FD_DIRTY_RASTER;
 		return 0;
 	case GL_BLEND:
 		state->rb_mrt[0].control |= (A3XX_RB_MRT_CONTROL_BLEND | A3XX_RB_MRT_CONTROL_BLEND2);
+		state->dirty_state |= FD_DIRTY_BLEND;
 		return 0;
 	case GL_DEPTH_TEST:
 		state->rb_depth_control |= (A3XX_RB_DEPTH_CONTROL_Z_ENABLE |
 				A3XX_RB_DEPTH_CONTROL_Z_TEST_ENABLE);
+		state->dirty_state |= FD_DIRTY_ZSA;
 		return 0;
 	case GL_STENCIL_TEST:
 		state->rb_stencil_control |= (A3XX_RB_STENCIL_CONTROL_STENCIL_ENABLE |
 				A3XX_RB_STENCIL_CONTROL_STENCIL_ENABLE_BF);
+		state->dirty_state |= FD_DIRTY_ZSA;
 		return 0;
 	case GL_DITHER:
 		state->rb_mrt[0].control |= A3XX_RB_MRT_CONTROL_DITHER_MODE(DITHER_ALWAYS);
+		state->dirty_state |= FD_DIRTY_BLEND;
 		return 0;
 	default:
 		ERROR_MSG("unsupported cap: 0x%04x", cap);
@@ -713,23 +1012,29 @@ int fd_disable(struct fd_state *state, GLenum cap)
 	case GL_CULL_FACE:
 		state->gras_su_mode_control &=
 			~(A3XX_GRAS_SU_MODE_CONTROL_CULL_FRONT | A3XX_GRAS_SU_MODE_CONTROL_CULL_BACK);
+		state->dirty_state |= FD_DIRTY_RASTER;
 		return 0;
 	case GL_POLYGON_OFFSET_FILL:
 		state->gras_su_mode_control &= ~A3XX_GRAS_SU_MODE_CONTROL_POLY_OFFSET;
+		state->dirty_state |= FD_DIRTY_RASTER;
 		return 0;
 	case GL_BLEND:
 		state->rb_mrt[0].control &= ~(A3XX_RB_MRT_CONTROL_BLEND | A3XX_RB_MRT_CONTROL_BLEND2);
+		state->dirty_state |= FD_DIRTY_BLEND;
 		return 0;
 	case GL_DEPTH_TEST:
 		state->rb_depth_control &= ~(A3XX_RB_DEPTH_CONTROL_Z_ENABLE |
 				A3XX_RB_DEPTH_CONTROL_Z_TEST_ENABLE);
+		state->dirty_state |= FD_DIRTY_ZSA;
 		return 0;
 	case GL_STENCIL_TEST:
 		state->rb_stencil_control &= ~(A3XX_RB_STENCIL_CONTROL_STENCIL_ENABLE |
 				A3XX_RB_STENCIL_CONTROL_STENCIL_ENABLE_BF);
+		state->dirty_state |= FD_DIRTY_ZSA;
 		return 0;
 	case GL_DITHER:
 		state->rb_mrt[0].control &= ~A3XX_RB_MRT_CONTROL_DITHER_MODE(DITHER_ALWAYS);
+		state->dirty_state |= FD_DIRTY_BLEND;
 		return 0;
 	default:
 		ERROR_MSG("unsupported cap: 0x%04x", cap);
@@ -834,6 +1139,7 @@ int fd_blend_func(struct fd_state *state, GLenum sfactor, GLenum dfactor)
 	}
 
 	state->rb_mrt[0].blendcontrol = bc;
+	state->dirty_state |= FD_DIRTY_BLEND;
 
 	return 0;
 }
@@ -853,6 +1159,7 @@ int fd_stencil_func(struct fd_state *state, GLenum func,
 	state->rb_stencil_control |=
 			A3XX_RB_STENCIL_CONTROL_FUNC(g2a(func)) |
 			A3XX_RB_STENCIL_CONTROL_FUNC_BF(g2a(func));
+	state->dirty_state |= FD_DIRTY_ZSA;
 	return 0;
 }
 
@@ -911,6 +1218,7 @@ int fd_stencil_op(struct fd_state *state, GLenum sfail,
 			A3XX_RB_STENCIL_CONTROL_FAIL_BF(rbsfail) |
 			A3XX_RB_STENCIL_CONTROL_ZPASS_BF(rbzpass) |
 			A3XX_RB_STENCIL_CONTROL_ZFAIL_BF(rbzfail);
+	state->dirty_state |= FD_DIRTY_ZSA;
 	return 0;
 }
 
@@ -918,6 +1226,7 @@ int fd_stencil_mask(struct fd_state *state, GLuint mask)
 {
 	state->rb_stencilrefmask &= ~A3XX_RB_STENCILREFMASK_STENCILWRITEMASK__MASK;
 	state->rb_stencilrefmask |= A3XX_RB_STENCILREFMASK_STENCILWRITEMASK(mask);
+	state->dirty_state |= FD_DIRTY_ZSA;
 	return 0;
 }
 
@@ -956,6 +1265,8 @@ static int set_clamp(enum a3xx_tex_clamp *clamp, GLint param)
 
 int fd_tex_param(struct fd_state *state, GLenum name, GLint param)
 {
+	state->dirty_state |= FD_DIRTY_TEXTURES;
+
 	switch (name) {
 	default:
 	case GL_TEXTURE_MAG_FILTER:
@@ -1106,8 +1417,7 @@ static void emit_query(struct fd_state *state, bool flush)
 	OUT_RING(ring, 0x00000000);
 
 	if (!state->query.bo) {
-		state->query.bo = fd_bo_new(state->dev, 0x1000,
-				DRM_FREEDRENO_GEM_TYPE_KMEM);
+		state->query.bo = fd_bo_cache_alloc(state->bo_cache, 0x1000);
 	}
 
 // TODO: just set directly for now until we add tiling support..
@@ -1145,7 +1455,7 @@ static int draw_impl(struct fd_state *state, GLenum mode,
 	struct fd_ringbuffer *ring = state->ring;
 	enum pc_di_index_size idx_type = INDEX_SIZE_IGN;
 	struct fd_bo *indx_bo = NULL;
-	uint32_t idx_size, stride_in_vpc;
+	uint32_t idx_offset = 0, idx_size, stride_in_vpc, dirty;
 
 	if (indices) {
 		switch (type) {
@@ -1166,9 +1476,7 @@ static int draw_impl(struct fd_state *state, GLenum mode,
 			return -1;
 		}
 
-		indx_bo = fd_bo_new(state->dev, idx_size,
-				DRM_FREEDRENO_GEM_TYPE_KMEM);
-		memcpy(fd_bo_map(indx_bo), indices, idx_size);
+		indx_bo = upload(state, indices, idx_size, &idx_offset);
 
 	} else {
 		idx_type = INDEX_SIZE_IGN;
@@ -1177,8 +1485,26 @@ static int draw_impl(struct fd_state *state, GLenum mode,
 
 	state->dirty = true;
 
-	fd_program_emit_state(state->program, first, &state->uniforms,
-			&state->attributes, &state->bufs, ring);
+	/* only the state which changed since the last draw in this batch is
+	 * emitted, see enum fd_dirty:
+	 */
+	dirty = state->dirty_state;
+	state->dirty_state = 0;
+
+	if (dirty & FD_DIRTY_PROGRAM)
+		fd_program_emit_shader_state(state->program, ring);
+
+	if ((dirty & FD_DIRTY_VTX) || (first != state->vtx_first)) {
+		fd_program_emit_vtx_state(state->program, first,
+				&state->attributes, ring);
+		state->vtx_first = first;
+	}
+
+	/* uniforms are read from the app's pointer at draw time, so
+	 * they always get emitted:
+	 */
+	fd_program_emit_const_state(state->program, &state->uniforms,
+			&state->bufs, ring);
 
 	/*
 	 * +----------- max outloc
@@ -1223,65 +1549,76 @@ static int draw_impl(struct fd_state *state, GLenum mode,
 	 * driver never uses value of 1, so possibly 0 (no varying), or minimum
 	 * of 2..
 	 */
-	stride_in_vpc = ALIGN(fd_program_outloc(state->program) - 8, 4) / 4;
-	if (stride_in_vpc > 0)
-		stride_in_vpc = max(stride_in_vpc, 2);
-	OUT_PKT0(ring, REG_A3XX_PC_PRIM_VTX_CNTL, 1);
-	OUT_RING(ring, A3XX_PC_PRIM_VTX_CNTL_STRIDE_IN_VPC(stride_in_vpc) |
-			state->pc_prim_vtx_cntl);
-
-	OUT_PKT0(ring, REG_A3XX_GRAS_SU_MODE_CONTROL, 1);
-	OUT_RING(ring, state->gras_su_mode_control);
+	if (dirty & (FD_DIRTY_PROGRAM | FD_DIRTY_RASTER)) {
+		stride_in_vpc = ALIGN(fd_program_outloc(state->program) - 8, 4) / 4;
+		if (stride_in_vpc > 0)
+			stride_in_vpc = max(stride_in_vpc, 2);
+		OUT_PKT0(ring, REG_A3XX_PC_PRIM_VTX_CNTL, 1);
+		OUT_RING(ring, A3XX_PC_PRIM_VTX_CNTL_STRIDE_IN_VPC(stride_in_vpc) |
+				state->pc_prim_vtx_cntl);
+	}
 
-	OUT_PKT0(ring, REG_A3XX_RB_DEPTH_CONTROL, 1);
-	OUT_RING(ring, state->rb_depth_control);
+	if (dirty & FD_DIRTY_RASTER) {
+		OUT_PKT0(ring, REG_A3XX_GRAS_SU_MODE_CONTROL, 1);
+		OUT_RING(ring, state->gras_su_mode_control);
+	}
 
-	OUT_PKT3(ring, CP_WAIT_FOR_IDLE, 1);
-	OUT_RING(ring, 0x00000000);
+	if (dirty & FD_DIRTY_ZSA) {
+		OUT_PKT0(ring, REG_A3XX_RB_DEPTH_CONTROL, 1);
+		OUT_RING(ring, state->rb_depth_control);
+	}
 
-	OUT_PKT3(ring, CP_REG_RMW, 3);
-	OUT_RING(ring, REG_A3XX_RB_RENDER_CONTROL);
-	OUT_RING(ring, A3XX_RB_RENDER_CONTROL_BIN_WIDTH__MASK);
-	OUT_RING(ring, A3XX_RB_RENDER_CONTROL_ENABLE_GMEM |
-			A3XX_RB_RENDER_CONTROL_FACENESS |
-			A3XX_RB_RENDER_CONTROL_XCOORD |
-			A3XX_RB_RENDER_CONTROL_YCOORD |
-			A3XX_RB_RENDER_CONTROL_ZCOORD |
-			A3XX_RB_RENDER_CONTROL_WCOORD |
-			state->rb_render_control);
+	if (dirty & FD_DIRTY_RENDER) {
+		OUT_PKT3(ring, CP_WAIT_FOR_IDLE, 1);
+		OUT_RING(ring, 0x00000000);
 
-	OUT_PKT0(ring, REG_A3XX_GRAS_CL_CLIP_CNTL, 1);
-	OUT_RING(ring, A3XX_GRAS_CL_CLIP_CNTL_IJ_PERSP_CENTER |
-			A3XX_GRAS_CL_CLIP_CNTL_ZCOORD |
-			A3XX_GRAS_CL_CLIP_CNTL_WCOORD);
+		OUT_PKT3(ring, CP_REG_RMW, 3);
+		OUT_RING(ring, REG_A3XX_RB_RENDER_CONTROL);
+		OUT_RING(ring, A3XX_RB_RENDER_CONTROL_BIN_WIDTH__MASK);
+		OUT_RING(ring, A3XX_RB_RENDER_CONTROL_ENABLE_GMEM |
+				A3XX_RB_RENDER_CONTROL_FACENESS |
+				A3XX_RB_RENDER_CONTROL_XCOORD |
+				A3XX_RB_RENDER_CONTROL_YCOORD |
+				A3XX_RB_RENDER_CONTROL_ZCOORD |
+				A3XX_RB_RENDER_CONTROL_WCOORD |
+				state->rb_render_control);
+
+		OUT_PKT0(ring, REG_A3XX_GRAS_CL_CLIP_CNTL, 1);
+		OUT_RING(ring, A3XX_GRAS_CL_CLIP_CNTL_IJ_PERSP_CENTER |
+				A3XX_GRAS_CL_CLIP_CNTL_ZCOORD |
+				A3XX_GRAS_CL_CLIP_CNTL_WCOORD);
+	}
 
-	OUT_PKT0(ring, REG_A3XX_GRAS_CL_VPORT_XOFFSET, 6);
-	OUT_RING(ring, A3XX_GRAS_CL_VPORT_XOFFSET(state->viewport.offset.x));
-	OUT_RING(ring, A3XX_GRAS_CL_VPORT_XSCALE(state->viewport.scale.x));
-	OUT_RING(ring, A3XX_GRAS_CL_VPORT_YOFFSET(state->viewport.offset.y));
-	OUT_RING(ring, A3XX_GRAS_CL_VPORT_YSCALE(state->viewport.scale.y));
-	OUT_RING(ring, A3XX_GRAS_CL_VPORT_ZOFFSET(state->viewport.offset.z));
-	OUT_RING(ring, A3XX_GRAS_CL_VPORT_ZSCALE(state->viewport.scale.z));
+	if (dirty & FD_DIRTY_VIEWPORT) {
+		OUT_PKT0(ring, REG_A3XX_GRAS_CL_VPORT_XOFFSET, 6);
+		OUT_RING(ring, A3XX_GRAS_CL_VPORT_XOFFSET(state->viewport.offset.x));
+		OUT_RING(ring, A3XX_GRAS_CL_VPORT_XSCALE(state->viewport.scale.x));
+		OUT_RING(ring, A3XX_GRAS_CL_VPORT_YOFFSET(state->viewport.offset.y));
+		OUT_RING(ring, A3XX_GRAS_CL_VPORT_YSCALE(state->viewport.scale.y));
+		OUT_RING(ring, A3XX_GRAS_CL_VPORT_ZOFFSET(state->viewport.offset.z));
+		OUT_RING(ring, A3XX_GRAS_CL_VPORT_ZSCALE(state->viewport.scale.z));
+	}
 
-	OUT_PKT0(ring, REG_A3XX_RB_STENCILREFMASK, 2);
-	OUT_RING(ring, state->rb_stencilrefmask);    /* RB_STENCILREFMASK */
-	OUT_RING(ring, state->rb_stencilrefmask);    /* RB_STENCILREFMASK_BF */
+	if (dirty & FD_DIRTY_ZSA) {
+		OUT_PKT0(ring, REG_A3XX_RB_STENCILREFMASK, 2);
+		OUT_RING(ring, state->rb_stencilrefmask);    /* RB_STENCILREFMASK */
+		OUT_RING(ring, state->rb_stencilrefmask);    /* RB_STENCILREFMASK_BF */
 
-	OUT_PKT0(ring, REG_A3XX_RB_STENCIL_CONTROL, 1);
-	OUT_RING(ring, state->rb_stencil_control);
+		OUT_PKT0(ring, REG_A3XX_RB_STENCIL_CONTROL, 1);
+		OUT_RING(ring, state->rb_stencil_control);
+	}
 
-	emit_textures(state);
+	if (dirty & FD_DIRTY_TEXTURES)
+		emit_textures(state);
 
-	emit_mrt(state, ring, state->render_target.surface);
+	if (dirty & FD_DIRTY_BLEND)
+		emit_mrt(state, ring, state->render_target.surface);
 
 	emit_draw_indx(ring, mode2prim(mode), idx_type, count,
-			indx_bo, 0, idx_size);
+			indx_bo, idx_offset, idx_size);
 	if (state->query.active)
 		emit_query(state, false);
 
-	if (indx_bo)
-		fd_bo_del(indx_bo);
-
 	return 0;
 }
 
@@ -1297,7 +1634,7 @@ int fd_draw_arrays(struct fd_state *state, GLenum mode,
 	return draw_impl(state, mode, first, count, 0, NULL);
 }
 
-int fd_run_compute(struct fd_state *state, uint32_t workdim,
+uint32_t fd_run_compute_async(struct fd_state *state, uint32_t workdim,
 		uint32_t *globaloff, uint32_t *globalsize, uint32_t *localsize)
 {
 	struct fd_ringbuffer *ring = state->ring;
@@ -1431,19 +1768,14 @@ int fd_run_compute(struct fd_state *state, uint32_t workdim,
 	OUT_RING(ring, 0xfffcffff);
 	OUT_RING(ring, 0x00000000);
 
-	fd_ringbuffer_flush(ring);
-
-	// TODO maybe return fence/timestamp and let app explicitly wait
-	// for timestamp, so it could better pipeline things?  Probably
-	// need to be a bit more sophisticated with ringbuffer rollover/
-	// reset..
-
-	fd_pipe_wait(state->pipe, fd_ringbuffer_timestamp(ring));
-	fd_ringbuffer_reset(state->ring);
-
-	fd_ringmarker_mark(state->draw_start);
+	return batch_submit(state);
+}
 
-	return 0;
+int fd_run_compute(struct fd_state *state, uint32_t workdim,
+		uint32_t *globaloff, uint32_t *globalsize, uint32_t *localsize)
+{
+	return fd_fence_wait(state, fd_run_compute_async(state, workdim,
+			globaloff, globalsize, localsize));
 }
 
 int fd_swap_buffers(struct fd_state *state)
@@ -1482,14 +1814,15 @@ static void flush_setup(struct fd_state *state, struct fd_ringbuffer *ring)
 	}
 }
 
-int fd_flush(struct fd_state *state)
+/* with nothing to flush, returns the fence of the last submit: */
+uint32_t fd_flush_async(struct fd_state *state)
 {
 	struct fd_surface *surface = state->render_target.surface;
 	struct fd_ringbuffer *ring = state->ring;
 	uint32_t i, yoff = 0;
 
 	if (!state->dirty)
-		return 0;
+		return state->fence;
 
 	if (state->query.bo) {
 		/* TODO support for > 1 tile: */
@@ -1561,15 +1894,19 @@ int fd_flush(struct fd_state *state)
 	}
 
 	fd_ringmarker_flush(state->draw_end);
-	fd_ringbuffer_flush(ring);
-	fd_pipe_wait(state->pipe, fd_ringbuffer_timestamp(ring));
-	fd_ringbuffer_reset(state->ring);
-
-	fd_ringmarker_mark(state->draw_start);
 
+	/* the draw cmds get replayed per tile after the gmem2mem of the
+	 * previous tile, so each batch starts out with nothing emitted,
+	 * which batch_submit() takes care of:
+	 */
 	state->dirty = false;
 
-	return 0;
+	return batch_submit(state);
+}
+
+int fd_flush(struct fd_state *state)
+{
+	return fd_fence_wait(state, fd_flush_async(state));
 }
 
 /* ************************************************************************* */
@@ -1593,9 +1930,8 @@ struct fd_surface * fd_surface_new_fmt(struct fd_state *state,
 	surface->pitch  = ALIGN(width, 32);
 	surface->cpp    = cpp;
 
-	surface->bo = fd_bo_new(state->dev,
-			surface->pitch * surface->height * surface->cpp,
-			DRM_FREEDRENO_GEM_TYPE_KMEM);
+	surface->bo = fd_bo_cache_alloc(state->bo_cache,
+			surface->pitch * surface->height * surface->cpp);
 	return surface;
 }
 
@@ -1618,7 +1954,7 @@ void fd_surface_del(struct fd_state *state, struct fd_surface *surface)
 		return;
 	if (state->render_target.surface == surface)
 		state->render_target.surface = NULL;
-	fd_bo_del(surface->bo);
+	fd_bo_cache_free(state->bo_cache, surface->bo);
 	free(surface);
 }
 
@@ -1695,6 +2031,8 @@ static void set_viewport(struct fd_state *state, uint32_t x, uint32_t y,
 	state->viewport.offset.x = half_width + x;
 	state->viewport.offset.y = half_height + y;
 	state->viewport.offset.z = 0.5;
+
+	state->dirty_state |= FD_DIRTY_VIEWPORT;
 }
 
 void fd_make_current(struct fd_state *state,
@@ -1838,8 +2176,7 @@ void fd_make_current(struct fd_state *state,
 		struct fd_bo *bo = state->vsc_pipe[i].bo;
 
 		if (!bo) {
-			bo = fd_bo_new(state->dev, 0x40000,
-					DRM_FREEDRENO_GEM_TYPE_KMEM);
+			bo = fd_bo_cache_alloc(state->bo_cache, 0x40000);
 			state->vsc_pipe[i].bo = bo;
 		}
 
@@ -1908,8 +2245,10 @@ void fd_make_current(struct fd_state *state,
 	OUT_RING(ring, A3XX_GRAS_CL_CLIP_CNTL_IJ_PERSP_CENTER);
 
 	fd_ringbuffer_flush(ring);
+	fd_bo_cache_flushed(state->bo_cache, fd_ringbuffer_timestamp(ring));
 
 	fd_ringmarker_mark(state->draw_start);
+	state->dirty_state = FD_DIRTY_ALL;
 }
 
 static int dump_hex(void *buf, uint32_t w, uint32_t h, uint32_t p, bool flt)
@@ -2013,12 +2352,18 @@ int fd_query_read(struct fd_state *state, struct fd_perfctrs *ctrs)
 
 	fd_bo_cpu_fini(bo);
 
-	fd_bo_del(state->query.bo);
+	fd_bo_cache_free(state->bo_cache, state->query.bo);
 	memset(&state->query, 0, sizeof(state->query));
 
 	return 0;
 }
 
+/* for tuning the bo cache: */
+void fd_bo_stats(struct fd_state *state, struct fd_bo_cache_stats *stats)
+{
+	fd_bo_cache_stats(state->bo_cache, stats);
+}
+
 void fd_query_dump(struct fd_perfctrs *ctrs)
 {
 #define dump_ctr(n) do { \
@@ -75,10 +75,17 @@ int fd_draw_arrays(struct fd_state *state, GLenum mode,
 		GLint first, GLsizei count);
 int fd_run_compute(struct fd_state *state, uint32_t workdim,
 		uint32_t *globaloff, uint32_t *globalsize, uint32_t *localsize);
+uint32_t fd_run_compute_async(struct fd_state *state, uint32_t workdim,
+		uint32_t *globaloff, uint32_t *globalsize, uint32_t *localsize);
 
 int fd_swap_buffers(struct fd_state *state);
 int fd_flush(struct fd_state *state);
 
+/* the _async variants return a fence, rather than waiting for the gpu: */
+uint32_t fd_flush_async(struct fd_state *state);
+int fd_fence_wait(struct fd_state *state, uint32_t fence);
+bool fd_fence_signaled(struct fd_state *state, uint32_t fence);
+
 struct fd_surface * fd_surface_screen(struct fd_state *state,
 		uint32_t *width, uint32_t *height);
 struct fd_surface * fd_surface_new(struct fd_state *state,
@@ -119,6 +126,9 @@ struct fd_perfctrs {
 	};
 };
 
+struct fd_bo_cache_stats;
+void fd_bo_stats(struct fd_state *state, struct fd_bo_cache_stats *stats);
+
 int fd_query_start(struct fd_state *state);
 int fd_query_end(struct fd_state *state);
 int fd_query_read(struct fd_state *state, struct fd_perfctrs *ctrs);
@@ -43,6 +43,16 @@ struct fd_shader {
 struct fd_program {
 	struct fd_state *state;
 	struct fd_shader vertex_shader, fragment_shader, compute_shader;
+
+	/* the program register state only depends on the shaders, so it
+	 * is recorded the first time it is emitted and copied into the
+	 * ring after that.  One copy for normal draws, one for the
+	 * resolve (gmem2mem) pass:
+	 */
+	struct {
+		uint32_t dwords[256];
+		uint32_t sizedwords;
+	} regs[2];
 };
 
 static struct fd_shader *get_shader(struct fd_program *program,
@@ -75,6 +85,9 @@ int fd_program_attach_asm(struct fd_program *program,
 
 	memset(shader, 0, sizeof(*shader));
 
+	program->regs[0].sizedwords = 0;
+	program->regs[1].sizedwords = 0;
+
 	shader->ir = fd_asm_parse(src);
 	if (!shader->ir) {
 		ERROR_MSG("parse failed");
@@ -161,20 +174,20 @@ static uint32_t regmask(uint32_t num)
 	return (1 << num) - 1;
 }
 
+/* the shader was already copied to shader->bo at attach time, so
+ * let the CP fetch it from there rather than inlining it in the ring:
+ */
 static void
 emit_shader(struct fd_ringbuffer *ring, struct fd_shader *shader,
 		enum adreno_state_block state_block)
 {
-	uint32_t i;
-	OUT_PKT3(ring, CP_LOAD_STATE, 2 + shader->sizedwords);
+	OUT_PKT3(ring, CP_LOAD_STATE, 2);
 	OUT_RING(ring, CP_LOAD_STATE_0_DST_OFF(0) |
-			CP_LOAD_STATE_0_STATE_SRC(SS_DIRECT) |
+			CP_LOAD_STATE_0_STATE_SRC(SS_INDIRECT) |
 			CP_LOAD_STATE_0_STATE_BLOCK(state_block) |
 			CP_LOAD_STATE_0_NUM_UNIT(instrlen(shader)));
-	OUT_RING(ring, CP_LOAD_STATE_1_STATE_TYPE(ST_SHADER) |
-			CP_LOAD_STATE_1_EXT_SRC_ADDR(0));
-	for (i = 0; i < shader->sizedwords; i++)
-		OUT_RING(ring, shader->bin[i]);
+	OUT_RELOC(ring, shader->bo, 0,     /* EXT_SRC_ADDR */
+			CP_LOAD_STATE_1_STATE_TYPE(ST_SHADER));
 }
 
 static void emit_vtx_fetch(struct fd_ringbuffer *ring,
@@ -195,7 +208,7 @@ static void emit_vtx_fetch(struct fd_ringbuffer *ring,
 				COND(switchnext, A3XX_VFD_FETCH_INSTR_0_SWITCHNEXT) |
 				A3XX_VFD_FETCH_INSTR_0_INDEXCODE(i) |
 				A3XX_VFD_FETCH_INSTR_0_STEPRATE(1));
-		OUT_RELOC(ring, p->bo, s * first, 0);    /* VFD_FETCH[i].INSTR_1 */
+		OUT_RELOC(ring, p->bo, p->offset + (s * first), 0); /* VFD_FETCH[i].INSTR_1 */
 
 		OUT_PKT0(ring, REG_A3XX_VFD_DECODE_INSTR(i), 1);
 		OUT_RING(ring, A3XX_VFD_DECODE_INSTR_WRITEMASK(regmask(a->num)) |
@@ -316,9 +329,8 @@ static void emit_global_mem(struct fd_ringbuffer *ring,
 	}
 }
 
-void fd_program_emit_state(struct fd_program *program, uint32_t first,
-		struct fd_parameters *uniforms, struct fd_parameters *attr,
-		struct fd_parameters *bufs, struct fd_ringbuffer *ring)
+static void emit_program_regs(struct fd_program *program, bool resolve,
+		struct fd_ringbuffer *ring)
 {
 	struct fd_shader *vs = get_shader(program, FD_SHADER_VERTEX);
 	struct fd_shader *fs = get_shader(program, FD_SHADER_FRAGMENT);
@@ -356,7 +368,7 @@ void fd_program_emit_state(struct fd_program *program, uint32_t first,
 	OUT_RING(ring, A3XX_SP_SP_CTRL_REG_CONSTMODE(0) |
 			A3XX_SP_SP_CTRL_REG_SLEEPMODE(1) |
 			// XXX "resolve" (?) bit set on gmem->mem pass..
-			COND(!uniforms, A3XX_SP_SP_CTRL_REG_RESOLVE) |
+			COND(resolve, A3XX_SP_SP_CTRL_REG_RESOLVE) |
 			// XXX sometimes 0, sometimes 1:
 			A3XX_SP_SP_CTRL_REG_L0MODE(1));
 
@@ -510,16 +522,6 @@ void fd_program_emit_state(struct fd_program *program, uint32_t first,
 	OUT_RING(ring, A3XX_VFD_VS_THREADING_THRESHOLD_REGID_THRESHOLD(15) |
 			A3XX_VFD_VS_THREADING_THRESHOLD_REGID_VTXCNT(252));
 
-	emit_shader(ring, vs, SB_VERT_SHADER);
-
-	OUT_PKT0(ring, REG_A3XX_VFD_PERFCOUNTER0_SELECT, 1);
-	OUT_RING(ring, 0x00000000);        /* VFD_PERFCOUNTER0_SELECT */
-
-	emit_shader(ring, fs, SB_FRAG_SHADER);
-
-	OUT_PKT0(ring, REG_A3XX_VFD_PERFCOUNTER0_SELECT, 1);
-	OUT_RING(ring, 0x00000000);        /* VFD_PERFCOUNTER0_SELECT */
-
 	OUT_PKT0(ring, REG_A3XX_VFD_CONTROL_0, 2);
 	OUT_RING(ring, A3XX_VFD_CONTROL_0_TOTALATTRTOVS(totalattr(vs)) |
 			A3XX_VFD_CONTROL_0_PACKETSIZE(2) |
@@ -528,9 +530,45 @@ void fd_program_emit_state(struct fd_program *program, uint32_t first,
 	OUT_RING(ring, A3XX_VFD_CONTROL_1_MAXSTORAGE(1) | // XXX
 			A3XX_VFD_CONTROL_1_REGID4VTX(63 << 2) |
 			A3XX_VFD_CONTROL_1_REGID4INST(63 << 2));
+}
+
+static void emit_program(struct fd_program *program, bool resolve,
+		struct fd_ringbuffer *ring)
+{
+	struct fd_shader *vs = get_shader(program, FD_SHADER_VERTEX);
+	struct fd_shader *fs = get_shader(program, FD_SHADER_FRAGMENT);
+	uint32_t *regs = program->regs[resolve].dwords;
+	uint32_t sizedwords = program->regs[resolve].sizedwords;
+
+	/* there are no relocs in the register state, so it can just be
+	 * copied (the shaders, which do have relocs, are emitted after):
+	 */
+	if (sizedwords) {
+		BEGIN_RING(ring, sizedwords);
+		memcpy(ring->cur, regs, sizedwords * 4);
+		ring->cur += sizedwords;
+	} else {
+		uint32_t *start = ring->cur;
+		emit_program_regs(program, resolve, ring);
+		sizedwords = ring->cur - start;
+		assert(sizedwords <= ARRAY_SIZE(program->regs[resolve].dwords));
+		memcpy(regs, start, sizedwords * 4);
+		program->regs[resolve].sizedwords = sizedwords;
+	}
 
-	emit_vtx_fetch(ring, vs, attr, first);
+	emit_shader(ring, vs, SB_VERT_SHADER);
+
+	OUT_PKT0(ring, REG_A3XX_VFD_PERFCOUNTER0_SELECT, 1);
+	OUT_RING(ring, 0x00000000);        /* VFD_PERFCOUNTER0_SELECT */
 
+	emit_shader(ring, fs, SB_FRAG_SHADER);
+
+	OUT_PKT0(ring, REG_A3XX_VFD_PERFCOUNTER0_SELECT, 1);
+	OUT_RING(ring, 0x00000000);        /* VFD_PERFCOUNTER0_SELECT */
+}
+
+static void emit_invalidate(struct fd_ringbuffer *ring)
+{
 	/* we have this sometimes, not others.. perhaps we could be clever
 	 * and figure out actually when we need to invalidate cache:
 	 */
@@ -539,12 +577,43 @@ void fd_program_emit_state(struct fd_program *program, uint32_t first,
 	OUT_RING(ring, A3XX_UCHE_CACHE_INVALIDATE1_REG_ADDR(0) |
 			A3XX_UCHE_CACHE_INVALIDATE1_REG_OPCODE(INVALIDATE) |
 			A3XX_UCHE_CACHE_INVALIDATE1_REG_ENTIRE_CACHE);
+}
 
+void fd_program_emit_state(struct fd_program *program, uint32_t first,
+		struct fd_parameters *uniforms, struct fd_parameters *attr,
+		struct fd_parameters *bufs, struct fd_ringbuffer *ring)
+{
 	/* for RB_RESOLVE_PASS, I think the consts are not needed: */
-	if (uniforms) {
-		emit_uniconst(ring, vs, uniforms, bufs, SB_VERT_SHADER);
-		emit_uniconst(ring, fs, uniforms, bufs, SB_FRAG_SHADER);
-	}
+	emit_program(program, !uniforms, ring);
+	fd_program_emit_vtx_state(program, first, attr, ring);
+	if (uniforms)
+		fd_program_emit_const_state(program, uniforms, bufs, ring);
+}
+
+/* the parts of fd_program_emit_state(), for draws which only need to
+ * re-emit what changed since the previous draw:
+ */
+void fd_program_emit_shader_state(struct fd_program *program,
+		struct fd_ringbuffer *ring)
+{
+	emit_program(program, false, ring);
+}
+
+void fd_program_emit_vtx_state(struct fd_program *program, uint32_t first,
+		struct fd_parameters *attr, struct fd_ringbuffer *ring)
+{
+	emit_vtx_fetch(ring, get_shader(program, FD_SHADER_VERTEX), attr, first);
+	emit_invalidate(ring);
+}
+
+void fd_program_emit_const_state(struct fd_program *program,
+		struct fd_parameters *uniforms, struct fd_parameters *bufs,
+		struct fd_ringbuffer *ring)
+{
+	emit_uniconst(ring, get_shader(program, FD_SHADER_VERTEX),
+			uniforms, bufs, SB_VERT_SHADER);
+	emit_uniconst(ring, get_shader(program, FD_SHADER_FRAGMENT),
+			uniforms, bufs, SB_FRAG_SHADER);
 }
 
 void fd_program_emit_compute_state(struct fd_program *program,
@@ -613,14 +682,7 @@ void fd_program_emit_compute_state(struct fd_program *program,
 	OUT_PKT0(ring, REG_A3XX_VFD_PERFCOUNTER0_SELECT, 1);
 	OUT_RING(ring, 0x00000000);        /* VFD_PERFCOUNTER0_SELECT */
 
-	/* we have this sometimes, not others.. perhaps we could be clever
-	 * and figure out actually when we need to invalidate cache:
-	 */
-	OUT_PKT0(ring, REG_A3XX_UCHE_CACHE_INVALIDATE0_REG, 2);
-	OUT_RING(ring, A3XX_UCHE_CACHE_INVALIDATE0_REG_ADDR(0));
-	OUT_RING(ring, A3XX_UCHE_CACHE_INVALIDATE1_REG_ADDR(0) |
-			A3XX_UCHE_CACHE_INVALIDATE1_REG_OPCODE(INVALIDATE) |
-			A3XX_UCHE_CACHE_INVALIDATE1_REG_ENTIRE_CACHE);
+	emit_invalidate(ring);
 
 	emit_uniconst(ring, cs, uniforms, bufs, SB_FRAG_SHADER);
 	emit_global_mem(ring, cs, bufs);
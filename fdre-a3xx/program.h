@@ -49,6 +49,13 @@ uint32_t fd_program_outloc(struct fd_program *program);
 void fd_program_emit_state(struct fd_program *program, uint32_t first,
 		struct fd_parameters *uniforms, struct fd_parameters *attr,
 		struct fd_parameters *bufs, struct fd_ringbuffer *ring);
+void fd_program_emit_shader_state(struct fd_program *program,
+		struct fd_ringbuffer *ring);
+void fd_program_emit_vtx_state(struct fd_program *program, uint32_t first,
+		struct fd_parameters *attr, struct fd_ringbuffer *ring);
+void fd_program_emit_const_state(struct fd_program *program,
+		struct fd_parameters *uniforms, struct fd_parameters *bufs,
+		struct fd_ringbuffer *ring);
 void fd_program_emit_compute_state(struct fd_program *program,
 		struct fd_parameters *uniforms, struct fd_parameters *attr,
 		struct fd_parameters *bufs, struct fd_ringbuffer *ring);
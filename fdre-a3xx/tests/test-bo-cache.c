@@ -0,0 +1,262 @@
+/*
+ * Copyright (c) 2012 Rob Clark <robdclark@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Checks the bo cache against a fake libdrm, which just counts the
+ * allocator calls, so this runs without a gpu.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "bo-cache.h"
+
+struct fd_bo {
+	uint32_t size;
+	void *map;
+};
+
+static unsigned nnew, ndel;
+
+struct fd_bo * fd_bo_new(struct fd_device *dev, uint32_t size, uint32_t flags)
+{
+	struct fd_bo *bo = calloc(1, sizeof(*bo));
+	bo->size = size;
+	bo->map = calloc(1, size);
+	nnew++;
+	return bo;
+}
+
+void fd_bo_del(struct fd_bo *bo)
+{
+	free(bo->map);
+	free(bo);
+	ndel++;
+}
+
+uint32_t fd_bo_size(struct fd_bo *bo)
+{
+	return bo->size;
+}
+
+void * fd_bo_map(struct fd_bo *bo)
+{
+	return bo->map;
+}
+
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+static struct fd_bo_cache_stats stats(struct fd_bo_cache *cache)
+{
+	struct fd_bo_cache_stats s;
+	fd_bo_cache_stats(cache, &s);
+	return s;
+}
+
+/* a freed bo is not reused until the submit which freed it retires: */
+static void test_reuse(void)
+{
+	struct fd_bo_cache *cache = fd_bo_cache_new(NULL);
+	struct fd_bo *bo, *bo2;
+
+	nnew = ndel = 0;
+
+	bo = fd_bo_cache_alloc(cache, 0x1000);
+	CHECK(nnew == 1);
+	CHECK(stats(cache).misses == 1);
+	memset(fd_bo_map(bo), 0xff, 0x1000);
+
+	/* still pending, no flush yet: */
+	fd_bo_cache_free(cache, bo);
+	CHECK(stats(cache).bytes_cached == 0x1000);
+	CHECK(stats(cache).nbos_cached == 1);
+	bo2 = fd_bo_cache_alloc(cache, 0x1000);
+	memset(fd_bo_map(bo2), 0xff, 0x1000);
+	CHECK(bo2 != bo);
+	CHECK(nnew == 2);
+	fd_bo_cache_free(cache, bo2);
+
+	/* flushed, but not retired: */
+	fd_bo_cache_flushed(cache, 10);
+	fd_bo_cache_retired(cache, 9);
+	bo2 = fd_bo_cache_alloc(cache, 0x1000);
+	memset(fd_bo_map(bo2), 0xff, 0x1000);
+	CHECK(bo2 != bo);
+	CHECK(nnew == 3);
+	fd_bo_cache_free(cache, bo2);
+	fd_bo_cache_flushed(cache, 11);
+
+	/* retired, so now it is a hit: */
+	fd_bo_cache_retired(cache, 10);
+	bo2 = fd_bo_cache_alloc(cache, 0x1000);
+	CHECK(nnew == 3);
+	CHECK(stats(cache).hits == 1);
+	/* recycled bo's come back zeroed: */
+	CHECK(((uint8_t *)fd_bo_map(bo2))[0xfff] == 0);
+	CHECK(stats(cache).misses == 3);
+	CHECK(stats(cache).nbos_cached == 2);
+	CHECK(stats(cache).bytes_cached == 0x2000);
+
+	fd_bo_cache_free(cache, bo2);
+	fd_bo_cache_del(cache);
+	CHECK(ndel == nnew);
+}
+
+/* sizes round up to the buckets, too big ones bypass the cache: */
+static void test_buckets(void)
+{
+	static const struct {
+		uint32_t size, bucket;
+	} sizes[] = {
+		{ 1,          0x1000 },
+		{ 0x1000,     0x1000 },
+		{ 0x1001,     0x2000 },
+		{ 0x2001,     0x3000 },
+		{ 0x3001,     0x4000 },
+		{ 0x4001,     0x5000 },
+		{ 0x7001,     0x8000 },
+		{ 0x8001,     0xa000 },
+		{ 0x10001,    0x14000 },
+		{ 0x40000,    0x40000 },
+		{ 0x4000000,  0x4000000 },
+		{ 0x6000001,  0x7000000 },
+	};
+	struct fd_bo_cache *cache = fd_bo_cache_new(NULL);
+	struct fd_bo *bo;
+	unsigned i;
+
+	nnew = ndel = 0;
+
+	for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+		bo = fd_bo_cache_alloc(cache, sizes[i].size);
+		CHECK(fd_bo_size(bo) == sizes[i].bucket);
+		fd_bo_cache_free(cache, bo);
+		/* in the right bucket, so it is reused once idle: */
+		fd_bo_cache_flushed(cache, i + 1);
+		fd_bo_cache_retired(cache, i + 1);
+		CHECK(fd_bo_cache_alloc(cache, sizes[i].bucket) == bo);
+		fd_bo_cache_free(cache, bo);
+	}
+	CHECK(ndel == 0);
+
+	/* bigger than the biggest bucket: */
+	bo = fd_bo_cache_alloc(cache, 0x7000001);
+	CHECK(fd_bo_size(bo) == 0x7000001);
+	fd_bo_cache_free(cache, bo);
+	CHECK(ndel == 1);
+
+	/* not a bucket size, so not from the cache: */
+	bo = fd_bo_new(NULL, 0x1800, 0);
+	fd_bo_cache_free(cache, bo);
+	CHECK(ndel == 2);
+
+	CHECK(stats(cache).nbos_cached == ARRAY_SIZE(sizes));
+
+	fd_bo_cache_del(cache);
+	CHECK(ndel == nnew);
+}
+
+/* timestamps wrap around: */
+static void test_wrap(void)
+{
+	struct fd_bo_cache *cache = fd_bo_cache_new(NULL);
+	struct fd_bo *bo, *other;
+
+	nnew = ndel = 0;
+
+	bo = fd_bo_cache_alloc(cache, 0x1000);
+	fd_bo_cache_free(cache, bo);
+	fd_bo_cache_flushed(cache, 0xfffffff0);
+
+	fd_bo_cache_retired(cache, 0xffffffef);
+	other = fd_bo_cache_alloc(cache, 0x1000);
+	CHECK(other != bo);
+	CHECK(nnew == 2);
+	fd_bo_cache_free(cache, other);
+
+	/* past the wrap, so the earlier timestamp has retired: */
+	fd_bo_cache_retired(cache, 0x00000005);
+	bo = fd_bo_cache_alloc(cache, 0x1000);
+	CHECK(nnew == 2);
+	fd_bo_cache_free(cache, bo);
+
+	/* and the other way around, freed after the wrap: */
+	fd_bo_cache_flushed(cache, 0x00000006);
+	fd_bo_cache_retired(cache, 0xfffffff8);
+	other = fd_bo_cache_alloc(cache, 0x1000);
+	CHECK(other != bo);
+	CHECK(nnew == 3);
+	fd_bo_cache_free(cache, other);
+
+	fd_bo_cache_del(cache);
+	CHECK(ndel == nnew);
+}
+
+/* bo's sitting unused in the cache are eventually freed: */
+static void test_evict(void)
+{
+	struct fd_bo_cache *cache = fd_bo_cache_new(NULL);
+	struct fd_bo *bo;
+
+	nnew = ndel = 0;
+
+	bo = fd_bo_cache_alloc(cache, 0x1000);
+	fd_bo_cache_free(cache, bo);
+	fd_bo_cache_flushed(cache, 1);
+	fd_bo_cache_retired(cache, 1);
+	CHECK(ndel == 0);
+
+	/* past the idle time of the cache (one second): */
+	sleep(2);
+
+	fd_bo_cache_retired(cache, 2);
+	CHECK(ndel == 1);
+	CHECK(stats(cache).frees == 1);
+	CHECK(stats(cache).nbos_cached == 0);
+	CHECK(stats(cache).bytes_cached == 0);
+
+	fd_bo_cache_del(cache);
+	CHECK(ndel == nnew);
+}
+
+int main(int argc, char **argv)
+{
+	test_reuse();
+	test_buckets();
+	test_wrap();
+	test_evict();
+
+	if (failures) {
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+
+	printf("all checks passed\n");
+	return 0;
+}
@@ -166,6 +166,9 @@ struct fd_param {
 		struct {                  /* attributes */
 			struct fd_bo     *bo;
 			enum a3xx_vtx_fmt fmt;
+			uint32_t offset;
+			/* size, if the data is in the upload heap: */
+			uint32_t upload;
 		};
 		struct fd_surface *tex;   /* textures */
 		struct {                  /* uniforms */
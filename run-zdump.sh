@@ -2,8 +2,5 @@
 
 dir=`dirname $0`
 
-for f in $*; do
-	echo "$f"
-	$dir/zdump $f > ${f%%.rd}.z
-done
-
+# dumps each foo.rd to foo.z, in parallel:
+$dir/zdump -b $*
@@ -0,0 +1,164 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glob.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "batch.h"
+
+static int cmpstr(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* expand the args into a sorted list of files, returns the count or -1: */
+int batch_files(int argc, char **argv, char ***files)
+{
+	glob_t g;
+	int i, j, n, flags = 0;
+
+	memset(&g, 0, sizeof(g));
+
+	for (i = 0; i < argc; i++) {
+		struct stat st;
+		char *pattern;
+		int ret;
+
+		if (!stat(argv[i], &st) && S_ISDIR(st.st_mode)) {
+			pattern = malloc(strlen(argv[i]) + 6);
+			sprintf(pattern, "%s/*.rd", argv[i]);
+		} else {
+			/* a plain file is just a glob that matches itself: */
+			pattern = strdup(argv[i]);
+		}
+
+		ret = glob(pattern, flags, NULL, &g);
+		if (ret && (ret != GLOB_NOMATCH)) {
+			fprintf(stderr, "could not expand: %s\n", argv[i]);
+			free(pattern);
+			globfree(&g);
+			return -1;
+		}
+		if (ret == GLOB_NOMATCH)
+			fprintf(stderr, "no match: %s\n", argv[i]);
+
+		free(pattern);
+		flags = GLOB_APPEND;
+	}
+
+	*files = malloc((g.gl_pathc + 1) * sizeof(char *));
+	for (i = 0; i < g.gl_pathc; i++)
+		(*files)[i] = strdup(g.gl_pathv[i]);
+	n = g.gl_pathc;
+	globfree(&g);
+
+	/* sorted, without duplicates: */
+	qsort(*files, n, sizeof(char *), cmpstr);
+	for (i = 0, j = 0; i < n; i++) {
+		if (j && !strcmp((*files)[j - 1], (*files)[i]))
+			free((*files)[i]);
+		else
+			(*files)[j++] = (*files)[i];
+	}
+
+	return j;
+}
+
+int batch_workers(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n > 0) ? n : 1;
+}
+
+/* run fn() for each job in a child process, at most nworkers at a time.
+ * A failed job doesn't stop the others, but the return is non-zero if
+ * any of them failed:
+ */
+int batch_run(const char **names, int njobs, int nworkers,
+		int (*fn)(int job, void *arg), void *arg)
+{
+	pid_t *pids = calloc(nworkers, sizeof(pid_t));
+	int *jobs = calloc(nworkers, sizeof(int));
+	int next = 0, running = 0, ret = 0, stop = 0;
+	int i, status;
+	pid_t pid;
+
+	while ((next < njobs) || running) {
+		if ((next < njobs) && (running < nworkers) && !stop) {
+			printf("%s\n", names[next]);
+			fflush(stdout);
+			fflush(stderr);
+
+			pid = fork();
+			if (pid < 0) {
+				perror("fork");
+				ret = -1;
+				stop = 1;
+				continue;
+			}
+			if (pid == 0)
+				exit(fn(next, arg) ? 1 : 0);
+
+			for (i = 0; pids[i]; i++)
+				;
+			pids[i] = pid;
+			jobs[i] = next++;
+			running++;
+			continue;
+		}
+
+		if (!running)
+			break;
+
+		pid = wait(&status);
+		if (pid < 0) {
+			perror("wait");
+			ret = -1;
+			break;
+		}
+
+		for (i = 0; (i < nworkers) && (pids[i] != pid); i++)
+			;
+		if (i == nworkers)
+			continue;
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			fprintf(stderr, "failed: %s\n", names[jobs[i]]);
+			ret = -1;
+		}
+
+		pids[i] = 0;
+		running--;
+	}
+
+	free(pids);
+	free(jobs);
+
+	return ret;
+}
@@ -0,0 +1,264 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Benchmark for the PM4 decoder:
+ *
+ *   bench-pm4 file.rd [size-in-MB]
+ *
+ * If file.rd does not exist, a synthetic a3xx capture of the given size
+ * (default 1024MB) is generated first.  Each submit has a cmdstream which
+ * calls a state IB a few times, both made of runs of register writes and
+ * the usual type3 packets.  The capture is decoded twice, once just
+ * counting the events, and once also looking up the register name and
+ * bitfields of each write.  Throughput is in MB of cmdstream decoded,
+ * counting IBs each time they are called.
+ *
+ * Results are reported on stderr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <assert.h>
+
+#include "libpm4.h"
+#include "adreno_pm4.xml.h"
+
+#define CMDS_ADDR   0xc0000000
+#define STATE_ADDR  0xc0100000
+#define BUF_DWORDS  0x4000
+#define NCALLS      4
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void write_section(FILE *f, uint32_t type, const void *buf, uint32_t sz)
+{
+	uint32_t hdr[4] = { ~0, ~0, type, sz };
+	fwrite(hdr, sizeof(hdr), 1, f);
+	fwrite(buf, sz, 1, f);
+}
+
+static uint32_t rnd(void)
+{
+	static uint32_t seed = 1;
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+/* fill with packets, leaving room at the end: */
+static uint32_t fill(uint32_t *dwords, uint32_t n, uint32_t room)
+{
+	uint32_t i = 0, j;
+
+	while ((i + 40 + room) < n) {
+		uint32_t cnt = 1 + rnd() % 16;
+		uint32_t reg = 0x2000 + rnd() % 0x800;
+
+		switch (rnd() % 4) {
+		case 0:
+		case 1:
+			dwords[i++] = ((cnt - 1) << 16) | reg;
+			for (j = 0; j < cnt; j++)
+				dwords[i++] = rnd();
+			break;
+		case 2:
+			dwords[i++] = CP_TYPE3_PKT | (2 << 16) | (CP_DRAW_INDX << 8);
+			dwords[i++] = 0;
+			dwords[i++] = rnd();
+			dwords[i++] = 3;
+			break;
+		case 3:
+			dwords[i++] = CP_TYPE3_PKT | ((cnt + 1) << 16) | (CP_LOAD_STATE << 8);
+			for (j = 0; j < cnt + 2; j++)
+				dwords[i++] = rnd();
+			break;
+		}
+	}
+
+	return i;
+}
+
+static void pad(uint32_t *dwords, uint32_t i, uint32_t n)
+{
+	while (i < n)
+		dwords[i++] = CP_TYPE2_PKT;
+}
+
+static int generate(const char *name, uint64_t size)
+{
+	uint32_t *cmds = malloc(BUF_DWORDS * 4);
+	uint32_t *state = malloc(BUF_DWORDS * 4);
+	uint32_t gpu_id = 320;
+	uint64_t written = 0;
+	unsigned int n = 0;
+	FILE *f;
+
+	f = fopen(name, "w");
+	if (!f) {
+		fprintf(stderr, "could not create: %s\n", name);
+		return -1;
+	}
+
+	write_section(f, RD_TEST, "bench-pm4", 9);
+	write_section(f, RD_GPU_ID, &gpu_id, 4);
+
+	while (written < size) {
+		uint32_t i = 0, k;
+
+		pad(state, fill(state, BUF_DWORDS, 0), BUF_DWORDS);
+
+		for (k = 0; k < NCALLS; k++) {
+			i += fill(&cmds[i], BUF_DWORDS / NCALLS, 3);
+			cmds[i++] = CP_TYPE3_PKT | (1 << 16) | (CP_INDIRECT_BUFFER_PFD << 8);
+			cmds[i++] = STATE_ADDR;
+			cmds[i++] = BUF_DWORDS;
+			pad(cmds, i, (k + 1) * BUF_DWORDS / NCALLS);
+			i = (k + 1) * BUF_DWORDS / NCALLS;
+		}
+
+		write_section(f, RD_GPUADDR, (uint32_t[3]){ STATE_ADDR, BUF_DWORDS * 4, 0 }, 12);
+		write_section(f, RD_BUFFER_CONTENTS, state, BUF_DWORDS * 4);
+		write_section(f, RD_GPUADDR, (uint32_t[3]){ CMDS_ADDR, BUF_DWORDS * 4, 0 }, 12);
+		write_section(f, RD_BUFFER_CONTENTS, cmds, BUF_DWORDS * 4);
+		write_section(f, RD_CMDSTREAM_ADDR, (uint32_t[3]){ CMDS_ADDR, BUF_DWORDS, 0 }, 12);
+		written += 2 * (BUF_DWORDS * 4) + 2 * 28 + 2 * 16 + 28;
+		n++;
+	}
+
+	fclose(f);
+	free(cmds);
+	free(state);
+
+	fprintf(stderr, "generated %s: %u submits, %"PRIu64" MB\n", name, n,
+			written >> 20);
+
+	return 0;
+}
+
+struct stats {
+	uint64_t dwords, packets, regs, errors, submits;
+	uint32_t sum;
+	int names;
+};
+
+static void count(const struct pm4_event *ev, void *arg)
+{
+	struct stats *st = arg;
+
+	switch (ev->type) {
+	case PM4_SUBMIT:
+		st->submits++;
+		break;
+	case PM4_PKT0:
+	case PM4_PKT1:
+	case PM4_PKT2:
+	case PM4_PKT3:
+		st->packets++;
+		st->dwords += 1 + ev->count;
+		break;
+	case PM4_REG:
+		st->regs++;
+		st->sum += ev->val;
+		if (st->names && ev->info) {
+			uint32_t i;
+			/* what a dumper would do, find the bitfields: */
+			st->sum += ev->info->name[0];
+			for (i = 0; i < ev->info->nfields; i++) {
+				const struct pm4_field *f = &ev->info->fields[i];
+				st->sum += (ev->val & f->mask) >> f->shift;
+			}
+		}
+		break;
+	case PM4_ERROR:
+		st->errors++;
+		break;
+	default:
+		break;
+	}
+}
+
+static int bench(const char *name, int names)
+{
+	struct stats st = { .names = names };
+	struct pm4_decoder *d;
+	struct rd_reader *r;
+	uint64_t t, ns;
+
+	r = rd_reader_open(open(name, O_RDONLY));
+	if (!r)
+		return -1;
+
+	d = pm4_decoder_new(320);
+
+	t = now();
+	pm4_decode_rd(d, r, ~(uint64_t)0, count, &st);
+	ns = now() - t;
+
+	fprintf(stderr, "%-16s %6"PRIu64" submits, %10"PRIu64" packets, "
+			"%10"PRIu64" regs, %10.3f ms, %8.1f MB/s, %6.1f Mevents/s\n",
+			names ? "decode+fields" : "decode",
+			st.submits, st.packets, st.regs, ns / 1000000.0,
+			(st.dwords * 4 / (1024.0 * 1024.0)) / (ns / 1000000000.0),
+			((st.packets + st.regs) / 1000000.0) / (ns / 1000000000.0));
+
+	pm4_decoder_free(d);
+	rd_reader_close(r);
+
+	if (st.errors) {
+		fprintf(stderr, "%"PRIu64" decode errors!\n", st.errors);
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t size = 1024;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s file.rd [size-in-MB]\n", argv[0]);
+		return -1;
+	}
+
+	if (argc > 2)
+		size = strtoull(argv[2], NULL, 0);
+
+	if (access(argv[1], R_OK) && generate(argv[1], size << 20))
+		return -1;
+
+	if (bench(argv[1], 0) || bench(argv[1], 1))
+		return -1;
+
+	return 0;
+}
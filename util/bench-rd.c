@@ -0,0 +1,243 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Benchmark for reading rd files, comparing librd against the old style
+ * loop of read()ing each section header and payload into a malloc'd
+ * buffer:
+ *
+ *   bench-rd file.rd [size-in-MB]
+ *
+ * If file.rd does not exist, a synthetic capture of the given size
+ * (default 4096MB) is generated first.  Both loops sum up every dword of
+ * every section, so they touch the same data.  Note that unless the page
+ * cache is dropped between runs, this measures reading from page cache.
+ *
+ * Results are reported on stderr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "librd.h"
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void report(const char *name, uint64_t start, unsigned int n,
+		uint64_t bytes)
+{
+	uint64_t ns = now() - start;
+	fprintf(stderr, "%-16s %8u sections, %10.3f ms, %8.1f MB/s\n", name, n,
+			ns / 1000000.0,
+			(bytes / (1024.0 * 1024.0)) / (ns / 1000000000.0));
+}
+
+static void write_section(FILE *f, uint32_t type, const void *buf, uint32_t sz)
+{
+	uint32_t hdr[4] = { ~0, ~0, type, sz };
+	fwrite(hdr, sizeof(hdr), 1, f);
+	fwrite(buf, sz, 1, f);
+}
+
+/* something shaped roughly like a real capture, a bunch of buffers of
+ * assorted sizes followed by the cmdstream, per submit:
+ */
+static int generate(const char *name, uint64_t size)
+{
+	static const uint32_t sizes[] = {
+			0x1000, 0x40, 0x10000, 0x1000, 0x100000, 0x400, 0x8000,
+	};
+	uint32_t *data = malloc(0x100000);
+	uint64_t written = 0;
+	unsigned int i, n = 0;
+	FILE *f;
+
+	f = fopen(name, "w");
+	if (!f) {
+		fprintf(stderr, "could not create: %s\n", name);
+		return -1;
+	}
+
+	for (i = 0; i < 0x100000 / 4; i++)
+		data[i] = i * 0x9e3779b1;
+
+	write_section(f, RD_TEST, "bench-rd", 8);
+
+	while (written < size) {
+		for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+			uint32_t gpuaddr[3] = { 0xc0000000 + (i << 20), sizes[i], 0 };
+			write_section(f, RD_GPUADDR, gpuaddr, sizeof(gpuaddr));
+			write_section(f, RD_BUFFER_CONTENTS, data, sizes[i]);
+			written += sizes[i] + 44;
+		}
+		write_section(f, RD_CMDSTREAM_ADDR, (uint32_t[3]){ 0xc0000000, 64, 0 }, 12);
+		written += 28;
+		n++;
+	}
+
+	fclose(f);
+	free(data);
+
+	fprintf(stderr, "generated %s: %u submits, %"PRIu64" MB\n", name, n,
+			written >> 20);
+
+	return 0;
+}
+
+static uint32_t sum(const uint32_t *dwords, uint32_t sz)
+{
+	uint32_t i, s = 0;
+	for (i = 0; i < sz / 4; i++)
+		s += dwords[i];
+	return s;
+}
+
+static int read_full(int fd, void *buf, int sz)
+{
+	uint8_t *p = buf;
+	int n = 0;
+	while (n < sz) {
+		int ret = read(fd, p + n, sz - n);
+		if (ret <= 0)
+			break;
+		n += ret;
+	}
+	return n;
+}
+
+static uint32_t bench_read(const char *name)
+{
+	uint64_t t = now(), bytes = 0;
+	uint32_t type, sz, s = 0;
+	unsigned int n = 0;
+	int fd = open(name, O_RDONLY);
+
+	while ((read_full(fd, &type, 4) == 4) && (read_full(fd, &sz, 4) == 4)) {
+		void *buf;
+
+		if ((type == 0xffffffff) && (sz == 0xffffffff))
+			continue;
+
+		buf = malloc(sz);
+		if (read_full(fd, buf, sz) != sz) {
+			free(buf);
+			break;
+		}
+		s += sum(buf, sz);
+		free(buf);
+
+		bytes += sz;
+		n++;
+	}
+
+	close(fd);
+	report("read()", t, n, bytes);
+
+	return s;
+}
+
+static uint32_t bench_librd(const char *name)
+{
+	uint64_t t = now(), bytes = 0;
+	struct rd_reader *r;
+	struct rd_section sect;
+	unsigned int n = 0;
+	uint32_t s = 0;
+
+	r = rd_reader_open(open(name, O_RDONLY));
+	if (!r)
+		return 0;
+
+	while (rd_reader_next(r, &sect)) {
+		s += sum(sect.data, sect.size);
+		bytes += sect.size;
+		n++;
+	}
+
+	rd_reader_close(r);
+	report("librd", t, n, bytes);
+
+	return s;
+}
+
+/* time to get to the last submit: */
+static void bench_seek(const char *name)
+{
+	uint64_t t = now(), end;
+	struct rd_index idx;
+	struct rd_reader *r;
+
+	r = rd_reader_open(open(name, O_RDONLY));
+	if (!r)
+		return;
+
+	if (rd_reader_load_index(r, &idx)) {
+		fprintf(stderr, "%s not indexed, skipping seek (see rdindex)\n", name);
+		rd_reader_close(r);
+		return;
+	}
+
+	if (idx.nsubmits)
+		rd_reader_seek_submits(r, idx.nsubmits - 1, idx.nsubmits - 1, &end);
+
+	fprintf(stderr, "%-16s %8u submits, %10.3f ms\n", "seek to last",
+			idx.nsubmits, (now() - t) / 1000000.0);
+
+	rd_index_fini(&idx);
+	rd_reader_close(r);
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t size = 4096;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s file.rd [size-in-MB]\n", argv[0]);
+		return -1;
+	}
+
+	if (argc > 2)
+		size = strtoull(argv[2], NULL, 0);
+
+	if (access(argv[1], R_OK) && generate(argv[1], size << 20))
+		return -1;
+
+	if (bench_read(argv[1]) != bench_librd(argv[1])) {
+		fprintf(stderr, "mismatch!\n");
+		return -1;
+	}
+
+	bench_seek(argv[1]);
+
+	return 0;
+}
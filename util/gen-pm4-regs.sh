@@ -0,0 +1,126 @@
+#!/bin/sh
+
+# Generates the register and opcode tables for libpm4 from the rules-ng-ng
+# headers in includes/, ie:
+#
+#   sh util/gen-pm4-regs.sh includes > pm4-regs.h
+#
+# For each register (or register array) the fields that follow it in the
+# header become its bitfields, both the FOO__MASK/FOO__SHIFT kind and the
+# single bit flags.
+
+inc=${1:-includes}
+
+regs() {
+	gen=$1
+	shift
+	awk -v gen=$gen '
+	function hex(s,    i, n, c) {
+		n = 0
+		s = tolower(substr(s, 3))
+		for (i = 1; i <= length(s); i++) {
+			c = index("0123456789abcdef", substr(s, i, 1)) - 1
+			n = n * 16 + c
+		}
+		return n
+	}
+	function shiftof(m,    s) {
+		s = 0
+		while ((m > 0) && ((m % 2) == 0)) {
+			m /= 2
+			s++
+		}
+		return s
+	}
+	function add_reg(name, offset, stride) {
+		nregs++
+		reg_name[nregs] = name
+		reg_offset[nregs] = offset
+		reg_stride[nregs] = stride
+		reg_first[nregs] = nfields
+		reg_nfields[nregs] = 0
+		prefix = substr(name, 5) "_"
+		sub(/^REG_A[0-9X]XX_/, "", reg_name[nregs])
+	}
+	function add_field(name, mask) {
+		field_name[nfields] = name
+		field_mask[nfields] = mask
+		field_shift[nfields] = shiftof(hex(mask))
+		field_index[name] = nfields
+		reg_nfields[nregs]++
+		nfields++
+	}
+	BEGIN {
+		nregs = 0
+		nfields = 0
+	}
+	/^#define REG_/ {
+		add_reg($2, $3, "0x0")
+		next
+	}
+	/^static inline uint32_t REG_.*\(uint32_t i0\) \{ return 0x[0-9a-f]+ \+ 0x[0-9a-f]+\*i0; \}/ {
+		name = $4
+		sub(/\(.*/, "", name)
+		stride = $10
+		sub(/\*.*/, "", stride)
+		add_reg(name, $8, stride)
+		next
+	}
+	/^#define / && nregs && (index($2, prefix) == 1) {
+		f = substr($2, length(prefix) + 1)
+		# the whole register, ie. FOO__MASK, is not a bitfield:
+		if (f ~ /^_(MASK|SHIFT)$/)
+			next
+		if (f ~ /__MASK$/) {
+			sub(/__MASK$/, "", f)
+			add_field(f, $3)
+		} else if (f ~ /__SHIFT$/) {
+			sub(/__SHIFT$/, "", f)
+			if (f in field_index)
+				field_shift[field_index[f]] = $3
+		} else if ($3 ~ /^0x/) {
+			add_field(f, $3)
+		}
+	}
+	END {
+		printf "static const struct pm4_field %s_fields[] = {\n", gen
+		for (i = 0; i < nfields; i++)
+			printf "\t{ \"%s\", %s, %d },\n", field_name[i], field_mask[i], field_shift[i]
+		printf "\t{ 0 },\n};\n\n"
+		printf "static const struct pm4_reg %s_regs[] = {\n", gen
+		for (i = 1; i <= nregs; i++)
+			printf "\t{ \"%s\", %s, %s, &%s_fields[%d], %d },\n", reg_name[i], reg_offset[i],
+					reg_stride[i], gen, reg_first[i], reg_nfields[i]
+		printf "};\n\n"
+	}
+	' "$@"
+}
+
+opcodes() {
+	awk '
+	/^enum adreno_pm4_type3_packets/ { inside = 1; next }
+	inside && /^};/ { inside = 0 }
+	inside && ($2 == "=") {
+		val = $3
+		sub(/,/, "", val)
+		# with aliases, the first name wins:
+		if (!(val in names))
+			names[val] = $1
+	}
+	END {
+		printf "static const char *pm4_opcode_names[128] = {\n"
+		for (i = 0; i < 128; i++)
+			if (i in names)
+				printf "\t[%d] = \"%s\",\n", i, names[i]
+		printf "};\n"
+	}
+	' "$@"
+}
+
+echo "/* generated by gen-pm4-regs.sh, do not edit */"
+echo
+regs a2xx $inc/a2xx.xml.h $inc/adreno_common.xml.h
+regs a3xx $inc/a3xx.xml.h $inc/adreno_common.xml.h
+regs a4xx $inc/a4xx.xml.h $inc/adreno_common.xml.h
+regs a5xx $inc/a5xx.xml.h
+opcodes $inc/adreno_pm4.xml.h
@@ -0,0 +1,542 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "libpm4.h"
+#include "adreno_pm4.xml.h"
+
+#include "pm4-regs.h"
+
+#define MAX_LEVEL   8      /* of nested IBs */
+#define MAX_ARRAY   64     /* instances of a register array */
+
+struct pm4_buf {
+	uint64_t gpuaddr;
+	uint32_t len;
+	const uint8_t *data;
+	uint8_t *copy;         /* if we own the data */
+};
+
+struct pm4_decoder {
+	uint32_t gpu_id;
+	int gen;
+
+	/* register info, indexed by offset: */
+	const struct pm4_reg **regs;
+	uint32_t nregs;
+
+	/* buffer map, sorted by gpuaddr: */
+	struct pm4_buf *bufs;
+	int nbufs, maxbufs;
+	int last;              /* the last buffer found, to check first */
+
+	pm4_callback cb;
+	void *arg;
+	int errors;
+};
+
+static const struct {
+	const struct pm4_reg *regs;
+	uint32_t nregs;
+} gens[] = {
+	[2] = { a2xx_regs, ARRAY_SIZE(a2xx_regs) },
+	[3] = { a3xx_regs, ARRAY_SIZE(a3xx_regs) },
+	[4] = { a4xx_regs, ARRAY_SIZE(a4xx_regs) },
+	[5] = { a5xx_regs, ARRAY_SIZE(a5xx_regs) },
+};
+
+/* the lookup tables are built on first use, and shared: */
+static const struct pm4_reg **lookups[ARRAY_SIZE(gens)];
+static uint32_t nlookups[ARRAY_SIZE(gens)];
+
+static void build_lookup(int gen)
+{
+	const struct pm4_reg *regs = gens[gen].regs;
+	const struct pm4_reg **lookup;
+	uint32_t i, j, n = 0;
+
+	for (i = 0; i < gens[gen].nregs; i++)
+		n = max(n, regs[i].offset + (regs[i].stride * MAX_ARRAY) + 1);
+
+	lookup = calloc(n, sizeof(*lookup));
+
+	/* plain registers first, the first one wins.  The headers also
+	 * describe some in-memory layouts (ie. TEX_SAMP_0) as if they were
+	 * registers, but those come after the real ones:
+	 */
+	for (i = 0; i < gens[gen].nregs; i++)
+		if (!regs[i].stride && !lookup[regs[i].offset])
+			lookup[regs[i].offset] = &regs[i];
+
+	/* then arrays, in the gaps.  A group (ie. RB_MRT) is followed by its
+	 * members at the same offset, which have the bitfields:
+	 */
+	for (i = 0; i < gens[gen].nregs; i++) {
+		if (!regs[i].stride)
+			continue;
+		for (j = 0; j < MAX_ARRAY; j++) {
+			const struct pm4_reg **p = &lookup[regs[i].offset + j * regs[i].stride];
+			if (*p && !(*p)->stride)
+				break;
+			if (!*p || (((*p)->offset == regs[i].offset) && !(*p)->nfields))
+				*p = &regs[i];
+		}
+	}
+
+	lookups[gen] = lookup;
+	nlookups[gen] = n;
+}
+
+struct pm4_decoder * pm4_decoder_new(uint32_t gpu_id)
+{
+	struct pm4_decoder *d = calloc(1, sizeof(*d));
+	pm4_set_gpu_id(d, gpu_id);
+	return d;
+}
+
+void pm4_decoder_free(struct pm4_decoder *d)
+{
+	int i;
+
+	for (i = 0; i < d->nbufs; i++)
+		free(d->bufs[i].copy);
+	free(d->bufs);
+	free(d);
+}
+
+void pm4_set_gpu_id(struct pm4_decoder *d, uint32_t gpu_id)
+{
+	int gen = gpu_id / 100;
+
+	if ((gen < 2) || (gen >= ARRAY_SIZE(gens)))
+		gen = 3;
+
+	if (!lookups[gen])
+		build_lookup(gen);
+
+	d->gpu_id = gpu_id;
+	d->gen = gen;
+	d->regs = lookups[gen];
+	d->nregs = nlookups[gen];
+}
+
+const struct pm4_reg * pm4_reg_info(struct pm4_decoder *d, uint32_t reg)
+{
+	return (reg < d->nregs) ? d->regs[reg] : NULL;
+}
+
+const char * pm4_reg_name(const struct pm4_reg *info, uint32_t reg,
+		char *buf, int sz)
+{
+	if (!info)
+		snprintf(buf, sz, "%05x", reg);
+	else if (info->stride)
+		snprintf(buf, sz, "%s[%u]", info->name,
+				(reg - info->offset) / info->stride);
+	else
+		return info->name;
+	return buf;
+}
+
+const char * pm4_opcode_name(uint32_t opcode)
+{
+	if ((opcode < ARRAY_SIZE(pm4_opcode_names)) && pm4_opcode_names[opcode])
+		return pm4_opcode_names[opcode];
+	return "UNKNOWN";
+}
+
+/*
+ * Buffer map:
+ */
+
+/* index of the first buffer ending after gpuaddr: */
+static int find_buf(struct pm4_decoder *d, uint64_t gpuaddr)
+{
+	int lo = 0, hi = d->nbufs;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if ((d->bufs[mid].gpuaddr + d->bufs[mid].len) <= gpuaddr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+void pm4_map(struct pm4_decoder *d, uint64_t gpuaddr, uint32_t len,
+		const void *data, int copy)
+{
+	struct pm4_buf *buf;
+	int i, j;
+
+	/* drop whatever it replaces: */
+	i = find_buf(d, gpuaddr);
+	for (j = i; (j < d->nbufs) && (d->bufs[j].gpuaddr < (gpuaddr + len)); j++)
+		free(d->bufs[j].copy);
+
+	if ((j - i) != 1) {
+		if ((d->nbufs - (j - i) + 1) > d->maxbufs) {
+			d->maxbufs = max(2 * d->maxbufs, 64);
+			d->bufs = realloc(d->bufs, d->maxbufs * sizeof(d->bufs[0]));
+		}
+		memmove(&d->bufs[i + 1], &d->bufs[j],
+				(d->nbufs - j) * sizeof(d->bufs[0]));
+		d->nbufs += 1 - (j - i);
+	}
+
+	buf = &d->bufs[i];
+	buf->gpuaddr = gpuaddr;
+	buf->len = len;
+	buf->copy = NULL;
+	if (copy) {
+		buf->copy = malloc(len);
+		memcpy(buf->copy, data, len);
+		data = buf->copy;
+	}
+	buf->data = data;
+
+	d->last = i;
+}
+
+/* new contents for part of a buffer, ie. RD_BUFFER_PARTIAL: */
+void pm4_patch(struct pm4_decoder *d, uint64_t gpuaddr, uint32_t offset,
+		uint32_t len, const void *data)
+{
+	struct pm4_buf *buf;
+	int i = find_buf(d, gpuaddr);
+
+	if ((i == d->nbufs) || (d->bufs[i].gpuaddr != gpuaddr) ||
+			((offset + len) > d->bufs[i].len))
+		return;
+
+	buf = &d->bufs[i];
+	if (!buf->copy) {
+		buf->copy = malloc(buf->len);
+		memcpy(buf->copy, buf->data, buf->len);
+		buf->data = buf->copy;
+	}
+
+	memcpy(buf->copy + offset, data, len);
+}
+
+const void * pm4_lookup(struct pm4_decoder *d, uint64_t gpuaddr, uint32_t len)
+{
+	struct pm4_buf *buf;
+	int i = d->last;
+
+	if ((i >= d->nbufs) || (gpuaddr < d->bufs[i].gpuaddr) ||
+			(gpuaddr >= (d->bufs[i].gpuaddr + d->bufs[i].len))) {
+		i = find_buf(d, gpuaddr);
+		if ((i == d->nbufs) || (gpuaddr < d->bufs[i].gpuaddr))
+			return NULL;
+		d->last = i;
+	}
+
+	buf = &d->bufs[i];
+	if ((gpuaddr + len) > (buf->gpuaddr + buf->len))
+		return NULL;
+
+	return buf->data + (gpuaddr - buf->gpuaddr);
+}
+
+/*
+ * Decoding:
+ */
+
+static inline void emit(struct pm4_decoder *d, struct pm4_event *ev)
+{
+	d->cb(ev, d->arg);
+}
+
+static void error(struct pm4_decoder *d, int level, uint64_t gpuaddr)
+{
+	struct pm4_event ev = {
+		.type = PM4_ERROR,
+		.level = level,
+		.gpuaddr = gpuaddr,
+	};
+	d->errors++;
+	emit(d, &ev);
+}
+
+static void regs(struct pm4_decoder *d, int level, uint64_t gpuaddr,
+		uint32_t reg, const uint32_t *vals, uint32_t count, int same)
+{
+	struct pm4_event ev = {
+		.type = PM4_REG,
+		.level = level,
+		.gpuaddr = gpuaddr,
+	};
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		ev.reg = reg;
+		ev.val = vals[i];
+		ev.info = (reg < d->nregs) ? d->regs[reg] : NULL;
+		emit(d, &ev);
+		if (!same)
+			reg++;
+	}
+}
+
+static void decode(struct pm4_decoder *d, uint64_t gpuaddr,
+		uint32_t sizedwords, int level);
+
+static void ib(struct pm4_decoder *d, uint64_t gpuaddr, uint32_t sizedwords,
+		int level)
+{
+	struct pm4_event ev = {
+		.type = PM4_IB,
+		.level = level,
+		.gpuaddr = gpuaddr,
+		.count = sizedwords,
+	};
+
+	emit(d, &ev);
+	decode(d, gpuaddr, sizedwords, level + 1);
+	ev.type = PM4_IB_END;
+	emit(d, &ev);
+}
+
+/* the interesting bits of type3/type7 packets, which have registers or
+ * IBs in them:
+ */
+static void pkt3(struct pm4_decoder *d, int level, uint64_t gpuaddr,
+		uint32_t opcode, const uint32_t *p, uint32_t count)
+{
+	int a5xx = (d->gen >= 5);
+	uint32_t i;
+
+	switch (opcode) {
+	case CP_INDIRECT_BUFFER:
+	case CP_INDIRECT_BUFFER_PFD:
+		if (a5xx && (count >= 3))
+			ib(d, p[0] | ((uint64_t)p[1] << 32), p[2], level);
+		else if (!a5xx && (count >= 2))
+			ib(d, p[0], p[1], level);
+		break;
+	case CP_SET_DRAW_STATE:
+		if (d->gen < 4)
+			break;
+		for (i = 0; (i + (a5xx ? 3 : 2)) <= count; i += (a5xx ? 3 : 2)) {
+			uint32_t n = p[i] & CP_SET_DRAW_STATE__0_COUNT__MASK;
+			uint64_t addr = p[i + 1];
+			if (p[i] & (CP_SET_DRAW_STATE__0_DISABLE |
+					CP_SET_DRAW_STATE__0_DISABLE_ALL_GROUPS |
+					CP_SET_DRAW_STATE__0_LOAD_IMMED))
+				continue;
+			if (a5xx)
+				addr |= (uint64_t)p[i + 2] << 32;
+			if (n)
+				ib(d, addr, n, level);
+		}
+		break;
+	case CP_SET_CONSTANT:
+		/* type 4 is registers, at 0x2000: */
+		if (!a5xx && (count >= 1) && (((p[0] >> 16) & 0xf) == 4))
+			regs(d, level, gpuaddr, 0x2000 + (p[0] & 0x7ff),
+					&p[1], count - 1, 0);
+		break;
+	default:
+		break;
+	}
+}
+
+static void decode(struct pm4_decoder *d, uint64_t gpuaddr,
+		uint32_t sizedwords, int level)
+{
+	const uint32_t *dwords;
+	struct pm4_event ev = {
+		.level = level,
+	};
+	uint32_t i = 0;
+
+	if (level > MAX_LEVEL) {
+		error(d, level, gpuaddr);
+		return;
+	}
+
+	dwords = pm4_lookup(d, gpuaddr, sizedwords * 4);
+	if (!dwords) {
+		error(d, level, gpuaddr);
+		return;
+	}
+
+	while (i < sizedwords) {
+		uint32_t hdr = dwords[i];
+		uint32_t count, reg = 0, same = 0;
+
+		ev.gpuaddr = gpuaddr + (4 * i);
+		ev.dwords = &dwords[i + 1];
+
+		if (d->gen >= 5) {
+			switch (hdr >> 28) {
+			case 0x4:
+				ev.type = PM4_PKT0;
+				count = hdr & 0x7f;
+				reg = (hdr >> 8) & 0x3ffff;
+				break;
+			case 0x7:
+				ev.type = PM4_PKT3;
+				count = hdr & 0x3fff;
+				ev.opcode = (hdr >> 16) & 0x7f;
+				break;
+			default:
+				error(d, level, ev.gpuaddr);
+				return;
+			}
+		} else {
+			switch (hdr & 0xc0000000) {
+			case CP_TYPE0_PKT:
+				ev.type = PM4_PKT0;
+				count = ((hdr >> 16) & 0x3fff) + 1;
+				reg = hdr & 0x7fff;
+				same = hdr & 0x8000;
+				break;
+			case CP_TYPE1_PKT:
+				ev.type = PM4_PKT1;
+				count = 2;
+				break;
+			case CP_TYPE2_PKT:
+				ev.type = PM4_PKT2;
+				count = 0;
+				break;
+			default:
+				ev.type = PM4_PKT3;
+				count = ((hdr >> 16) & 0x3fff) + 1;
+				ev.opcode = (hdr >> 8) & 0x7f;
+				break;
+			}
+		}
+
+		if ((i + 1 + count) > sizedwords) {
+			error(d, level, ev.gpuaddr);
+			return;
+		}
+
+		ev.count = count;
+		emit(d, &ev);
+
+		switch (ev.type) {
+		case PM4_PKT0:
+			regs(d, level, ev.gpuaddr, reg, ev.dwords, count, same);
+			break;
+		case PM4_PKT1:
+			regs(d, level, ev.gpuaddr, hdr & 0x7ff, &ev.dwords[0], 1, 0);
+			regs(d, level, ev.gpuaddr, (hdr >> 11) & 0x7ff, &ev.dwords[1], 1, 0);
+			break;
+		case PM4_PKT3:
+			pkt3(d, level, ev.gpuaddr, ev.opcode, ev.dwords, count);
+			break;
+		default:
+			break;
+		}
+
+		i += 1 + count;
+	}
+}
+
+int pm4_decode(struct pm4_decoder *d, uint64_t gpuaddr, uint32_t sizedwords,
+		pm4_callback cb, void *arg)
+{
+	d->cb = cb;
+	d->arg = arg;
+	d->errors = 0;
+
+	decode(d, gpuaddr, sizedwords, 0);
+
+	return d->errors ? -1 : 0;
+}
+
+/* decode all the submits in a capture, up to end, following the buffer
+ * contents as they change.  Submits are numbered the same way as in
+ * RD_INDEX, ie. the first run of cmdstreams is submit 0:
+ */
+int pm4_decode_rd(struct pm4_decoder *d, struct rd_reader *r, uint64_t end,
+		pm4_callback cb, void *arg)
+{
+	int copy = !rd_reader_mapped(r);
+	struct rd_section s;
+	uint64_t gpuaddr = 0;
+	uint32_t len = 0, submit = 0;
+	int in_cmds = 0, errors = 0;
+
+	while ((rd_reader_tell(r) < end) && rd_reader_next(r, &s)) {
+		const uint32_t *buf = s.data;
+
+		switch (s.type) {
+		case RD_GPU_ID:
+			if (s.size >= 4)
+				pm4_set_gpu_id(d, buf[0]);
+			break;
+		case RD_GPUADDR:
+			if (s.size < 8)
+				break;
+			gpuaddr = buf[0];
+			if (s.size >= 12)
+				gpuaddr |= (uint64_t)buf[2] << 32;
+			len = buf[1];
+			break;
+		case RD_BUFFER_CONTENTS:
+			pm4_map(d, gpuaddr, min(len, s.size), s.data, copy);
+			break;
+		case RD_BUFFER_PARTIAL:
+			if (s.size >= 20)
+				pm4_patch(d, buf[0] | ((uint64_t)buf[2] << 32), buf[3],
+						min(buf[4], s.size - 20), &buf[5]);
+			break;
+		case RD_CMDSTREAM_ADDR:
+			if (s.size < 8)
+				break;
+			if (!in_cmds) {
+				struct pm4_event ev = {
+					.type = PM4_SUBMIT,
+					.count = submit++,
+				};
+				cb(&ev, arg);
+			}
+			in_cmds = 1;
+			if (pm4_decode(d, buf[0] | ((s.size >= 12) ?
+					((uint64_t)buf[2] << 32) : 0), buf[1], cb, arg))
+				errors++;
+			continue;
+		case RD_CONTEXT:
+		case RD_CMDSTREAM:
+		case RD_IOCTL:
+			/* still part of the same submit */
+			continue;
+		default:
+			break;
+		}
+
+		in_cmds = 0;
+	}
+
+	return errors ? -1 : 0;
+}
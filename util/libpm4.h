@@ -0,0 +1,103 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIBPM4_H_
+#define LIBPM4_H_
+
+#include <stdint.h>
+
+#include "librd.h"
+
+/*
+ * PM4 cmdstream decoder.  IBs are walked packet by packet and handed to
+ * a callback as a stream of events, with nested IBs (CP_INDIRECT_BUFFER,
+ * and CP_SET_DRAW_STATE groups) followed thru a map of the buffers in the
+ * capture.  Register names and bitfields come from tables generated from
+ * the rnn headers at build time (see gen-pm4-regs.sh).
+ *
+ * For a5xx, type4 packets are reported as PM4_PKT0 and type7 as PM4_PKT3.
+ */
+
+struct pm4_field {
+	const char *name;
+	uint32_t mask;
+	uint32_t shift;
+};
+
+struct pm4_reg {
+	const char *name;
+	uint32_t offset;
+	uint32_t stride;           /* for register arrays, otherwise zero */
+	const struct pm4_field *fields;
+	uint32_t nfields;
+};
+
+enum pm4_event_type {
+	PM4_SUBMIT,      /* start of a submit, count is the submit number */
+	PM4_PKT0,        /* register write packet, followed by its PM4_REGs */
+	PM4_PKT1,
+	PM4_PKT2,        /* nop */
+	PM4_PKT3,
+	PM4_REG,         /* register write, from PM4_PKT0/1 or CP_SET_CONSTANT */
+	PM4_IB,          /* nested IB, followed by its packets */
+	PM4_IB_END,
+	PM4_ERROR,       /* bad packet, or an IB not in the buffer map */
+};
+
+struct pm4_event {
+	enum pm4_event_type type;
+	int level;                 /* IB depth, 0 for the submitted cmdstream */
+	uint64_t gpuaddr;          /* of the packet header, or of the IB */
+	const uint32_t *dwords;    /* packet payload */
+	uint32_t count;            /* payload dwords (or IB size in dwords) */
+	uint32_t opcode;           /* PM4_PKT3 */
+	uint32_t reg, val;         /* PM4_REG */
+	const struct pm4_reg *info;  /* PM4_REG, or NULL if unknown */
+};
+
+typedef void (*pm4_callback)(const struct pm4_event *ev, void *arg);
+
+struct pm4_decoder;
+
+struct pm4_decoder * pm4_decoder_new(uint32_t gpu_id);
+void pm4_decoder_free(struct pm4_decoder *d);
+void pm4_set_gpu_id(struct pm4_decoder *d, uint32_t gpu_id);
+
+/* buffer map, if copy is not set the data must stay valid: */
+void pm4_map(struct pm4_decoder *d, uint64_t gpuaddr, uint32_t len,
+		const void *data, int copy);
+void pm4_patch(struct pm4_decoder *d, uint64_t gpuaddr, uint32_t offset,
+		uint32_t len, const void *data);
+const void * pm4_lookup(struct pm4_decoder *d, uint64_t gpuaddr, uint32_t len);
+
+int pm4_decode(struct pm4_decoder *d, uint64_t gpuaddr, uint32_t sizedwords,
+		pm4_callback cb, void *arg);
+int pm4_decode_rd(struct pm4_decoder *d, struct rd_reader *r, uint64_t end,
+		pm4_callback cb, void *arg);
+
+const struct pm4_reg * pm4_reg_info(struct pm4_decoder *d, uint32_t reg);
+const char * pm4_reg_name(const struct pm4_reg *info, uint32_t reg,
+		char *buf, int sz);
+const char * pm4_opcode_name(uint32_t opcode);
+
+#endif /* LIBPM4_H_ */
@@ -0,0 +1,353 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "librd.h"
+
+#define SYNC 0xffffffff
+
+struct rd_reader {
+	int fd;
+	uint64_t pos, size;
+	int synced;            /* file has sync markers */
+	uint32_t gpu_id;       /* from before the range rd_reader_seek_submits() skips to */
+
+	/* plain files: */
+	const uint8_t *map;
+
+	/* otherwise: */
+	struct rdz_file *f;
+	uint8_t *buf;
+	uint32_t bufsz;
+};
+
+/* get a pointer to sz bytes at off, or NULL if past the end: */
+static const void * view(struct rd_reader *r, uint64_t off, uint32_t sz)
+{
+	if ((off > r->size) || (sz > (r->size - off)))
+		return NULL;
+
+	if (r->map)
+		return r->map + off;
+
+	if (sz > r->bufsz) {
+		r->bufsz = max(sz, 2 * r->bufsz);
+		free(r->buf);
+		r->buf = malloc(r->bufsz);
+	}
+
+	if ((rdz_tell(r->f) != off) && rdz_seek(r->f, off))
+		return NULL;
+
+	if (rdz_read(r->f, r->buf, sz) != sz)
+		return NULL;
+
+	return r->buf;
+}
+
+struct rd_reader * rd_reader_open(int fd)
+{
+	struct rd_reader *r;
+	const uint32_t *p;
+
+	if (fd < 0)
+		return NULL;
+
+	r = calloc(1, sizeof(*r));
+	r->fd = fd;
+	r->f = rdz_open(fd);
+	if (!r->f) {
+		close(fd);
+		free(r);
+		return NULL;
+	}
+
+	r->size = rdz_size(r->f);
+
+	if (!rdz_compressed(r->f) && r->size && (r->size == (size_t)r->size)) {
+		void *map = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			madvise(map, r->size, MADV_SEQUENTIAL);
+			r->map = map;
+		}
+	}
+
+	/* old captures don't have sync markers: */
+	p = view(r, 0, 4);
+	r->synced = p && (*p == SYNC);
+
+	return r;
+}
+
+void rd_reader_close(struct rd_reader *r)
+{
+	if (r->map)
+		munmap((void *)r->map, r->size);
+	rdz_close(r->f);
+	free(r->buf);
+	free(r);
+}
+
+/* check the header of the section at off, returning the offset of the
+ * payload (or zero if it is not a valid section):
+ */
+static uint64_t check_section(struct rd_reader *r, uint64_t off,
+		uint32_t *type, uint32_t *size)
+{
+	const uint32_t *p;
+	int sync = 0;
+
+	while ((p = view(r, off, 4)) && (*p == SYNC)) {
+		off += 4;
+		sync++;
+	}
+
+	if (!(p = view(r, off, 8)))
+		return 0;
+
+	*type = p[0];
+	*size = p[1];
+	off += 8;
+
+	if (*size > (r->size - off))
+		return 0;
+
+	if (r->synced) {
+		if (!sync || (*type == RD_NONE) || (*type > 0xffff))
+			return 0;
+		/* the next section should start with a sync marker too.  Only
+		 * checked when mapped, since otherwise it means reading ahead
+		 * and back again:
+		 */
+		if (r->map && ((off + *size) < r->size) &&
+				(*(uint32_t *)(r->map + off + *size) != SYNC))
+			return 0;
+	}
+
+	return off;
+}
+
+/* find the next sync marker followed by a valid section: */
+static uint64_t resync(struct rd_reader *r, uint64_t off)
+{
+	uint32_t type, size;
+
+	for (off = ALIGN(off, 4); (off + 8) <= r->size; off += 4) {
+		const uint32_t *p = view(r, off, 8);
+		if (p && (p[0] == SYNC) && (p[1] == SYNC) &&
+				check_section(r, off, &type, &size))
+			return off;
+	}
+
+	return r->size;
+}
+
+/* get the next section, returns zero at the end of the file: */
+int rd_reader_next(struct rd_reader *r, struct rd_section *s)
+{
+	while (r->pos < r->size) {
+		uint64_t start = r->pos, off;
+		uint32_t type, size;
+
+		off = check_section(r, start, &type, &size);
+		if (!off) {
+			/* without sync markers, there is no way to resync: */
+			if (!r->synced) {
+				fprintf(stderr, "corrupt section at %"PRIu64"\n", start);
+				r->pos = r->size;
+				break;
+			}
+			r->pos = resync(r, start + 4);
+			fprintf(stderr, "corrupt section at %"PRIu64", skipped %"PRIu64
+					" bytes\n", start, r->pos - start);
+			continue;
+		}
+
+		s->type   = type;
+		s->size   = size;
+		s->offset = start;
+		s->data   = view(r, off, size);
+		r->pos = off + size;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+int rd_reader_seek(struct rd_reader *r, uint64_t offset)
+{
+	if (offset > r->size)
+		return -1;
+	r->pos = offset;
+	return 0;
+}
+
+uint64_t rd_reader_tell(struct rd_reader *r)
+{
+	return r->pos;
+}
+
+uint64_t rd_reader_size(struct rd_reader *r)
+{
+	return r->size;
+}
+
+int rd_reader_compressed(struct rd_reader *r)
+{
+	return rdz_compressed(r->f);
+}
+
+uint32_t rd_reader_gpu_id(struct rd_reader *r)
+{
+	return r->gpu_id;
+}
+
+/* if mapped, section data stays valid until the reader is closed: */
+int rd_reader_mapped(struct rd_reader *r)
+{
+	return !!r->map;
+}
+
+/* read the index from the end of the file, if there is one: */
+int rd_reader_load_index(struct rd_reader *r, struct rd_index *idx)
+{
+	struct rd_index_footer footer;
+	uint32_t hdr[4];
+	uint64_t sz;
+	const void *p;
+
+	memset(idx, 0, sizeof(*idx));
+
+	if (r->size < (sizeof(hdr) + sizeof(footer)))
+		return -1;
+
+	if (!(p = view(r, r->size - sizeof(footer), sizeof(footer))))
+		return -1;
+	memcpy(&footer, p, sizeof(footer));
+
+	if ((footer.magic != RD_INDEX_MAGIC) ||
+			(footer.version != RD_INDEX_VERSION))
+		return -1;
+
+	sz = ((uint64_t)footer.nsections * sizeof(idx->sections[0])) +
+			((uint64_t)footer.nsubmits * sizeof(idx->submits[0])) +
+			sizeof(footer);
+	if ((footer.offset + sizeof(hdr) + sz) != r->size)
+		return -1;
+
+	if (!(p = view(r, footer.offset, sizeof(hdr))))
+		return -1;
+	memcpy(hdr, p, sizeof(hdr));
+	if ((hdr[0] != SYNC) || (hdr[1] != SYNC) ||
+			(hdr[2] != RD_INDEX) || (hdr[3] != sz))
+		return -1;
+
+	if (!(p = view(r, footer.offset + sizeof(hdr), sz)))
+		return -1;
+
+	idx->nsections = idx->maxsections = footer.nsections;
+	idx->nsubmits  = idx->maxsubmits  = footer.nsubmits;
+	idx->sections = malloc(idx->nsections * sizeof(idx->sections[0]));
+	idx->submits  = malloc(idx->nsubmits * sizeof(idx->submits[0]));
+	idx->end = footer.offset;
+
+	memcpy(idx->sections, p, idx->nsections * sizeof(idx->sections[0]));
+	memcpy(idx->submits, (const uint8_t *)p +
+			idx->nsections * sizeof(idx->sections[0]),
+			idx->nsubmits * sizeof(idx->submits[0]));
+
+	return 0;
+}
+
+/* build the index by reading thru the whole file, stopping at an existing
+ * index.  Leaves the read position at idx->end.
+ */
+int rd_reader_scan_index(struct rd_reader *r, struct rd_index *idx)
+{
+	struct rd_section s;
+
+	memset(idx, 0, sizeof(*idx));
+
+	r->pos = 0;
+	while (rd_reader_next(r, &s)) {
+		if (s.type == RD_INDEX)
+			break;
+		rd_index_add(idx, s.offset, s.type, s.size);
+		idx->end = r->pos;
+	}
+
+	/* don't include anything corrupt at the end: */
+	r->pos = idx->end;
+
+	return 0;
+}
+
+/* position the reader at the start of submits first thru last (or to the
+ * end of the file, if last is ~0), using the index if the file has one,
+ * and otherwise building it.  Sets end to the offset where the range ends.
+ */
+int rd_reader_seek_submits(struct rd_reader *r, unsigned int first,
+		unsigned int last, uint64_t *end)
+{
+	struct rd_index idx;
+	struct rd_section s;
+	uint64_t start;
+	unsigned int i;
+	int ret;
+
+	if (rd_reader_load_index(r, &idx)) {
+		fprintf(stderr, "no index, scanning (see rdindex)\n");
+		rd_reader_scan_index(r, &idx);
+	}
+
+	ret = rd_index_range(&idx, first, last, &start, end);
+	if (ret) {
+		fprintf(stderr, "no submit %u, only %u\n", first, idx.nsubmits);
+		rd_index_fini(&idx);
+		return ret;
+	}
+
+	/* the RD_GPU_ID section is normally before the range, so the decoders
+	 * would never see it:
+	 */
+	for (i = 0; (i < idx.nsections) && (idx.sections[i].offset < start); i++) {
+		if (idx.sections[i].type != RD_GPU_ID)
+			continue;
+		r->pos = idx.sections[i].offset;
+		if (rd_reader_next(r, &s) && (s.type == RD_GPU_ID) && (s.size >= 4))
+			r->gpu_id = *(const uint32_t *)s.data;
+	}
+
+	r->pos = start;
+
+	rd_index_fini(&idx);
+
+	return ret;
+}
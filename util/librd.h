@@ -0,0 +1,77 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIBRD_H_
+#define LIBRD_H_
+
+#include <stdint.h>
+
+#include "redump.h"
+#include "rdz.h"
+#include "rdidx.h"
+
+/*
+ * Reader for rd files, shared by the various tools.  Plain files are
+ * mmap'd, and sections are handed back as pointers into the mapping,
+ * without copying.  Compressed files (or files too big to map) are read
+ * thru rdz, in which case the section data is only valid until the next
+ * call.
+ *
+ * Sync markers are skipped, and the framing checked, so that if a section
+ * is corrupt (ie. a capture cut off in the middle of writing a section)
+ * the reader can resync at the next sync marker.  Sections of unknown
+ * type are returned like any other, it is up to the caller to skip them.
+ */
+
+struct rd_section {
+	uint32_t type;
+	uint32_t size;
+	const void *data;
+	uint64_t offset;    /* start of the section, including sync marker */
+};
+
+struct rd_reader;
+
+/* the reader owns fd, which is closed by rd_reader_close(), or right
+ * away if rd_reader_open() fails:
+ */
+struct rd_reader * rd_reader_open(int fd);
+void rd_reader_close(struct rd_reader *r);
+int rd_reader_next(struct rd_reader *r, struct rd_section *s);
+int rd_reader_seek(struct rd_reader *r, uint64_t offset);
+uint64_t rd_reader_tell(struct rd_reader *r);
+uint64_t rd_reader_size(struct rd_reader *r);
+int rd_reader_compressed(struct rd_reader *r);
+int rd_reader_mapped(struct rd_reader *r);
+
+/* RD_INDEX support: */
+int rd_reader_load_index(struct rd_reader *r, struct rd_index *idx);
+int rd_reader_scan_index(struct rd_reader *r, struct rd_index *idx);
+int rd_reader_seek_submits(struct rd_reader *r, unsigned int first,
+		unsigned int last, uint64_t *end);
+/* gpu id from the last RD_GPU_ID skipped by rd_reader_seek_submits(), or
+ * zero if there was none:
+ */
+uint32_t rd_reader_gpu_id(struct rd_reader *r);
+
+#endif /* LIBRD_H_ */
@@ -0,0 +1,975 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "librd.h"
+#include "rdz.h"
+#include "rdpack.h"
+
+/* same layout as in the index file: */
+struct entry {
+	uint8_t hash[16];
+	uint64_t offset;
+	uint32_t rawsz, compsz;
+};
+
+#define PENDING     (~(uint64_t)0)
+#define FLUSH_SIZE  (64 * 1024 * 1024)
+
+struct buf {
+	uint8_t *data;
+	size_t len, max;
+};
+
+struct rdpack_store {
+	char *dir;
+	int chunks_fd, index_fd, lock_fd;
+
+	struct entry *entries;
+	unsigned int nentries, maxentries;
+	uint32_t *table;            /* entry index + 1, or zero if empty */
+	unsigned int tabsz;
+	uint64_t index_end;         /* how much of the index has been read */
+	int broken;                 /* pending chunks were lost */
+
+	/* chunk records not in the store yet: */
+	struct buf pending;
+	struct {
+		uint32_t entry, len;
+		uint64_t pos;
+	} *pendings;
+	unsigned int npendings, maxpendings;
+
+	/* for reading chunks back: */
+	struct buf rec, chunk;
+};
+
+static void * buf_grow(struct buf *b, size_t sz)
+{
+	void *ptr;
+
+	if ((b->len + sz) > b->max) {
+		b->max = max(b->len + sz, 2 * b->max);
+		b->data = realloc(b->data, b->max);
+	}
+
+	ptr = b->data + b->len;
+	b->len += sz;
+
+	return ptr;
+}
+
+static void buf_put(struct buf *b, const void *data, size_t sz)
+{
+	memcpy(buf_grow(b, sz), data, sz);
+}
+
+static void buf_put_u32(struct buf *b, uint32_t val)
+{
+	buf_put(b, &val, 4);
+}
+
+static void buf_pad(struct buf *b)
+{
+	size_t sz = ALIGN(b->len, 4) - b->len;
+	memset(buf_grow(b, sz), 0, sz);
+}
+
+static int write_all(int fd, const void *data, size_t sz)
+{
+	const uint8_t *p = data;
+
+	while (sz) {
+		ssize_t ret = write(fd, p, sz);
+		if (ret <= 0)
+			return -1;
+		p += ret;
+		sz -= ret;
+	}
+
+	return 0;
+}
+
+static int pread_all(int fd, void *data, size_t sz, uint64_t off)
+{
+	uint8_t *p = data;
+
+	while (sz) {
+		ssize_t ret = pread(fd, p, sz, off);
+		if (ret <= 0)
+			return -1;
+		p += ret;
+		off += ret;
+		sz -= ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Content defined chunking, with a gear hash.  Boundaries are where the
+ * top bits of the hash are zero, since the low bits only depend on the
+ * last few bytes:
+ */
+
+#define GEAR_MASK  ((uint64_t)(RDPACK_AVG_CHUNK - 1) << \
+		(64 - __builtin_ctz(RDPACK_AVG_CHUNK)))
+
+static uint64_t gear[256];
+
+static void gear_init(void)
+{
+	uint64_t seed = 0x2545f4914f6cdd1dull;
+	int i;
+
+	if (gear[0])
+		return;
+
+	/* splitmix64, so the table is the same everywhere: */
+	for (i = 0; i < 256; i++) {
+		uint64_t z = (seed += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		gear[i] = z ^ (z >> 31);
+	}
+}
+
+static uint32_t next_chunk(const uint8_t *data, uint64_t len)
+{
+	uint32_t i, n = min(len, RDPACK_MAX_CHUNK);
+	uint64_t h = 0;
+
+	if (n <= RDPACK_MIN_CHUNK)
+		return n;
+
+	for (i = RDPACK_MIN_CHUNK; i < n; i++) {
+		h = (h << 1) + gear[data[i]];
+		if (!(h & GEAR_MASK))
+			return i + 1;
+	}
+
+	return n;
+}
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+/* two independent 64b lanes, not cryptographic: */
+static void hash128(const void *buf, uint32_t sz, uint8_t out[16])
+{
+	static const uint64_t p1 = 0x9e3779b185ebca87ull;
+	static const uint64_t p2 = 0xc2b2ae3d27d4eb4full;
+	static const uint64_t p3 = 0x165667b19e3779f9ull;
+	const uint8_t *ptr = buf;
+	const uint8_t *end = ptr + sz;
+	uint64_t h1 = p2 ^ (sz * p1);
+	uint64_t h2 = p3 ^ (sz * p2);
+
+	while ((ptr + 8) <= end) {
+		uint64_t v;
+		memcpy(&v, ptr, 8);
+		h1 ^= rotl64(v * p2, 31) * p1;
+		h1 = rotl64(h1, 27) * p1 + p2;
+		h2 ^= rotl64(v * p3, 29) * p2;
+		h2 = rotl64(h2, 31) * p2 + p3;
+		ptr += 8;
+	}
+
+	while (ptr < end) {
+		h1 ^= (*ptr) * p1;
+		h1 = rotl64(h1, 11) * p2;
+		h2 ^= (*ptr++) * p3;
+		h2 = rotl64(h2, 13) * p1;
+	}
+
+	h1 = fmix64(h1);
+	h2 = fmix64(h2 ^ h1);
+	h1 += h2;
+
+	memcpy(&out[0], &h1, 8);
+	memcpy(&out[8], &h2, 8);
+}
+
+/*
+ * The index, in memory:
+ */
+
+static uint32_t hash_slot(struct rdpack_store *s, const uint8_t *hash)
+{
+	uint64_t key;
+	memcpy(&key, hash, 8);
+	return key & (s->tabsz - 1);
+}
+
+static int lookup(struct rdpack_store *s, const uint8_t *hash)
+{
+	uint32_t i;
+
+	if (!s->tabsz)
+		return -1;
+
+	for (i = hash_slot(s, hash); s->table[i]; i = (i + 1) & (s->tabsz - 1))
+		if (!memcmp(s->entries[s->table[i] - 1].hash, hash, 16))
+			return s->table[i] - 1;
+
+	return -1;
+}
+
+static void table_add(struct rdpack_store *s, uint32_t n)
+{
+	uint32_t i = hash_slot(s, s->entries[n].hash);
+
+	while (s->table[i])
+		i = (i + 1) & (s->tabsz - 1);
+
+	s->table[i] = n + 1;
+}
+
+static int insert(struct rdpack_store *s, const struct entry *e)
+{
+	unsigned int i;
+
+	if (s->nentries == s->maxentries) {
+		s->maxentries = max(2 * s->maxentries, 1024);
+		s->entries = realloc(s->entries, s->maxentries * sizeof(s->entries[0]));
+	}
+
+	s->entries[s->nentries] = *e;
+
+	/* keep the table at most half full: */
+	if ((2 * (s->nentries + 1)) > s->tabsz) {
+		s->tabsz = max(2 * s->tabsz, 4096);
+		free(s->table);
+		s->table = calloc(s->tabsz, sizeof(s->table[0]));
+		for (i = 0; i < s->nentries; i++)
+			table_add(s, i);
+	}
+
+	table_add(s, s->nentries);
+
+	return s->nentries++;
+}
+
+/* read the entries added to the index since it was last read, by us or
+ * anyone else:
+ */
+static int refresh(struct rdpack_store *s)
+{
+	struct entry *entries;
+	struct stat st;
+	unsigned int i, n;
+
+	if (fstat(s->index_fd, &st))
+		return -1;
+
+	/* ignore a partly written entry at the end: */
+	n = (st.st_size - s->index_end) / sizeof(struct entry);
+	if ((st.st_size <= s->index_end) || !n)
+		return 0;
+
+	entries = malloc(n * sizeof(*entries));
+	if (pread_all(s->index_fd, entries, n * sizeof(*entries), s->index_end)) {
+		free(entries);
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		int idx = lookup(s, entries[i].hash);
+		if (idx < 0)
+			insert(s, &entries[i]);
+		else if (s->entries[idx].offset == PENDING)
+			s->entries[idx] = entries[i];
+	}
+
+	s->index_end += n * sizeof(*entries);
+	free(entries);
+
+	return 0;
+}
+
+/* append the pending chunks which are still not in the store: */
+static int flush(struct rdpack_store *s, uint64_t *stored)
+{
+	struct buf idx = {0};
+	uint64_t end, out = 0;
+	unsigned int i;
+	int ret = -1;
+
+	if (!s->npendings)
+		return 0;
+
+	flock(s->lock_fd, LOCK_EX);
+
+	if (refresh(s))
+		goto out;
+
+	end = lseek(s->chunks_fd, 0, SEEK_END);
+
+	for (i = 0; i < s->npendings; i++) {
+		struct entry *e = &s->entries[s->pendings[i].entry];
+
+		/* someone else got there first: */
+		if (e->offset != PENDING)
+			continue;
+
+		memmove(s->pending.data + out, s->pending.data + s->pendings[i].pos,
+				s->pendings[i].len);
+		e->offset = end + out;
+		out += s->pendings[i].len;
+		buf_put(&idx, e, sizeof(*e));
+	}
+
+	/* chunks first, so the index never points at missing data: */
+	if (write_all(s->chunks_fd, s->pending.data, out))
+		goto out;
+	if (idx.len && (pwrite(s->index_fd, idx.data, idx.len, s->index_end) != idx.len))
+		goto out;
+
+	s->index_end += idx.len;
+	*stored += out;
+	ret = 0;
+
+out:
+	flock(s->lock_fd, LOCK_UN);
+
+	/* the lost chunks are still in the in-memory index, so nothing more
+	 * can be packed safely:
+	 */
+	if (ret)
+		s->broken = 1;
+
+	s->pending.len = 0;
+	s->npendings = 0;
+	free(idx.data);
+
+	return ret;
+}
+
+/*
+ * Store:
+ */
+
+static int open_file(struct rdpack_store *s, const char *name, int create)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", s->dir, name);
+	return open(path, (create ? O_CREAT : 0) | O_RDWR, 0644);
+}
+
+static int check_header(int fd)
+{
+	uint32_t hdr[2] = { RDPACK_MAGIC, RDPACK_VERSION };
+	uint32_t buf[2];
+	struct stat st;
+
+	if (fstat(fd, &st))
+		return -1;
+
+	/* new file: */
+	if (!st.st_size)
+		return (pwrite(fd, hdr, sizeof(hdr), 0) == sizeof(hdr)) ? 0 : -1;
+
+	if (pread_all(fd, buf, sizeof(buf), 0) || memcmp(buf, hdr, sizeof(hdr)))
+		return -1;
+
+	return 0;
+}
+
+struct rdpack_store * rdpack_open(const char *dir, int create)
+{
+	struct rdpack_store *s = calloc(1, sizeof(*s));
+	int ret;
+
+	gear_init();
+
+	if (create)
+		mkdir(dir, 0755);
+
+	s->dir = strdup(dir);
+	s->chunks_fd = open_file(s, "chunks", create);
+	s->index_fd = open_file(s, "index", create);
+	s->lock_fd = open_file(s, "lock", create);
+	s->index_end = 8;
+
+	if ((s->chunks_fd < 0) || (s->index_fd < 0) || (s->lock_fd < 0)) {
+		fprintf(stderr, "could not open store: %s\n", dir);
+		rdpack_close(s);
+		return NULL;
+	}
+
+	flock(s->lock_fd, LOCK_EX);
+	ret = check_header(s->chunks_fd) || check_header(s->index_fd);
+	flock(s->lock_fd, LOCK_UN);
+
+	if (ret || refresh(s)) {
+		fprintf(stderr, "bad store: %s\n", dir);
+		rdpack_close(s);
+		return NULL;
+	}
+
+	return s;
+}
+
+void rdpack_close(struct rdpack_store *s)
+{
+	if (s->chunks_fd >= 0)
+		close(s->chunks_fd);
+	if (s->index_fd >= 0)
+		close(s->index_fd);
+	if (s->lock_fd >= 0)
+		close(s->lock_fd);
+	free(s->dir);
+	free(s->entries);
+	free(s->table);
+	free(s->pending.data);
+	free(s->pendings);
+	free(s->rec.data);
+	free(s->chunk.data);
+	free(s);
+}
+
+/*
+ * Packing:
+ */
+
+static void add_chunk(struct rdpack_store *s, const uint8_t *data,
+		uint32_t len, const uint8_t *hash, struct rdpack_stats *stats)
+{
+	struct entry e;
+	uint32_t *hdr;
+	size_t pos;
+	int compsz;
+
+	stats->chunks++;
+	stats->chunked += len;
+
+	if (lookup(s, hash) >= 0)
+		return;
+
+	pos = s->pending.len;
+	buf_grow(&s->pending, 32 + RDZ_BOUND(len));
+
+	compsz = rdz_compress(data, len, s->pending.data + pos + 32, RDZ_BOUND(len));
+	if ((compsz < 0) || (compsz >= len)) {
+		memcpy(s->pending.data + pos + 32, data, len);
+		compsz = len;
+	}
+
+	hdr = (uint32_t *)(s->pending.data + pos);
+	hdr[0] = RDPACK_CHUNK_MAGIC;
+	hdr[1] = len;
+	hdr[2] = compsz;
+	hdr[3] = 0;
+	memcpy(&hdr[4], hash, 16);
+
+	s->pending.len = pos + 32 + compsz;
+	buf_pad(&s->pending);
+
+	memcpy(e.hash, hash, 16);
+	e.offset = PENDING;
+	e.rawsz = len;
+	e.compsz = compsz;
+
+	if (s->npendings == s->maxpendings) {
+		s->maxpendings = max(2 * s->maxpendings, 1024);
+		s->pendings = realloc(s->pendings, s->maxpendings * sizeof(s->pendings[0]));
+	}
+	s->pendings[s->npendings].entry = insert(s, &e);
+	s->pendings[s->npendings].pos = pos;
+	s->pendings[s->npendings].len = s->pending.len - pos;
+	s->npendings++;
+
+	stats->new_chunks++;
+}
+
+static int chunked(uint32_t type)
+{
+	switch (type) {
+	case RD_BUFFER_CONTENTS:
+	case RD_BUFFER_PARTIAL:
+	case RD_PROGRAM:
+	case RD_VERT_SHADER:
+	case RD_FRAG_SHADER:
+	case RD_CMDSTREAM:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static int add_section(struct rdpack_store *s, struct buf *recipe,
+		uint32_t tag, const struct rd_section *sect,
+		struct rdpack_stats *stats)
+{
+	const uint8_t *data = sect->data;
+	uint32_t off = 0, nchunks = 0;
+	size_t pos;
+
+	buf_put_u32(recipe, tag);
+	buf_put_u32(recipe, sect->type);
+	buf_put_u32(recipe, sect->size);
+
+	pos = recipe->len;
+	buf_put_u32(recipe, 0);
+
+	if (!chunked(sect->type) || (sect->size < RDPACK_MIN_CHUNK)) {
+		buf_put(recipe, data, sect->size);
+		buf_pad(recipe);
+		return 0;
+	}
+
+	while (off < sect->size) {
+		uint32_t len = next_chunk(data + off, sect->size - off);
+		uint8_t hash[16];
+
+		hash128(data + off, len, hash);
+		buf_put(recipe, hash, 16);
+		add_chunk(s, data + off, len, hash, stats);
+
+		off += len;
+		nchunks++;
+
+		if ((s->pending.len >= FLUSH_SIZE) && flush(s, &stats->stored))
+			return -1;
+	}
+
+	memcpy(recipe->data + pos, &nchunks, 4);
+
+	return 0;
+}
+
+/* anything that is not a section is copied as is, from a second reader
+ * since librd doesn't give access to it:
+ */
+static int add_raw(struct rdz_file **raw, const char *path, struct buf *recipe,
+		uint64_t off, uint64_t len)
+{
+	if (!*raw) {
+		int fd = open(path, O_RDONLY);
+		*raw = (fd >= 0) ? rdz_open(fd) : NULL;
+		if (!*raw)
+			return -1;
+	}
+
+	if (rdz_seek(*raw, off))
+		return -1;
+
+	while (len) {
+		uint32_t n = min(len, RDZ_BLOCK_SIZE);
+
+		buf_put_u32(recipe, RDPACK_RAW);
+		buf_put_u32(recipe, n);
+		if (rdz_read(*raw, buf_grow(recipe, n), n) != n)
+			return -1;
+		buf_pad(recipe);
+
+		len -= n;
+	}
+
+	return 0;
+}
+
+static void recipe_path(struct rdpack_store *s, const char *name,
+		char *path, int sz)
+{
+	snprintf(path, sz, "%s/%s.rdr", s->dir, name);
+}
+
+int rdpack_add(struct rdpack_store *s, const char *path, const char *name,
+		int replace, struct rdpack_stats *stats)
+{
+	struct rdz_file *raw = NULL;
+	struct buf recipe = {0};
+	struct rd_reader *r;
+	struct rd_section sect;
+	char tmp[PATH_MAX], dst[PATH_MAX];
+	uint64_t prev = 0, rawsz;
+	int fd, ret = -1;
+
+	memset(stats, 0, sizeof(*stats));
+
+	if (s->broken)
+		return -1;
+
+	recipe_path(s, name, dst, sizeof(dst));
+	if (!replace && !access(dst, F_OK)) {
+		fprintf(stderr, "already in store: %s\n", name);
+		return -1;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "could not open: %s\n", path);
+		return -1;
+	}
+
+	r = rd_reader_open(fd);
+	if (!r) {
+		fprintf(stderr, "could not open: %s\n", path);
+		return -1;
+	}
+
+	rawsz = rd_reader_size(r);
+	buf_put_u32(&recipe, RDPACK_RECIPE_MAGIC);
+	buf_put_u32(&recipe, RDPACK_VERSION);
+	buf_put(&recipe, &rawsz, 8);
+
+	while (rd_reader_next(r, &sect)) {
+		uint64_t payload = rd_reader_tell(r) - sect.size;
+		uint32_t tag;
+
+		/* librd only skips sync markers, unless it had to resync: */
+		if ((payload - prev) == 16) {
+			tag = RDPACK_SECTION;
+		} else if ((payload - prev) == 8) {
+			tag = RDPACK_SECTION_NOSYNC;
+		} else {
+			if (add_raw(&raw, path, &recipe, prev, payload - prev))
+				goto out;
+			tag = RDPACK_PAYLOAD;
+		}
+
+		if (add_section(s, &recipe, tag, &sect, stats))
+			goto out;
+
+		prev = rd_reader_tell(r);
+	}
+
+	if ((prev < rawsz) && add_raw(&raw, path, &recipe, prev, rawsz - prev))
+		goto out;
+
+	if (flush(s, &stats->stored))
+		goto out;
+
+	/* the recipe goes in last, so it never refers to missing chunks: */
+	snprintf(tmp, sizeof(tmp), "%s/.%s.%d", s->dir, name, getpid());
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if ((fd < 0) || write_all(fd, recipe.data, recipe.len)) {
+		fprintf(stderr, "could not write: %s\n", tmp);
+		if (fd >= 0)
+			close(fd);
+		unlink(tmp);
+		goto out;
+	}
+	close(fd);
+
+	/* link() rather than rename() fails if another writer added the
+	 * same name in the meantime, rather than silently replacing it:
+	 */
+	if (replace ? rename(tmp, dst) : link(tmp, dst)) {
+		if (errno == EEXIST)
+			fprintf(stderr, "already in store: %s\n", name);
+		unlink(tmp);
+		goto out;
+	}
+	if (!replace)
+		unlink(tmp);
+
+	stats->rawsz = rawsz;
+	stats->stored += recipe.len;
+	ret = 0;
+
+out:
+	if (ret)
+		fprintf(stderr, "could not pack: %s\n", path);
+	if (raw)
+		rdz_close(raw);
+	rd_reader_close(r);
+	free(recipe.data);
+	return ret;
+}
+
+/*
+ * Unpacking:
+ */
+
+static const void * read_chunk(struct rdpack_store *s, const uint8_t *hash,
+		uint32_t *len)
+{
+	const struct entry *e;
+	const uint32_t *hdr;
+	const void *data;
+	uint8_t check[16];
+	int idx = lookup(s, hash);
+
+	/* maybe added since the store was opened: */
+	if ((idx < 0) && !refresh(s))
+		idx = lookup(s, hash);
+	if ((idx < 0) || (s->entries[idx].offset == PENDING)) {
+		fprintf(stderr, "missing chunk\n");
+		return NULL;
+	}
+
+	e = &s->entries[idx];
+
+	s->rec.len = 0;
+	buf_grow(&s->rec, 32 + e->compsz);
+	if (pread_all(s->chunks_fd, s->rec.data, 32 + e->compsz, e->offset))
+		return NULL;
+
+	hdr = (const uint32_t *)s->rec.data;
+	if ((hdr[0] != RDPACK_CHUNK_MAGIC) || (hdr[1] != e->rawsz) ||
+			(hdr[2] != e->compsz) || memcmp(&hdr[4], hash, 16)) {
+		fprintf(stderr, "corrupt chunk at %"PRIu64"\n", e->offset);
+		return NULL;
+	}
+
+	data = &hdr[8];
+	if (e->compsz != e->rawsz) {
+		s->chunk.len = 0;
+		buf_grow(&s->chunk, e->rawsz);
+		if (rdz_decompress(data, e->compsz, s->chunk.data, e->rawsz) != e->rawsz)
+			data = NULL;
+		else
+			data = s->chunk.data;
+	}
+
+	if (data)
+		hash128(data, e->rawsz, check);
+	if (!data || memcmp(check, hash, 16)) {
+		fprintf(stderr, "corrupt chunk at %"PRIu64"\n", e->offset);
+		return NULL;
+	}
+
+	*len = e->rawsz;
+	return data;
+}
+
+static int read_recipe(struct rdpack_store *s, const char *name, struct buf *b)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	int fd, ret;
+
+	recipe_path(s, name, path, sizeof(path));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	ret = fstat(fd, &st);
+	if (!ret) {
+		b->len = 0;
+		buf_grow(b, st.st_size);
+		ret = pread_all(fd, b->data, st.st_size, 0);
+	}
+	close(fd);
+
+	if (ret || (b->len < 16) || (((uint32_t *)b->data)[0] != RDPACK_RECIPE_MAGIC) ||
+			(((uint32_t *)b->data)[1] != RDPACK_VERSION))
+		return -1;
+
+	return 0;
+}
+
+int rdpack_stream(struct rdpack_store *s, const char *name,
+		rdpack_write fxn, void *arg)
+{
+	struct buf recipe = {0};
+	const uint8_t *p, *end;
+	int ret = -1;
+
+	if (read_recipe(s, name, &recipe)) {
+		fprintf(stderr, "no such capture: %s\n", name);
+		goto out;
+	}
+
+	p = recipe.data + 16;
+	end = recipe.data + recipe.len;
+
+	while (p < end) {
+		const uint32_t *rec = (const uint32_t *)p;
+		uint32_t i, len;
+
+		if ((end - p) < 8)
+			goto corrupt;
+
+		if (rec[0] == RDPACK_RAW) {
+			len = rec[1];
+			if ((end - p - 8) < ALIGN(len, 4))
+				goto corrupt;
+			if (fxn(&rec[2], len, arg))
+				goto out;
+			p += 8 + ALIGN(len, 4);
+			continue;
+		}
+
+		if ((end - p) < 16)
+			goto corrupt;
+
+		switch (rec[0]) {
+		case RDPACK_SECTION: {
+			uint32_t hdr[4] = { ~0, ~0, rec[1], rec[2] };
+			if (fxn(hdr, 16, arg))
+				goto out;
+			break;
+		}
+		case RDPACK_SECTION_NOSYNC:
+			if (fxn(&rec[1], 8, arg))
+				goto out;
+			break;
+		case RDPACK_PAYLOAD:
+			break;
+		default:
+			goto corrupt;
+		}
+
+		p += 16;
+
+		/* inline payload: */
+		if (!rec[3]) {
+			len = rec[2];
+			if ((end - p) < ALIGN(len, 4))
+				goto corrupt;
+			if (fxn(p, len, arg))
+				goto out;
+			p += ALIGN(len, 4);
+			continue;
+		}
+
+		if ((end - p) < (16 * (uint64_t)rec[3]))
+			goto corrupt;
+
+		for (i = 0, len = 0; i < rec[3]; i++, p += 16) {
+			uint32_t sz;
+			const void *data = read_chunk(s, p, &sz);
+			if (!data || fxn(data, sz, arg))
+				goto out;
+			len += sz;
+		}
+
+		if (len != rec[2])
+			goto corrupt;
+	}
+
+	ret = 0;
+	goto out;
+
+corrupt:
+	fprintf(stderr, "corrupt recipe: %s\n", name);
+out:
+	free(recipe.data);
+	return ret;
+}
+
+int64_t rdpack_size(struct rdpack_store *s, const char *name)
+{
+	char path[PATH_MAX];
+	uint32_t hdr[4];
+	int fd, ret;
+
+	recipe_path(s, name, path, sizeof(path));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	ret = pread_all(fd, hdr, sizeof(hdr), 0);
+	close(fd);
+
+	if (ret || (hdr[0] != RDPACK_RECIPE_MAGIC))
+		return -1;
+
+	return hdr[2] | ((uint64_t)hdr[3] << 32);
+}
+
+static int cmp_names(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+int rdpack_names(struct rdpack_store *s, char ***names)
+{
+	struct dirent *de;
+	DIR *d = opendir(s->dir);
+	int n = 0, max = 0;
+
+	*names = NULL;
+	if (!d)
+		return 0;
+
+	while ((de = readdir(d))) {
+		int len = strlen(de->d_name);
+
+		/* skipping recipes still being written: */
+		if ((de->d_name[0] == '.') || (len <= 4) ||
+				strcmp(de->d_name + len - 4, ".rdr"))
+			continue;
+
+		if (n == max) {
+			max = max(2 * max, 64);
+			*names = realloc(*names, max * sizeof(char *));
+		}
+		(*names)[n++] = strndup(de->d_name, len - 4);
+	}
+	closedir(d);
+
+	qsort(*names, n, sizeof(char *), cmp_names);
+
+	return n;
+}
+
+uint64_t rdpack_stored(struct rdpack_store *s)
+{
+	struct dirent *de;
+	uint64_t total = 0;
+	DIR *d = opendir(s->dir);
+
+	if (!d)
+		return 0;
+
+	while ((de = readdir(d))) {
+		char path[PATH_MAX];
+		struct stat st;
+
+		snprintf(path, sizeof(path), "%s/%s", s->dir, de->d_name);
+		if (!stat(path, &st) && S_ISREG(st.st_mode))
+			total += st.st_size;
+	}
+	closedir(d);
+
+	return total;
+}
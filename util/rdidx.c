@@ -0,0 +1,137 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rdidx.h"
+
+static int is_cmds(uint32_t type)
+{
+	return (type == RD_CMDSTREAM_ADDR) || (type == RD_CONTEXT) ||
+			(type == RD_CMDSTREAM);
+}
+
+/* add the next section, which starts at offset in the rd stream: */
+void rd_index_add(struct rd_index *idx, uint64_t offset, uint32_t type,
+		uint32_t size)
+{
+	if (idx->nsections == idx->maxsections) {
+		idx->maxsections = max(2 * idx->maxsections, 1024);
+		idx->sections = realloc(idx->sections,
+				idx->maxsections * sizeof(idx->sections[0]));
+	}
+
+	if (!idx->nsections || (idx->after_cmds && !is_cmds(type) &&
+			(type != RD_IOCTL))) {
+		if (idx->nsubmits == idx->maxsubmits) {
+			idx->maxsubmits = max(2 * idx->maxsubmits, 256);
+			idx->submits = realloc(idx->submits,
+					idx->maxsubmits * sizeof(idx->submits[0]));
+		}
+		idx->submits[idx->nsubmits++] = idx->nsections;
+		idx->after_cmds = 0;
+	}
+
+	if (is_cmds(type))
+		idx->after_cmds = 1;
+
+	idx->sections[idx->nsections++] = (struct rd_index_entry){
+		.offset = offset,
+		.type   = type,
+		.size   = size,
+	};
+}
+
+/* build the payload of the RD_INDEX section, to be written at offset: */
+void * rd_index_section(struct rd_index *idx, uint64_t offset, uint32_t *sz)
+{
+	struct rd_index_footer footer = {
+			.offset    = offset,
+			.nsections = idx->nsections,
+			.nsubmits  = idx->nsubmits,
+			.version   = RD_INDEX_VERSION,
+			.magic     = RD_INDEX_MAGIC,
+	};
+	unsigned int ssz = idx->nsections * sizeof(idx->sections[0]);
+	unsigned int bsz = idx->nsubmits * sizeof(idx->submits[0]);
+	uint8_t *buf;
+
+	*sz = ssz + bsz + sizeof(footer);
+	buf = malloc(*sz);
+	memcpy(buf, idx->sections, ssz);
+	memcpy(buf + ssz, idx->submits, bsz);
+	memcpy(buf + ssz + bsz, &footer, sizeof(footer));
+
+	return buf;
+}
+
+/* find the part of the rd stream covering submits first thru last: */
+int rd_index_range(struct rd_index *idx, unsigned int first,
+		unsigned int last, uint64_t *start, uint64_t *end)
+{
+	if (first >= idx->nsubmits)
+		return -1;
+
+	*start = idx->sections[idx->submits[first]].offset;
+
+	if (last < (idx->nsubmits - 1))
+		*end = idx->sections[idx->submits[last + 1]].offset;
+	else
+		*end = idx->end;
+
+	return 0;
+}
+
+/* parse a submit range, "n" or "first-last" or "first-": */
+int rd_index_parse_range(const char *str, unsigned int *first,
+		unsigned int *last)
+{
+	char *end;
+
+	*first = strtoul(str, &end, 0);
+	if (end == str)
+		return -1;
+
+	if (*end == '\0') {
+		*last = *first;
+	} else if (*end == '-') {
+		str = end + 1;
+		if (*str == '\0')
+			*last = ~0;
+		else if (((*last = strtoul(str, &end, 0)) < *first) || *end)
+			return -1;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+void rd_index_fini(struct rd_index *idx)
+{
+	free(idx->sections);
+	free(idx->submits);
+	memset(idx, 0, sizeof(*idx));
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef RDIDX_H_
+#define RDIDX_H_
+
+#include "redump.h"
+
+/*
+ * Building the optional RD_INDEX section, see librd.h for reading it.
+ * Submit boundaries are found from the section types alone, so an index
+ * built by libwrap while capturing matches one built later by rdindex: a
+ * submit ends with its cmdstream sections (RD_CMDSTREAM_ADDR, or
+ * RD_CONTEXT/RD_CMDSTREAM for 2d) plus any ioctls logged after them, and
+ * the next section of any other type starts the next submit.  Everything before the first submit
+ * (RD_TEST, RD_GPU_ID, etc) is part of submit 0.
+ */
+
+struct rd_index {
+	struct rd_index_entry *sections;
+	uint32_t *submits;
+	unsigned int nsections, nsubmits;
+	uint64_t end;      /* where the last indexed section ends */
+
+	/* builder state: */
+	unsigned int maxsections, maxsubmits;
+	int after_cmds;
+};
+
+void rd_index_add(struct rd_index *idx, uint64_t offset, uint32_t type,
+		uint32_t size);
+void * rd_index_section(struct rd_index *idx, uint64_t offset, uint32_t *sz);
+int rd_index_range(struct rd_index *idx, unsigned int first,
+		unsigned int last, uint64_t *start, uint64_t *end);
+void rd_index_fini(struct rd_index *idx);
+
+int rd_index_parse_range(const char *str, unsigned int *first,
+		unsigned int *last);
+
+#endif /* RDIDX_H_ */
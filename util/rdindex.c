@@ -0,0 +1,190 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Adds an RD_INDEX section to rd files which don't have one, ie. captured
+ * without WRAP_INDEX, or where the app crashed before it was written:
+ *
+ *   rdindex [-l] trace.rd...
+ *
+ * With -l, the file is not modified, just the submits it contains listed.
+ * The index lets zdump/redump -s seek straight to the submits of interest.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "librd.h"
+
+static int list;
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-l] trace.rd...\n", name);
+	exit(2);
+}
+
+static int write_full(int fd, const void *buf, int sz)
+{
+	const uint8_t *p = buf;
+	while (sz > 0) {
+		int ret = write(fd, p, sz);
+		if (ret <= 0)
+			return -1;
+		p += ret;
+		sz -= ret;
+	}
+	return 0;
+}
+
+/* append the section to a compressed file, as new blocks: */
+static int append_rdz(int fd, const uint8_t *data, unsigned int len)
+{
+	uint8_t *comp = malloc(RDZ_BOUND(RDZ_BLOCK_SIZE));
+	int ret = 0;
+
+	while (len && !ret) {
+		unsigned int n = min(len, RDZ_BLOCK_SIZE);
+		uint32_t hdr[3] = { RDZ_BLOCK_MAGIC, n, n };
+		const void *p = data;
+		int compsz = rdz_compress(data, n, comp, RDZ_BOUND(n));
+
+		if ((compsz > 0) && (compsz < n)) {
+			hdr[2] = compsz;
+			p = comp;
+		}
+
+		ret = write_full(fd, hdr, sizeof(hdr)) ||
+				write_full(fd, p, hdr[2]);
+
+		data += n;
+		len -= n;
+	}
+
+	free(comp);
+
+	return ret;
+}
+
+static int append_index(int fd, struct rd_reader *r, struct rd_index *idx)
+{
+	uint32_t hdr[4] = { ~0, ~0, RD_INDEX, 0 };
+	uint8_t *buf, *payload;
+	int ret;
+
+	payload = rd_index_section(idx, idx->end, &hdr[3]);
+	buf = malloc(sizeof(hdr) + hdr[3]);
+	memcpy(buf, hdr, sizeof(hdr));
+	memcpy(buf + sizeof(hdr), payload, hdr[3]);
+	free(payload);
+
+	if (lseek(fd, 0, SEEK_END) == (off_t)-1) {
+		ret = -1;
+	} else if (rd_reader_compressed(r)) {
+		ret = append_rdz(fd, buf, sizeof(hdr) + hdr[3]);
+	} else {
+		ret = write_full(fd, buf, sizeof(hdr) + hdr[3]);
+	}
+
+	free(buf);
+
+	return ret;
+}
+
+static int index_file(const char *name)
+{
+	struct rd_index idx;
+	struct rd_reader *r;
+	int fd, ret = 0;
+	unsigned int i;
+
+	fd = open(name, list ? O_RDONLY : O_RDWR);
+	if (fd < 0) {
+		fprintf(stderr, "could not open: %s\n", name);
+		return -1;
+	}
+
+	r = rd_reader_open(fd);
+	if (!r)
+		return -1;
+
+	if (!rd_reader_load_index(r, &idx)) {
+		if (!list)
+			printf("%s: already indexed\n", name);
+	} else if (rd_reader_scan_index(r, &idx)) {
+		fprintf(stderr, "%s: could not read\n", name);
+		ret = -1;
+	} else if (!list) {
+		if (idx.end != rd_reader_size(r)) {
+			fprintf(stderr, "%s: truncated or corrupt at offset %"PRIu64
+					", not indexing\n", name, idx.end);
+			ret = -1;
+		} else if (append_index(fd, r, &idx)) {
+			fprintf(stderr, "%s: write failed\n", name);
+			ret = -1;
+		}
+	}
+
+	if (!ret)
+		printf("%s: %u sections, %u submits\n", name,
+				idx.nsections, idx.nsubmits);
+
+	for (i = 0; list && (i < idx.nsubmits); i++) {
+		uint64_t start, end;
+		unsigned int n = ((i + 1) < idx.nsubmits) ?
+				idx.submits[i + 1] : idx.nsections;
+		rd_index_range(&idx, i, i, &start, &end);
+		printf("  submit %u: offset %"PRIu64", %u sections, %"PRIu64" bytes\n",
+				i, start, n - idx.submits[i], end - start);
+	}
+
+	rd_index_fini(&idx);
+	rd_reader_close(r);
+
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int i, ret = 0;
+
+	for (i = 1; (i < argc) && (argv[i][0] == '-'); i++) {
+		if (!strcmp(argv[i], "-l"))
+			list = 1;
+		else
+			usage(argv[0]);
+	}
+
+	if (i == argc)
+		usage(argv[0]);
+
+	for (; i < argc; i++)
+		if (index_file(argv[i]))
+			ret = 1;
+
+	return ret;
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Add captures to a content addressed store (see rdpack.h), in parallel:
+ *
+ *   rdpack [-j workers] [-p prefix] [-f] store file.rd|dir|glob...
+ *
+ * Each capture is stored under its file name without the .rd, after the
+ * prefix if given.  Captures from different run-tests.sh sweeps have the
+ * same file names, so use a prefix per sweep, ie. '-p sweep1-'.  A name
+ * that is already in the store is an error, unless -f is given to
+ * replace it.  Use rdunpack to get them back.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "rdpack.h"
+#include "batch.h"
+
+static const char *store, *prefix = "";
+static int replace;
+
+static char * capture_name(const char *path)
+{
+	const char *base = strrchr(path, '/');
+	char *name;
+	int len;
+
+	base = base ? base + 1 : path;
+	len = strlen(base);
+
+	if ((len > 4) && !strcmp(base + len - 4, ".rdz"))
+		len -= 4;
+	else if ((len > 3) && !strcmp(base + len - 3, ".rd"))
+		len -= 3;
+
+	name = malloc(strlen(prefix) + len + 1);
+	sprintf(name, "%s%.*s", prefix, len, base);
+
+	return name;
+}
+
+static double ratio(uint64_t raw, uint64_t stored)
+{
+	return stored ? ((double)raw / stored) : 0.0;
+}
+
+static int pack_job(int job, void *arg)
+{
+	const char *path = ((char **)arg)[job];
+	struct rdpack_store *s = rdpack_open(store, 0);
+	struct rdpack_stats stats;
+	char *name = capture_name(path);
+	int ret = -1;
+
+	if (s && !rdpack_add(s, path, name, replace, &stats)) {
+		printf("%s: %"PRIu64" KB, %"PRIu64" chunks (%"PRIu64" new), "
+				"%"PRIu64" KB stored, %.1fx\n", name,
+				stats.rawsz >> 10, stats.chunks, stats.new_chunks,
+				stats.stored >> 10, ratio(stats.rawsz, stats.stored));
+		fflush(stdout);
+		ret = 0;
+	}
+
+	if (s)
+		rdpack_close(s);
+	free(name);
+
+	return ret;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-j workers] [-p prefix] [-f] store file.rd|dir|glob...\n", name);
+	exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+	struct rdpack_store *s;
+	int i, n, ret, nworkers = batch_workers();
+	char **files, **names;
+	uint64_t raw = 0;
+
+	for (i = 1; (i < argc) && (argv[i][0] == '-'); i++) {
+		if (!strcmp(argv[i], "-j") && (i + 1 < argc) &&
+				(atoi(argv[i + 1]) > 0)) {
+			nworkers = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-p") && (i + 1 < argc) &&
+				!strchr(argv[i + 1], '/')) {
+			prefix = argv[++i];
+		} else if (!strcmp(argv[i], "-f")) {
+			replace = 1;
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	if ((argc - i) < 2)
+		usage(argv[0]);
+
+	store = argv[i++];
+
+	/* create the store up front, rather than racing to in the workers: */
+	s = rdpack_open(store, 1);
+	if (!s)
+		return -1;
+	rdpack_close(s);
+
+	n = batch_files(argc - i, &argv[i], &files);
+	if (n < 0)
+		return -1;
+
+	ret = batch_run((const char **)files, n, nworkers, pack_job, files);
+
+	s = rdpack_open(store, 0);
+	if (!s)
+		return -1;
+
+	n = rdpack_names(s, &names);
+	for (i = 0; i < n; i++) {
+		raw += rdpack_size(s, names[i]);
+		free(names[i]);
+	}
+	free(names);
+
+	printf("store: %d captures, %"PRIu64" MB in %"PRIu64" MB, %.1fx\n",
+			n, raw >> 20, rdpack_stored(s) >> 20,
+			ratio(raw, rdpack_stored(s)));
+
+	rdpack_close(s);
+
+	return ret;
+}
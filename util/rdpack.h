@@ -0,0 +1,114 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef RDPACK_H_
+#define RDPACK_H_
+
+#include <stdint.h>
+
+/*
+ * Content addressed store for lots of captures (see rdpack/rdunpack).  The
+ * big payloads (buffer contents, programs and cmdstreams) are split into
+ * chunks with content defined chunking, so the same data lands in the
+ * same chunks wherever it is in a buffer, and each unique chunk is stored
+ * once, compressed with the rdz codec.  A store is a directory with:
+ *
+ *   chunks:   u32 RDPACK_MAGIC, u32 RDPACK_VERSION, chunk*
+ *     chunk:  u32 RDPACK_CHUNK_MAGIC, u32 rawsz, u32 compsz, u32 pad,
+ *             u8 hash[16], u8 data[ALIGN(compsz, 4)]
+ *   index:    u32 RDPACK_MAGIC, u32 RDPACK_VERSION, entry*
+ *     entry:  u8 hash[16], u64 offset (in chunks), u32 rawsz, u32 compsz
+ *   lock:     flock()'d while appending to chunks/index
+ *   <name>.rdr, a recipe for each capture:
+ *             u32 RDPACK_RECIPE_MAGIC, u32 RDPACK_VERSION, u64 rawsz, rec*
+ *
+ * Recipe records, which rebuild the capture byte for byte:
+ *
+ *   RDPACK_SECTION:  u32 tag, u32 type, u32 size, u32 nchunks, then the
+ *                    payload inline (padded to 4 bytes) if nchunks is
+ *                    zero, otherwise the u8 hash[16] of each chunk
+ *   RDPACK_SECTION_NOSYNC: the same, for old captures without sync markers
+ *   RDPACK_PAYLOAD:  the same, but with the header in the RDPACK_RAW before
+ *   RDPACK_RAW:      u32 tag, u32 len, u8 data[ALIGN(len, 4)], for anything
+ *                    that isn't a section (ie. garbage skipped on resync)
+ *
+ * As with rdz, if compsz == rawsz the chunk is stored uncompressed.  Only
+ * the index and chunks files are shared between writers, and they are
+ * only appended to (chunks first), so readers never need the lock.
+ *
+ * Chunks are identified by a 128b hash of their contents, which is not a
+ * cryptographic hash, so a store should not be fed untrusted captures.
+ */
+
+#define RDPACK_MAGIC         0x4b504452   /* "RDPK" */
+#define RDPACK_VERSION       1
+#define RDPACK_CHUNK_MAGIC   0x43504452   /* "RDPC" */
+#define RDPACK_RECIPE_MAGIC  0x52504452   /* "RDPR" */
+
+enum rdpack_tag {
+	RDPACK_SECTION = 1,
+	RDPACK_SECTION_NOSYNC = 2,
+	RDPACK_PAYLOAD = 3,
+	RDPACK_RAW = 4,
+};
+
+/* content defined chunk sizes, with a boundary on average every
+ * RDPACK_AVG_CHUNK bytes after the minimum:
+ */
+#define RDPACK_MIN_CHUNK     (2 * 1024)
+#define RDPACK_AVG_CHUNK     (8 * 1024)
+#define RDPACK_MAX_CHUNK     (64 * 1024)
+
+struct rdpack_stats {
+	uint64_t rawsz;            /* of the captures */
+	uint64_t chunked;          /* bytes of payload split into chunks */
+	uint64_t chunks, new_chunks;
+	uint64_t stored;           /* bytes appended to chunks and the recipe */
+};
+
+struct rdpack_store;
+
+struct rdpack_store * rdpack_open(const char *dir, int create);
+void rdpack_close(struct rdpack_store *s);
+
+/* add a capture (plain or rdz) to the store as name, which fails if
+ * there already is a capture of that name, unless replace is set:
+ */
+int rdpack_add(struct rdpack_store *s, const char *path, const char *name,
+		int replace, struct rdpack_stats *stats);
+
+/* rebuild a capture, handing it to fxn in order, a piece at a time: */
+typedef int (*rdpack_write)(const void *buf, uint32_t sz, void *arg);
+int rdpack_stream(struct rdpack_store *s, const char *name,
+		rdpack_write fxn, void *arg);
+
+/* raw size of a capture in the store, or -1 if it is not there: */
+int64_t rdpack_size(struct rdpack_store *s, const char *name);
+
+/* names of the captures in the store, sorted, returns the count: */
+int rdpack_names(struct rdpack_store *s, char ***names);
+
+/* size of the store on disk: */
+uint64_t rdpack_stored(struct rdpack_store *s);
+
+#endif /* RDPACK_H_ */
@@ -0,0 +1,660 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Replays the submits in captures, to measure the cpu side cost of
+ * submission without a gpu:
+ *
+ *   rdreplay [-n] [-l loops] [-s first[-last]] [-j workers] file.rd...
+ *
+ * Buffers are rebuilt from RD_GPUADDR/RD_BUFFER_CONTENTS (and patched by
+ * RD_BUFFER_PARTIAL), and the cmdstreams from RD_CMDSTREAM_ADDR are
+ * submitted with IOCTL_KGSL_SUBMIT_COMMANDS.  Without a gpu, run it under
+ * libwrapfake (which makes it a benchmark for libwrap itself), ie:
+ *
+ *   WRAP_GPU_ID=330 WRAP_GMEM_SIZE=0x100000 \
+ *       LD_PRELOAD=`pwd`/libwrapfake.so ./rdreplay capture.rd
+ *
+ * or with -n, to a null sink which just allocates host memory and throws
+ * the submits away.
+ *
+ * The replayed buffers don't get the same gpuaddrs as in the capture, so
+ * the cmdstream is relocated: the same as libwrap's WRAP_REFERENCED scan,
+ * anything in a packet payload that looks like a gpuaddr pointing into a
+ * buffer is treated as one.  The payload is read from the captured
+ * contents (kept by libpm4), so relocating again is harmless, but it is
+ * skipped for cmdstreams already relocated since the last upload.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#define __user
+#include "msm_kgsl.h"
+
+#include "libpm4.h"
+#include "batch.h"
+
+struct bo {
+	uint64_t addr;             /* in the capture */
+	uint32_t len;
+	uint64_t gpuaddr;          /* replayed */
+	uint32_t id, mmapsize;
+	uint32_t *map;
+};
+
+struct sink {
+	const char *name;
+	int (*open)(void);
+	int (*bo_new)(struct bo *bo);
+	void (*bo_del)(struct bo *bo);
+	int (*submit)(struct kgsl_ibdesc *ibs, unsigned int n);
+};
+
+struct stats {
+	uint64_t submits, ibs;
+	uint64_t upload_ns, reloc_ns, submit_ns;
+	uint64_t uploaded, relocs;
+	uint64_t allocs, frees, allocated;
+};
+
+static const struct sink *sink;
+static struct stats stats;
+
+/* replayed buffers, sorted by address in the capture: */
+static struct bo **bos;
+static unsigned int nbos, maxbos, last_hit;
+static uint64_t min_addr = ~(uint64_t)0, max_addr;
+
+static struct kgsl_ibdesc *ibs;
+static unsigned int nibs, maxibs;
+
+/* bumped by anything that could change a relocation, and the cmdstreams
+ * relocated since:
+ */
+static unsigned int gen;
+static struct {
+	uint64_t addr;
+	uint32_t sizedwords;
+} *relocated;
+static unsigned int nrelocated, maxrelocated, relocated_gen;
+
+static int is64b;
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * kgsl, which is emulated when run under libwrapfake:
+ */
+
+static int fd = -1;
+
+static int kgsl_open(void)
+{
+	fd = open("/dev/kgsl-3d0", O_RDWR);
+	if (fd < 0) {
+		fprintf(stderr, "could not open kgsl device\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int kgsl_bo_new(struct bo *bo)
+{
+	struct kgsl_gpumem_alloc_id req = {
+			.size = bo->len,
+	};
+
+	if (ioctl(fd, IOCTL_KGSL_GPUMEM_ALLOC_ID, &req))
+		return -1;
+
+	bo->id = req.id;
+	bo->gpuaddr = req.gpuaddr;
+	bo->mmapsize = req.mmapsize;
+	bo->map = mmap(NULL, req.mmapsize, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, (off_t)req.id << 12);
+	if (bo->map == MAP_FAILED) {
+		struct kgsl_gpumem_free_id free_req = {
+				.id = req.id,
+		};
+		ioctl(fd, IOCTL_KGSL_GPUMEM_FREE_ID, &free_req);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void kgsl_bo_del(struct bo *bo)
+{
+	struct kgsl_gpumem_free_id req = {
+			.id = bo->id,
+	};
+	munmap(bo->map, bo->mmapsize);
+	ioctl(fd, IOCTL_KGSL_GPUMEM_FREE_ID, &req);
+}
+
+static int kgsl_submit(struct kgsl_ibdesc *ibs, unsigned int n)
+{
+	struct kgsl_submit_commands req = {
+			.cmdlist = ibs,
+			.numcmds = n,
+	};
+	return ioctl(fd, IOCTL_KGSL_SUBMIT_COMMANDS, &req);
+}
+
+static const struct sink kgsl_sink = {
+		.name = "kgsl",
+		.open = kgsl_open,
+		.bo_new = kgsl_bo_new,
+		.bo_del = kgsl_bo_del,
+		.submit = kgsl_submit,
+};
+
+/*
+ * null sink, host memory and gpuaddrs that are never reused:
+ */
+
+static uint64_t null_gpuaddr;
+
+static int null_open(void)
+{
+	null_gpuaddr = 0x10000000;
+	return 0;
+}
+
+static int null_bo_new(struct bo *bo)
+{
+	bo->map = malloc(bo->len);
+	if (!bo->map)
+		return -1;
+	bo->gpuaddr = null_gpuaddr;
+	if (is64b)
+		bo->gpuaddr |= (uint64_t)0x1ffff << 32;
+	null_gpuaddr += ALIGN(bo->len, 0x1000);
+	return 0;
+}
+
+static void null_bo_del(struct bo *bo)
+{
+	free(bo->map);
+}
+
+static int null_submit(struct kgsl_ibdesc *ibs, unsigned int n)
+{
+	return 0;
+}
+
+static const struct sink null_sink = {
+		.name = "null",
+		.open = null_open,
+		.bo_new = null_bo_new,
+		.bo_del = null_bo_del,
+		.submit = null_submit,
+};
+
+/*
+ * buffers:
+ */
+
+/* index of the first buffer which ends after addr: */
+static unsigned int bo_search(uint64_t addr)
+{
+	unsigned int lo = 0, hi = nbos;
+
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		if ((bos[mid]->addr + bos[mid]->len) <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static struct bo * bo_lookup(uint64_t addr)
+{
+	struct bo *bo;
+	unsigned int i;
+
+	if ((addr < min_addr) || (addr >= max_addr))
+		return NULL;
+
+	if (last_hit < nbos) {
+		bo = bos[last_hit];
+		if ((addr >= bo->addr) && (addr < (bo->addr + bo->len)))
+			return bo;
+	}
+
+	i = bo_search(addr);
+	if ((i == nbos) || (addr < bos[i]->addr))
+		return NULL;
+
+	last_hit = i;
+	return bos[i];
+}
+
+static void bo_free(unsigned int i)
+{
+	sink->bo_del(bos[i]);
+	free(bos[i]);
+	stats.frees++;
+	gen++;
+	nbos--;
+	memmove(&bos[i], &bos[i + 1], (nbos - i) * sizeof(bos[0]));
+}
+
+static void update_range(void)
+{
+	min_addr = nbos ? bos[0]->addr : ~(uint64_t)0;
+	max_addr = nbos ? (bos[nbos - 1]->addr + bos[nbos - 1]->len) : 0;
+	last_hit = 0;
+}
+
+/* find the buffer at addr, replacing any that overlap it (unless it is the
+ * same size):
+ */
+static struct bo * bo_get(uint64_t addr, uint32_t len)
+{
+	unsigned int i = bo_search(addr);
+	struct bo *bo;
+
+	if ((i < nbos) && (bos[i]->addr == addr) && (bos[i]->len == len))
+		return bos[i];
+
+	while ((i < nbos) && (bos[i]->addr < (addr + len)))
+		bo_free(i);
+
+	bo = calloc(1, sizeof(*bo));
+	bo->addr = addr;
+	bo->len = len;
+	if (sink->bo_new(bo)) {
+		fprintf(stderr, "could not allocate buffer: %016"PRIx64" (len: %x)\n",
+				addr, len);
+		free(bo);
+		update_range();
+		return NULL;
+	}
+	stats.allocs++;
+	stats.allocated += len;
+	gen++;
+
+	if (nbos == maxbos) {
+		maxbos = max(2 * maxbos, 64);
+		bos = realloc(bos, maxbos * sizeof(bos[0]));
+	}
+	memmove(&bos[i + 1], &bos[i], (nbos - i) * sizeof(bos[0]));
+	bos[i] = bo;
+	nbos++;
+	update_range();
+
+	return bo;
+}
+
+static void bo_free_all(void)
+{
+	while (nbos)
+		bo_free(nbos - 1);
+	update_range();
+}
+
+static void upload(struct bo *bo, uint32_t offset, const void *data, uint32_t len)
+{
+	if (!bo || (offset >= bo->len))
+		return;
+	len = min(len, bo->len - offset);
+	memcpy((char *)bo->map + offset, data, len);
+	stats.uploaded += len;
+	gen++;
+}
+
+/*
+ * relocation:
+ */
+
+static int reloc(uint64_t addr, uint32_t *lo, uint32_t *hi)
+{
+	struct bo *bo = bo_lookup(addr);
+	uint64_t gpuaddr;
+
+	if (!bo)
+		return 0;
+
+	gpuaddr = bo->gpuaddr + (addr - bo->addr);
+	if (*lo != (uint32_t)gpuaddr) {
+		*lo = gpuaddr;
+		stats.relocs++;
+	}
+	if (hi && (*hi != (uint32_t)(gpuaddr >> 32))) {
+		*hi = gpuaddr >> 32;
+		stats.relocs++;
+	}
+
+	return 1;
+}
+
+static void reloc_packet(const struct pm4_event *ev, void *arg)
+{
+	struct bo *bo;
+	uint32_t *dst;
+	uint32_t i;
+
+	if (((ev->type != PM4_PKT0) && (ev->type != PM4_PKT3)) || !ev->count)
+		return;
+
+	/* the replayed copy of the payload: */
+	bo = bo_lookup(ev->gpuaddr + 4);
+	if (!bo || ((ev->gpuaddr + 4 + 4 * ev->count) > (bo->addr + bo->len)))
+		return;
+	dst = bo->map + ((ev->gpuaddr + 4 - bo->addr) / 4);
+
+	for (i = 0; i < ev->count; i++) {
+		uint32_t v = ev->dwords[i];
+
+		/* 64b addresses are split into lo/hi dwords: */
+		if (is64b && ((i + 1) < ev->count) &&
+				reloc(v | ((uint64_t)ev->dwords[i + 1] << 32),
+						&dst[i], &dst[i + 1])) {
+			i++;
+			continue;
+		}
+
+		reloc(v, &dst[i], NULL);
+	}
+}
+
+/*
+ * replay:
+ */
+
+static void submit(void)
+{
+	uint64_t start = now();
+
+	if (sink->submit(ibs, nibs))
+		fprintf(stderr, "submit failed\n");
+
+	stats.submit_ns += now() - start;
+	stats.submits++;
+	stats.ibs += nibs;
+	nibs = 0;
+}
+
+static void relocate(struct pm4_decoder *d, uint64_t addr, uint32_t sizedwords)
+{
+	unsigned int i;
+
+	if (relocated_gen != gen) {
+		relocated_gen = gen;
+		nrelocated = 0;
+	}
+
+	for (i = 0; i < nrelocated; i++)
+		if ((relocated[i].addr == addr) &&
+				(relocated[i].sizedwords == sizedwords))
+			return;
+
+	pm4_decode(d, addr, sizedwords, reloc_packet, NULL);
+
+	if (nrelocated == maxrelocated) {
+		maxrelocated = max(2 * maxrelocated, 16);
+		relocated = realloc(relocated, maxrelocated * sizeof(relocated[0]));
+	}
+	relocated[nrelocated].addr = addr;
+	relocated[nrelocated].sizedwords = sizedwords;
+	nrelocated++;
+}
+
+static void add_ib(struct pm4_decoder *d, uint64_t addr, uint32_t sizedwords)
+{
+	struct bo *bo = bo_lookup(addr);
+	uint64_t start = now();
+
+	if (!bo) {
+		fprintf(stderr, "cmdstream not in a buffer: %016"PRIx64"\n", addr);
+		return;
+	}
+
+	relocate(d, addr, sizedwords);
+	stats.reloc_ns += now() - start;
+
+	if (nibs == maxibs) {
+		maxibs = max(2 * maxibs, 16);
+		ibs = realloc(ibs, maxibs * sizeof(ibs[0]));
+	}
+	ibs[nibs++] = (struct kgsl_ibdesc){
+		.gpuaddr = bo->gpuaddr + (addr - bo->addr),
+		.sizedwords = sizedwords,
+	};
+}
+
+static void replay(struct rd_reader *r, uint64_t end)
+{
+	struct pm4_decoder *d = pm4_decoder_new(320);
+	int copy = !rd_reader_mapped(r);
+	struct rd_section s;
+	uint64_t gpuaddr = 0, start;
+	uint32_t len = 0;
+	struct bo *bo;
+
+	/* when replaying a range, the RD_GPU_ID is before it: */
+	if (rd_reader_gpu_id(r)) {
+		pm4_set_gpu_id(d, rd_reader_gpu_id(r));
+		is64b = rd_reader_gpu_id(r) >= 500;
+	}
+
+	while ((rd_reader_tell(r) < end) && rd_reader_next(r, &s)) {
+		const uint32_t *buf = s.data;
+
+		switch (s.type) {
+		case RD_GPU_ID:
+			if (s.size >= 4) {
+				pm4_set_gpu_id(d, buf[0]);
+				is64b = buf[0] >= 500;
+			}
+			break;
+		case RD_GPUADDR:
+			if (s.size < 8)
+				break;
+			gpuaddr = buf[0];
+			if (s.size >= 12)
+				gpuaddr |= (uint64_t)buf[2] << 32;
+			len = buf[1];
+			break;
+		case RD_BUFFER_CONTENTS:
+			start = now();
+			pm4_map(d, gpuaddr, min(len, s.size), s.data, copy);
+			bo = bo_get(gpuaddr, len);
+			upload(bo, 0, s.data, s.size);
+			stats.upload_ns += now() - start;
+			break;
+		case RD_BUFFER_UNCHANGED:
+			/* already uploaded, unless it was before the first
+			 * replayed submit, in which case the contents are lost:
+			 */
+			if (s.size >= 12)
+				bo_get(buf[0] | ((uint64_t)buf[2] << 32), buf[1]);
+			break;
+		case RD_BUFFER_PARTIAL:
+			if (s.size < 20)
+				break;
+			start = now();
+			gpuaddr = buf[0] | ((uint64_t)buf[2] << 32);
+			pm4_patch(d, gpuaddr, buf[3], min(buf[4], s.size - 20), &buf[5]);
+			bo = bo_get(gpuaddr, buf[1]);
+			upload(bo, buf[3], &buf[5], min(buf[4], s.size - 20));
+			stats.upload_ns += now() - start;
+			break;
+		case RD_CMDSTREAM_ADDR:
+			if (s.size >= 8)
+				add_ib(d, buf[0] | ((s.size >= 12) ?
+						((uint64_t)buf[2] << 32) : 0), buf[1]);
+			continue;
+		case RD_CONTEXT:
+		case RD_CMDSTREAM:
+		case RD_IOCTL:
+			/* still part of the same submit */
+			continue;
+		default:
+			break;
+		}
+
+		if (nibs)
+			submit();
+	}
+
+	if (nibs)
+		submit();
+
+	bo_free_all();
+	pm4_decoder_free(d);
+}
+
+static double per_submit(uint64_t n)
+{
+	return stats.submits ? ((double)n / stats.submits) : 0.0;
+}
+
+static void report(const char *name, uint64_t ns)
+{
+	printf("%s: %"PRIu64" submits (%"PRIu64" IBs), %s sink, %.3f ms\n",
+			name, stats.submits, stats.ibs, sink->name, ns / 1000000.0);
+	printf("  ns/submit:  %10.1f upload, %10.1f reloc, %10.1f submit\n",
+			per_submit(stats.upload_ns), per_submit(stats.reloc_ns),
+			per_submit(stats.submit_ns));
+	printf("  uploaded:   %10"PRIu64" KB, %10.1f KB/submit\n",
+			stats.uploaded >> 10, per_submit(stats.uploaded) / 1024);
+	printf("  relocated:  %10"PRIu64" KB, %10.1f bytes/submit\n",
+			(stats.relocs * 4) >> 10, per_submit(stats.relocs * 4));
+	printf("  allocs:     %10"PRIu64" (%"PRIu64" KB), frees: %"PRIu64"\n",
+			stats.allocs, stats.allocated >> 10, stats.frees);
+	fflush(stdout);
+}
+
+static unsigned int first = 0, last = ~0;
+static int range, loops = 1;
+
+static int replay_path(const char *path)
+{
+	uint64_t end = ~(uint64_t)0, offset, start;
+	struct rd_reader *r;
+	int i, fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		fprintf(stderr, "could not open: %s\n", path);
+		return -1;
+	}
+	r = rd_reader_open(fd);
+	if (!r)
+		return -1;
+	if (range && rd_reader_seek_submits(r, first, last, &end)) {
+		rd_reader_close(r);
+		return -1;
+	}
+
+	memset(&stats, 0, sizeof(stats));
+	offset = rd_reader_tell(r);
+	start = now();
+	for (i = 0; i < loops; i++) {
+		rd_reader_seek(r, offset);
+		replay(r, end);
+	}
+	report(path, now() - start);
+
+	rd_reader_close(r);
+	return 0;
+}
+
+/* each capture is replayed in its own process, since libwrap is not
+ * thread safe:
+ */
+static int replay_job(int job, void *arg)
+{
+	if (sink->open())
+		return -1;
+	return replay_path(((char **)arg)[job]);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n] [-l loops] [-s first[-last]] [-j workers] file.rd...\n", name);
+	exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+	int i, n, nworkers = 1;
+	char **files;
+
+	sink = &kgsl_sink;
+
+	/* -n for the null sink, -l to replay each capture more than once,
+	 * -s n or -s first-last to only replay some submits, and -j to
+	 * replay several captures in parallel:
+	 */
+	for (i = 1; (i < argc) && (argv[i][0] == '-'); i++) {
+		if (!strcmp(argv[i], "-n")) {
+			sink = &null_sink;
+		} else if (!strcmp(argv[i], "-l") && (i + 1 < argc) &&
+				(atoi(argv[i + 1]) > 0)) {
+			loops = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-s") && (i + 1 < argc) &&
+				!rd_index_parse_range(argv[i + 1], &first, &last)) {
+			range = 1;
+			i++;
+		} else if (!strcmp(argv[i], "-j") && (i + 1 < argc) &&
+				(atoi(argv[i + 1]) > 0)) {
+			nworkers = atoi(argv[++i]);
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	if (i == argc)
+		usage(argv[0]);
+
+	if ((nworkers == 1) && (i + 1 == argc)) {
+		if (sink->open())
+			return -1;
+		return replay_path(argv[i]);
+	}
+
+	n = batch_files(argc - i, &argv[i], &files);
+	if (n < 0)
+		return -1;
+	return batch_run((const char **)files, n, nworkers, replay_job, files);
+}
@@ -0,0 +1,375 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Redundant state analyzer: replays the register writes in captures (type0
+ * and type4 packets, CP_SET_CONSTANT and CP_REG_RMW) into a shadow register
+ * file, and counts the writes of a value the register already held:
+ *
+ *   rdstate [-n top] [-r] [-s first[-last]] file.rd...
+ *
+ * A packet where every write is redundant counts as wasted in full, header
+ * included; otherwise just the redundant dwords are.  State is carried over
+ * from one submit to the next, unless -r is given, in which case the
+ * shadow registers are forgotten at the start of each submit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <assert.h>
+
+#include "libpm4.h"
+#include "adreno_pm4.xml.h"
+
+#define MAX_REGS  0x40000    /* type4 packets have 18 bits of register */
+
+struct reg_stats {
+	uint64_t writes, redundant;
+};
+
+struct pkt_stats {
+	uint64_t packets, redundant, wasted;
+};
+
+struct submit_stats {
+	uint32_t submit;
+	uint64_t dwords, wasted, draws;
+};
+
+static uint32_t shadow[MAX_REGS];
+static uint8_t valid[MAX_REGS];
+static struct reg_stats regs[MAX_REGS];
+static const struct pm4_reg *infos[MAX_REGS];
+
+/* type0 (and type1/type4) packets, and type3 packets by opcode: */
+static struct pkt_stats pkt0_stats, pkt3_stats[128];
+
+static struct submit_stats *submits;
+static unsigned int nsubmits, maxsubmits;
+
+static uint64_t total_dwords, total_draws;
+static int reset_per_submit;
+
+/* the packet the register writes belong to: */
+static struct {
+	struct pkt_stats *stats;
+	uint32_t dwords, writes, redundant;
+} cur;
+
+static void end_packet(void)
+{
+	struct submit_stats *s = nsubmits ? &submits[nsubmits - 1] : NULL;
+	uint64_t wasted;
+
+	if (!cur.stats)
+		return;
+
+	if (cur.writes && (cur.redundant == cur.writes)) {
+		cur.stats->redundant++;
+		wasted = cur.dwords;
+	} else {
+		wasted = cur.redundant;
+	}
+
+	cur.stats->wasted += wasted;
+	if (s)
+		s->wasted += wasted;
+
+	cur.stats = NULL;
+}
+
+static void write_reg(uint32_t reg, uint32_t val, const struct pm4_reg *info)
+{
+	reg &= MAX_REGS - 1;
+
+	regs[reg].writes++;
+	infos[reg] = info;
+	cur.writes++;
+
+	if (valid[reg] && (shadow[reg] == val)) {
+		regs[reg].redundant++;
+		cur.redundant++;
+		return;
+	}
+
+	shadow[reg] = val;
+	valid[reg] = 1;
+}
+
+static void reg_rmw(struct pm4_decoder *d, const uint32_t *p)
+{
+	uint32_t reg = p[0] & (MAX_REGS - 1);
+
+	/* if the old value is not known, neither is the new one, unless
+	 * the and mask clears everything:
+	 */
+	if (!valid[reg] && p[1]) {
+		regs[reg].writes++;
+		infos[reg] = pm4_reg_info(d, reg);
+		cur.writes++;
+		return;
+	}
+
+	write_reg(reg, (shadow[reg] & p[1]) | p[2], pm4_reg_info(d, reg));
+}
+
+static int is_draw(uint32_t opcode)
+{
+	switch (opcode) {
+	case CP_DRAW_INDX:
+	case CP_DRAW_INDX_2:
+	case CP_DRAW_INDX_BIN:
+	case CP_DRAW_INDX_2_BIN:
+	case CP_DRAW_INDX_OFFSET:
+	case CP_DRAW_INDIRECT:
+	case CP_DRAW_INDX_INDIRECT:
+	case CP_DRAW_AUTO:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static void event(const struct pm4_event *ev, void *arg)
+{
+	struct submit_stats *s = nsubmits ? &submits[nsubmits - 1] : NULL;
+
+	switch (ev->type) {
+	case PM4_SUBMIT:
+		end_packet();
+		if (nsubmits == maxsubmits) {
+			maxsubmits = max(2 * maxsubmits, 1024);
+			submits = realloc(submits, maxsubmits * sizeof(submits[0]));
+		}
+		s = &submits[nsubmits++];
+		memset(s, 0, sizeof(*s));
+		s->submit = ev->count;
+		if (reset_per_submit)
+			memset(valid, 0, sizeof(valid));
+		break;
+	case PM4_PKT0:
+	case PM4_PKT1:
+	case PM4_PKT2:
+	case PM4_PKT3:
+		end_packet();
+		total_dwords += 1 + ev->count;
+		if (s)
+			s->dwords += 1 + ev->count;
+
+		cur.stats = (ev->type == PM4_PKT3) ?
+				&pkt3_stats[ev->opcode] : &pkt0_stats;
+		cur.stats->packets++;
+		cur.dwords = 1 + ev->count;
+		cur.writes = cur.redundant = 0;
+
+		if (ev->type != PM4_PKT3)
+			break;
+
+		if (is_draw(ev->opcode)) {
+			total_draws++;
+			if (s)
+				s->draws++;
+		} else if ((ev->opcode == CP_REG_RMW) && (ev->count >= 3)) {
+			reg_rmw(arg, ev->dwords);
+		}
+		break;
+	case PM4_REG:
+		write_reg(ev->reg, ev->val, ev->info);
+		break;
+	default:
+		break;
+	}
+}
+
+static double pct(uint64_t n, uint64_t total)
+{
+	return total ? (100.0 * n / total) : 0.0;
+}
+
+static int cmp_regs(const void *a, const void *b)
+{
+	const struct reg_stats *ra = &regs[*(const uint32_t *)a];
+	const struct reg_stats *rb = &regs[*(const uint32_t *)b];
+	if (ra->redundant != rb->redundant)
+		return (ra->redundant < rb->redundant) ? 1 : -1;
+	return (*(const uint32_t *)a < *(const uint32_t *)b) ? -1 : 1;
+}
+
+static int cmp_submits(const void *a, const void *b)
+{
+	const struct submit_stats *sa = a, *sb = b;
+	if (sa->wasted != sb->wasted)
+		return (sa->wasted < sb->wasted) ? 1 : -1;
+	return (sa->submit < sb->submit) ? -1 : 1;
+}
+
+static void report(const char *name, int top)
+{
+	uint64_t writes = 0, redundant = 0, wasted = pkt0_stats.wasted;
+	uint32_t *order;
+	unsigned int i, n = 0;
+	char buf[64];
+
+	for (i = 0; i < MAX_REGS; i++) {
+		writes += regs[i].writes;
+		redundant += regs[i].redundant;
+		if (regs[i].redundant)
+			n++;
+	}
+	for (i = 0; i < ARRAY_SIZE(pkt3_stats); i++)
+		wasted += pkt3_stats[i].wasted;
+
+	printf("%s:\n", name);
+	printf("  submits: %u, draws: %"PRIu64", cmdstream: %"PRIu64" dwords\n",
+			nsubmits, total_draws, total_dwords);
+	printf("  register writes: %"PRIu64", redundant: %"PRIu64" (%.1f%%)\n",
+			writes, redundant, pct(redundant, writes));
+	printf("  wasted: %"PRIu64" dwords (%"PRIu64" KB), %.1f%% of the cmdstream",
+			wasted, (wasted * 4) >> 10, pct(wasted, total_dwords));
+	if (total_draws)
+		printf(", %.1f dwords/draw", (double)wasted / total_draws);
+	printf("\n\n");
+
+	/* top registers: */
+	order = malloc((n + 1) * sizeof(*order));
+	for (i = 0, n = 0; i < MAX_REGS; i++)
+		if (regs[i].redundant)
+			order[n++] = i;
+	qsort(order, n, sizeof(*order), cmp_regs);
+
+	printf("  %12s %12s %6s  register\n", "redundant", "writes", "%");
+	for (i = 0; (i < n) && (i < top); i++) {
+		uint32_t reg = order[i];
+		printf("  %12"PRIu64" %12"PRIu64" %5.1f%%  %s\n",
+				regs[reg].redundant, regs[reg].writes,
+				pct(regs[reg].redundant, regs[reg].writes),
+				pm4_reg_name(infos[reg], reg, buf, sizeof(buf)));
+	}
+	printf("\n");
+	free(order);
+
+	/* by packet: */
+	printf("  %12s %12s %12s  packet\n", "packets", "redundant", "wasted");
+	if (pkt0_stats.packets) {
+		printf("  %12"PRIu64" %12"PRIu64" %12"PRIu64"  type0\n",
+				pkt0_stats.packets, pkt0_stats.redundant, pkt0_stats.wasted);
+	}
+	for (i = 0; i < ARRAY_SIZE(pkt3_stats); i++) {
+		struct pkt_stats *p = &pkt3_stats[i];
+		if (!p->wasted)
+			continue;
+		printf("  %12"PRIu64" %12"PRIu64" %12"PRIu64"  %s\n",
+				p->packets, p->redundant, p->wasted, pm4_opcode_name(i));
+	}
+	printf("\n");
+
+	/* worst submits: */
+	qsort(submits, nsubmits, sizeof(submits[0]), cmp_submits);
+	printf("  %12s %12s %12s %12s\n", "submit", "dwords", "wasted", "draws");
+	for (i = 0; (i < nsubmits) && (i < top) && submits[i].wasted; i++) {
+		printf("  %12u %12"PRIu64" %12"PRIu64" %12"PRIu64"\n",
+				submits[i].submit, submits[i].dwords, submits[i].wasted,
+				submits[i].draws);
+	}
+	printf("\n");
+}
+
+static void reset(void)
+{
+	memset(valid, 0, sizeof(valid));
+	memset(regs, 0, sizeof(regs));
+	memset(infos, 0, sizeof(infos));
+	memset(&pkt0_stats, 0, sizeof(pkt0_stats));
+	memset(pkt3_stats, 0, sizeof(pkt3_stats));
+	memset(&cur, 0, sizeof(cur));
+	nsubmits = 0;
+	total_dwords = total_draws = 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n top] [-r] [-s first[-last]] file.rd...\n", name);
+	exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int first = 0, last = ~0;
+	int i, range = 0, top = 20;
+
+	for (i = 1; (i < argc) && (argv[i][0] == '-'); i++) {
+		if (!strcmp(argv[i], "-r")) {
+			reset_per_submit = 1;
+		} else if (!strcmp(argv[i], "-s") && (i + 1 < argc) &&
+				!rd_index_parse_range(argv[i + 1], &first, &last)) {
+			range = 1;
+			i++;
+		} else if (!strcmp(argv[i], "-n") && (i + 1 < argc) &&
+				(atoi(argv[i + 1]) > 0)) {
+			top = atoi(argv[++i]);
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	if (i == argc)
+		usage(argv[0]);
+
+	for (; i < argc; i++) {
+		uint64_t end = ~(uint64_t)0;
+		struct pm4_decoder *d;
+		struct rd_reader *r;
+		int fd = open(argv[i], O_RDONLY);
+		if (fd < 0) {
+			fprintf(stderr, "could not open: %s\n", argv[i]);
+			return -1;
+		}
+		r = rd_reader_open(fd);
+		if (!r)
+			return -1;
+		if (range && rd_reader_seek_submits(r, first, last, &end))
+			return -1;
+
+		/* a3xx, unless the capture says otherwise, which with -s is
+		 * before the range:
+		 */
+		d = pm4_decoder_new(320);
+		if (rd_reader_gpu_id(r))
+			pm4_set_gpu_id(d, rd_reader_gpu_id(r));
+		reset();
+		if (pm4_decode_rd(d, r, end, event, d))
+			fprintf(stderr, "%s: some IBs could not be decoded\n", argv[i]);
+		end_packet();
+		report(argv[i], top);
+
+		pm4_decoder_free(d);
+		rd_reader_close(r);
+	}
+
+	return 0;
+}
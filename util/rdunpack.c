@@ -0,0 +1,150 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Get captures back out of a store made by rdpack:
+ *
+ *   rdunpack store                         list the captures
+ *   rdunpack [-o dir] store name...        rebuild name.rd
+ *   rdunpack -c store name                 or stream it to stdout
+ *
+ * Compressed captures come back as plain .rd files.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+
+#include "rdpack.h"
+
+static int write_fd(const void *buf, uint32_t sz, void *arg)
+{
+	const uint8_t *p = buf;
+	int fd = *(int *)arg;
+
+	while (sz) {
+		ssize_t ret = write(fd, p, sz);
+		if (ret <= 0) {
+			perror("write");
+			return -1;
+		}
+		p += ret;
+		sz -= ret;
+	}
+
+	return 0;
+}
+
+static void list(struct rdpack_store *s)
+{
+	uint64_t raw = 0, stored = rdpack_stored(s);
+	char **names;
+	int i, n;
+
+	n = rdpack_names(s, &names);
+	for (i = 0; i < n; i++) {
+		int64_t sz = rdpack_size(s, names[i]);
+		printf("%12"PRId64"  %s\n", sz, names[i]);
+		if (sz > 0)
+			raw += sz;
+		free(names[i]);
+	}
+	free(names);
+
+	printf("%d captures, %"PRIu64" MB in %"PRIu64" MB, %.1fx\n", n,
+			raw >> 20, stored >> 20, stored ? ((double)raw / stored) : 0.0);
+}
+
+static int unpack(struct rdpack_store *s, const char *name, const char *dir)
+{
+	char path[PATH_MAX];
+	int fd, ret;
+
+	snprintf(path, sizeof(path), "%s/%s.rd", dir, name);
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "could not open: %s\n", path);
+		return -1;
+	}
+
+	ret = rdpack_stream(s, name, write_fd, &fd);
+	close(fd);
+
+	if (ret)
+		unlink(path);
+
+	return ret;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s store\n", name);
+	fprintf(stderr, "       %s [-o dir] store name...\n", name);
+	fprintf(stderr, "       %s -c store name\n", name);
+	exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+	struct rdpack_store *s;
+	const char *dir = ".";
+	int i, ret = 0, stream = 0;
+
+	for (i = 1; (i < argc) && (argv[i][0] == '-'); i++) {
+		if (!strcmp(argv[i], "-c")) {
+			stream = 1;
+		} else if (!strcmp(argv[i], "-o") && (i + 1 < argc)) {
+			dir = argv[++i];
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	if ((i == argc) || (stream && ((argc - i) != 2)))
+		usage(argv[0]);
+
+	s = rdpack_open(argv[i++], 0);
+	if (!s)
+		return -1;
+
+	if (i == argc) {
+		list(s);
+	} else if (stream) {
+		int fd = STDOUT_FILENO;
+		ret = rdpack_stream(s, argv[i], write_fd, &fd);
+	} else {
+		for (; i < argc; i++)
+			if (unpack(s, argv[i], dir))
+				ret = -1;
+	}
+
+	rdpack_close(s);
+
+	return ret;
+}
@@ -0,0 +1,469 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "rdz.h"
+
+/*
+ * The codec is a simple byte oriented LZ77 (in the style of lz4), which
+ * is fast enough to keep up with capturing and does well on the sort of
+ * data that ends up in rd files (lots of zero pages, repeated vertex and
+ * constant data, etc).  A block is a sequence of:
+ *
+ *   u8  token:     literal length (hi nibble), match length - 4 (lo nibble)
+ *   u8  litlen[]:  if literal length nibble is 15, more length bytes
+ *                  follow, added up until one is not 255
+ *   u8  literals[]
+ *   u16 offset:    little endian, distance back to the match
+ *   u8  matchlen[]: extra match length bytes, like litlen
+ *
+ * The last sequence in a block only has literals.
+ */
+
+#define MINMATCH   4
+#define HASH_BITS  14
+#define MAX_OFFSET 0xffff
+
+static inline uint32_t read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline unsigned int hash4(uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static inline uint8_t * put_len(uint8_t *op, unsigned int len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+	return op;
+}
+
+static inline uint8_t * put_literals(uint8_t *op, const uint8_t *lit,
+		unsigned int litlen, unsigned int mlen)
+{
+	uint8_t *token = op++;
+
+	*token = ((litlen < 15) ? litlen : 15) << 4;
+	*token |= (mlen < 15) ? mlen : 15;
+	if (litlen >= 15)
+		op = put_len(op, litlen - 15);
+	memcpy(op, lit, litlen);
+
+	return op + litlen;
+}
+
+/* returns compressed size, or -1 if it doesn't fit in dstsz */
+int rdz_compress(const void *src, int srcsz, void *dst, int dstsz)
+{
+	uint32_t table[1 << HASH_BITS];
+	const uint8_t *base = src;
+	const uint8_t *ip = base, *anchor = base;
+	const uint8_t *end = base + srcsz;
+	const uint8_t *limit = end - MINMATCH;
+	uint8_t *op = dst, *oend = op + dstsz;
+	unsigned int misses = 0;
+
+	memset(table, 0, sizeof(table));
+
+	while (ip < limit) {
+		uint32_t seq = read32(ip);
+		unsigned int h = hash4(seq);
+		const uint8_t *ref = base + table[h];
+		unsigned int litlen, mlen;
+
+		table[h] = ip - base;
+
+		if ((ref >= ip) || ((ip - ref) > MAX_OFFSET) || (read32(ref) != seq)) {
+			/* skip faster through incompressible data: */
+			ip += 1 + (misses++ >> 6);
+			continue;
+		}
+		misses = 0;
+
+		/* extend the match as far as it goes: */
+		{
+			const uint8_t *m = ip + MINMATCH, *r = ref + MINMATCH;
+			while (((m + 8) <= end) && (read32(m) == read32(r)) &&
+					(read32(m + 4) == read32(r + 4))) {
+				m += 8;
+				r += 8;
+			}
+			while ((m < end) && (*m == *r)) {
+				m++;
+				r++;
+			}
+			mlen = m - ip - MINMATCH;
+		}
+
+		litlen = ip - anchor;
+		if ((op + 1 + litlen + (litlen / 255) + 2 + (mlen / 255) + 2) > oend)
+			return -1;
+
+		op = put_literals(op, anchor, litlen, mlen);
+		*op++ = (ip - ref) & 0xff;
+		*op++ = (ip - ref) >> 8;
+		if (mlen >= 15)
+			op = put_len(op, mlen - 15);
+
+		ip += MINMATCH + mlen;
+		anchor = ip;
+	}
+
+	/* and the trailing literals: */
+	{
+		unsigned int litlen = end - anchor;
+		if ((op + 1 + litlen + (litlen / 255) + 1) > oend)
+			return -1;
+		op = put_literals(op, anchor, litlen, 0);
+	}
+
+	return op - (uint8_t *)dst;
+}
+
+static inline int get_len(const uint8_t **ipp, const uint8_t *iend,
+		unsigned int *len)
+{
+	const uint8_t *ip = *ipp;
+	uint8_t b;
+	do {
+		if (ip >= iend)
+			return -1;
+		b = *ip++;
+		*len += b;
+	} while (b == 255);
+	*ipp = ip;
+	return 0;
+}
+
+/* returns decompressed size, or -1 on corrupt input */
+int rdz_decompress(const void *src, int srcsz, void *dst, int dstsz)
+{
+	const uint8_t *ip = src, *iend = ip + srcsz;
+	uint8_t *op = dst, *oend = op + dstsz;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+		unsigned int litlen = token >> 4;
+		unsigned int mlen = token & 0xf;
+		unsigned int off;
+		const uint8_t *ref;
+
+		if ((litlen == 15) && get_len(&ip, iend, &litlen))
+			return -1;
+		if ((litlen > (iend - ip)) || (litlen > (oend - op)))
+			return -1;
+		memcpy(op, ip, litlen);
+		op += litlen;
+		ip += litlen;
+
+		if (ip >= iend)
+			break;
+
+		if ((iend - ip) < 2)
+			return -1;
+		off = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if ((off == 0) || (off > (op - (uint8_t *)dst)))
+			return -1;
+
+		if ((mlen == 15) && get_len(&ip, iend, &mlen))
+			return -1;
+		mlen += MINMATCH;
+		if (mlen > (oend - op))
+			return -1;
+
+		ref = op - off;
+		if (off >= mlen) {
+			memcpy(op, ref, mlen);
+			op += mlen;
+		} else if (off == 1) {
+			memset(op, *ref, mlen);
+			op += mlen;
+		} else {
+			while (mlen--)
+				*op++ = *ref++;
+		}
+	}
+
+	return op - (uint8_t *)dst;
+}
+
+struct rdz_block {
+	uint64_t rawoff;     /* offset of the block in the rd stream */
+	off_t fileoff;       /* offset of the block header in the file */
+};
+
+struct rdz_file {
+	int fd;
+	int compressed;
+	uint8_t *raw, *comp;
+	int rawsz, rawoff;
+	uint64_t pos;
+	/* for compressed files, table of blocks (plus one past the end),
+	 * built the first time it is needed for seeking:
+	 */
+	struct rdz_block *blocks;
+	unsigned int nblocks;
+};
+
+static int read_full(int fd, void *buf, int sz)
+{
+	uint8_t *p = buf;
+	int n = 0;
+	while (n < sz) {
+		int ret = read(fd, p + n, sz - n);
+		if (ret <= 0)
+			break;
+		n += ret;
+	}
+	return n;
+}
+
+struct rdz_file * rdz_open(int fd)
+{
+	struct rdz_file *f = calloc(1, sizeof(*f));
+	uint32_t hdr[2];
+	int n;
+
+	f->fd = fd;
+
+	n = read_full(fd, hdr, 4);
+	if ((n == 4) && (hdr[0] == RDZ_MAGIC)) {
+		if ((read_full(fd, &hdr[1], 4) != 4) || (hdr[1] != RDZ_VERSION)) {
+			fprintf(stderr, "unsupported rdz version\n");
+			free(f);
+			return NULL;
+		}
+		f->compressed = 1;
+		f->raw  = malloc(RDZ_BLOCK_SIZE);
+		f->comp = malloc(RDZ_BOUND(RDZ_BLOCK_SIZE));
+	} else {
+		/* plain rd file, hand back what we already read: */
+		f->raw = malloc(4);
+		memcpy(f->raw, hdr, n);
+		f->rawsz = n;
+	}
+
+	return f;
+}
+
+static int rdz_next_block(struct rdz_file *f)
+{
+	uint32_t hdr[3];
+
+	f->rawsz = f->rawoff = 0;
+
+	if (!f->compressed)
+		return -1;
+
+	if (read_full(f->fd, hdr, sizeof(hdr)) != sizeof(hdr))
+		return -1;
+
+	if ((hdr[0] != RDZ_BLOCK_MAGIC) || (hdr[1] > RDZ_BLOCK_SIZE) ||
+			(hdr[2] > RDZ_BOUND(hdr[1]))) {
+		fprintf(stderr, "corrupt rdz block header\n");
+		return -1;
+	}
+
+	if (hdr[2] == hdr[1]) {
+		if (read_full(f->fd, f->raw, hdr[1]) != hdr[1])
+			return -1;
+	} else {
+		if (read_full(f->fd, f->comp, hdr[2]) != hdr[2])
+			return -1;
+		if (rdz_decompress(f->comp, hdr[2], f->raw, hdr[1]) != hdr[1]) {
+			fprintf(stderr, "corrupt rdz block\n");
+			return -1;
+		}
+	}
+
+	f->rawsz = hdr[1];
+
+	return 0;
+}
+
+/* like read(), but transparently decompresses.  Returns the number of
+ * bytes read, which is only less than sz at end of file
+ */
+int rdz_read(struct rdz_file *f, void *buf, int sz)
+{
+	uint8_t *p = buf;
+	int n = 0;
+
+	while (n < sz) {
+		int avail = f->rawsz - f->rawoff;
+
+		if (avail > 0) {
+			if (avail > (sz - n))
+				avail = sz - n;
+			memcpy(p + n, f->raw + f->rawoff, avail);
+			f->rawoff += avail;
+			n += avail;
+		} else if (f->compressed) {
+			if (rdz_next_block(f))
+				break;
+		} else {
+			f->rawsz = f->rawoff = 0;
+			n += read_full(f->fd, p + n, sz - n);
+			break;
+		}
+	}
+
+	f->pos += n;
+
+	return n;
+}
+
+void rdz_close(struct rdz_file *f)
+{
+	close(f->fd);
+	free(f->raw);
+	free(f->comp);
+	free(f->blocks);
+	free(f);
+}
+
+int rdz_compressed(struct rdz_file *f)
+{
+	return f->compressed;
+}
+
+uint64_t rdz_tell(struct rdz_file *f)
+{
+	return f->pos;
+}
+
+/* walk the block headers, which doesn't require decompressing anything: */
+static void rdz_scan_blocks(struct rdz_file *f)
+{
+	unsigned int size = 0;
+	uint64_t rawoff = 0;
+	off_t off = 8;
+
+	if (f->blocks)
+		return;
+
+	for (;;) {
+		uint32_t hdr[3];
+		int last = 0;
+
+		if (pread(f->fd, hdr, sizeof(hdr), off) != sizeof(hdr)) {
+			last = 1;
+		} else if ((hdr[0] != RDZ_BLOCK_MAGIC) || (hdr[1] > RDZ_BLOCK_SIZE)) {
+			fprintf(stderr, "corrupt rdz block header\n");
+			last = 1;
+		}
+
+		if (f->nblocks == size) {
+			size = size ? size * 2 : 64;
+			f->blocks = realloc(f->blocks, size * sizeof(f->blocks[0]));
+		}
+
+		f->blocks[f->nblocks].rawoff  = rawoff;
+		f->blocks[f->nblocks].fileoff = off;
+
+		if (last)
+			break;
+
+		f->nblocks++;
+		rawoff += hdr[1];
+		off += sizeof(hdr) + hdr[2];
+	}
+}
+
+uint64_t rdz_size(struct rdz_file *f)
+{
+	struct stat st;
+
+	if (f->compressed) {
+		rdz_scan_blocks(f);
+		return f->blocks[f->nblocks].rawoff;
+	}
+
+	if (fstat(f->fd, &st))
+		return 0;
+
+	return st.st_size;
+}
+
+int rdz_seek(struct rdz_file *f, uint64_t off)
+{
+	uint64_t start = f->pos - f->rawoff;
+	unsigned int lo, hi;
+
+	if (!f->compressed) {
+		if (lseek(f->fd, off, SEEK_SET) == (off_t)-1)
+			return -1;
+		f->rawsz = f->rawoff = 0;
+		f->pos = off;
+		return 0;
+	}
+
+	/* within the block already decompressed? */
+	if ((off >= start) && (off <= (start + f->rawsz))) {
+		f->rawoff = off - start;
+		f->pos = off;
+		return 0;
+	}
+
+	rdz_scan_blocks(f);
+
+	if (off > f->blocks[f->nblocks].rawoff)
+		return -1;
+
+	/* find the last block starting at or before off: */
+	lo = 0;
+	hi = f->nblocks;
+	while ((hi - lo) > 1) {
+		unsigned int mid = (lo + hi) / 2;
+		if (f->blocks[mid].rawoff <= off)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	if (lseek(f->fd, f->blocks[lo].fileoff, SEEK_SET) == (off_t)-1)
+		return -1;
+
+	f->rawsz = f->rawoff = 0;
+	if ((lo < f->nblocks) && rdz_next_block(f))
+		return -1;
+
+	f->rawoff = off - f->blocks[lo].rawoff;
+	f->pos = off;
+
+	return 0;
+}
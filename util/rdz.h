@@ -0,0 +1,67 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef RDZ_H_
+#define RDZ_H_
+
+#include <stdint.h>
+
+/*
+ * Optional compressed container for .rd files.  The normal rd byte stream
+ * is split into blocks of up to RDZ_BLOCK_SIZE bytes, each compressed
+ * independently with a small LZ77 style codec:
+ *
+ *   file:   u32 RDZ_MAGIC, u32 RDZ_VERSION, block*
+ *   block:  u32 RDZ_BLOCK_MAGIC, u32 rawsz, u32 compsz, u8 data[compsz]
+ *
+ * If compsz == rawsz the block is stored uncompressed.  Since every block
+ * header has both sizes, a reader can find all the blocks (and their
+ * offsets in the decompressed stream) without decompressing anything,
+ * and decompress them in parallel.
+ */
+
+#define RDZ_MAGIC        0x315a4452   /* "RDZ1" */
+#define RDZ_VERSION      1
+#define RDZ_BLOCK_MAGIC  0x425a4452   /* "RDZB" */
+#define RDZ_BLOCK_SIZE   (1024 * 1024)
+
+/* worst case size of compressed data, when nothing compresses: */
+#define RDZ_BOUND(sz)    ((sz) + ((sz) / 255) + 16)
+
+int rdz_compress(const void *src, int srcsz, void *dst, int dstsz);
+int rdz_decompress(const void *src, int srcsz, void *dst, int dstsz);
+
+/* reader which transparently handles both plain and compressed files: */
+struct rdz_file;
+
+struct rdz_file * rdz_open(int fd);
+int rdz_read(struct rdz_file *f, void *buf, int sz);
+void rdz_close(struct rdz_file *f);
+int rdz_compressed(struct rdz_file *f);
+
+/* offsets/sizes are in the (decompressed) rd stream: */
+uint64_t rdz_tell(struct rdz_file *f);
+uint64_t rdz_size(struct rdz_file *f);
+int rdz_seek(struct rdz_file *f, uint64_t off);
+
+#endif /* RDZ_H_ */
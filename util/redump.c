@@ -27,10 +27,20 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
 #include <fcntl.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
 
-#include "redump.h"
+#include "librd.h"
+#include "batch.h"
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#  include <arm_neon.h>
+#endif
 
 static const uint32_t patterns[] = {
 		/* these should be ordered by most inclusive pattern, ie. most 'f's */
@@ -124,221 +134,743 @@ struct param {
 };
 
 struct context {
-	int       fd;
-	uint32_t *buf;           /* current row buffer */
+	struct rd_reader *r;
+	uint64_t  end;           /* end of the submits being compared */
+	int       valid;         /* ctx has a section in the current row */
+	const uint32_t *buf;     /* current row buffer, points into the file */
 	int       sz;            /* current row buffer size */
-	uint32_t  gpuaddrs[32];
-	int       ngpuaddrs;
-	struct param params[32];
-	int       nparams;
+	uint32_t *gpuaddrs;
+	int       ngpuaddrs, maxgpuaddrs;
+	/* open addressing hash of gpuaddrs, index + 1 (zero is empty): */
+	int      *gpuaddr_hash;
+	unsigned int hashsize;
+	struct param *params;
+	int       nparams, maxparams;
+	/* for cmdstreams, gpuaddr index of each dword (or -1), and the dword
+	 * in each column of the alignment (or -1 for a gap):
+	 */
+	int      *gidx;
+	int      *cols;
 };
 
-struct context ctxts[64];
+struct context *ctxts;
 int nctxts;
-typedef int offsets_t[ARRAY_SIZE(ctxts)];
+int ncols;
+int *col_patterns;       /* index into patterns[] for each column, or -1 */
 
 static void handle_string(struct context *ctx)
 {
-	printf("%s", (char *)ctx->buf);
+	printf("%.*s", ctx->sz, (const char *)ctx->buf);
+}
+
+static inline unsigned int gpuaddr_hash(uint32_t gpuaddr, unsigned int size)
+{
+	return ((gpuaddr * 0x9e3779b1u) >> 7) & (size - 1);
+}
+
+static void add_gpuaddr(struct context *ctx, uint32_t gpuaddr)
+{
+	unsigned int h, i;
+
+	if (ctx->ngpuaddrs == ctx->maxgpuaddrs) {
+		ctx->maxgpuaddrs = max(2 * ctx->maxgpuaddrs, 32);
+		ctx->gpuaddrs = realloc(ctx->gpuaddrs,
+				ctx->maxgpuaddrs * sizeof(ctx->gpuaddrs[0]));
+	}
+
+	/* keep the hash at most half full: */
+	if ((2 * (ctx->ngpuaddrs + 1)) > ctx->hashsize) {
+		ctx->hashsize = max(2 * ctx->hashsize, 64);
+		free(ctx->gpuaddr_hash);
+		ctx->gpuaddr_hash = calloc(ctx->hashsize, sizeof(int));
+		for (i = 0; i < ctx->ngpuaddrs; i++) {
+			h = gpuaddr_hash(ctx->gpuaddrs[i], ctx->hashsize);
+			while (ctx->gpuaddr_hash[h] &&
+					(ctx->gpuaddrs[ctx->gpuaddr_hash[h] - 1] != ctx->gpuaddrs[i]))
+				h = (h + 1) & (ctx->hashsize - 1);
+			if (!ctx->gpuaddr_hash[h])
+				ctx->gpuaddr_hash[h] = i + 1;
+		}
+	}
+
+	ctx->gpuaddrs[ctx->ngpuaddrs++] = gpuaddr;
+
+	/* if it is a duplicate, the first one wins: */
+	h = gpuaddr_hash(gpuaddr, ctx->hashsize);
+	while (ctx->gpuaddr_hash[h]) {
+		if (ctx->gpuaddrs[ctx->gpuaddr_hash[h] - 1] == gpuaddr)
+			return;
+		h = (h + 1) & (ctx->hashsize - 1);
+	}
+	ctx->gpuaddr_hash[h] = ctx->ngpuaddrs;
 }
 
 static void handle_gpuaddr(struct context *ctx)
 {
-	uint32_t gpuaddr = ctx->buf[0];
 	printf("<font color=\"#%06x\"><b>%08x</b></font><br>",
-			gpuaddr_colors[ctx->ngpuaddrs], gpuaddr);
+			gpuaddr_colors[(ctx->ngpuaddrs - 1) % ARRAY_SIZE(gpuaddr_colors)],
+			ctx->buf[0]);
 	printf("(len: %x)", ctx->buf[1]);
-	ctx->gpuaddrs[ctx->ngpuaddrs++] = gpuaddr;
+}
+
+static void handle_unchanged(struct context *ctx)
+{
+	/* the gpuaddr was already seen in an earlier RD_GPUADDR section, so
+	 * nothing to add to the table, just note it:
+	 */
+	printf("<b>%08x</b><br>", ctx->buf[0]);
+	printf("(unchanged since submit %u)", ctx->buf[3]);
+}
+
+static void handle_partial(struct context *ctx)
+{
+	printf("<b>%08x</b><br>", ctx->buf[0]);
+	printf("(partial: %x bytes at +%x)", ctx->buf[4], ctx->buf[3]);
+}
+
+static void handle_ioctl(struct context *ctx)
+{
+	struct rd_ioctl *rec = (struct rd_ioctl *)ctx->buf;
+	printf("%s %08x", (rec->dir == _IOC_WRITE) ? "&gt;" : "&lt;", rec->request);
+	if (rec->dir != _IOC_WRITE)
+		printf(" =&gt; %d", rec->ret);
+}
+
+static void add_param(struct context *ctx)
+{
+	struct param *param;
+
+	if (ctx->nparams == ctx->maxparams) {
+		ctx->maxparams = max(2 * ctx->maxparams, 32);
+		ctx->params = realloc(ctx->params,
+				ctx->maxparams * sizeof(ctx->params[0]));
+	}
+
+	param = &ctx->params[ctx->nparams++];
+	param->type   = ctx->buf[0];
+	param->val    = ctx->buf[1];
+	param->bitlen = ctx->buf[2];
+	if (param->val >= (1 << param->bitlen)) {
+		fprintf(stderr, "invalid param: %08x (name: %s, bitlen: %d)\n",
+				param->val, param_names[param->type], param->bitlen);
+	}
+}
+
+/* update the gpuaddr/param tables, before the row is output: */
+static void track_section(struct context *ctx, enum rd_sect_type type)
+{
+	switch (type) {
+	case RD_GPUADDR:
+		add_gpuaddr(ctx, ctx->buf[0]);
+		break;
+	case RD_PARAM:
+		add_param(ctx);
+		break;
+	case RD_FLUSH:
+		ctx->nparams = 0;
+		break;
+	default:
+		break;
+	}
 }
 
 static int find_gpuaddr(struct context *ctx, uint32_t dword)
 {
-	int i;
-	for (i = 0; i < ctx->ngpuaddrs; i++)
-		if (dword == ctx->gpuaddrs[i])
+	unsigned int h;
+
+	if (!ctx->hashsize)
+		return -1;
+
+	h = gpuaddr_hash(dword, ctx->hashsize);
+	while (ctx->gpuaddr_hash[h]) {
+		int i = ctx->gpuaddr_hash[h] - 1;
+		if (ctx->gpuaddrs[i] == dword)
 			return i;
+		h = (h + 1) & (ctx->hashsize - 1);
+	}
+
 	return -1;
 }
 
-static int find_pattern(uint32_t dword, int i, offsets_t offsets)
+/*
+ * Cmdstream alignment.  Each cmdstream is aligned against the first one
+ * with an anchored diff: common prefix/suffix, then dwords which appear
+ * exactly once in both (with gpuaddrs compared by which buffer they point
+ * to) as anchors, recursing into the gaps between them.  What is left
+ * without anchors is aligned with needleman-wunsch, scored with the same
+ * ranking of gpuaddr/pattern matches as the hexdump colors, if it is
+ * small enough, or otherwise just dword for dword.  The pairwise results
+ * are then merged into columns shared by all the ctxts.
+ */
+
+#define GAP_PENALTY   2
+#define MAX_DP_CELLS  (1 << 22)
+#define MAX_DEPTH     64
+
+struct seq {
+	const uint32_t *dwords;
+	const int *gidx;
+};
+
+static inline uint64_t key(const struct seq *s, int i)
 {
-	int j, k;
-	for (j = 0; j < ARRAY_SIZE(patterns); j++) {
-		int found = 1;
-		uint32_t pattern = patterns[j];
-		for (k = 0; k < nctxts; k++) {
-			uint32_t other_dword = ctxts[k].buf[i - offsets[k]];
-			if ((dword & pattern) != (other_dword & pattern)) {
-				found = 0;
-				break;
+	if (s->gidx[i] >= 0)
+		return (1ull << 32) | s->gidx[i];
+	return s->dwords[i];
+}
+
+static int rank(const struct seq *a, int i, const struct seq *b, int j)
+{
+	uint32_t diff;
+	int k;
+
+	if ((a->gidx[i] >= 0) || (b->gidx[j] >= 0))
+		return (a->gidx[i] == b->gidx[j]) ? ARRAY_SIZE(patterns) : 0;
+
+	diff = a->dwords[i] ^ b->dwords[j];
+	for (k = 0; k < ARRAY_SIZE(patterns); k++)
+		if (!(diff & patterns[k]))
+			return ARRAY_SIZE(patterns) - 1 - k;
+
+	return 0;
+}
+
+/* global alignment of a[a0..a1) and b[b0..b1) by dynamic programming: */
+static void align_dp(const struct seq *a, int a0, int a1,
+		const struct seq *b, int b0, int b1, int *map)
+{
+	enum { DIAG, UP, LEFT };
+	int na = a1 - a0, nb = b1 - b0;
+	uint8_t *trace = malloc((na + 1) * (nb + 1));
+	int *prev = malloc((nb + 1) * sizeof(int));
+	int *cur  = malloc((nb + 1) * sizeof(int));
+	int i, j;
+
+#define TRACE(i, j) trace[(i) * (nb + 1) + (j)]
+
+	for (j = 0; j <= nb; j++) {
+		prev[j] = -j * GAP_PENALTY;
+		TRACE(0, j) = LEFT;
+	}
+
+	for (i = 1; i <= na; i++) {
+		int *tmp;
+
+		cur[0] = -i * GAP_PENALTY;
+		TRACE(i, 0) = UP;
+
+		for (j = 1; j <= nb; j++) {
+			int diag = prev[j - 1] + rank(a, a0 + i - 1, b, b0 + j - 1);
+			int up   = prev[j] - GAP_PENALTY;
+			int left = cur[j - 1] - GAP_PENALTY;
+
+			if ((diag >= up) && (diag >= left)) {
+				cur[j] = diag;
+				TRACE(i, j) = DIAG;
+			} else if (up >= left) {
+				cur[j] = up;
+				TRACE(i, j) = UP;
+			} else {
+				cur[j] = left;
+				TRACE(i, j) = LEFT;
 			}
 		}
-		if (found)
-			return j;
+
+		tmp = prev;
+		prev = cur;
+		cur = tmp;
 	}
-	return -1;
+
+	for (i = na, j = nb; (i > 0) && (j > 0); ) {
+		switch (TRACE(i, j)) {
+		case DIAG:
+			map[a0 + --i] = b0 + --j;
+			break;
+		case UP:
+			i--;
+			break;
+		case LEFT:
+			j--;
+			break;
+		}
+	}
+
+#undef TRACE
+
+	free(trace);
+	free(prev);
+	free(cur);
 }
 
-static int find_rank(int i, offsets_t offsets)
+/* find anchors, dwords which appear exactly once in both a[a0..a1) and
+ * b[b0..b1), and keep the longest increasing run of them (patience diff).
+ * Returns the number of anchors, with their positions in a and b:
+ */
+static int find_anchors(const struct seq *a, int a0, int a1,
+		const struct seq *b, int b0, int b1, int *anchors_a, int *anchors_b)
 {
-	int j, k, rank = 0;
-	uint32_t dword;
+	struct entry {
+		uint64_t key;
+		int cnta, cntb, posa, posb;
+	} *table;
+	unsigned int size = 16, mask;
+	int i, n = 0, len = 0;
+	int *pa, *pb, *tails, *links;
+
+	while (size < 2 * (unsigned)(a1 - a0 + b1 - b0))
+		size *= 2;
+	mask = size - 1;
+	table = calloc(size, sizeof(*table));
+
+	for (i = a0; i < b1 - b0 + a1; i++) {
+		const struct seq *s = (i < a1) ? a : b;
+		int pos = (i < a1) ? i : (i - a1 + b0);
+		uint64_t k = key(s, pos);
+		unsigned int h = (unsigned int)((k * 0x9e3779b97f4a7c15ull) >> 40) & mask;
+
+		while (table[h].cnta + table[h].cntb) {
+			if (table[h].key == k)
+				break;
+			h = (h + 1) & mask;
+		}
 
-	/* check if we are past the end: */
-	for (k = 0; k < nctxts; k++)
-		if (i >= (ctxts[k].sz/ 4 + offsets[k]))
-			return 0;
+		table[h].key = k;
+		if (s == a) {
+			table[h].cnta++;
+			table[h].posa = pos;
+		} else {
+			table[h].cntb++;
+			table[h].posb = pos;
+		}
+	}
 
-	dword = ctxts[0].buf[i - offsets[0]];
+	/* candidates, in order of position in a: */
+	pa = malloc((a1 - a0) * sizeof(int));
+	pb = malloc((a1 - a0) * sizeof(int));
+	for (i = a0; i < a1; i++) {
+		uint64_t k = key(a, i);
+		unsigned int h = (unsigned int)((k * 0x9e3779b97f4a7c15ull) >> 40) & mask;
+		while (table[h].key != k)
+			h = (h + 1) & mask;
+		if ((table[h].cnta == 1) && (table[h].cntb == 1)) {
+			pa[n] = i;
+			pb[n] = table[h].posb;
+			n++;
+		}
+	}
 
-	j = find_gpuaddr(&ctxts[0], dword);
-	if (j >= 0) {
-		/* highest rank, if all are gpuaddr: */
-		rank = ARRAY_SIZE(patterns);
-		for (k = 0; k < nctxts; k++) {
-			struct context *ctx = &ctxts[k];
-			if (j != find_gpuaddr(ctx, ctx->buf[i - offsets[k]])) {
-				rank = 0;
-				break;
-			}
+	/* longest increasing subsequence of pb: */
+	tails = malloc((n + 1) * sizeof(int));
+	links = malloc((n + 1) * sizeof(int));
+	for (i = 0; i < n; i++) {
+		int lo = 0, hi = len;
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+			if (pb[tails[mid]] < pb[i])
+				lo = mid + 1;
+			else
+				hi = mid;
 		}
-	} else {
-		/* followed by pattern match.. in order of priority */
-		/* TODO we need some fuzziness for partial match here.. */
-		j = find_pattern(dword, i, offsets);
-		if (j >= 0)
-			rank = ARRAY_SIZE(patterns) - 1 - j;
+		links[i] = lo ? tails[lo - 1] : -1;
+		tails[lo] = i;
+		if (lo == len)
+			len++;
 	}
 
-	return rank + find_rank(i + 1, offsets) / 2;
+	for (i = len ? tails[len - 1] : -1, n = len; i >= 0; i = links[i]) {
+		n--;
+		anchors_a[n] = pa[i];
+		anchors_b[n] = pb[i];
+	}
+
+	free(table);
+	free(pa);
+	free(pb);
+	free(tails);
+	free(links);
+
+	return len;
 }
 
-static int adjust_offsets_recursive(struct context *ctx, int i,
-		offsets_t offsets, int n, int max_sz)
+static void align_region(const struct seq *a, int a0, int a1,
+		const struct seq *b, int b0, int b1, int *map, int depth)
 {
-	int rank;
+	int *anchors_a, *anchors_b;
+	int i, n;
 
-	rank = find_rank(i, offsets);
+	/* common prefix and suffix: */
+	while ((a0 < a1) && (b0 < b1) && (key(a, a0) == key(b, b0)))
+		map[a0++] = b0++;
+	while ((a0 < a1) && (b0 < b1) && (key(a, a1 - 1) == key(b, b1 - 1)))
+		map[--a1] = --b1;
+
+	if ((a0 == a1) || (b0 == b1))
+		return;
+
+	if ((depth < MAX_DEPTH) && ((a1 - a0) > 1) && ((b1 - b0) > 1)) {
+		anchors_a = malloc((a1 - a0) * sizeof(int));
+		anchors_b = malloc((a1 - a0) * sizeof(int));
+
+		n = find_anchors(a, a0, a1, b, b0, b1, anchors_a, anchors_b);
+		for (i = 0; i < n; i++) {
+			align_region(a, a0, anchors_a[i], b, b0, anchors_b[i],
+					map, depth + 1);
+			map[anchors_a[i]] = anchors_b[i];
+			a0 = anchors_a[i] + 1;
+			b0 = anchors_b[i] + 1;
+		}
 
-	if (n < nctxts) {
-		int new_rank;
-		offsets_t new_offsets;
-		memcpy(new_offsets, offsets, sizeof(offsets_t));
+		free(anchors_a);
+		free(anchors_b);
 
-		if ((ctxts[n].sz/4 + offsets[n]) < max_sz)
-			new_offsets[n] += 1;
-		new_rank = adjust_offsets_recursive(ctx, i, new_offsets, n+1, max_sz);
-		if (new_rank > rank) {
-			rank = new_rank;
-			memcpy(offsets, new_offsets, sizeof(offsets_t));
+		if (n > 0) {
+			align_region(a, a0, a1, b, b0, b1, map, depth + 1);
+			return;
 		}
 	}
 
-	return rank;
+	if (((uint64_t)(a1 - a0) * (b1 - b0)) <= MAX_DP_CELLS) {
+		align_dp(a, a0, a1, b, b0, b1, map);
+	} else {
+		for (i = 0; (a0 + i < a1) && (b0 + i < b1); i++)
+			map[a0 + i] = b0 + i;
+	}
 }
 
-static void adjust_offsets(struct context *ctx, int i, offsets_t offsets)
+/*
+ * A pattern matches all the ctxts in a column if none of the bits in the
+ * pattern differ, ie. if (pattern & (OR(dwords) ^ AND(dwords))) == 0.  So
+ * rather than comparing each ctxt against all the others, accumulate the
+ * OR and AND of each column, one ctxt at a time, and then pick the most
+ * inclusive pattern per column.  Both steps are simple enough to do four
+ * columns at a time with SSE2/NEON.
+ */
+
+static void accumulate_columns(uint32_t *acc_or, uint32_t *acc_and,
+		const uint32_t *vals, int n)
 {
-	int k;
-	int max_sz = 0;
+	int c = 0;
+
+#if defined(__SSE2__)
+	for (; (c + 4) <= n; c += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)&vals[c]);
+		__m128i o = _mm_loadu_si128((const __m128i *)&acc_or[c]);
+		__m128i a = _mm_loadu_si128((const __m128i *)&acc_and[c]);
+		_mm_storeu_si128((__m128i *)&acc_or[c], _mm_or_si128(o, v));
+		_mm_storeu_si128((__m128i *)&acc_and[c], _mm_and_si128(a, v));
+	}
+#elif defined(__ARM_NEON)
+	for (; (c + 4) <= n; c += 4) {
+		uint32x4_t v = vld1q_u32(&vals[c]);
+		vst1q_u32(&acc_or[c], vorrq_u32(vld1q_u32(&acc_or[c]), v));
+		vst1q_u32(&acc_and[c], vandq_u32(vld1q_u32(&acc_and[c]), v));
+	}
+#endif
 
-	for (k = 0; k < nctxts; k++)
-		if (ctxts[k].sz > max_sz)
-			max_sz = ctxts[k].sz;
+	for (; c < n; c++) {
+		acc_or[c]  |= vals[c];
+		acc_and[c] &= vals[c];
+	}
+}
 
-	/* convert to dwords: */
-	max_sz /= 4;
+/* diff[c] is the bits which differ in column c, returns the index of the
+ * first pattern with none of those bits set, or -1:
+ */
+static void match_patterns(const uint32_t *diff, int *result, int n)
+{
+	int c = 0, j;
+
+#if defined(__SSE2__)
+	for (; (c + 4) <= n; c += 4) {
+		__m128i d = _mm_loadu_si128((const __m128i *)&diff[c]);
+		__m128i r = _mm_set1_epi32(-1);
+		/* in reverse, so the most inclusive pattern wins: */
+		for (j = ARRAY_SIZE(patterns) - 1; j >= 0; j--) {
+			__m128i m = _mm_cmpeq_epi32(
+					_mm_and_si128(d, _mm_set1_epi32(patterns[j])),
+					_mm_setzero_si128());
+			r = _mm_or_si128(_mm_and_si128(m, _mm_set1_epi32(j)),
+					_mm_andnot_si128(m, r));
+		}
+		_mm_storeu_si128((__m128i *)&result[c], r);
+	}
+#elif defined(__ARM_NEON)
+	for (; (c + 4) <= n; c += 4) {
+		uint32x4_t d = vld1q_u32(&diff[c]);
+		int32x4_t r = vdupq_n_s32(-1);
+		for (j = ARRAY_SIZE(patterns) - 1; j >= 0; j--) {
+			uint32x4_t m = vceqq_u32(vandq_u32(d, vdupq_n_u32(patterns[j])),
+					vdupq_n_u32(0));
+			r = vbslq_s32(m, vdupq_n_s32(j), r);
+		}
+		vst1q_s32(&result[c], r);
+	}
+#endif
 
-	adjust_offsets_recursive(ctx, i, offsets, 0, max_sz);
+	for (; c < n; c++) {
+		result[c] = -1;
+		for (j = 0; j < ARRAY_SIZE(patterns); j++) {
+			if (!(diff[c] & patterns[j])) {
+				result[c] = j;
+				break;
+			}
+		}
+	}
 }
 
-static void handle_hexdump(struct context *ctx)
+/* figure out col_patterns[] for the aligned cmdstreams: */
+static void classify_columns(void)
 {
-	uint32_t *dwords = ctx->buf;
-	int i, j, k;
-	offsets_t offsets = {0};
-	int offset = 0;
-	int idx = -1;
+	uint32_t *acc_or  = malloc((ncols + 1) * sizeof(uint32_t));
+	uint32_t *acc_and = malloc((ncols + 1) * sizeof(uint32_t));
+	uint32_t *vals    = malloc((ncols + 1) * sizeof(uint32_t));
+	uint8_t  *gaps    = calloc(ncols + 1, 1);
+	int c, k;
+
+	memset(acc_or, 0x00, ncols * sizeof(uint32_t));
+	memset(acc_and, 0xff, ncols * sizeof(uint32_t));
 
-	/* figure out idx: */
 	for (k = 0; k < nctxts; k++) {
-		if (&ctxts[k] == ctx) {
-			idx = k;
-			break;
+		struct context *ctx = &ctxts[k];
+
+		if (!ctx->valid)
+			continue;
+
+		/* gather, with gaps not matching anything: */
+		for (c = 0; c < ncols; c++) {
+			int i = ctx->cols[c];
+			gaps[c] |= (i < 0);
+			vals[c] = (i < 0) ? 0 : ctx->buf[i];
 		}
+
+		accumulate_columns(acc_or, acc_and, vals, ncols);
 	}
 
-	for (i = 0; i < ctx->sz/4; i++) {
-		int found = 0;
-		uint32_t dword;
-		uint32_t pattern = 0;
-		uint32_t known_pattern = 0;
-		uint32_t known_pattern_color = 0;
-		uint32_t pmasks[32];
-		uint32_t pcolors[32];
-		const char *pnames[32];
-		int nparams = 0;
-
-		/* adjust offsets for fuzzy matching: */
-		adjust_offsets(ctx, i + offset, offsets);
-		j = offsets[idx] - offset;
-		while (j--)
-			printf("<font face=\"monospace\" color=\"#000000\">........</font><br>");
-		offset = offsets[idx];
+	for (c = 0; c < ncols; c++)
+		vals[c] = gaps[c] ? ~0 : (acc_or[c] ^ acc_and[c]);
 
-		dword = dwords[i];
+	col_patterns = realloc(col_patterns, (ncols + 1) * sizeof(int));
+	match_patterns(vals, col_patterns, ncols);
 
-		/* check for gpu address: */
-		j = find_gpuaddr(ctx, dword);
-		if (j >= 0) {
-			printf("<font face=\"monospace\">%04x: <font color=\"#%06x\"><b>%08x</b></font> (gpuaddr)</font><br>",
-					i, gpuaddr_colors[j], dword);
+	free(acc_or);
+	free(acc_and);
+	free(vals);
+	free(gaps);
+}
+
+/* align the cmdstreams in the current row, setting up ncols and the
+ * cols table of each ctx:
+ */
+static void align_cmdstreams(void)
+{
+	struct context *ref = NULL;
+	struct seq refseq;
+	int **maps = calloc(nctxts, sizeof(int *));
+	int *width, n, r, c, i, k;
+
+	for (k = 0; k < nctxts; k++) {
+		struct context *ctx = &ctxts[k];
+
+		if (!ctx->valid)
 			continue;
+
+		n = ctx->sz / 4;
+		ctx->gidx = realloc(ctx->gidx, (n + 1) * sizeof(int));
+		for (i = 0; i < n; i++)
+			ctx->gidx[i] = find_gpuaddr(ctx, ctx->buf[i]);
+
+		if (!ref)
+			ref = ctx;
+	}
+
+	if (!ref) {
+		ncols = 0;
+		free(maps);
+		return;
+	}
+
+	n = ref->sz / 4;
+	refseq = (struct seq){ ref->buf, ref->gidx };
+
+	/* pairwise against the reference, and how many columns need to be
+	 * inserted before each dword of the reference (or after the last):
+	 */
+	width = calloc(n + 1, sizeof(int));
+	for (k = 0; k < nctxts; k++) {
+		struct context *ctx = &ctxts[k];
+		struct seq seq = { ctx->buf, ctx->gidx };
+		int prev = -1;
+
+		if (!ctx->valid || (ctx == ref))
+			continue;
+
+		maps[k] = malloc(n * sizeof(int));
+		for (r = 0; r < n; r++)
+			maps[k][r] = -1;
+
+		align_region(&refseq, 0, n, &seq, 0, ctx->sz / 4, maps[k], 0);
+
+		for (r = 0; r < n; r++) {
+			if (maps[k][r] >= 0) {
+				width[r] = max(width[r], maps[k][r] - prev - 1);
+				prev = maps[k][r];
+			}
 		}
+		width[n] = max(width[n], ctx->sz / 4 - prev - 1);
+	}
 
-		/* check for similarity with other ctxts: */
-		j = find_pattern(dword, i + offset, offsets);
-		if (j >= 0)
-			pattern = patterns[j];
+	ncols = n;
+	for (r = 0; r <= n; r++)
+		ncols += width[r];
 
-		/* check for known patterns: */
-		for (j = 0; j < ARRAY_SIZE(known_patterns); j++) {
-			if (known_patterns[j].val == (dword & known_patterns[j].mask)) {
-				known_pattern = known_patterns[j].mask;
-				known_pattern_color = known_patterns[j].color;
-				break;
+	/* and merge: */
+	for (k = 0; k < nctxts; k++) {
+		struct context *ctx = &ctxts[k];
+		int prev = -1;
+
+		if (!ctx->valid)
+			continue;
+
+		ctx->cols = realloc(ctx->cols, (ncols + 1) * sizeof(int));
+
+		for (r = 0, c = 0; r <= n; r++) {
+			int next, ins = 0;
+
+			if (ctx == ref)
+				next = r;
+			else if (r < n)
+				next = maps[k][r];
+			else
+				next = ctx->sz / 4;
+
+			/* dwords with no match in the reference: */
+			if (next >= 0)
+				for (; prev + 1 + ins < next; ins++)
+					ctx->cols[c + ins] = prev + 1 + ins;
+			for (; ins < width[r]; ins++)
+				ctx->cols[c + ins] = -1;
+			c += width[r];
+
+			if (r < n) {
+				ctx->cols[c++] = next;
+				if (next >= 0)
+					prev = next;
 			}
 		}
+	}
 
-		/* check for recognized params: */
-		if (!known_pattern) {
-			for (j = 0; j < ctx->nparams; j++) {
-				struct param *param = &ctx->params[j];
-				int alignedlen = ALIGN(param->bitlen, 8);
-				uint64_t m = (uint64_t)(1 << param->bitlen) - 1;
-				uint32_t val = param->val;
-				/* ignore param vals of zero, to easy for false match: */
-				if (!val)
-					continue;
-				do {
-					if ((dword & m) == val) {
-						int n = nparams++;
-						pmasks[n]  = m;
-						pcolors[n] = param_colors[param->type];
-						pnames[n]  = param_names[param->type];
-						break;
-					}
-					m <<= alignedlen;
-					val <<= alignedlen;
-				} while (m & (uint64_t)0xffffffff);
+	for (k = 0; k < nctxts; k++)
+		free(maps[k]);
+	free(maps);
+	free(width);
+}
+
+/* classification of a dword in one column of the cmdstreams, shared by
+ * the html and compact output:
+ */
+struct dword_class {
+	int      idx;            /* dword offset in the cmdstream, or -1 for a gap */
+	uint32_t dword;
+	int      gpuaddr;        /* index into ctx->gpuaddrs, or -1 */
+	int      pattern;        /* index into patterns[], or -1 */
+	int      known;          /* index into known_patterns[], or -1 */
+	int      nparams;
+	uint32_t pmasks[32];
+	int      ptypes[32];
+};
+
+static void classify_dword(struct context *ctx, int c, struct dword_class *d)
+{
+	int i, j;
+
+	d->idx = ctx->valid ? ctx->cols[c] : -1;
+	d->dword = 0;
+	d->gpuaddr = -1;
+	d->pattern = -1;
+	d->known = -1;
+	d->nparams = 0;
+
+	i = d->idx;
+	if (i < 0)
+		return;
+
+	d->dword = ctx->buf[i];
+
+	/* check for gpu address: */
+	d->gpuaddr = ctx->gidx[i];
+	if (d->gpuaddr >= 0)
+		return;
+
+	/* check for similarity with other ctxts: */
+	d->pattern = col_patterns[c];
+
+	/* check for known patterns: */
+	for (j = 0; j < ARRAY_SIZE(known_patterns); j++) {
+		if (known_patterns[j].val == (d->dword & known_patterns[j].mask)) {
+			d->known = j;
+			return;
+		}
+	}
+
+	/* check for recognized params: */
+	for (j = 0; j < ctx->nparams; j++) {
+		struct param *param = &ctx->params[j];
+		int alignedlen = ALIGN(param->bitlen, 8);
+		uint64_t m = (uint64_t)(1 << param->bitlen) - 1;
+		uint32_t val = param->val;
+		/* ignore param vals of zero, to easy for false match: */
+		if (!val)
+			continue;
+		do {
+			if (((d->dword & m) == val) && (d->nparams < ARRAY_SIZE(d->pmasks))) {
+				int n = d->nparams++;
+				d->pmasks[n] = m;
+				d->ptypes[n] = param->type;
+				break;
 			}
+			m <<= alignedlen;
+			val <<= alignedlen;
+		} while (m & (uint64_t)0xffffffff);
+	}
+}
+
+static void handle_hexdump(struct context *ctx)
+{
+	struct dword_class d;
+	int c, j, k;
+
+	for (c = 0; c < ncols; c++) {
+		uint32_t pattern = 0;
+		uint32_t known_pattern = 0;
+		uint32_t known_pattern_color = 0;
+
+		classify_dword(ctx, c, &d);
+
+		if (d.idx < 0) {
+			printf("<font face=\"monospace\" color=\"#000000\">........</font><br>");
+			continue;
 		}
 
-		if (pattern || known_pattern || nparams) {
+		if (d.gpuaddr >= 0) {
+			printf("<font face=\"monospace\">%04x: <font color=\"#%06x\"><b>%08x</b></font> (gpuaddr)</font><br>",
+					d.idx, gpuaddr_colors[d.gpuaddr % ARRAY_SIZE(gpuaddr_colors)],
+					d.dword);
+			continue;
+		}
+
+		if (d.pattern >= 0)
+			pattern = patterns[d.pattern];
+
+		if (d.known >= 0) {
+			known_pattern = known_patterns[d.known].mask;
+			known_pattern_color = known_patterns[d.known].color;
+		}
+
+		if (pattern || known_pattern || d.nparams) {
 			uint32_t mask = 0xff000000;
 			uint32_t shift = 24;
 
-			printf("<font face=\"monospace\">%04x: ", i);
+			printf("<font face=\"monospace\">%04x: ", d.idx);
 
 			for (k = 0; k < 4; k++, mask >>= 8, shift -= 8) {
 				uint32_t color = 0;
@@ -349,30 +881,30 @@ static void handle_hexdump(struct context *ctx)
 				if (known_pattern & mask)
 					color = known_pattern_color;
 
-				for (j = 0; j < nparams; j++) {
-					if (mask & pmasks[j]) {
-						color = pcolors[j];
+				for (j = 0; j < d.nparams; j++) {
+					if (mask & d.pmasks[j]) {
+						color = param_colors[d.ptypes[j]];
 						printf("<b>");
 						break;
 					}
 				}
 
 				printf("<font color=\"#%06x\">%02x</font>",
-						color, (dword & mask) >> shift);
+						color, (d.dword & mask) >> shift);
 
-				for (j = 0; j < nparams; j++) {
-					if (mask & pmasks[j]) {
+				for (j = 0; j < d.nparams; j++) {
+					if (mask & d.pmasks[j]) {
 						printf("</b>");
 						break;
 					}
 				}
 			}
-			if (nparams > 0) {
+			if (d.nparams > 0) {
 				printf(" (");
-				for (j = 0; j < nparams; j++) {
+				for (j = 0; j < d.nparams; j++) {
 					if (j != 0)
 						printf(", ");
-					printf("%s", pnames[j]);
+					printf("%s", param_names[d.ptypes[j]]);
 				}
 				printf("?)");
 			}
@@ -380,7 +912,7 @@ static void handle_hexdump(struct context *ctx)
 			continue;
 		}
 
-		printf("<font face=\"monospace\" color=\"#000000\">%04x: %08x</font><br>", i, dword);
+		printf("<font face=\"monospace\" color=\"#000000\">%04x: %08x</font><br>", d.idx, d.dword);
 	}
 }
 
@@ -396,23 +928,15 @@ static void handle_cmdstream(struct context *ctx)
 
 static void handle_param(struct context *ctx)
 {
-	struct param *param = &ctx->params[ctx->nparams++];
-	param->type   = ctx->buf[0];
-	param->val    = ctx->buf[1];
-	param->bitlen = ctx->buf[2];
+	struct param *param = &ctx->params[ctx->nparams - 1];
 	printf("%s<br>", param_names[param->type]);
 	printf("<font color=\"#%06x\"><b>%08x</b></font><br>",
 			param_colors[param->type], param->val);
 	printf("(bitlen: %d)", param->bitlen);
-	if (param->val >= (1 << param->bitlen)) {
-		fprintf(stderr, "invalid param: %08x (name: %s, bitlen: %d)\n",
-				param->val, param_names[param->type], param->bitlen);
-	}
 }
 
 static void handle_flush(struct context *ctx)
 {
-	ctx->nparams = 0;
 }
 
 static void (*sect_handlers[])(struct context *ctx) = {
@@ -423,6 +947,9 @@ static void (*sect_handlers[])(struct context *ctx) = {
 	[RD_CMDSTREAM] = handle_cmdstream,
 	[RD_PARAM] = handle_param,
 	[RD_FLUSH] = handle_flush,
+	[RD_BUFFER_UNCHANGED] = handle_unchanged,
+	[RD_BUFFER_PARTIAL] = handle_partial,
+	[RD_IOCTL] = handle_ioctl,
 };
 
 static const char *sect_names[] = {
@@ -433,48 +960,387 @@ static const char *sect_names[] = {
 	[RD_CMDSTREAM] = "cmdstream",
 	[RD_PARAM]     = "param",
 	[RD_FLUSH]     = "flush",
+	[RD_BUFFER_UNCHANGED] = "unchanged",
+	[RD_BUFFER_PARTIAL] = "partial",
+	[RD_IOCTL] = "ioctl",
 };
 
-int main(int argc, char **argv)
+/* get the next section for the row, skipping the ones we don't compare: */
+static int next_section(struct context *ctx, struct rd_section *s)
 {
-	int i, n;
+	while ((rd_reader_tell(ctx->r) < ctx->end) && rd_reader_next(ctx->r, s))
+		if ((s->type < ARRAY_SIZE(sect_handlers)) && sect_handlers[s->type])
+			return 1;
+	return 0;
+}
+
+/*
+ * Output backends.  The html table is the default, but with a lot of
+ * ctxts or long cmdstreams it gets too big for a browser to open, so
+ * with -o the same rows are written in a compact form to a directory:
+ *
+ *   index.json         - the input files, number of rows, color tables
+ *   rows-NNNNNN.jsonl  - one json line per row, ROWS_PER_CHUNK rows per file
+ *   cmds-NNNNNN.bin    - the classified dwords of the cmdstream in row NNNNNN
+ *
+ * The .bin files are a struct cmds_header, followed by the columns in
+ * blocks of COLS_PER_BLOCK, each block holding the struct cmds_dword of
+ * every ctx in turn, so that a page of columns is one contiguous read.
+ * Everything is little endian.  util/redump-viewer.html loads these on
+ * demand.
+ */
+
+struct backend {
+	void (*start)(void);
+	void (*row)(enum rd_sect_type type);
+	void (*end)(void);
+};
+
+static void html_start(void)
+{
+	printf("<html><body><table border=\"1\">\n");
+}
+
+static void html_row(enum rd_sect_type type)
+{
+	int i;
+
+	printf("<tr><th>%s</th>", sect_names[type]);
+
+	for (i = 0; i < nctxts; i++) {
+		struct context *ctx = &ctxts[i];
+
+		printf("<td>");
+		if (ctx->valid)
+			sect_handlers[type](ctx);
+		printf("</td>");
+	}
+
+	printf("</tr>\n");
+}
+
+static void html_end(void)
+{
+	printf("</table></body></html>\n");
+}
+
+static const struct backend html_backend = {
+	.start = html_start,
+	.row   = html_row,
+	.end   = html_end,
+};
+
+#define ROWS_PER_CHUNK  1024
+#define COLS_PER_BLOCK  1024
+#define CMDS_MAGIC      0x53444d43   /* "CMDS" */
+
+struct cmds_header {
+	uint32_t magic, nctxts, ncols, block;
+};
+
+struct cmds_dword {
+	uint32_t idx;            /* dword offset in the cmdstream, or ~0 for a gap */
+	uint32_t dword;
+	int32_t  gpuaddr;        /* index into the ctx's gpuaddrs, or -1 */
+	int8_t   pattern;        /* index into patterns[], or -1 */
+	int8_t   known;          /* index into known_patterns[], or -1 */
+	uint16_t pad;
+	uint32_t params;         /* bitmask of the param types which matched */
+	uint8_t  pbytes[4];      /* param type + 1 coloring each byte, msb first */
+};
+
+static const char *outdir;
+static const char **files;
+static FILE *rows;
+static int nrows;
+
+static FILE *open_output(const char *fmt, int n)
+{
+	char path[PATH_MAX];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/", outdir);
+	snprintf(path + strlen(path), sizeof(path) - strlen(path), fmt, n);
+
+	f = fopen(path, "w");
+	if (!f) {
+		fprintf(stderr, "could not open: %s\n", path);
+		exit(-1);
+	}
+	/* the output is written in big sequential chunks: */
+	setvbuf(f, NULL, _IOFBF, 1 << 20);
+
+	return f;
+}
+
+static void json_string(FILE *f, const char *str, int len)
+{
+	int i;
+
+	fputc('"', f);
+	for (i = 0; (i < len) && str[i]; i++) {
+		unsigned char ch = str[i];
+		if ((ch == '"') || (ch == '\\'))
+			fprintf(f, "\\%c", ch);
+		else if (ch < 0x20)
+			fprintf(f, "\\u%04x", ch);
+		else
+			fputc(ch, f);
+	}
+	fputc('"', f);
+}
+
+static void json_cell(FILE *f, struct context *ctx, enum rd_sect_type type)
+{
+	const uint32_t *buf = ctx->buf;
+	struct rd_ioctl *rec;
+	struct param *param;
+
+	switch (type) {
+	case RD_TEST:
+	case RD_CMD:
+		fprintf(f, "{\"text\":");
+		json_string(f, (const char *)buf, ctx->sz);
+		fprintf(f, "}");
+		break;
+	case RD_GPUADDR:
+		fprintf(f, "{\"gpuaddr\":%u,\"len\":%u,\"idx\":%d}",
+				buf[0], buf[1], ctx->ngpuaddrs - 1);
+		break;
+	case RD_CMDSTREAM:
+		fprintf(f, "{\"len\":%d}", ctx->sz / 4);
+		break;
+	case RD_PARAM:
+		param = &ctx->params[ctx->nparams - 1];
+		fprintf(f, "{\"type\":%u,\"val\":%u,\"bitlen\":%u}",
+				param->type, param->val, param->bitlen);
+		break;
+	case RD_BUFFER_UNCHANGED:
+		fprintf(f, "{\"gpuaddr\":%u,\"submit\":%u}", buf[0], buf[3]);
+		break;
+	case RD_BUFFER_PARTIAL:
+		fprintf(f, "{\"gpuaddr\":%u,\"offset\":%u,\"len\":%u}",
+				buf[0], buf[3], buf[4]);
+		break;
+	case RD_IOCTL:
+		rec = (struct rd_ioctl *)buf;
+		fprintf(f, "{\"request\":%u", rec->request);
+		if (rec->dir != _IOC_WRITE)
+			fprintf(f, ",\"ret\":%d", rec->ret);
+		fprintf(f, "}");
+		break;
+	default:
+		fprintf(f, "{}");
+		break;
+	}
+}
+
+static void pack_dword(struct context *ctx, int c, struct cmds_dword *rec)
+{
+	struct dword_class d;
+	int j, k;
+
+	classify_dword(ctx, c, &d);
+
+	memset(rec, 0, sizeof(*rec));
+	rec->idx = d.idx;
+	rec->dword = d.dword;
+	rec->gpuaddr = d.gpuaddr;
+	rec->pattern = d.pattern;
+	rec->known = d.known;
+
+	for (j = 0; j < d.nparams; j++)
+		if (d.ptypes[j] < 32)
+			rec->params |= 1 << d.ptypes[j];
+
+	/* same as the html, the first param overlapping a byte colors it: */
+	for (k = 0; k < 4; k++) {
+		uint32_t mask = 0xff000000 >> (8 * k);
+		for (j = 0; j < d.nparams; j++) {
+			if (mask & d.pmasks[j]) {
+				rec->pbytes[k] = d.ptypes[j] + 1;
+				break;
+			}
+		}
+	}
+}
+
+static void write_cmds(int row)
+{
+	struct cmds_header hdr = {
+		.magic  = CMDS_MAGIC,
+		.nctxts = nctxts,
+		.ncols  = ncols,
+		.block  = COLS_PER_BLOCK,
+	};
+	struct cmds_dword *recs = malloc(COLS_PER_BLOCK * sizeof(*recs));
+	FILE *f = open_output("cmds-%06d.bin", row);
+	int b, c, k;
+
+	fwrite(&hdr, sizeof(hdr), 1, f);
+
+	for (b = 0; b < ncols; b += COLS_PER_BLOCK) {
+		int n = min(COLS_PER_BLOCK, ncols - b);
+		for (k = 0; k < nctxts; k++) {
+			for (c = 0; c < n; c++)
+				pack_dword(&ctxts[k], b + c, &recs[c]);
+			fwrite(recs, sizeof(*recs), n, f);
+		}
+	}
+
+	fclose(f);
+	free(recs);
+}
+
+static void compact_start(void)
+{
+	if (mkdir(outdir, 0755) && (errno != EEXIST)) {
+		fprintf(stderr, "could not create: %s\n", outdir);
+		exit(-1);
+	}
+}
+
+static void compact_row(enum rd_sect_type type)
+{
+	int i;
+
+	if (!(nrows % ROWS_PER_CHUNK)) {
+		if (rows)
+			fclose(rows);
+		rows = open_output("rows-%06d.jsonl", nrows / ROWS_PER_CHUNK);
+	}
 
-	for (i = 1; i < argc; i++) {
+	fprintf(rows, "{\"type\":\"%s\"", sect_names[type]);
+
+	if (type == RD_CMDSTREAM) {
+		write_cmds(nrows);
+		fprintf(rows, ",\"ncols\":%d,\"bin\":\"cmds-%06d.bin\"", ncols, nrows);
+	}
+
+	fprintf(rows, ",\"cells\":[");
+	for (i = 0; i < nctxts; i++) {
+		struct context *ctx = &ctxts[i];
+
+		if (i)
+			fputc(',', rows);
+		if (ctx->valid)
+			json_cell(rows, ctx, type);
+		else
+			fprintf(rows, "null");
+	}
+	fprintf(rows, "]}\n");
+
+	nrows++;
+}
+
+static void json_table(FILE *f, const char *name, const uint32_t *vals, int n)
+{
+	int i;
+
+	fprintf(f, ",\n\"%s\":[", name);
+	for (i = 0; i < n; i++)
+		fprintf(f, "%s%u", i ? "," : "", vals[i]);
+	fprintf(f, "]");
+}
+
+static void compact_end(void)
+{
+	FILE *f;
+	int i;
+
+	if (rows)
+		fclose(rows);
+
+	f = open_output("index.json", 0);
+
+	fprintf(f, "{\"version\":1,\"nrows\":%d,\"rows_per_chunk\":%d",
+			nrows, ROWS_PER_CHUNK);
+	fprintf(f, ",\n\"files\":[");
+	for (i = 0; i < nctxts; i++) {
+		if (i)
+			fputc(',', f);
+		json_string(f, files[i], strlen(files[i]));
+	}
+	fprintf(f, "]");
+
+	json_table(f, "patterns", patterns, ARRAY_SIZE(patterns));
+	json_table(f, "gpuaddr_colors", gpuaddr_colors, ARRAY_SIZE(gpuaddr_colors));
+	json_table(f, "param_colors", param_colors, ARRAY_SIZE(param_colors));
+
+	fprintf(f, ",\n\"param_names\":[");
+	for (i = 0; i < ARRAY_SIZE(param_names); i++) {
+		if (i)
+			fputc(',', f);
+		json_string(f, param_names[i], strlen(param_names[i]));
+	}
+	fprintf(f, "]");
+
+	fprintf(f, ",\n\"known_patterns\":[");
+	for (i = 0; i < ARRAY_SIZE(known_patterns); i++) {
+		fprintf(f, "%s{\"val\":%u,\"mask\":%u,\"color\":%u}", i ? "," : "",
+				known_patterns[i].val, known_patterns[i].mask,
+				known_patterns[i].color);
+	}
+	fprintf(f, "]}\n");
+
+	fclose(f);
+}
+
+static const struct backend compact_backend = {
+	.start = compact_start,
+	.row   = compact_row,
+	.end   = compact_end,
+};
+
+static unsigned int first = 0, last = ~0;
+static int range;
+static const struct backend *out = &html_backend;
+
+static int redump(int n, const char **paths)
+{
+	int i;
+
+	ctxts = calloc(n + 1, sizeof(*ctxts));
+	files = paths;
+
+	for (i = 0; i < n; i++) {
 		struct context *ctx = &ctxts[nctxts++];
-		ctx->fd = open(argv[i], O_RDONLY);
-		if (ctx->fd < 0) {
-			fprintf(stderr, "could not open: %s\n", argv[i]);
+		int fd = open(paths[i], O_RDONLY);
+		if (fd < 0) {
+			fprintf(stderr, "could not open: %s\n", paths[i]);
 			return -1;
 		}
+		ctx->r = rd_reader_open(fd);
+		if (!ctx->r)
+			return -1;
+		ctx->end = ~(uint64_t)0;
+		if (range && rd_reader_seek_submits(ctx->r, first, last, &ctx->end))
+			return -1;
 	}
 
-	printf("<html><body><table border=\"1\">\n");
+	out->start();
 	do {
 		enum rd_sect_type row_type = RD_NONE;
 
-		for (i = 0; i < nctxts; i++) {
+		for (i = 0, n = 0; i < nctxts; i++) {
 			struct context *ctx = &ctxts[i];
-			enum rd_sect_type type = RD_NONE;
+			struct rd_section s;
 
+			ctx->valid = 0;
 			ctx->sz = 0;
-			free(ctx->buf);
 			ctx->buf = NULL;
 
-			if ((read(ctx->fd, &type, sizeof(type)) > 0) &&
-					(read(ctx->fd, &ctx->sz, 4) > 0)) {
+			if (next_section(ctx, &s)) {
 				if (row_type == RD_NONE)
-					row_type = type;
-
-				if (type == row_type) {
-					/* allocate  bit extra, because there could be some optional
-					 * words in the cmdstreams, and they might not all be the
-					 * same size..
-					 */
-					ctx->buf = calloc(1, ctx->sz + 1 + 20);
-					read(ctx->fd, ctx->buf, ctx->sz);
-					((char *)ctx->buf)[ctx->sz] = '\0';
+					row_type = s.type;
+
+				if (s.type == row_type) {
+					ctx->valid = 1;
+					ctx->buf = s.data;
+					ctx->sz  = s.size;
+					n++;
 				} else {
-					fprintf(stderr, "unexpected type '%d', expected '%d'\n", type, row_type);
+					fprintf(stderr, "unexpected type '%d', expected '%d'\n", s.type, row_type);
 					return -1;
 				}
 			}
@@ -486,23 +1352,155 @@ int main(int argc, char **argv)
 			break;
 		}
 
-		printf("<tr><th>%s</th>", sect_names[row_type]);
-
-		for (i = 0, n = 0; i < nctxts; i++) {
-			struct context *ctx = &ctxts[i];
+		for (i = 0; i < nctxts; i++)
+			if (ctxts[i].valid)
+				track_section(&ctxts[i], row_type);
 
-			printf("<td>");
-			if (ctx->sz > 0) {
-				sect_handlers[row_type](ctx);
-				n++;
-			}
-			printf("</td>");
+		if (row_type == RD_CMDSTREAM) {
+			align_cmdstreams();
+			classify_columns();
 		}
 
-		printf("</tr>\n");
+		out->row(row_type);
 	} while(n > 0);
-	printf("</table></body></html>\n");
+	out->end();
 
 	return 0;
 }
 
+/*
+ * Batch mode, like run-redump.sh: the files are grouped by test name,
+ * which is the file name up to the first "-<digit>", and each group is
+ * compared to test.html (or with -o dir, to dir/test/).
+ */
+
+struct group {
+	char *name;
+	const char **paths;
+	int npaths;
+};
+
+static struct group *groups;
+static const char *batch_outdir;
+
+static char * test_name(const char *path)
+{
+	const char *base = strrchr(path, '/');
+	const char *p;
+	int len = strlen(path);
+
+	base = base ? base + 1 : path;
+	for (p = base; *p; p++) {
+		if ((p[0] == '-') && (p[1] >= '0') && (p[1] <= '9')) {
+			len = p - path;
+			break;
+		}
+	}
+
+	/* no "-<digit>", so the test is just the one file: */
+	if (!*p && (len > 3) && !strcmp(path + len - 3, ".rd"))
+		len -= 3;
+
+	return strndup(path, len);
+}
+
+static int group_files(char **paths, int n, const char ***names)
+{
+	int i, j, ngroups = 0;
+
+	groups = calloc(n + 1, sizeof(*groups));
+	*names = calloc(n + 1, sizeof(char *));
+
+	for (i = 0; i < n; i++) {
+		char *name = test_name(paths[i]);
+
+		for (j = 0; j < ngroups; j++)
+			if (!strcmp(groups[j].name, name))
+				break;
+
+		if (j == ngroups) {
+			groups[j].name = name;
+			groups[j].paths = calloc(n + 1, sizeof(char *));
+			(*names)[j] = name;
+			ngroups++;
+		} else {
+			free(name);
+		}
+
+		groups[j].paths[groups[j].npaths++] = paths[i];
+	}
+
+	return ngroups;
+}
+
+static int redump_job(int job, void *arg)
+{
+	struct group *g = &groups[job];
+	char path[PATH_MAX];
+
+	if (batch_outdir) {
+		const char *base = strrchr(g->name, '/');
+		if (mkdir(batch_outdir, 0755) && (errno != EEXIST)) {
+			fprintf(stderr, "could not create: %s\n", batch_outdir);
+			return -1;
+		}
+		snprintf(path, sizeof(path), "%s/%s", batch_outdir,
+				base ? base + 1 : g->name);
+		outdir = path;
+	} else {
+		snprintf(path, sizeof(path), "%s.html", g->name);
+		if (!freopen(path, "w", stdout)) {
+			fprintf(stderr, "could not open: %s\n", path);
+			return -1;
+		}
+	}
+
+	return redump(g->npaths, g->paths);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-s first[-last]] [-o dir] file.rd...\n", name);
+	fprintf(stderr, "       %s -b [-j workers] [-s first[-last]] [-o dir] dir|glob...\n", name);
+	exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+	int i, n, batch = 0, nworkers = batch_workers();
+	const char **names;
+	char **paths;
+
+	/* -s n, or -s first-last, to only compare some submits, -o dir for
+	 * the compact output, and -b to compare each group of files (from
+	 * dirs or globs) in parallel:
+	 */
+	for (i = 1; (i < argc) && (argv[i][0] == '-'); i++) {
+		if (!strcmp(argv[i], "-b")) {
+			batch = 1;
+		} else if (!strcmp(argv[i], "-s") && (i + 1 < argc) &&
+				!rd_index_parse_range(argv[i + 1], &first, &last)) {
+			range = 1;
+			i++;
+		} else if (!strcmp(argv[i], "-o") && (i + 1 < argc)) {
+			outdir = argv[++i];
+			out = &compact_backend;
+		} else if (!strcmp(argv[i], "-j") && (i + 1 < argc) &&
+				(atoi(argv[i + 1]) > 0)) {
+			nworkers = atoi(argv[++i]);
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	if (batch) {
+		batch_outdir = outdir;
+		n = batch_files(argc - i, &argv[i], &paths);
+		if (n < 0)
+			return -1;
+		n = group_files(paths, n, &names);
+		return batch_run(names, n, nworkers, redump_job, NULL);
+	}
+
+	return redump(argc - i, (const char **)&argv[i]);
+}
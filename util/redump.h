@@ -24,6 +24,8 @@
 #ifndef REDUMP_H_
 #define REDUMP_H_
 
+#include <stdint.h>
+
 enum rd_sect_type {
 	RD_NONE,
 	RD_TEST,       /* ascii text */
@@ -39,6 +41,52 @@ enum rd_sect_type {
 	RD_FRAG_SHADER,
 	RD_BUFFER_CONTENTS,
 	RD_GPU_ID,
+	RD_BUFFER_UNCHANGED, /* u32 gpuaddr, u32 size, u32 gpuaddr_hi, u32 submit */
+	RD_BUFFER_PARTIAL,   /* u32 gpuaddr, u32 size, u32 gpuaddr_hi, u32 offset,
+	                      * u32 len, followed by len bytes of new contents
+	                      * at offset, applied on top of the last contents
+	                      * written for the buffer */
+	RD_IOCTL,      /* struct rd_ioctl, followed by the raw ioctl struct */
+	RD_INDEX,      /* struct rd_index_entry[nsections], u32 submits[nsubmits],
+	                * struct rd_index_footer.  Optional, and only ever the
+	                * last section in the file */
+};
+
+/* RD_IOCTL record, for WRAP_IOCTL_LOG=binary.  The ioctl struct follows
+ * if it is copied in that direction (ie. _IOC_WRITE for pre, _IOC_READ
+ * for post), and is _IOC_SIZE(request) bytes:
+ */
+struct rd_ioctl {
+	uint32_t request;
+	int32_t  fd;
+	uint32_t dev;         /* 0: kgsl-3d, 1: kgsl-2d */
+	uint32_t dir;         /* _IOC_WRITE for pre, _IOC_READ for post */
+	int32_t  ret;         /* post only */
+	uint32_t pad;
+	uint64_t ts;          /* CLOCK_MONOTONIC, in ns */
+};
+
+/* RD_INDEX, table of contents so readers can seek straight to a submit.
+ * Offsets are in the (decompressed) rd stream, and point to the start of
+ * the section, ie. where the previous section ends.  Each entry in the
+ * submits[] table is the index of the first section of the submit.  To
+ * find the index, read the footer from the end of the file.
+ */
+struct rd_index_entry {
+	uint64_t offset;
+	uint32_t type;
+	uint32_t size;
+};
+
+#define RD_INDEX_MAGIC    0x58444952   /* "RIDX" */
+#define RD_INDEX_VERSION  1
+
+struct rd_index_footer {
+	uint64_t offset;      /* of the RD_INDEX section */
+	uint32_t nsections;
+	uint32_t nsubmits;
+	uint32_t version;
+	uint32_t magic;
 };
 
 /* RD_PARAM types: */
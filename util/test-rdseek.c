@@ -0,0 +1,186 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Decoding a range of submits from an a5xx capture, the way rdstate and
+ * rdreplay do with -s.  The RD_GPU_ID is before the range, but the pkt4
+ * and pkt7 packets in it should still decode as a5xx, which they do not
+ * with the a3xx default.  Runs without a gpu:
+ *
+ *   test-rdseek [file.rd]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <assert.h>
+
+#include "libpm4.h"
+#include "adreno_pm4.xml.h"
+
+#define CMDS_ADDR   0x1c0000000ull
+#define HLSQ_REG    0x0e00    /* REG_A5XX_HLSQ_TIMEOUT_THRESHOLD_0 */
+#define NSUBMITS    3
+
+struct stats {
+	unsigned int submits, draws, errors, named;
+};
+
+static void write_section(FILE *f, uint32_t type, const void *buf, uint32_t sz)
+{
+	uint32_t hdr[4] = { ~0, ~0, type, sz };
+	fwrite(hdr, sizeof(hdr), 1, f);
+	fwrite(buf, sz, 1, f);
+}
+
+static int generate(const char *name)
+{
+	uint32_t gpu_id = 530;
+	unsigned int n;
+	FILE *f;
+
+	f = fopen(name, "w");
+	if (!f) {
+		fprintf(stderr, "could not create: %s\n", name);
+		return -1;
+	}
+
+	write_section(f, RD_TEST, "test-rdseek", 11);
+	write_section(f, RD_GPU_ID, &gpu_id, 4);
+
+	for (n = 0; n < NSUBMITS; n++) {
+		uint64_t addr = CMDS_ADDR + (n * 0x1000);
+		uint32_t cmds[] = {
+			CP_TYPE4_PKT | (HLSQ_REG << 8) | 1,
+			n,
+			CP_TYPE7_PKT | (CP_DRAW_INDX_OFFSET << 16) | 3,
+			0, 1, 3,
+		};
+		uint32_t gpuaddr[3] = { addr, sizeof(cmds), addr >> 32 };
+		uint32_t cmdstream[3] = { addr, sizeof(cmds) / 4, addr >> 32 };
+
+		write_section(f, RD_GPUADDR, gpuaddr, sizeof(gpuaddr));
+		write_section(f, RD_BUFFER_CONTENTS, cmds, sizeof(cmds));
+		write_section(f, RD_CMDSTREAM_ADDR, cmdstream, sizeof(cmdstream));
+	}
+
+	fclose(f);
+
+	return 0;
+}
+
+static void count(const struct pm4_event *ev, void *arg)
+{
+	struct stats *st = arg;
+
+	switch (ev->type) {
+	case PM4_SUBMIT:
+		st->submits++;
+		break;
+	case PM4_PKT3:
+		if (ev->opcode == CP_DRAW_INDX_OFFSET)
+			st->draws++;
+		break;
+	case PM4_REG:
+		if (ev->info && !strcmp(ev->info->name, "HLSQ_TIMEOUT_THRESHOLD_0"))
+			st->named++;
+		break;
+	case PM4_ERROR:
+		st->errors++;
+		break;
+	default:
+		break;
+	}
+}
+
+/* same as rdstate, with seek set if -s was given: */
+static int check(const char *name, int seek, unsigned int first,
+		unsigned int last)
+{
+	unsigned int n = seek ? (last - first + 1) : NSUBMITS;
+	uint64_t end = ~(uint64_t)0;
+	struct stats st = {0};
+	struct pm4_decoder *d;
+	struct rd_reader *r;
+	int ret = 0;
+
+	r = rd_reader_open(open(name, O_RDONLY));
+	if (!r) {
+		fprintf(stderr, "could not open: %s\n", name);
+		return -1;
+	}
+
+	if (seek && rd_reader_seek_submits(r, first, last, &end)) {
+		rd_reader_close(r);
+		return -1;
+	}
+
+	if (seek && (rd_reader_gpu_id(r) != 530)) {
+		fprintf(stderr, "-s %u-%u: gpu id %u, expected 530\n", first, last,
+				rd_reader_gpu_id(r));
+		ret = -1;
+	}
+
+	d = pm4_decoder_new(320);
+	if (rd_reader_gpu_id(r))
+		pm4_set_gpu_id(d, rd_reader_gpu_id(r));
+	pm4_decode_rd(d, r, end, count, &st);
+
+	if ((st.submits != n) || (st.draws != n) || (st.named != n) ||
+			st.errors) {
+		fprintf(stderr, "%s%u-%u: %u submits, %u draws, %u named regs, "
+				"%u errors, expected %u of each and no errors\n",
+				seek ? "-s " : "", first, last, st.submits, st.draws,
+				st.named, st.errors, n);
+		ret = -1;
+	}
+
+	pm4_decoder_free(d);
+	rd_reader_close(r);
+
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	const char *name = (argc > 1) ? argv[1] : "test-rdseek.rd";
+	int ret = 0;
+
+	if (generate(name))
+		return -1;
+
+	ret |= check(name, 0, 0, NSUBMITS - 1);
+	ret |= check(name, 1, 1, 2);
+	ret |= check(name, 1, 2, 2);
+
+	unlink(name);
+
+	if (ret)
+		return -1;
+
+	printf("ok\n");
+
+	return 0;
+}
@@ -30,7 +30,8 @@
 #include <fcntl.h>
 #include <string.h>
 
-#include "redump.h"
+#include "librd.h"
+#include "batch.h"
 
 #include "freedreno_z1xx.h"
 
@@ -124,13 +125,13 @@ static const struct {
 
 static void dump_register(uint32_t reg, uint32_t dword)
 {
-	if (regs[reg].name)
+	if ((reg < ARRAY_SIZE(regs)) && regs[reg].name)
 		regs[reg].dump(regs[reg].name, dword);
 	else
 		printf("\tunknown(%02x): %08x (%d)\n", reg, dword, dword);
 }
 
-static void dump_cmdstream(uint32_t *dwords, uint32_t sizedwords)
+static void dump_cmdstream(const uint32_t *dwords, uint32_t sizedwords)
 {
 	int i, j;
 	for (i = 0; i < sizedwords; i++) {
@@ -175,32 +176,33 @@ static const char *param_names[] = {
 		"",
 };
 
-static void dump_file(int fd)
+static void dump_file(struct rd_reader *r, uint64_t end)
 {
-	enum rd_sect_type type = RD_NONE;
-	void *buf = NULL;
-	int sz;
+	struct rd_section s;
 
-	while ((read(fd, &type, sizeof(type)) > 0) && (read(fd, &sz, 4) > 0)) {
-		free(buf);
+	while ((rd_reader_tell(r) < end) && rd_reader_next(r, &s)) {
+		const uint32_t *dwords = s.data;
 
-		buf = malloc(sz + 1);
-		((char *)buf)[sz] = '\0';
-		read(fd, buf, sz);
-
-		switch(type) {
+		switch(s.type) {
 		case RD_TEST:
-			printf("test: %s\n", (char *)buf);
+			printf("test: %.*s\n", s.size, (const char *)s.data);
 			break;
 		case RD_CMD:
-			printf("cmd: %s\n", (char *)buf);
+			printf("cmd: %.*s\n", s.size, (const char *)s.data);
 			break;
 		case RD_CMDSTREAM:
-			dump_cmdstream(buf, sz/4);
+			dump_cmdstream(dwords, s.size/4);
 			break;
 		case RD_PARAM:
-			printf("param: %s: %u\n", param_names[((uint32_t *)buf)[0]],
-					((uint32_t *)buf)[1]);
+			printf("param: %s: %u\n", param_names[dwords[0]], dwords[1]);
+			break;
+		case RD_BUFFER_UNCHANGED:
+			printf("unchanged: %08x%08x (len: %x), since submit %u\n",
+					dwords[2], dwords[0], dwords[1], dwords[3]);
+			break;
+		case RD_BUFFER_PARTIAL:
+			printf("partial: %08x%08x (len: %x), %x bytes at +%x\n",
+					dwords[2], dwords[0], dwords[1], dwords[4], dwords[3]);
 			break;
 		default:
 			break;
@@ -208,18 +210,89 @@ static void dump_file(int fd)
 	}
 }
 
+static unsigned int first = 0, last = ~0;
+static int range;
+
+static int dump_path(const char *path)
+{
+	uint64_t end = ~(uint64_t)0;
+	struct rd_reader *r;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "could not open: %s\n", path);
+		return -1;
+	}
+	r = rd_reader_open(fd);
+	if (!r)
+		return -1;
+	if (range && rd_reader_seek_submits(r, first, last, &end)) {
+		rd_reader_close(r);
+		return -1;
+	}
+	dump_file(r, end);
+	rd_reader_close(r);
+	return 0;
+}
+
+/* batch mode, foo.rd is dumped to foo.z: */
+static int dump_job(int job, void *arg)
+{
+	const char *path = ((char **)arg)[job];
+	int len = strlen(path);
+	char *out = malloc(len + 3);
+
+	if ((len > 3) && !strcmp(path + len - 3, ".rd"))
+		len -= 3;
+	sprintf(out, "%.*s.z", len, path);
+
+	if (!freopen(out, "w", stdout)) {
+		fprintf(stderr, "could not open: %s\n", out);
+		return -1;
+	}
+
+	return dump_path(path);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-s first[-last]] file.rd...\n", name);
+	fprintf(stderr, "       %s -b [-j workers] [-s first[-last]] dir|glob...\n", name);
+	exit(-1);
+}
+
 int main(int argc, char **argv)
 {
-	int i;
+	int i, n, batch = 0, nworkers = batch_workers();
+	char **files;
 
-	for (i = 1; i < argc; i++) {
-		int fd = open(argv[i], O_RDONLY);
-		if (fd < 0) {
-			fprintf(stderr, "could not open: %s\n", argv[1]);
-			return -1;
+	/* -s n, or -s first-last, to only dump some submits, and -b to dump
+	 * each file (or each .rd in a dir, or glob) to a .z file in parallel:
+	 */
+	for (i = 1; (i < argc) && (argv[i][0] == '-'); i++) {
+		if (!strcmp(argv[i], "-b")) {
+			batch = 1;
+		} else if (!strcmp(argv[i], "-s") && (i + 1 < argc) &&
+				!rd_index_parse_range(argv[i + 1], &first, &last)) {
+			range = 1;
+			i++;
+		} else if (!strcmp(argv[i], "-j") && (i + 1 < argc) &&
+				(atoi(argv[i + 1]) > 0)) {
+			nworkers = atoi(argv[++i]);
+		} else {
+			usage(argv[0]);
 		}
-		dump_file(fd);
 	}
 
+	if (batch) {
+		n = batch_files(argc - i, &argv[i], &files);
+		if (n < 0)
+			return -1;
+		return batch_run((const char **)files, n, nworkers, dump_job, files);
+	}
+
+	for (; i < argc; i++)
+		if (dump_path(argv[i]))
+			return -1;
+
 	return 0;
 }
@@ -0,0 +1,434 @@
+/*
+ * Copyright (c) 2012 Rob Clark <robdclark@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Microbenchmarks for libwrap's kgsl emulation.  Run under libwrapfake,
+ * with libwrap's logging thrown away, ie:
+ *
+ *   TESTNAME=bench TESTNUM=0 WRAP_GPU_ID=330 WRAP_GMEM_SIZE=0x100000 \
+ *       LD_PRELOAD=`pwd`/libwrapfake.so ./bench-fake buffers 100000 > /dev/null
+ *
+ * Results are reported on stderr.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#define __user
+#include "msm_kgsl.h"
+#include "adreno_pm4.xml.h"
+
+static int fd;
+static unsigned int gpu_id;
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void report(const char *name, uint64_t start, unsigned int n)
+{
+	uint64_t ns = now() - start;
+	fprintf(stderr, "%-16s %8u ops, %10.3f ms, %8.1f ns/op\n", name, n,
+			ns / 1000000.0, (double)ns / n);
+}
+
+static void report_mb(const char *name, uint64_t start, uint64_t bytes)
+{
+	uint64_t ns = now() - start;
+	fprintf(stderr, "%-16s %8.1f MB/s\n", name,
+			(bytes / (1024.0 * 1024.0)) / (ns / 1000000000.0));
+}
+
+static void open_device(void)
+{
+	struct kgsl_devinfo devinfo = {0};
+	struct kgsl_device_getproperty getprop = {
+			.type = KGSL_PROP_DEVICE_INFO,
+			.value = &devinfo,
+			.sizebytes = sizeof(devinfo),
+	};
+
+	fd = open("/dev/kgsl-3d0", O_RDWR);
+	if (fd < 0) {
+		fprintf(stderr, "could not open kgsl device\n");
+		exit(-1);
+	}
+
+	ioctl(fd, IOCTL_KGSL_DEVICE_GETPROPERTY, &getprop);
+	gpu_id = devinfo.gpu_id;
+}
+
+struct bo {
+	struct kgsl_gpumem_alloc_id req;
+	uint32_t *map;
+};
+
+static void bo_new(struct bo *bo, unsigned int size)
+{
+	bo->req.size = size;
+	ioctl(fd, IOCTL_KGSL_GPUMEM_ALLOC_ID, &bo->req);
+	bo->map = mmap(NULL, bo->req.mmapsize, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, (off_t)bo->req.id << 12);
+	memset(bo->map, 0, size);
+}
+
+static void bo_del(struct bo *bo)
+{
+	struct kgsl_gpumem_free_id req = {
+			.id = bo->req.id,
+	};
+	munmap(bo->map, bo->req.mmapsize);
+	ioctl(fd, IOCTL_KGSL_GPUMEM_FREE_ID, &req);
+}
+
+static inline unsigned int odd_parity_bit(unsigned int val)
+{
+	val ^= val >> 16;
+	val ^= val >> 8;
+	val ^= val >> 4;
+	val &= 0xf;
+	return (~0x6996 >> val) & 1;
+}
+
+/* emit a register write (type0/pkt4) of a single gpuaddr: */
+static uint32_t * out_reg_addr(uint32_t *cmd, uint32_t reg, uint64_t gpuaddr)
+{
+	if (gpu_id >= 500) {
+		*cmd++ = CP_TYPE4_PKT | 2 | (odd_parity_bit(2) << 7) |
+				(reg << 8) | (odd_parity_bit(reg) << 27);
+		*cmd++ = gpuaddr;
+		*cmd++ = gpuaddr >> 32;
+	} else {
+		*cmd++ = CP_TYPE0_PKT | reg;
+		*cmd++ = gpuaddr;
+	}
+	return cmd;
+}
+
+/* emit a call to an IB: */
+static uint32_t * out_ib(uint32_t *cmd, uint64_t gpuaddr, uint32_t sizedwords)
+{
+	if (gpu_id >= 500) {
+		*cmd++ = CP_TYPE7_PKT | 3 | (odd_parity_bit(3) << 15) |
+				(CP_INDIRECT_BUFFER_PFE << 16) |
+				(odd_parity_bit(CP_INDIRECT_BUFFER_PFE) << 23);
+		*cmd++ = gpuaddr;
+		*cmd++ = gpuaddr >> 32;
+		*cmd++ = sizedwords;
+	} else {
+		*cmd++ = CP_TYPE3_PKT | (1 << 16) | (CP_INDIRECT_BUFFER_PFE << 8);
+		*cmd++ = gpuaddr;
+		*cmd++ = sizedwords;
+	}
+	return cmd;
+}
+
+/* register (alloc + mmap) and look up (munmap + free) lots of buffers,
+ * to measure the cost of libwrap's buffer tracking:
+ */
+static void bench_buffers(unsigned int n)
+{
+	struct kgsl_gpumem_alloc_id *allocs = calloc(n, sizeof(*allocs));
+	void **ptrs = calloc(n, sizeof(*ptrs));
+	uint64_t start;
+	unsigned int i;
+
+	start = now();
+	for (i = 0; i < n; i++) {
+		allocs[i].size = 0x1000;
+		ioctl(fd, IOCTL_KGSL_GPUMEM_ALLOC_ID, &allocs[i]);
+	}
+	report("alloc", start, n);
+
+	start = now();
+	for (i = 0; i < n; i++) {
+		ptrs[i] = mmap(NULL, allocs[i].mmapsize, PROT_READ | PROT_WRITE,
+				MAP_SHARED, fd, (off_t)allocs[i].id << 12);
+	}
+	report("mmap", start, n);
+
+	start = now();
+	for (i = 0; i < n; i++)
+		munmap(ptrs[i], allocs[i].mmapsize);
+	report("munmap", start, n);
+
+	start = now();
+	for (i = 0; i < n; i++) {
+		struct kgsl_gpumem_free_id req = {
+				.id = allocs[i].id,
+		};
+		ioctl(fd, IOCTL_KGSL_GPUMEM_FREE_ID, &req);
+	}
+	report("free", start, n);
+
+	free(allocs);
+	free(ptrs);
+}
+
+/* submit a synthetic cmdstream, where the IB1 references one buffer and
+ * calls an IB2 which references another, with lots of other buffers
+ * which are not referenced but get a dword changed between submits:
+ */
+static void bench_submit(unsigned int nbufs, unsigned int nsubmits,
+		unsigned int size)
+{
+	struct bo *bos = calloc(nbufs + 4, sizeof(*bos));
+	uint32_t *cmd, *ib1, *ib2;
+	uint64_t start;
+	unsigned int i, j;
+
+	for (i = 0; i < nbufs + 4; i++)
+		bo_new(&bos[i], (i < 4) ? 0x1000 : size);
+
+	ib2 = cmd = bos[1].map;
+	cmd = out_reg_addr(cmd, 0x2100, bos[3].req.gpuaddr);
+	ib2 = (uint32_t *)(cmd - ib2);
+
+	ib1 = cmd = bos[0].map;
+	cmd = out_reg_addr(cmd, 0x2100, bos[2].req.gpuaddr);
+	cmd = out_ib(cmd, bos[1].req.gpuaddr, (uintptr_t)ib2);
+	ib1 = (uint32_t *)(cmd - ib1);
+
+	start = now();
+	for (i = 0; i < nsubmits; i++) {
+		struct kgsl_ibdesc ibdesc = {
+				.gpuaddr = bos[0].req.gpuaddr,
+				.sizedwords = (uintptr_t)ib1,
+		};
+		struct kgsl_submit_commands req = {
+				.cmdlist = &ibdesc,
+				.numcmds = 1,
+		};
+
+		for (j = 4; j < nbufs + 4; j++)
+			bos[j].map[i % (size / 4)] = i;
+
+		ioctl(fd, IOCTL_KGSL_SUBMIT_COMMANDS, &req);
+	}
+	report("submit", start, nsubmits);
+	report_mb("buffer data", start, (uint64_t)nsubmits *
+			((4 * 0x1000) + ((uint64_t)nbufs * size)));
+
+	for (i = 0; i < nbufs + 4; i++)
+		bo_del(&bos[i]);
+	free(bos);
+}
+
+/*
+ * Stress test for the emulated gpu address space and buffer ids: randomly
+ * (but reproducibly) allocate and free buffers of varying size/alignment,
+ * through both GPUMEM_ALLOC_ID and GPUOBJ_ALLOC/INFO, checking that live
+ * buffers never overlap and ids are never handed out twice.  The checksum
+ * of all the addresses handed out should be the same for every run.
+ */
+
+#define CHURN_SLOTS 1024
+
+struct churn_bo {
+	uint64_t gpuaddr, size;
+	unsigned int id;
+	int gpuobj;
+};
+
+static uint32_t churn_rand(void)
+{
+	static uint64_t seed = 0x2545f4914f6cdd1dull;
+	seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+	return seed >> 33;
+}
+
+static int cmp_gpuaddr(const void *a, const void *b)
+{
+	const struct churn_bo *x = *(const struct churn_bo **)a;
+	const struct churn_bo *y = *(const struct churn_bo **)b;
+	return (x->gpuaddr > y->gpuaddr) - (x->gpuaddr < y->gpuaddr);
+}
+
+static int churn_check(struct churn_bo *slots)
+{
+	struct churn_bo *live[CHURN_SLOTS];
+	int i, n = 0, errors = 0;
+
+	for (i = 0; i < CHURN_SLOTS; i++)
+		if (slots[i].id)
+			live[n++] = &slots[i];
+
+	qsort(live, n, sizeof(live[0]), cmp_gpuaddr);
+
+	for (i = 1; i < n; i++) {
+		if (live[i - 1]->gpuaddr + live[i - 1]->size > live[i]->gpuaddr) {
+			fprintf(stderr, "overlap: %016"PRIx64"+%"PRIx64" and %016"PRIx64"\n",
+					live[i - 1]->gpuaddr, live[i - 1]->size, live[i]->gpuaddr);
+			errors++;
+		}
+	}
+
+	return errors;
+}
+
+static void bench_churn(unsigned int n)
+{
+	struct churn_bo *slots = calloc(CHURN_SLOTS, sizeof(*slots));
+	unsigned char *used_ids = NULL;
+	unsigned int i, nids = 0, max_id = 0, errors = 0;
+	uint64_t start, csum = 0;
+
+	start = now();
+	for (i = 0; i < n; i++) {
+		struct churn_bo *bo = &slots[churn_rand() % CHURN_SLOTS];
+
+		if (bo->id) {
+			if (bo->gpuobj) {
+				struct kgsl_gpuobj_free req = { .id = bo->id };
+				ioctl(fd, IOCTL_KGSL_GPUOBJ_FREE, &req);
+			} else {
+				struct kgsl_gpumem_free_id req = { .id = bo->id };
+				ioctl(fd, IOCTL_KGSL_GPUMEM_FREE_ID, &req);
+			}
+			used_ids[bo->id] = 0;
+			bo->id = 0;
+		} else {
+			/* mostly small, with the occasional big one: */
+			uint64_t size = 0x100 << (churn_rand() % ((churn_rand() % 8) ? 8 : 13));
+			unsigned int align = (churn_rand() % 4) ? 0 : (12 + churn_rand() % 5);
+			uint64_t flags = (uint64_t)align << KGSL_MEMALIGN_SHIFT;
+
+			bo->gpuobj = churn_rand() % 2;
+			if (bo->gpuobj) {
+				struct kgsl_gpuobj_alloc req = { .size = size, .flags = flags };
+				struct kgsl_gpuobj_info info = {0};
+				ioctl(fd, IOCTL_KGSL_GPUOBJ_ALLOC, &req);
+				info.id = req.id;
+				ioctl(fd, IOCTL_KGSL_GPUOBJ_INFO, &info);
+				bo->id = req.id;
+				bo->gpuaddr = info.gpuaddr;
+			} else {
+				struct kgsl_gpumem_alloc_id req = { .size = size, .flags = flags };
+				ioctl(fd, IOCTL_KGSL_GPUMEM_ALLOC_ID, &req);
+				bo->id = req.id;
+				bo->gpuaddr = req.gpuaddr;
+			}
+			bo->size = size;
+
+			if (!bo->gpuaddr || (align && (bo->gpuaddr & ((1 << align) - 1)))) {
+				fprintf(stderr, "bad gpuaddr: %016"PRIx64" (size=%"PRIx64", align=%u)\n",
+						bo->gpuaddr, size, align);
+				errors++;
+			}
+
+			if (bo->id >= nids) {
+				unsigned int old = nids;
+				nids = (bo->id + 1) * 2;
+				used_ids = realloc(used_ids, nids);
+				memset(used_ids + old, 0, nids - old);
+			}
+			if (!bo->id || used_ids[bo->id]) {
+				fprintf(stderr, "bad id: %u\n", bo->id);
+				errors++;
+			}
+			used_ids[bo->id] = 1;
+			if (bo->id > max_id)
+				max_id = bo->id;
+
+			csum = (csum * 31) ^ bo->gpuaddr;
+		}
+
+		if (!(i % 100000))
+			errors += churn_check(slots);
+	}
+	errors += churn_check(slots);
+	report("churn", start, n);
+
+	fprintf(stderr, "max id: %u, checksum: %016"PRIx64", %u errors\n",
+			max_id, csum, errors);
+
+	free(used_ids);
+	free(slots);
+
+	if (errors)
+		exit(1);
+}
+
+/* cheap ioctls, to see the overhead of logging them: */
+static void bench_ioctl(unsigned int n)
+{
+	struct kgsl_devinfo devinfo = {0};
+	struct kgsl_device_getproperty req = {
+			.type = KGSL_PROP_DEVICE_INFO,
+			.value = &devinfo,
+			.sizebytes = sizeof(devinfo),
+	};
+	uint64_t start;
+	unsigned int i;
+
+	start = now();
+	for (i = 0; i < n; i++)
+		ioctl(fd, IOCTL_KGSL_DEVICE_GETPROPERTY, &req);
+	report("ioctl", start, n);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s buffers [count]\n", name);
+	fprintf(stderr, "       %s submit [nbufs] [nsubmits] [bufsize]\n", name);
+	fprintf(stderr, "       %s ioctl [count]\n", name);
+	fprintf(stderr, "       %s churn [count]\n", name);
+	exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+		usage(argv[0]);
+
+	open_device();
+
+	if (!strcmp(argv[1], "buffers")) {
+		bench_buffers((argc > 2) ? strtol(argv[2], NULL, 0) : 100000);
+	} else if (!strcmp(argv[1], "churn")) {
+		bench_churn((argc > 2) ? strtol(argv[2], NULL, 0) : 1000000);
+	} else if (!strcmp(argv[1], "ioctl")) {
+		bench_ioctl((argc > 2) ? strtol(argv[2], NULL, 0) : 100000);
+	} else if (!strcmp(argv[1], "submit")) {
+		bench_submit((argc > 2) ? strtol(argv[2], NULL, 0) : 64,
+				(argc > 3) ? strtol(argv[3], NULL, 0) : 100,
+				(argc > 4) ? strtol(argv[4], NULL, 0) : 0x10000);
+	} else {
+		usage(argv[0]);
+	}
+
+	close(fd);
+
+	return 0;
+}
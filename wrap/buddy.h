@@ -0,0 +1,153 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _BUDDY_H_
+#define _BUDDY_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* simple binary buddy allocator, for address ranges.  Blocks are powers
+ * of two (so naturally aligned to their size), from 1 << min_order up to
+ * the whole range.  Free blocks of each size are kept in a LIFO list, so
+ * placement only depends on the sequence of allocs and frees, which keeps
+ * it deterministic.
+ *
+ * Book-keeping is in arrays indexed by the smallest block, so the range
+ * should not be huge compared to the smallest block.
+ */
+
+#define BUDDY_NIL  0xffffffff
+#define BUDDY_FREE 0x80
+
+struct buddy {
+	uint64_t base;
+	unsigned int min_order, top;  /* top: order of whole range, relative to min */
+	/* per smallest block: zero if not the start of a block, else
+	 * the block's order + 1, plus BUDDY_FREE if it is free:
+	 */
+	uint8_t *state;
+	uint32_t *next, *prev;        /* free list links */
+	uint32_t heads[32];           /* free list per order */
+};
+
+static inline void buddy_push(struct buddy *b, uint32_t idx, unsigned int k)
+{
+	b->next[idx] = b->heads[k];
+	b->prev[idx] = BUDDY_NIL;
+	if (b->heads[k] != BUDDY_NIL)
+		b->prev[b->heads[k]] = idx;
+	b->heads[k] = idx;
+	b->state[idx] = (k + 1) | BUDDY_FREE;
+}
+
+static inline void buddy_unlink(struct buddy *b, uint32_t idx, unsigned int k)
+{
+	if (b->prev[idx] != BUDDY_NIL)
+		b->next[b->prev[idx]] = b->next[idx];
+	else
+		b->heads[k] = b->next[idx];
+	if (b->next[idx] != BUDDY_NIL)
+		b->prev[b->next[idx]] = b->prev[idx];
+	b->state[idx] = 0;
+}
+
+static inline void buddy_init(struct buddy *b, uint64_t base,
+		unsigned int min_order, unsigned int max_order)
+{
+	uint32_t n = 1 << (max_order - min_order);
+	unsigned int k;
+
+	b->base = base;
+	b->min_order = min_order;
+	b->top = max_order - min_order;
+	b->state = calloc(n, sizeof(*b->state));
+	b->next = calloc(n, sizeof(*b->next));
+	b->prev = calloc(n, sizeof(*b->prev));
+	for (k = 0; k < sizeof(b->heads) / sizeof(b->heads[0]); k++)
+		b->heads[k] = BUDDY_NIL;
+
+	buddy_push(b, 0, b->top);
+}
+
+/* returns zero if there is no free block big enough: */
+static inline uint64_t buddy_alloc(struct buddy *b, uint64_t size, uint64_t align)
+{
+	unsigned int k = 0, j;
+	uint32_t idx;
+
+	if (align > size)
+		size = align;
+
+	while ((k <= b->top) && ((1ull << (b->min_order + k)) < size))
+		k++;
+
+	for (j = k; (j <= b->top) && (b->heads[j] == BUDDY_NIL); j++)
+		;
+
+	if (j > b->top)
+		return 0;
+
+	idx = b->heads[j];
+	buddy_unlink(b, idx, j);
+
+	/* split, keeping the lower half: */
+	while (j > k) {
+		j--;
+		buddy_push(b, idx + (1 << j), j);
+	}
+
+	b->state[idx] = k + 1;
+
+	return b->base + ((uint64_t)idx << b->min_order);
+}
+
+/* returns non-zero if addr is not the start of an allocated block: */
+static inline int buddy_free(struct buddy *b, uint64_t addr)
+{
+	uint32_t idx = (addr - b->base) >> b->min_order;
+	unsigned int k;
+
+	if ((addr < b->base) || (idx >> b->top) ||
+			!b->state[idx] || (b->state[idx] & BUDDY_FREE))
+		return -1;
+
+	k = b->state[idx] - 1;
+	b->state[idx] = 0;
+
+	/* merge with the buddy for as long as it is free: */
+	while (k < b->top) {
+		uint32_t bud = idx ^ (1 << k);
+		if (b->state[bud] != ((k + 1) | BUDDY_FREE))
+			break;
+		buddy_unlink(b, bud, k);
+		idx &= ~(1 << k);
+		k++;
+	}
+
+	buddy_push(b, idx, k);
+
+	return 0;
+}
+
+#endif /* _BUDDY_H_ */
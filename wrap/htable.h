@@ -0,0 +1,109 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _HTABLE_H_
+#define _HTABLE_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* intrusive chained hash table keyed on u32, which grows as entries are
+ * added.  Duplicate keys are allowed, lookup visits every match.
+ */
+struct htable_node {
+	struct htable_node *next;
+	uint32_t key;
+};
+
+struct htable {
+	struct htable_node **buckets;
+	unsigned int size, count;   /* size is always power of two */
+};
+
+#define HTABLE_INIT { NULL, 0, 0 }
+
+static inline unsigned int htable_hash(uint32_t key, unsigned int size)
+{
+	/* fibonacci hashing, ids and handles tend to be sequential: */
+	return ((key * 0x9e3779b1u) >> 7) & (size - 1);
+}
+
+static void htable_resize(struct htable *t, unsigned int size)
+{
+	struct htable_node **buckets = calloc(size, sizeof(*buckets));
+	unsigned int i;
+
+	for (i = 0; i < t->size; i++) {
+		struct htable_node *n = t->buckets[i];
+		while (n) {
+			struct htable_node *next = n->next;
+			unsigned int h = htable_hash(n->key, size);
+			n->next = buckets[h];
+			buckets[h] = n;
+			n = next;
+		}
+	}
+
+	free(t->buckets);
+	t->buckets = buckets;
+	t->size = size;
+}
+
+static inline void htable_insert(struct htable *t, struct htable_node *node,
+		uint32_t key)
+{
+	unsigned int h;
+
+	if (t->count >= t->size)
+		htable_resize(t, t->size ? t->size * 2 : 256);
+
+	h = htable_hash(key, t->size);
+	node->key = key;
+	node->next = t->buckets[h];
+	t->buckets[h] = node;
+	t->count++;
+}
+
+static inline void htable_remove(struct htable *t, struct htable_node *node)
+{
+	struct htable_node **p;
+
+	if (!t->size)
+		return;
+
+	for (p = &t->buckets[htable_hash(node->key, t->size)]; *p; p = &(*p)->next) {
+		if (*p == node) {
+			*p = node->next;
+			node->next = NULL;
+			t->count--;
+			return;
+		}
+	}
+}
+
+#define htable_for_each_match(n, t, k)					\
+	for (n = (t)->size ? (t)->buckets[htable_hash(k, (t)->size)] : NULL; \
+	     n; n = n->next)						\
+		if (n->key == (k))
+
+#endif /* _HTABLE_H_ */
@@ -0,0 +1,173 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Renders the RD_IOCTL records written with WRAP_IOCTL_LOG=binary back
+ * into the same text that libwrap logs by default, ie:
+ *
+ *   ioctldump [-t] trace.rd
+ *
+ * With -t, each ioctl is prefixed with the time (in usec) since the first
+ * one.  Only the generic part of the text log is reproduced (the ioctl
+ * and a hexdump of it's struct), not the per-ioctl decoding which follows
+ * pointers into the app's memory.. the buffers and cmdstream which that
+ * would show are in the rd file already.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+
+#define __user
+#include "msm_kgsl.h"
+#include "librd.h"
+#include "kgsl-ioctls.h"
+
+static int timestamps;
+static uint64_t first_ts;
+
+static void
+hexdump(const void *data, int size)
+{
+	unsigned char *buf = (void *) data;
+	char alpha[17];
+	int i;
+
+	for (i = 0; i < size; i++) {
+		if (!(i % 16))
+			printf("\t\t\t%08X", (unsigned int) i);
+		if (!(i % 4))
+			printf(" ");
+
+		printf(" %02x", buf[i]);
+
+		if (isprint(buf[i]) && (buf[i] < 0xA0))
+			alpha[i % 16] = buf[i];
+		else
+			alpha[i % 16] = '.';
+
+		if ((i % 16) == 15) {
+			alpha[16] = 0;
+			printf("\t|%s|\n", alpha);
+		}
+	}
+
+	if (i % 16) {
+		for (i %= 16; i < 16; i++) {
+			printf("   ");
+			alpha[i] = '.';
+
+			if (i == 15) {
+				alpha[16] = 0;
+				printf("\t|%s|\n", alpha);
+			}
+		}
+	}
+}
+
+static void dump_ioctl(const struct rd_ioctl *rec, const void *ptr, int sz)
+{
+	struct device_info *info = rec->dev ? &kgsl_2d_info : &kgsl_3d_info;
+	int nr = _IOC_NR(rec->request);
+	const char *name;
+	char c;
+
+	if (rec->dir == _IOC_READ)
+		c = '<';
+	else
+		c = '>';
+
+	if (info->ioctl_info[nr].name)
+		name = info->ioctl_info[nr].name;
+	else
+		name = "<unknown>";
+
+	if (timestamps) {
+		if (!first_ts)
+			first_ts = rec->ts;
+		printf("%10.3f ", (double)(rec->ts - first_ts) / 1000.0);
+	}
+
+	printf("%c [%4d] %8s: %s (%08lx)", c, rec->fd, info->name, name,
+			(unsigned long)rec->request);
+	if (rec->dir == _IOC_READ)
+		printf(" => %d", rec->ret);
+	printf("\n");
+
+	hexdump(ptr, sz);
+}
+
+static void dump_file(struct rd_reader *r)
+{
+	struct rd_section s;
+
+	while (rd_reader_next(r, &s)) {
+		const struct rd_ioctl *rec = s.data;
+
+		if ((s.type == RD_IOCTL) && (s.size >= sizeof(*rec))) {
+			dump_ioctl(rec, rec + 1, min(s.size - sizeof(*rec),
+					_IOC_SIZE(rec->request)));
+		}
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-t] file.rd...\n", name);
+	exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	for (i = 1; (i < argc) && (argv[i][0] == '-'); i++) {
+		if (!strcmp(argv[i], "-t"))
+			timestamps = 1;
+		else
+			usage(argv[0]);
+	}
+
+	if (i == argc)
+		usage(argv[0]);
+
+	for (; i < argc; i++) {
+		struct rd_reader *r;
+		int fd = open(argv[i], O_RDONLY);
+		if (fd < 0) {
+			fprintf(stderr, "could not open: %s\n", argv[i]);
+			return -1;
+		}
+		r = rd_reader_open(fd);
+		if (!r)
+			return -1;
+		dump_file(r);
+		rd_reader_close(r);
+	}
+
+	return 0;
+}
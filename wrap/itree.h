@@ -0,0 +1,188 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _ITREE_H_
+#define _ITREE_H_
+
+#include <stdint.h>
+
+/* intrusive interval tree.. an AVL tree sorted by interval start (with
+ * node address as tie-breaker so duplicate starts are fine), where each
+ * node is augmented with the max end of it's subtree so that stabbing
+ * queries only need to visit the subtrees which can possibly overlap.
+ *
+ * Intervals are [start, last], ie. last is inclusive.
+ */
+struct itree_node {
+	struct itree_node *left, *right;
+	uint64_t start, last, max_last;
+	int height;
+};
+
+struct itree {
+	struct itree_node *root;
+};
+
+#define ITREE_INIT { NULL }
+
+static inline int itree_height(struct itree_node *n)
+{
+	return n ? n->height : 0;
+}
+
+static inline void itree_update(struct itree_node *n)
+{
+	int hl = itree_height(n->left), hr = itree_height(n->right);
+	n->height = 1 + ((hl > hr) ? hl : hr);
+	n->max_last = n->last;
+	if (n->left && (n->left->max_last > n->max_last))
+		n->max_last = n->left->max_last;
+	if (n->right && (n->right->max_last > n->max_last))
+		n->max_last = n->right->max_last;
+}
+
+static inline struct itree_node * itree_rotate_right(struct itree_node *n)
+{
+	struct itree_node *l = n->left;
+	n->left = l->right;
+	l->right = n;
+	itree_update(n);
+	itree_update(l);
+	return l;
+}
+
+static inline struct itree_node * itree_rotate_left(struct itree_node *n)
+{
+	struct itree_node *r = n->right;
+	n->right = r->left;
+	r->left = n;
+	itree_update(n);
+	itree_update(r);
+	return r;
+}
+
+static inline struct itree_node * itree_balance(struct itree_node *n)
+{
+	int bal;
+
+	itree_update(n);
+	bal = itree_height(n->left) - itree_height(n->right);
+
+	if (bal > 1) {
+		if (itree_height(n->left->left) < itree_height(n->left->right))
+			n->left = itree_rotate_left(n->left);
+		return itree_rotate_right(n);
+	} else if (bal < -1) {
+		if (itree_height(n->right->right) < itree_height(n->right->left))
+			n->right = itree_rotate_right(n->right);
+		return itree_rotate_left(n);
+	}
+
+	return n;
+}
+
+static inline int itree_less(struct itree_node *a, struct itree_node *b)
+{
+	if (a->start != b->start)
+		return a->start < b->start;
+	return (uintptr_t)a < (uintptr_t)b;
+}
+
+static struct itree_node * __itree_insert(struct itree_node *n,
+		struct itree_node *node)
+{
+	if (!n)
+		return node;
+	if (itree_less(node, n))
+		n->left = __itree_insert(n->left, node);
+	else
+		n->right = __itree_insert(n->right, node);
+	return itree_balance(n);
+}
+
+static struct itree_node * __itree_remove_min(struct itree_node *n,
+		struct itree_node **min)
+{
+	if (!n->left) {
+		*min = n;
+		return n->right;
+	}
+	n->left = __itree_remove_min(n->left, min);
+	return itree_balance(n);
+}
+
+static struct itree_node * __itree_remove(struct itree_node *n,
+		struct itree_node *node)
+{
+	if (!n)
+		return NULL;
+
+	if (n == node) {
+		struct itree_node *min;
+		if (!n->right)
+			return n->left;
+		n->right = __itree_remove_min(n->right, &min);
+		min->left = n->left;
+		min->right = n->right;
+		return itree_balance(min);
+	}
+
+	if (itree_less(node, n))
+		n->left = __itree_remove(n->left, node);
+	else
+		n->right = __itree_remove(n->right, node);
+
+	return itree_balance(n);
+}
+
+static inline void itree_insert(struct itree *t, struct itree_node *node,
+		uint64_t start, uint64_t last)
+{
+	node->left = node->right = NULL;
+	node->start = start;
+	node->last = last;
+	node->max_last = last;
+	node->height = 1;
+	t->root = __itree_insert(t->root, node);
+}
+
+static inline void itree_remove(struct itree *t, struct itree_node *node)
+{
+	t->root = __itree_remove(t->root, node);
+}
+
+/* call fxn for every node whose interval contains point: */
+static void itree_stab(struct itree_node *n, uint64_t point,
+		void (*fxn)(struct itree_node *node, void *data), void *data)
+{
+	while (n && (point <= n->max_last)) {
+		itree_stab(n->left, point, fxn, data);
+		if (point < n->start)
+			return;
+		if (point <= n->last)
+			fxn(n, data);
+		n = n->right;
+	}
+}
+
+#endif /* _ITREE_H_ */
@@ -0,0 +1,104 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef KGSL_IOCTLS_H_
+#define KGSL_IOCTLS_H_
+
+/* ioctl name tables, shared by libwrap and ioctldump (which renders the
+ * binary ioctl log back to text)
+ */
+
+struct device_info {
+	const char *name;
+	struct {
+		const char *name;
+	} ioctl_info[_IOC_NR(0xffffffff)];
+};
+
+#define IOCTL_INFO(n) \
+		[_IOC_NR(n)] = { .name = #n }
+
+static struct device_info kgsl_3d_info = {
+		.name = "kgsl-3d",
+		.ioctl_info = {
+				IOCTL_INFO(IOCTL_KGSL_DEVICE_GETPROPERTY),
+				IOCTL_INFO(IOCTL_KGSL_DEVICE_WAITTIMESTAMP),
+				IOCTL_INFO(IOCTL_KGSL_DEVICE_WAITTIMESTAMP_CTXTID),
+				IOCTL_INFO(IOCTL_KGSL_RINGBUFFER_ISSUEIBCMDS),
+				IOCTL_INFO(IOCTL_KGSL_CMDSTREAM_READTIMESTAMP),
+				IOCTL_INFO(IOCTL_KGSL_CMDSTREAM_FREEMEMONTIMESTAMP),
+				IOCTL_INFO(IOCTL_KGSL_DRAWCTXT_CREATE),
+				IOCTL_INFO(IOCTL_KGSL_DRAWCTXT_DESTROY),
+				IOCTL_INFO(IOCTL_KGSL_MAP_USER_MEM),
+				IOCTL_INFO(IOCTL_KGSL_SHAREDMEM_FROM_PMEM),
+				IOCTL_INFO(IOCTL_KGSL_SHAREDMEM_FREE),
+				IOCTL_INFO(IOCTL_KGSL_SHAREDMEM_FROM_VMALLOC),
+				IOCTL_INFO(IOCTL_KGSL_SHAREDMEM_FLUSH_CACHE),
+				IOCTL_INFO(IOCTL_KGSL_GPUMEM_ALLOC),
+				IOCTL_INFO(IOCTL_KGSL_CFF_SYNCMEM),
+				IOCTL_INFO(IOCTL_KGSL_CFF_USER_EVENT),
+				IOCTL_INFO(IOCTL_KGSL_TIMESTAMP_EVENT),
+				IOCTL_INFO(IOCTL_KGSL_GPUMEM_ALLOC_ID),
+				IOCTL_INFO(IOCTL_KGSL_GPUMEM_FREE_ID),
+				IOCTL_INFO(IOCTL_KGSL_PERFCOUNTER_GET),
+				IOCTL_INFO(IOCTL_KGSL_PERFCOUNTER_PUT),
+				/* kgsl-3d specific ioctls: */
+				IOCTL_INFO(IOCTL_KGSL_DRAWCTXT_SET_BIN_BASE_OFFSET),
+				IOCTL_INFO(IOCTL_KGSL_SUBMIT_COMMANDS),
+				IOCTL_INFO(IOCTL_KGSL_SYNCSOURCE_CREATE),
+				IOCTL_INFO(IOCTL_KGSL_SYNCSOURCE_DESTROY),
+				IOCTL_INFO(IOCTL_KGSL_GPUOBJ_ALLOC),
+				IOCTL_INFO(IOCTL_KGSL_GPUOBJ_FREE),
+				IOCTL_INFO(IOCTL_KGSL_GPUOBJ_INFO),
+				IOCTL_INFO(IOCTL_KGSL_GPU_COMMAND),
+		},
+};
+
+// kgsl-2d => Z180 vector graphcis core.. not sure if it is interesting..
+static struct device_info kgsl_2d_info = {
+		.name = "kgsl-2d",
+		.ioctl_info = {
+				IOCTL_INFO(IOCTL_KGSL_DEVICE_GETPROPERTY),
+				IOCTL_INFO(IOCTL_KGSL_DEVICE_WAITTIMESTAMP),
+				IOCTL_INFO(IOCTL_KGSL_DEVICE_WAITTIMESTAMP_CTXTID),
+				IOCTL_INFO(IOCTL_KGSL_RINGBUFFER_ISSUEIBCMDS),
+				IOCTL_INFO(IOCTL_KGSL_CMDSTREAM_READTIMESTAMP),
+				IOCTL_INFO(IOCTL_KGSL_CMDSTREAM_FREEMEMONTIMESTAMP),
+				IOCTL_INFO(IOCTL_KGSL_DRAWCTXT_CREATE),
+				IOCTL_INFO(IOCTL_KGSL_DRAWCTXT_DESTROY),
+				IOCTL_INFO(IOCTL_KGSL_MAP_USER_MEM),
+				IOCTL_INFO(IOCTL_KGSL_SHAREDMEM_FROM_PMEM),
+				IOCTL_INFO(IOCTL_KGSL_SHAREDMEM_FREE),
+				IOCTL_INFO(IOCTL_KGSL_SHAREDMEM_FROM_VMALLOC),
+				IOCTL_INFO(IOCTL_KGSL_SHAREDMEM_FLUSH_CACHE),
+				IOCTL_INFO(IOCTL_KGSL_GPUMEM_ALLOC),
+				IOCTL_INFO(IOCTL_KGSL_CFF_SYNCMEM),
+				IOCTL_INFO(IOCTL_KGSL_CFF_USER_EVENT),
+				IOCTL_INFO(IOCTL_KGSL_TIMESTAMP_EVENT),
+				IOCTL_INFO(IOCTL_KGSL_GPUMEM_ALLOC_ID),
+				IOCTL_INFO(IOCTL_KGSL_GPUMEM_FREE_ID),
+				/* no kgsl-2d specific ioctls, I don't think.. */
+		},
+};
+
+#endif /* KGSL_IOCTLS_H_ */
@@ -26,8 +26,17 @@
  */
 
 #include <ctype.h>
+#include <time.h>
+#include <sched.h>
+#include <ucontext.h>
+#include <sys/syscall.h>
 
 #include "wrap.h"
+#include "itree.h"
+#include "htable.h"
+#include "kgsl-ioctls.h"
+#include "buddy.h"
+#include "adreno_pm4.xml.h"
 
 #ifdef USE_PTHREADS
 static pthread_mutex_t l = PTHREAD_RECURSIVE_MUTEX_INITIALIZER;
@@ -38,78 +47,13 @@ static pthread_mutex_t l = PTHREAD_RECURSIVE_MUTEX_INITIALIZER;
 #define UNLOCK()
 #endif
 
-struct device_info {
-	const char *name;
-	struct {
-		const char *name;
-	} ioctl_info[_IOC_NR(0xffffffff)];
-};
-
-#define IOCTL_INFO(n) \
-		[_IOC_NR(n)] = { .name = #n }
-
-static struct device_info kgsl_3d_info = {
-		.name = "kgsl-3d",
-		.ioctl_info = {
-				IOCTL_INFO(IOCTL_KGSL_DEVICE_GETPROPERTY),
-				IOCTL_INFO(IOCTL_KGSL_DEVICE_WAITTIMESTAMP),
-				IOCTL_INFO(IOCTL_KGSL_DEVICE_WAITTIMESTAMP_CTXTID),
-				IOCTL_INFO(IOCTL_KGSL_RINGBUFFER_ISSUEIBCMDS),
-				IOCTL_INFO(IOCTL_KGSL_CMDSTREAM_READTIMESTAMP),
-				IOCTL_INFO(IOCTL_KGSL_CMDSTREAM_FREEMEMONTIMESTAMP),
-				IOCTL_INFO(IOCTL_KGSL_DRAWCTXT_CREATE),
-				IOCTL_INFO(IOCTL_KGSL_DRAWCTXT_DESTROY),
-				IOCTL_INFO(IOCTL_KGSL_MAP_USER_MEM),
-				IOCTL_INFO(IOCTL_KGSL_SHAREDMEM_FROM_PMEM),
-				IOCTL_INFO(IOCTL_KGSL_SHAREDMEM_FREE),
-				IOCTL_INFO(IOCTL_KGSL_SHAREDMEM_FROM_VMALLOC),
-				IOCTL_INFO(IOCTL_KGSL_SHAREDMEM_FLUSH_CACHE),
-				IOCTL_INFO(IOCTL_KGSL_GPUMEM_ALLOC),
-				IOCTL_INFO(IOCTL_KGSL_CFF_SYNCMEM),
-				IOCTL_INFO(IOCTL_KGSL_CFF_USER_EVENT),
-				IOCTL_INFO(IOCTL_KGSL_TIMESTAMP_EVENT),
-				IOCTL_INFO(IOCTL_KGSL_GPUMEM_ALLOC_ID),
-				IOCTL_INFO(IOCTL_KGSL_GPUMEM_FREE_ID),
-				IOCTL_INFO(IOCTL_KGSL_PERFCOUNTER_GET),
-				IOCTL_INFO(IOCTL_KGSL_PERFCOUNTER_PUT),
-				/* kgsl-3d specific ioctls: */
-				IOCTL_INFO(IOCTL_KGSL_DRAWCTXT_SET_BIN_BASE_OFFSET),
-				IOCTL_INFO(IOCTL_KGSL_SUBMIT_COMMANDS),
-				IOCTL_INFO(IOCTL_KGSL_SYNCSOURCE_CREATE),
-				IOCTL_INFO(IOCTL_KGSL_SYNCSOURCE_DESTROY),
-				IOCTL_INFO(IOCTL_KGSL_GPUOBJ_ALLOC),
-				IOCTL_INFO(IOCTL_KGSL_GPUOBJ_FREE),
-				IOCTL_INFO(IOCTL_KGSL_GPUOBJ_INFO),
-				IOCTL_INFO(IOCTL_KGSL_GPU_COMMAND),
-		},
-};
-
-// kgsl-2d => Z180 vector graphcis core.. not sure if it is interesting..
-static struct device_info kgsl_2d_info = {
-		.name = "kgsl-2d",
-		.ioctl_info = {
-				IOCTL_INFO(IOCTL_KGSL_DEVICE_GETPROPERTY),
-				IOCTL_INFO(IOCTL_KGSL_DEVICE_WAITTIMESTAMP),
-				IOCTL_INFO(IOCTL_KGSL_DEVICE_WAITTIMESTAMP_CTXTID),
-				IOCTL_INFO(IOCTL_KGSL_RINGBUFFER_ISSUEIBCMDS),
-				IOCTL_INFO(IOCTL_KGSL_CMDSTREAM_READTIMESTAMP),
-				IOCTL_INFO(IOCTL_KGSL_CMDSTREAM_FREEMEMONTIMESTAMP),
-				IOCTL_INFO(IOCTL_KGSL_DRAWCTXT_CREATE),
-				IOCTL_INFO(IOCTL_KGSL_DRAWCTXT_DESTROY),
-				IOCTL_INFO(IOCTL_KGSL_MAP_USER_MEM),
-				IOCTL_INFO(IOCTL_KGSL_SHAREDMEM_FROM_PMEM),
-				IOCTL_INFO(IOCTL_KGSL_SHAREDMEM_FREE),
-				IOCTL_INFO(IOCTL_KGSL_SHAREDMEM_FROM_VMALLOC),
-				IOCTL_INFO(IOCTL_KGSL_SHAREDMEM_FLUSH_CACHE),
-				IOCTL_INFO(IOCTL_KGSL_GPUMEM_ALLOC),
-				IOCTL_INFO(IOCTL_KGSL_CFF_SYNCMEM),
-				IOCTL_INFO(IOCTL_KGSL_CFF_USER_EVENT),
-				IOCTL_INFO(IOCTL_KGSL_TIMESTAMP_EVENT),
-				IOCTL_INFO(IOCTL_KGSL_GPUMEM_ALLOC_ID),
-				IOCTL_INFO(IOCTL_KGSL_GPUMEM_FREE_ID),
-				/* no kgsl-2d specific ioctls, I don't think.. */
-		},
-};
+/* the ioctl trace, unless logging as text skip all the formatting.
+ * Errors and warnings use plain printf() so they are always seen:
+ */
+#define log_printf(...) do {						\
+		if (wrap_ioctl_log() == WRAP_IOCTL_LOG_TEXT)		\
+			printf(__VA_ARGS__);				\
+	} while (0)
 
 static struct {
 	int is_3d, is_2d;
@@ -136,17 +80,20 @@ hexdump(const void *data, int size)
 	char alpha[17];
 	int i;
 
+	if (wrap_ioctl_log() != WRAP_IOCTL_LOG_TEXT)
+		return;
+
 	for (i = 0; i < size; i++) {
 		if (!(i % 16))
-			printf("\t\t\t%08X", (unsigned int) i);
+			log_printf("\t\t\t%08X", (unsigned int) i);
 		if (!(i % 4))
-			printf(" ");
+			log_printf(" ");
 
 		if (((void *) (buf + i)) < ((void *) data)) {
-			printf("   ");
+			log_printf("   ");
 			alpha[i % 16] = '.';
 		} else {
-			printf(" %02x", buf[i]);
+			log_printf(" %02x", buf[i]);
 
 			if (isprint(buf[i]) && (buf[i] < 0xA0))
 				alpha[i % 16] = buf[i];
@@ -156,18 +103,18 @@ hexdump(const void *data, int size)
 
 		if ((i % 16) == 15) {
 			alpha[16] = 0;
-			printf("\t|%s|\n", alpha);
+			log_printf("\t|%s|\n", alpha);
 		}
 	}
 
 	if (i % 16) {
 		for (i %= 16; i < 16; i++) {
-			printf("   ");
+			log_printf("   ");
 			alpha[i] = '.';
 
 			if (i == 15) {
 				alpha[16] = 0;
-				printf("\t|%s|\n", alpha);
+				log_printf("\t|%s|\n", alpha);
 			}
 		}
 	}
@@ -180,19 +127,44 @@ hexdump_dwords(const void *data, int sizedwords)
 	uint32_t *buf = (void *) data;
 	int i;
 
+	if (wrap_ioctl_log() != WRAP_IOCTL_LOG_TEXT)
+		return;
+
 	for (i = 0; i < sizedwords; i++) {
 		if (!(i % 8))
-			printf("\t\t\t%08X:   ", (unsigned int) i*4);
-		printf(" %08x", buf[i]);
+			log_printf("\t\t\t%08X:   ", (unsigned int) i*4);
+		log_printf(" %08x", buf[i]);
 		if ((i % 8) == 7)
-			printf("\n");
+			log_printf("\n");
 	}
 
 	if (i % 8)
-		printf("\n");
+		log_printf("\n");
 }
 
 
+static void log_ioctl(struct device_info *info, int dir, int fd,
+		unsigned long int request, void *ptr, int ret)
+{
+	struct timespec ts;
+	struct rd_ioctl rec = {
+			.request = request,
+			.fd = fd,
+			.dev = (info == &kgsl_2d_info),
+			.dir = dir,
+			.ret = ret,
+	};
+	struct iovec iov[2] = {
+			{ &rec, sizeof(rec) },
+			{ ptr, (dir & _IOC_DIR(request)) ? _IOC_SIZE(request) : 0 },
+	};
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	rec.ts = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+	rd_write_sectionv(RD_IOCTL, iov, 2);
+}
+
 static void dump_ioctl(struct device_info *info, int dir, int fd,
 		unsigned long int request, void *ptr, int ret)
 {
@@ -201,6 +173,11 @@ static void dump_ioctl(struct device_info *info, int dir, int fd,
 	char c;
 	const char *name;
 
+	if (wrap_ioctl_log() == WRAP_IOCTL_LOG_BINARY)
+		log_ioctl(info, dir, fd, request, ptr, ret);
+	if (wrap_ioctl_log() != WRAP_IOCTL_LOG_TEXT)
+		return;
+
 	if (dir == _IOC_READ)
 		c = '<';
 	else
@@ -211,10 +188,10 @@ static void dump_ioctl(struct device_info *info, int dir, int fd,
 	else
 		name = "<unknown>";
 
-	printf("%c [%4d] %8s: %s (%08lx)", c, fd, info->name, name, request);
+	log_printf("%c [%4d] %8s: %s (%08lx)", c, fd, info->name, name, request);
 	if (dir == _IOC_READ)
-		printf(" => %d", ret);
-	printf("\n");
+		log_printf(" => %d", ret);
+	log_printf("\n");
 
 	if (dir & _IOC_DIR(request))
 		hexdump(ptr, sz);
@@ -239,53 +216,380 @@ struct buffer {
 	uint64_t offset;
 	struct list node;
 	int munmap;
+	int memfd;        /* for FAKE, the memfd backing hostptr, or -1 */
 	int dumped;
+	int referenced;   /* for WRAP_REFERENCED, seen in current submit */
+	/* for WRAP_INCREMENTAL, hash of contents when last written to the
+	 * rd file (of generation hash_gen) at submit hash_submit:
+	 */
+	uint64_t hash;
+	unsigned int hash_gen, hash_submit;
+
+	/* for WRAP_DIRTY_PAGES, bitmap of pages written by the app since the
+	 * contents were last written to the rd file:
+	 */
+	uint32_t *dirty;
+
+	/* indexes for find_buffer(), if multiple buffers match the most
+	 * recently registered one (highest seq) wins:
+	 */
+	unsigned int seq;
+	struct itree_node hostptr_node, gpuaddr_node, offset_node;
+	struct htable_node handle_node, id_node;
 };
 
 static LIST_HEAD(buffers_of_interest);
 
+static struct itree hostptr_tree = ITREE_INIT;
+static struct itree gpuaddr_tree = ITREE_INIT;
+static struct itree offset_tree  = ITREE_INIT;
+static struct htable handle_table = HTABLE_INIT;
+static struct htable id_table     = HTABLE_INIT;
+
+/* zero address or length means not (yet) known, so not indexed: */
+static void index_range(struct itree *t, struct itree_node *node,
+		uint64_t start, unsigned int len)
+{
+	if (start && len)
+		itree_insert(t, node, start, start + len - 1);
+	else
+		node->height = 0;
+}
+
+static void unindex_range(struct itree *t, struct itree_node *node)
+{
+	if (node->height)
+		itree_remove(t, node);
+	node->height = 0;
+}
+
+static void index_key(struct htable *t, struct htable_node *node, uint32_t key)
+{
+	if (key)
+		htable_insert(t, node, key);
+}
+
+static void unindex_key(struct htable *t, struct htable_node *node)
+{
+	if (node->key)
+		htable_remove(t, node);
+	node->key = 0;
+}
+
+static void buffer_set_hostptr(struct buffer *buf, void *hostptr)
+{
+	unindex_range(&hostptr_tree, &buf->hostptr_node);
+	buf->hostptr = hostptr;
+	index_range(&hostptr_tree, &buf->hostptr_node,
+			(uintptr_t)hostptr, buf->len);
+}
+
+static void buffer_set_gpuaddr(struct buffer *buf, uint64_t gpuaddr)
+{
+	unindex_range(&gpuaddr_tree, &buf->gpuaddr_node);
+	buf->gpuaddr = gpuaddr;
+	index_range(&gpuaddr_tree, &buf->gpuaddr_node, gpuaddr, buf->len);
+}
+
+static void buffer_set_offset(struct buffer *buf, uint64_t offset)
+{
+	unindex_range(&offset_tree, &buf->offset_node);
+	buf->offset = offset;
+	index_range(&offset_tree, &buf->offset_node, offset, buf->len);
+}
+
+static void buffer_set_id(struct buffer *buf, unsigned int id)
+{
+	unindex_key(&id_table, &buf->id_node);
+	buf->id = id;
+	index_key(&id_table, &buf->id_node, id);
+}
+
 static struct buffer * register_buffer(void *hostptr, uint64_t flags,
 		unsigned int len, unsigned int handle)
 {
+	static unsigned int seq;
 	struct buffer *buf = calloc(1, sizeof *buf);
-	buf->hostptr = hostptr;
 	buf->flags = flags;
 	buf->len = len;
+	buf->seq = ++seq;
 	buf->handle = handle;
+	buf->memfd = -1;
+	buffer_set_hostptr(buf, hostptr);
+	index_key(&handle_table, &buf->handle_node, handle);
 	list_add(&buf->node, &buffers_of_interest);
 	return buf;
 }
 
+static struct buffer * newest(struct buffer *a, struct buffer *b)
+{
+	if (!a || (b && (b->seq > a->seq)))
+		return b;
+	return a;
+}
+
+#define stab_fxn(name)							\
+static void stab_##name(struct itree_node *node, void *data)		\
+{									\
+	struct buffer **match = data;					\
+	*match = newest(*match, container_of(node, struct buffer, name));	\
+}
+stab_fxn(hostptr_node)
+stab_fxn(gpuaddr_node)
+stab_fxn(offset_node)
+
 static struct buffer * find_buffer(void *hostptr, uint64_t gpuaddr,
 		uint64_t offset, unsigned int handle, unsigned id)
 {
 	struct buffer *buf = NULL;
-	list_for_each_entry(buf, &buffers_of_interest, node) {
-		if (hostptr)
-			if ((buf->hostptr <= hostptr) && (hostptr < (buf->hostptr + buf->len)))
-				return buf;
-		if (gpuaddr)
-			if ((buf->gpuaddr <= gpuaddr) && (gpuaddr < (buf->gpuaddr + buf->len)))
-				return buf;
-		if (offset)
-			if ((buf->offset <= offset) && (offset < (buf->offset + buf->len)))
-				return buf;
-		if (handle)
-			if (buf->handle == handle)
-				return buf;
-		if (id)
-			if (buf->id == id)
-				return buf;
+	struct htable_node *n;
+
+	if (hostptr)
+		itree_stab(hostptr_tree.root, (uintptr_t)hostptr, stab_hostptr_node, &buf);
+	if (gpuaddr)
+		itree_stab(gpuaddr_tree.root, gpuaddr, stab_gpuaddr_node, &buf);
+	if (offset)
+		itree_stab(offset_tree.root, offset, stab_offset_node, &buf);
+	if (handle)
+		htable_for_each_match(n, &handle_table, handle)
+			buf = newest(buf, container_of(n, struct buffer, handle_node));
+	if (id)
+		htable_for_each_match(n, &id_table, id)
+			buf = newest(buf, container_of(n, struct buffer, id_node));
+
+	return buf;
+}
+
+/*
+ * For WRAP_DIRTY_PAGES, the buffers mapped via our mmap hooks are made
+ * read-only, and the first write to each page traps to segv_handler()
+ * which marks the page dirty and makes it writable again.  When the
+ * contents need to be dumped again, only the dirty pages are written
+ * (and write-protected again).
+ *
+ * Note that only writes by the app's CPU are seen, not anything written
+ * by the GPU (or the kernel, which would get -EFAULT instead).
+ */
+
+static unsigned int page_size(void)
+{
+	static unsigned int val;
+	if (!val)
+		val = sysconf(_SC_PAGESIZE);
+	return val;
+}
+
+static struct sigaction old_segv;
+
+/* more than any number of threads racing on one page: */
+#define MAX_RETRIES 4096
+
+/* The tracked ranges, as seen by segv_handler().  The fault can happen
+ * anywhere, including while this or another thread holds the lock in the
+ * middle of updating the buffer indexes, so the handler must not take the
+ * lock or use find_buffer().  Instead it scans this table, whose slots
+ * are only filled and cleared with the lock held, with 'start' written
+ * last and cleared first.  Dirty bits are set and cleared atomically.
+ */
+static struct {
+	uintptr_t start, end;
+	uint32_t *dirty;
+	/* handlers between setting a dirty bit and unprotecting the page: */
+	unsigned int busy;
+	/* faults on already dirty pages since a page was last unprotected: */
+	unsigned int retries;
+} tracked[4096];
+static unsigned int ntracked;
+
+static int fault_is_write(void *ctx)
+{
+#if defined(__arm__)
+	/* WnR bit of the fault status register: */
+	return !!(((ucontext_t *)ctx)->uc_mcontext.error_code & (1 << 11));
+#elif defined(__x86_64__) && defined(REG_ERR)
+	return !!(((ucontext_t *)ctx)->uc_mcontext.gregs[REG_ERR] & 2);
+#else
+	/* can't tell, but reads of the read-only pages don't fault anyway: */
+	return 1;
+#endif
+}
+
+/* returns true if the fault was a write to a page which is write
+ * protected because it isn't dirty yet:
+ */
+static int dirty_fault(siginfo_t *info, void *ctx)
+{
+	uintptr_t addr = (uintptr_t)info->si_addr;
+	uintptr_t page = addr & ~(uintptr_t)(page_size() - 1);
+	unsigned int i, n = __atomic_load_n(&ntracked, __ATOMIC_ACQUIRE);
+
+	if ((info->si_code != SEGV_ACCERR) || !fault_is_write(ctx))
+		return 0;
+
+	for (i = 0; i < n; i++) {
+		uintptr_t start = __atomic_load_n(&tracked[i].start, __ATOMIC_ACQUIRE);
+		unsigned int pg, busy;
+		uint32_t bit, old;
+
+		if (!start || (addr < start) || (addr >= tracked[i].end))
+			continue;
+
+		pg = (page - start) / page_size();
+		bit = 1 << (pg % 32);
+
+		__atomic_add_fetch(&tracked[i].busy, 1, __ATOMIC_SEQ_CST);
+		old = __atomic_fetch_or(&tracked[i].dirty[pg / 32], bit,
+				__ATOMIC_SEQ_CST);
+		if (!(old & bit)) {
+			mprotect((void *)page, page_size(), PROT_READ | PROT_WRITE);
+			__atomic_store_n(&tracked[i].retries, 0, __ATOMIC_SEQ_CST);
+		}
+		busy = __atomic_sub_fetch(&tracked[i].busy, 1, __ATOMIC_SEQ_CST);
+
+		if (!(old & bit))
+			return 1;
+
+		/* already dirty, so the page should be writable.  Other threads
+		 * which faulted on it at the same time as the one unprotecting
+		 * it get here, and just need to retry the access (for as long
+		 * as that one is still busy).  But if it keeps faulting, the
+		 * app protected the page itself, so it is not ours:
+		 */
+		return busy || __atomic_add_fetch(&tracked[i].retries, 1,
+				__ATOMIC_SEQ_CST) < MAX_RETRIES;
+	}
+
+	return 0;
+}
+
+static void segv_handler(int sig, siginfo_t *info, void *ctx)
+{
+	if (dirty_fault(info, ctx))
+		return;
+
+	/* not one of ours, so pass it on: */
+	if (old_segv.sa_flags & SA_SIGINFO) {
+		old_segv.sa_sigaction(sig, info, ctx);
+	} else if ((old_segv.sa_handler == SIG_DFL) ||
+			(old_segv.sa_handler == SIG_IGN)) {
+		/* restore the default, and let the access fault again: */
+		sigaction(SIGSEGV, &old_segv, NULL);
+	} else {
+		old_segv.sa_handler(sig);
 	}
-	return NULL;
+}
+
+/* called with the lock held: */
+static void dirty_track(struct buffer *buf)
+{
+	static int installed;
+	unsigned int npages = ALIGN(buf->len, page_size()) / page_size();
+	unsigned int i;
+
+	if (buf->dirty || !buf->len || ((uintptr_t)buf->hostptr % page_size()))
+		return;
+
+	for (i = 0; i < ntracked; i++)
+		if (!tracked[i].start)
+			break;
+
+	/* out of slots, so the buffer is just always dumped in full: */
+	if (i == ARRAY_SIZE(tracked))
+		return;
+
+	if (!installed) {
+		struct sigaction sa = {
+				.sa_sigaction = segv_handler,
+				.sa_flags = SA_SIGINFO | SA_RESTART,
+		};
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGSEGV, &sa, &old_segv);
+		installed = 1;
+	}
+
+	buf->dirty = calloc(ALIGN(npages, 32) / 32, sizeof(uint32_t));
+
+	tracked[i].end = (uintptr_t)buf->hostptr + (npages * page_size());
+	tracked[i].dirty = buf->dirty;
+	tracked[i].retries = 0;
+	__atomic_store_n(&tracked[i].start, (uintptr_t)buf->hostptr,
+			__ATOMIC_RELEASE);
+	if (i == ntracked)
+		__atomic_store_n(&ntracked, i + 1, __ATOMIC_RELEASE);
+
+	mprotect(buf->hostptr, npages * page_size(), PROT_READ);
+}
+
+/* called with the lock held, before buf->dirty is freed: */
+static void dirty_untrack(struct buffer *buf)
+{
+	unsigned int i;
+
+	for (i = 0; i < ntracked; i++) {
+		if (tracked[i].start && (tracked[i].dirty == buf->dirty)) {
+			__atomic_store_n(&tracked[i].start, 0, __ATOMIC_RELEASE);
+			/* let a handler on another thread finish with it: */
+			while (__atomic_load_n(&tracked[i].busy, __ATOMIC_ACQUIRE))
+				sched_yield();
+			break;
+		}
+	}
+}
+
+static int dirty_test(struct buffer *buf, unsigned int n)
+{
+	return buf->dirty[n / 32] & (1 << (n % 32));
+}
+
+/* find the next run of dirty pages, starting from *start, and write
+ * protect them again.  Returns the number of pages in the run:
+ */
+static unsigned int dirty_next(struct buffer *buf, unsigned int *start)
+{
+	unsigned int npages = ALIGN(buf->len, page_size()) / page_size();
+	unsigned int n = *start, end;
+
+	while ((n < npages) && !dirty_test(buf, n))
+		n++;
+	/* atomically, since segv_handler() can set bits at any time: */
+	for (end = n; (end < npages) && dirty_test(buf, end); end++)
+		__atomic_and_fetch(&buf->dirty[end / 32], ~(1 << (end % 32)),
+				__ATOMIC_SEQ_CST);
+
+	if (end > n)
+		mprotect(buf->hostptr + (n * page_size()),
+				(end - n) * page_size(), PROT_READ);
+
+	*start = n;
+	return end - n;
+}
+
+static void dirty_reset(struct buffer *buf)
+{
+	unsigned int n = 0, cnt;
+	while ((cnt = dirty_next(buf, &n)))
+		n += cnt;
 }
 
 static void unregister_buffer(struct buffer *buf)
 {
 	if (buf) {
 		list_del(&buf->node);
+		unindex_range(&hostptr_tree, &buf->hostptr_node);
+		unindex_range(&gpuaddr_tree, &buf->gpuaddr_node);
+		unindex_range(&offset_tree, &buf->offset_node);
+		unindex_key(&handle_table, &buf->handle_node);
+		unindex_key(&id_table, &buf->id_node);
+		if (buf->dirty)
+			dirty_untrack(buf);
 		if (buf->munmap)
 			munmap(buf->hostptr, buf->len);
+		else if (buf->dirty)
+			mprotect(buf->hostptr, ALIGN(buf->len, page_size()),
+					PROT_READ | PROT_WRITE);
+		if (buf->memfd >= 0)
+			close(buf->memfd);
+		free(buf->dirty);
 		free(buf);
 	}
 }
@@ -298,7 +602,7 @@ static void dump_buffer(uint64_t gpuaddr)
 		char filename[32];
 		int fd;
 		sprintf(filename, "%04d-%016lx.dat", cnt, buf->gpuaddr);
-		printf("\t\tdumping: %s\n", filename);
+		log_printf("\t\tdumping: %s\n", filename);
 		fd = open(filename, O_WRONLY| O_TRUNC | O_CREAT, 0644);
 		write(fd, buf->hostptr, buf->len);
 		close(fd);
@@ -308,16 +612,112 @@ static void dump_buffer(uint64_t gpuaddr)
 
 #ifdef FAKE
 static int is64b = 0;
-uint64_t alloc_gpuaddr(uint32_t size)
+
+/* emulated gpu address space is 1GB at 0xc0000000 (with the upper bits
+ * set for 64b gpus), from a buddy allocator so that freed space is reused
+ * and the addresses handed out are deterministic:
+ */
+static struct buddy gpuaddr_heap;
+
+uint64_t alloc_gpuaddr(uint32_t size, uint32_t align)
 {
-	// TODO need better scheme to deal w/ deallocation..
-	static uint32_t gpuaddr = 0xc0000000;
-	uint32_t addr = gpuaddr;
-	gpuaddr += size;
+	uint64_t addr;
+
+	if (!gpuaddr_heap.state)
+		buddy_init(&gpuaddr_heap, 0xc0000000, 12, 30);
+
+	addr = buddy_alloc(&gpuaddr_heap, size, align);
+	if (!addr) {
+		printf("out of emulated gpu address space! (size=%08x)\n", size);
+		return 0;
+	}
+
 	if (is64b)
 		return ((uint64_t)0x1ffff << 32) | addr;
 	return addr;
 }
+
+void free_gpuaddr(uint64_t gpuaddr)
+{
+	if (gpuaddr && buddy_free(&gpuaddr_heap, (uint32_t)gpuaddr))
+		printf("bad gpuaddr free: %016"PRIx64"\n", gpuaddr);
+}
+
+/* emulated buffers are backed by a memfd, so their contents can be dumped
+ * without copying them through userspace (and the kernel fills in zero
+ * pages as they are touched).  Falls back to anonymous memory:
+ */
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+static void * emulated_mmap(size_t length, int *memfd)
+{
+	void *ptr;
+	PROLOG(mmap);
+
+#ifdef __NR_memfd_create
+	*memfd = syscall(__NR_memfd_create, "kgsl-bo", MFD_CLOEXEC);
+	if ((*memfd >= 0) && !ftruncate(*memfd, length)) {
+		ptr = orig_mmap(NULL, length, PROT_READ | PROT_WRITE,
+				MAP_SHARED, *memfd, 0);
+		if (ptr != MAP_FAILED)
+			return ptr;
+	}
+	if (*memfd >= 0)
+		close(*memfd);
+#endif
+
+	*memfd = -1;
+	return orig_mmap(NULL, length, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+}
+
+/* alignment requested in the alloc flags, at least a page: */
+static uint32_t flags_align(uint64_t flags)
+{
+	return max(0x1000, 1 << ((flags & KGSL_MEMALIGN_MASK) >> KGSL_MEMALIGN_SHIFT));
+}
+
+/* buffer ids, shared by GPUMEM_ALLOC_ID and GPUOBJ_ALLOC, with the lowest
+ * free id reused first (they also end up in the mmap offset, so need to
+ * stay small):
+ */
+static struct {
+	uint32_t *bits;
+	unsigned int words, hint;
+} ids;
+
+static unsigned int alloc_id(void)
+{
+	unsigned int i, b;
+
+	for (i = ids.hint; (i < ids.words) && (ids.bits[i] == ~0u); i++)
+		;
+
+	if (i == ids.words) {
+		ids.words = max(ids.words * 2, 64);
+		ids.bits = realloc(ids.bits, ids.words * sizeof(uint32_t));
+		memset(&ids.bits[i], 0, (ids.words - i) * sizeof(uint32_t));
+		/* id zero is not valid: */
+		if (!i)
+			ids.bits[0] = 1;
+	}
+
+	ids.hint = i;
+	b = __builtin_ctz(~ids.bits[i]);
+	ids.bits[i] |= 1u << b;
+
+	return (i * 32) + b;
+}
+
+static void free_id(unsigned int id)
+{
+	if (!id || (id / 32 >= ids.words))
+		return;
+	ids.bits[id / 32] &= ~(1u << (id % 32));
+	ids.hint = min(ids.hint, id / 32);
+}
 #endif
 
 /*****************************************************************************/
@@ -335,13 +735,13 @@ static int install_fd(const char *path, int fd)
 		file_table[fd].is_emulated = 1;
 #endif
 		file_table[fd].is_3d = 1;
-		printf("found kgsl_3d0: %d\n", fd);
+		log_printf("found kgsl_3d0: %d\n", fd);
 	} else if (!strcmp(path, "/dev/kgsl-2d0")) {
 		file_table[fd].is_2d = 1;
-		printf("found kgsl_2d0: %d\n", fd);
+		log_printf("found kgsl_2d0: %d\n", fd);
 	} else if (!strcmp(path, "/dev/kgsl-2d1")) {
 		file_table[fd].is_2d = 1;
-		printf("found kgsl_2d1: %d\n", fd);
+		log_printf("found kgsl_2d1: %d\n", fd);
 	} else if (strstr(path, "/dev/")) {
 		printf("#### missing device, path: %s: %d\n", path, fd);
 	}
@@ -368,7 +768,7 @@ int open(const char* path, int flags, ...)
 		const char *actual_path = path;
 		if (access(path, F_OK) && (path == strstr(path, "/dev/"))) {
 			/* fake non-existant device files: */
-			printf("emulating: %s\n", path);
+			log_printf("emulating: %s\n", path);
 			actual_path = "/dev/null";
 		}
 		ret = orig_open(actual_path, flags);
@@ -411,7 +811,7 @@ int openat(int dirfd, const char *path, int flags, ...)
 		const char *actual_path = path;
 		if (access(path, F_OK) && (path == strstr(path, "/dev/"))) {
 			/* fake non-existant device files: */
-			printf("emulating: %s\n", path);
+			log_printf("emulating: %s\n", path);
 			actual_path = "/dev/null";
 		}
 		ret = orig_openat(dirfd, actual_path, flags);
@@ -440,7 +840,7 @@ int __openat(int dirfd, const char *path, int flags, int mode)
 	int ret;
 	PROLOG(__openat);
 
-	printf("openat: path: %s\n", path);
+	log_printf("openat: path: %s\n", path);
 
 	if (flags & (O_CREAT | O_TMPFILE)) {
 		ret = orig___openat(dirfd, path, flags, mode);
@@ -449,7 +849,7 @@ int __openat(int dirfd, const char *path, int flags, int mode)
 		const char *actual_path = path;
 		if (access(path, F_OK) && (path == strstr(path, "/dev/"))) {
 			/* fake non-existant device files: */
-			printf("emulating: %s\n", path);
+			log_printf("emulating: %s\n", path);
 			actual_path = "/dev/null";
 		}
 		ret = orig___openat(dirfd, actual_path, flags, mode);
@@ -482,7 +882,7 @@ int close(int fd)
 	if ((fd >= 0) && (fd < ARRAY_SIZE(file_table))) {
 		if (file_table[fd].is_3d) {
 			// XXX unregister buffers
-			printf("closing 3d\n");
+			log_printf("closing 3d\n");
 		}
 		file_table[fd].is_3d = 0;
 		file_table[fd].is_2d = 0;
@@ -514,12 +914,231 @@ static void log_cmdaddr(uint64_t gpuaddr, uint32_t sizedwords)
 	rd_write_section(RD_CMDSTREAM_ADDR, sect, sizeof(sect));
 }
 
+static unsigned int submit_cnt;
+
+static void log_buffer_unchanged(struct buffer *buf)
+{
+	uint32_t sect[4] = {
+			buf->gpuaddr, buf->len, buf->gpuaddr >> 32, buf->hash_submit,
+	};
+	rd_write_section(RD_BUFFER_UNCHANGED, sect, sizeof(sect));
+}
+
+/* write just the pages written since the contents were last written: */
+static void log_buffer_dirty(struct buffer *buf)
+{
+	unsigned int n = 0, cnt, found = 0;
+
+	while ((cnt = dirty_next(buf, &n))) {
+		uint32_t offset = n * page_size();
+		uint32_t len = min(buf->len, (n + cnt) * page_size()) - offset;
+		uint32_t hdr[5] = {
+				buf->gpuaddr, buf->len, buf->gpuaddr >> 32, offset, len,
+		};
+		struct iovec iov[2] = {
+				{ hdr, sizeof(hdr) },
+				{ buf->hostptr + offset, len },
+		};
+		rd_write_sectionv(RD_BUFFER_PARTIAL, iov, 2);
+		n += cnt;
+		found = 1;
+	}
+
+	if (found)
+		buf->hash_submit = submit_cnt;
+	else
+		log_buffer_unchanged(buf);
+}
+
+static void log_buffer_contents(struct buffer *buf)
+{
+	if (buf->dirty && (buf->hash_gen == rd_generation())) {
+		log_buffer_dirty(buf);
+		return;
+	}
+
+	if (wrap_incremental() && !buf->dirty) {
+		/* fold in gpuaddr, since it can be assigned after the buffer
+		 * is first dumped (ie. GPUOBJ_INFO):
+		 */
+		uint64_t hash = rd_hash(buf->hostptr, buf->len) ^ buf->gpuaddr;
+		if ((buf->hash_gen == rd_generation()) && (buf->hash == hash)) {
+			log_buffer_unchanged(buf);
+			return;
+		}
+		buf->hash = hash;
+	}
+
+	/* start tracking from the contents written now: */
+	if (buf->dirty)
+		dirty_reset(buf);
+
+	log_gpuaddr(buf->gpuaddr, buf->len);
+	rd_write_section_fd(RD_BUFFER_CONTENTS, buf->hostptr, buf->len,
+			buf->memfd, 0);
+	buf->hash_submit = submit_cnt;
+
+	/* note, the rd file could have been (re)opened by the write: */
+	buf->hash_gen = rd_generation();
+}
+
 static void dump_ib_prep(void)
 {
 	struct buffer *other_buf;
 
+	rd_flight_submit();
+	submit_cnt++;
+
 	list_for_each_entry(other_buf, &buffers_of_interest, node) {
 		other_buf->dumped = 0;
+		other_buf->referenced = 0;
+	}
+}
+
+/*
+ * For WRAP_REFERENCED, walk the cmdstream (and any IBs it calls) to find
+ * which buffers it references, so we only need to dump those.  Anything
+ * in a packet payload which looks like a gpuaddr pointing into a buffer
+ * counts as a reference (which can have false positives, but that just
+ * means we dump a bit more than needed).  If the cmdstream doesn't parse,
+ * the caller falls back to dumping everything.
+ */
+
+/* a5xx+ uses pkt4/pkt7 instead of type0/type3 packets: */
+static int is_a5xx;
+
+static void mark_referenced(uint64_t gpuaddr)
+{
+	struct buffer *buf;
+
+	if (!gpuaddr)
+		return;
+
+	buf = find_buffer(NULL, gpuaddr, 0, 0, 0);
+	if (buf)
+		buf->referenced = 1;
+}
+
+static int scan_ib(uint64_t gpuaddr, uint32_t sizedwords, int level);
+
+static int scan_payload(uint32_t *dwords, uint32_t cnt, int opc, int level)
+{
+	uint32_t i;
+
+	switch (opc) {
+	case CP_INDIRECT_BUFFER_PFE:
+	case CP_INDIRECT_BUFFER_PFD:
+		if (is_a5xx && (cnt >= 3))
+			return scan_ib(dwords[0] | ((uint64_t)dwords[1] << 32),
+					dwords[2] & 0xfffff, level + 1);
+		if (!is_a5xx && (cnt >= 2))
+			return scan_ib(dwords[0], dwords[1] & 0xfffff, level + 1);
+		return -1;
+	case CP_SET_DRAW_STATE:
+		/* groups of: count/flags, address.. but disabled groups can
+		 * have stale addresses, so don't treat failure as fatal:
+		 */
+		for (i = 0; (i + (is_a5xx ? 2 : 1)) < cnt; i += (is_a5xx ? 3 : 2)) {
+			uint64_t addr = dwords[i + 1];
+			if (is_a5xx)
+				addr |= (uint64_t)dwords[i + 2] << 32;
+			if ((dwords[i] & 0xffff) && addr)
+				scan_ib(addr, dwords[i] & 0xffff, level + 1);
+		}
+		break;
+	}
+
+	for (i = 0; i < cnt; i++) {
+		mark_referenced(dwords[i]);
+		/* 64b addresses are split into lo/hi dwords: */
+		if (is_a5xx && ((i + 1) < cnt))
+			mark_referenced(dwords[i] | ((uint64_t)dwords[i + 1] << 32));
+	}
+
+	return 0;
+}
+
+static int scan_ib(uint64_t gpuaddr, uint32_t sizedwords, int level)
+{
+	struct buffer *buf = find_buffer(NULL, gpuaddr, 0, 0, 0);
+	uint32_t *dwords;
+	uint32_t i = 0;
+
+	/* IB1 -> IB2 is as deep as the hw goes, anything more is garbage: */
+	if (level > 2)
+		return -1;
+
+	if (!buf || !buf->hostptr ||
+			(((gpuaddr - buf->gpuaddr) + (uint64_t)sizedwords * 4) > buf->len))
+		return -1;
+
+	buf->referenced = 1;
+	dwords = buf->hostptr + (gpuaddr - buf->gpuaddr);
+
+	while (i < sizedwords) {
+		uint32_t hdr = dwords[i++];
+		uint32_t cnt;
+		int opc = -1;
+
+		if (is_a5xx) {
+			switch (hdr >> 28) {
+			case CP_TYPE4_PKT >> 28:
+				cnt = hdr & 0x7f;
+				break;
+			case CP_TYPE7_PKT >> 28:
+				cnt = hdr & 0x3fff;
+				opc = (hdr >> 16) & 0x7f;
+				break;
+			default:
+				return -1;
+			}
+		} else {
+			switch (hdr & 0xc0000000) {
+			case CP_TYPE0_PKT:
+				cnt = ((hdr >> 16) & 0x3fff) + 1;
+				break;
+			case CP_TYPE2_PKT:
+				cnt = 0;
+				break;
+			case CP_TYPE3_PKT:
+				cnt = ((hdr >> 16) & 0x3fff) + 1;
+				opc = (hdr >> 8) & 0x7f;
+				break;
+			default:
+				/* type1 is not used in practice */
+				return -1;
+			}
+		}
+
+		if ((i + cnt) > sizedwords)
+			return -1;
+
+		if (scan_payload(&dwords[i], cnt, opc, level))
+			return -1;
+
+		i += cnt;
+	}
+
+	return 0;
+}
+
+static void dump_buffers(uint64_t gpuaddr, uint32_t sizedwords)
+{
+	struct buffer *other_buf;
+	int all = 1;
+
+	if (wrap_referenced()) {
+		all = !!scan_ib(gpuaddr, sizedwords, 0);
+		if (all)
+			printf("\t\tcould not parse cmdstream, dumping all buffers\n");
+	}
+
+	list_for_each_entry(other_buf, &buffers_of_interest, node) {
+		if (other_buf && other_buf->hostptr && !other_buf->dumped &&
+				(all || other_buf->referenced)) {
+			log_buffer_contents(other_buf);
+			other_buf->dumped = 1;
+		}
 	}
 }
 
@@ -527,23 +1146,14 @@ static void dump_ib(struct kgsl_ibdesc *ibdesc)
 {
 	struct buffer *buf = find_buffer(NULL, ibdesc->gpuaddr, 0, 0, 0);
 	if (buf && buf->hostptr) {
-		struct buffer *other_buf;
 		uint32_t off = ibdesc->gpuaddr - buf->gpuaddr;
 		uint32_t *ptr = buf->hostptr + off;
 
-		printf("\t\tcmd: (%u dwords)\n", (uint32_t)ibdesc->sizedwords);
+		log_printf("\t\tcmd: (%u dwords)\n", (uint32_t)ibdesc->sizedwords);
 
 		hexdump_dwords(ptr, ibdesc->sizedwords);
 
-		list_for_each_entry(other_buf, &buffers_of_interest, node) {
-			if (other_buf && other_buf->hostptr && !other_buf->dumped) {
-				uint32_t len = other_buf->len;
-				log_gpuaddr(other_buf->gpuaddr, len);
-				rd_write_section(RD_BUFFER_CONTENTS,
-						other_buf->hostptr, len);
-				other_buf->dumped = 1;
-			}
-		}
+		dump_buffers(ibdesc->gpuaddr, ibdesc->sizedwords);
 
 		/* we already dump all the buffer contents, so just need
 		 * to dump the address/size of the cmdstream:
@@ -557,24 +1167,15 @@ static void dump_cmd(struct kgsl_command_object *cmd)
 	/* note: kgsl seems to ignore cmd->offset.. which may be a bug.. */
 	struct buffer *buf = find_buffer(NULL, cmd->gpuaddr, 0, 0, 0);
 	if (buf && buf->hostptr) {
-		struct buffer *other_buf;
 		uint32_t sizedwords = cmd->size / 4;
 		uint32_t off = cmd->gpuaddr - buf->gpuaddr;
 		uint32_t *ptr = buf->hostptr + off;
 
-		printf("\t\tcmd: (%u dwords)\n", sizedwords);
+		log_printf("\t\tcmd: (%u dwords)\n", sizedwords);
 
 		hexdump_dwords(ptr, sizedwords);
 
-		list_for_each_entry(other_buf, &buffers_of_interest, node) {
-			if (other_buf && other_buf->hostptr && !other_buf->dumped) {
-				uint32_t len = other_buf->len;
-				log_gpuaddr(other_buf->gpuaddr, len);
-				rd_write_section(RD_BUFFER_CONTENTS,
-						other_buf->hostptr, len);
-				other_buf->dumped = 1;
-			}
-		}
+		dump_buffers(cmd->gpuaddr, sizedwords);
 
 		/* we already dump all the buffer contents, so just need
 		 * to dump the address/size of the cmdstream:
@@ -590,7 +1191,7 @@ static void kgsl_ioctl_ringbuffer_issueibcmds_pre(int fd,
 	int i;
 	struct kgsl_ibdesc *ibdesc;
 	dump_ib_prep();
-	printf("\t\tdrawctxt_id:\t%08x\n", param->drawctxt_id);
+	log_printf("\t\tdrawctxt_id:\t%08x\n", param->drawctxt_id);
 	/*
 For z180_cmdstream_issueibcmds():
 
@@ -632,16 +1233,16 @@ PACKETSIZE_STATESTREAM:
 
 so the context, restored on context switch, is the first: 320 (0x140) words
 	*/
-	printf("\t\tflags:\t\t%08x\n", param->flags);
-	printf("\t\tnumibs:\t\t%08x\n", param->numibs);
-	printf("\t\tibdesc_addr:\t%08x\n", param->ibdesc_addr);
+	log_printf("\t\tflags:\t\t%08x\n", param->flags);
+	log_printf("\t\tnumibs:\t\t%08x\n", param->numibs);
+	log_printf("\t\tibdesc_addr:\t%08x\n", param->ibdesc_addr);
 	ibdesc = (struct kgsl_ibdesc *)param->ibdesc_addr;
 	for (i = 0; i < param->numibs; i++) {
 		// z180_cmdstream_issueibcmds or adreno_ringbuffer_issueibcmds
-		printf("\t\tibdesc[%d].ctrl:\t\t%08x\n", i, ibdesc[i].ctrl);
-		printf("\t\tibdesc[%d].sizedwords:\t%08x\n", i, (uint32_t)ibdesc[i].sizedwords);
-		printf("\t\tibdesc[%d].gpuaddr:\t%08x\n", i, ibdesc[i].gpuaddr);
-		printf("\t\tibdesc[%d].hostptr:\t%p\n", i, ibdesc[i].hostptr);
+		log_printf("\t\tibdesc[%d].ctrl:\t\t%08x\n", i, ibdesc[i].ctrl);
+		log_printf("\t\tibdesc[%d].sizedwords:\t%08x\n", i, (uint32_t)ibdesc[i].sizedwords);
+		log_printf("\t\tibdesc[%d].gpuaddr:\t%08x\n", i, ibdesc[i].gpuaddr);
+		log_printf("\t\tibdesc[%d].hostptr:\t%p\n", i, ibdesc[i].hostptr);
 		if (is2d) {
 			if (ibdesc[i].sizedwords > PACKETSIZE_STATESTREAM) {
 				unsigned int len, *ptr;
@@ -653,12 +1254,12 @@ so the context, restored on context switch, is the first: 320 (0x140) words
 				 * can patch up the cmdstream to jump back to the next ringbuffer
 				 * entry.
 				 */
-				printf("\t\tcontext:\n");
+				log_printf("\t\tcontext:\n");
 				hexdump_dwords(ibdesc[i].hostptr, PACKETSIZE_STATESTREAM);
 				rd_write_section(RD_CONTEXT, ibdesc[i].hostptr,
 						PACKETSIZE_STATESTREAM * sizeof(unsigned int));
 
-				printf("\t\tcmd:\n");
+				log_printf("\t\tcmd:\n");
 				ptr = (unsigned int *)(ibdesc[i].hostptr +
 						PACKETSIZE_STATESTREAM * sizeof(unsigned int));
 				len = ptr[2] & 0xfff;
@@ -683,7 +1284,7 @@ so the context, restored on context switch, is the first: 320 (0x140) words
 static void kgsl_ioctl_ringbuffer_issueibcmds_post(int fd,
 		struct kgsl_ringbuffer_issueibcmds *param)
 {
-	printf("\t\ttimestamp:\t%08x\n", param->timestamp);
+	log_printf("\t\ttimestamp:\t%08x\n", param->timestamp);
 }
 
 static void kgsl_ioctl_submit_commands_pre(int fd,
@@ -696,14 +1297,14 @@ static void kgsl_ioctl_submit_commands_pre(int fd,
 
 	ibdesc = (struct kgsl_ibdesc *)param->cmdlist;
 
-	printf("\t\tdrawctxt_id:\t%08x\n", param->context_id);
-	printf("\t\tflags:\t\t%08x\n", param->flags);
-	printf("\t\tnumibs:\t\t%08x\n", param->numcmds);
+	log_printf("\t\tdrawctxt_id:\t%08x\n", param->context_id);
+	log_printf("\t\tflags:\t\t%08x\n", param->flags);
+	log_printf("\t\tnumibs:\t\t%08x\n", param->numcmds);
 	for (i = 0; i < param->numcmds; i++) {
-		printf("\t\tibdesc[%d].ctrl:\t\t%08x\n", i, ibdesc[i].ctrl);
-		printf("\t\tibdesc[%d].sizedwords:\t%08x\n", i, (uint32_t)ibdesc[i].sizedwords);
-		printf("\t\tibdesc[%d].gpuaddr:\t%08x\n", i, ibdesc[i].gpuaddr);
-		printf("\t\tibdesc[%d].hostptr:\t%p\n", i, ibdesc[i].hostptr);
+		log_printf("\t\tibdesc[%d].ctrl:\t\t%08x\n", i, ibdesc[i].ctrl);
+		log_printf("\t\tibdesc[%d].sizedwords:\t%08x\n", i, (uint32_t)ibdesc[i].sizedwords);
+		log_printf("\t\tibdesc[%d].gpuaddr:\t%08x\n", i, ibdesc[i].gpuaddr);
+		log_printf("\t\tibdesc[%d].hostptr:\t%p\n", i, ibdesc[i].hostptr);
 		dump_ib(&ibdesc[i]);
 	}
 }
@@ -711,13 +1312,13 @@ static void kgsl_ioctl_submit_commands_pre(int fd,
 static void kgsl_ioctl_submit_commands_post(int fd,
 		struct kgsl_submit_commands *param)
 {
-	printf("\t\ttimestamp:\t%08x\n", param->timestamp);
+	log_printf("\t\ttimestamp:\t%08x\n", param->timestamp);
 }
 
 static void kgsl_ioctl_drawctxt_create_pre(int fd,
 		struct kgsl_drawctxt_create *param)
 {
-	printf("\t\tflags:\t\t%08x\n", param->flags);
+	log_printf("\t\tflags:\t\t%08x\n", param->flags);
 }
 
 static void kgsl_ioctl_drawctxt_create_post(int fd,
@@ -727,7 +1328,7 @@ static void kgsl_ioctl_drawctxt_create_post(int fd,
 	static unsigned ctxid = 0;
 	param->drawctxt_id = ++ctxid;
 #endif
-	printf("\t\tdrawctxt_id:\t%08x\n", param->drawctxt_id);
+	log_printf("\t\tdrawctxt_id:\t%08x\n", param->drawctxt_id);
 }
 
 #define PROP_INFO(n) [n] = #n
@@ -760,7 +1361,7 @@ static void kgsl_ioctl_device_getproperty_post(int fd,
 {
 	const char *typename =
 		(param->type < ARRAY_SIZE(propnames)) ? propnames[param->type] : NULL;
-	printf("\t\ttype:\t\t%08x (%s)\n", param->type,
+	log_printf("\t\ttype:\t\t%08x (%s)\n", param->type,
 			typename ? typename : "unknown");
 	if (param->type == KGSL_PROP_DEVICE_INFO) {
 		struct kgsl_devinfo *devinfo = param->value;
@@ -782,12 +1383,12 @@ static void kgsl_ioctl_device_getproperty_post(int fd,
 			devinfo->mmu_enabled = 1;
 			devinfo->gmem_gpubaseaddr = 0x10000;
 #endif
-			printf("\t\tEMULATING gpu_id: %d (%08x)!!!\n",
+			log_printf("\t\tEMULATING gpu_id: %d (%08x)!!!\n",
 					devinfo->gpu_id, devinfo->chip_id);
 		}
 		if (wrap_gmem_size()) {
 			devinfo->gmem_sizebytes = wrap_gmem_size();
-			printf("\t\tEMULATING gmem_sizebytes: %u !!!\n", (uint32_t)devinfo->gmem_sizebytes);
+			log_printf("\t\tEMULATING gmem_sizebytes: %u !!!\n", (uint32_t)devinfo->gmem_sizebytes);
 		}
 		gpu_id = devinfo->gpu_id;
 		if (!gpu_id) {
@@ -796,8 +1397,9 @@ static void kgsl_ioctl_device_getproperty_post(int fd,
 				((devinfo->chip_id >> 8) & 0xff) * 1;
 		}
 		rd_write_section(RD_GPU_ID, &gpu_id, sizeof(gpu_id));
-		printf("\t\tgpu_id: %d\n", gpu_id);
-		printf("\t\tgmem_sizebytes: 0x%x\n", (uint32_t)devinfo->gmem_sizebytes);
+		is_a5xx = gpu_id >= 500;
+		log_printf("\t\tgpu_id: %d\n", gpu_id);
+		log_printf("\t\tgmem_sizebytes: 0x%x\n", (uint32_t)devinfo->gmem_sizebytes);
 #ifdef FAKE
 	} else if (param->type == KGSL_PROP_DEVICE_SHADOW) {
 		struct kgsl_shadowprop *shadow = param->value;
@@ -870,8 +1472,8 @@ static void kgsl_ioctl_sharedmem_from_vmalloc_pre(int fd,
 	int len;
 
 	/* just make gpuaddr == hostptr.. should make it easy to track */
-	printf("\t\tflags:\t\t%08x\n", param->flags);
-	printf("\t\thostptr:\t%08x\n", param->hostptr);
+	log_printf("\t\tflags:\t\t%08x\n", param->flags);
+	log_printf("\t\thostptr:\t%08x\n", param->hostptr);
 	if (param->gpuaddr) {
 		len = param->gpuaddr;
 	} else {
@@ -999,9 +1601,9 @@ static void kgsl_ioctl_sharedmem_from_vmalloc_pre(int fd,
 		}
 	}
 #ifdef FAKE
-	param->gpuaddr = alloc_gpuaddr(len);
+	param->gpuaddr = alloc_gpuaddr(len, 0x1000);
 #endif
-	printf("\t\tlen:\t\t%08x\n", len);
+	log_printf("\t\tlen:\t\t%08x\n", len);
 }
 
 static void kgsl_ioctl_sharedmem_from_vmalloc_post(int fd,
@@ -1010,23 +1612,26 @@ static void kgsl_ioctl_sharedmem_from_vmalloc_post(int fd,
 	struct buffer *buf = find_buffer((void *)param->hostptr, 0, 0, 0, 0);
 	log_gpuaddr(param->gpuaddr, len_from_vma(param->hostptr));
 	if (buf)
-		buf->gpuaddr = param->gpuaddr;
-	printf("\t\tgpuaddr:\t%08x\n", param->gpuaddr);
+		buffer_set_gpuaddr(buf, param->gpuaddr);
+	log_printf("\t\tgpuaddr:\t%08x\n", param->gpuaddr);
 }
 
 static void kgsl_ioctl_sharedmem_free_pre(int fd,
 		struct kgsl_sharedmem_free *param)
 {
 	struct buffer *buf = find_buffer((void *)-1, param->gpuaddr, 0, 0, 0);
-	printf("\t\tgpuaddr:\t%08x\n", param->gpuaddr);
+	log_printf("\t\tgpuaddr:\t%08x\n", param->gpuaddr);
 	unregister_buffer(buf);
+#ifdef FAKE
+	free_gpuaddr(param->gpuaddr);
+#endif
 }
 
 static void kgsl_ioctl_gpumem_alloc_pre(int fd,
 		struct kgsl_gpumem_alloc *param)
 {
-	printf("\t\tflags:\t\t%08x\n", param->flags);
-	printf("\t\tsize:\t\t%08x\n", (uint32_t)param->size);
+	log_printf("\t\tflags:\t\t%08x\n", param->flags);
+	log_printf("\t\tsize:\t\t%08x\n", (uint32_t)param->size);
 }
 
 static void kgsl_ioctl_gpumem_alloc_post(int fd,
@@ -1034,18 +1639,18 @@ static void kgsl_ioctl_gpumem_alloc_post(int fd,
 {
 	struct buffer *buf;
 	log_gpuaddr(param->gpuaddr, param->size);
-	printf("\t\tgpuaddr:\t%08lx\n", param->gpuaddr);
+	log_printf("\t\tgpuaddr:\t%08lx\n", param->gpuaddr);
 	/* NOTE: host addr comes from mmap'ing w/ gpuaddr as offset */
 	buf = register_buffer(NULL, param->flags, param->size, 0);
-	buf->gpuaddr = param->gpuaddr;
-	buf->offset = param->gpuaddr;
+	buffer_set_gpuaddr(buf, param->gpuaddr);
+	buffer_set_offset(buf, param->gpuaddr);
 }
 
 static void kgsl_ioctl_gpumem_alloc_id_pre(int fd,
 		struct kgsl_gpumem_alloc_id *param)
 {
-	printf("\t\tflags:\t\t%08x\n", param->flags);
-	printf("\t\tsize:\t\t%08x\n", (uint32_t)param->size);
+	log_printf("\t\tflags:\t\t%08x\n", param->flags);
+	log_printf("\t\tsize:\t\t%08x\n", (uint32_t)param->size);
 	/* easier to force it not to USE_CPU_MAP than dealing with
 	 * the mmap dance:
 	 */
@@ -1057,33 +1662,36 @@ static void kgsl_ioctl_gpumem_alloc_id_post(int fd,
 {
 	struct buffer *buf;
 #ifdef FAKE
-	static int id = 0;
-
-	param->id = ++id;
+	param->id = alloc_id();
 	param->mmapsize = ALIGN(param->size, 0x1000);
-	param->gpuaddr = alloc_gpuaddr(param->mmapsize);
+	param->gpuaddr = alloc_gpuaddr(param->mmapsize, flags_align(param->flags));
 #endif
 
 	log_gpuaddr(param->gpuaddr, param->size);
-	printf("\t\tid:\t%u\n", param->id);
-	printf("\t\tgpuaddr:\t%08lx\n", param->gpuaddr);
+	log_printf("\t\tid:\t%u\n", param->id);
+	log_printf("\t\tgpuaddr:\t%08lx\n", param->gpuaddr);
 	/* NOTE: host addr comes from mmap'ing w/ gpuaddr as offset */
 	buf = register_buffer(NULL, param->flags, param->size, 0);
-	buf->id = param->id;
-	buf->gpuaddr = param->gpuaddr;
-	buf->offset = param->gpuaddr;
+	buffer_set_id(buf, param->id);
+	buffer_set_gpuaddr(buf, param->gpuaddr);
+	buffer_set_offset(buf, param->gpuaddr);
 }
 
 static void kgsl_ioctl_gpumem_free_id_pre(int fd,
 		struct kgsl_gpumem_free_id *param)
 {
-	printf("\t\tid:\t%u\n", param->id);
+	log_printf("\t\tid:\t%u\n", param->id);
 }
 
 static void kgsl_ioctl_gpumem_free_id_post(int fd,
 		struct kgsl_gpumem_free_id *param)
 {
 	struct buffer *buf = find_buffer((void *)-1, 0, 0, 0, param->id);
+#ifdef FAKE
+	if (buf)
+		free_gpuaddr(buf->gpuaddr);
+	free_id(param->id);
+#endif
 	unregister_buffer(buf);
 }
 
@@ -1092,8 +1700,8 @@ static void kgls_ioctl_perfcounter_get_post(int fd,
 {
 	char buf[128];
 
-	printf("\t\tgroupid:\t%u\n", param->groupid);
-	printf("\t\tcountable:\t%u\n", param->countable);
+	log_printf("\t\tgroupid:\t%u\n", param->groupid);
+	log_printf("\t\tcountable:\t%u\n", param->countable);
 #ifdef FAKE
 	int g = param->groupid % 128;
 	int c = param->countable % 128;
@@ -1117,8 +1725,8 @@ static void kgls_ioctl_perfcounter_get_post(int fd,
 	param->offset = cache[g][c].lo;
 	param->offset_hi = cache[g][c].hi;
 #endif
-	printf("\t\toffset_lo:\t0x%x\n", param->offset);
-	printf("\t\toffset_hi:\t0x%x\n", param->offset_hi);
+	log_printf("\t\toffset_lo:\t0x%x\n", param->offset);
+	log_printf("\t\toffset_hi:\t0x%x\n", param->offset_hi);
 
 	rd_write_section(RD_CMD, buf, snprintf(buf, sizeof(buf),
 			"perfcounter_get: groupid=%u, countable=%u, off_lo=0x%x, off_hi=0x%x",
@@ -1130,8 +1738,8 @@ static void kgls_ioctl_perfcounter_put_pre(int fd,
 {
 	char buf[128];
 
-	printf("\t\tgroupid:\t%u\n", param->groupid);
-	printf("\t\tcountable:\t%u\n", param->countable);
+	log_printf("\t\tgroupid:\t%u\n", param->groupid);
+	log_printf("\t\tcountable:\t%u\n", param->countable);
 
 	rd_write_section(RD_CMD, buf, snprintf(buf, sizeof(buf),
 			"perfcounter_put: groupid=%u, countable=%u",
@@ -1141,8 +1749,8 @@ static void kgls_ioctl_perfcounter_put_pre(int fd,
 static void kgls_ioctl_gpuobj_alloc_pre(int fd,
 		struct kgsl_gpuobj_alloc *param)
 {
-	printf("\t\tflags:\t\t%08x %08x\n", (uint32_t)(param->flags >> 32), (uint32_t)param->flags);
-	printf("\t\tsize:\t\t%08x\n", (uint32_t)param->size);
+	log_printf("\t\tflags:\t\t%08x %08x\n", (uint32_t)(param->flags >> 32), (uint32_t)param->flags);
+	log_printf("\t\tsize:\t\t%08x\n", (uint32_t)param->size);
 	/* easier to force it not to USE_CPU_MAP than dealing with
 	 * the mmap dance:
 	 */
@@ -1154,34 +1762,37 @@ static void kgls_ioctl_gpuobj_alloc_post(int fd,
 {
 	struct buffer *buf;
 #ifdef FAKE
-	static int id = 0;
-
-	param->id = ++id;
+	param->id = alloc_id();
 	param->mmapsize = ALIGN(param->size, 0x1000);
 #endif
-	printf("\t\tid:\t%u\n", param->id);
+	log_printf("\t\tid:\t%u\n", param->id);
 	/* NOTE: host addr comes from mmap'ing w/ gpuaddr as offset */
 	buf = register_buffer(NULL, param->flags, param->size, 0);
-	buf->id = param->id;
+	buffer_set_id(buf, param->id);
 }
 
 static void kgls_ioctl_gpuobj_free_pre(int fd,
 		struct kgsl_gpuobj_free *param)
 {
-	printf("\t\tid:\t%u\n", param->id);
+	log_printf("\t\tid:\t%u\n", param->id);
 }
 
 static void kgls_ioctl_gpuobj_free_post(int fd,
 		struct kgsl_gpuobj_free *param)
 {
 	struct buffer *buf = find_buffer((void *)-1, 0, 0, 0, param->id);
+#ifdef FAKE
+	if (buf)
+		free_gpuaddr(buf->gpuaddr);
+	free_id(param->id);
+#endif
 	unregister_buffer(buf);
 }
 
 static void kgsl_ioclt_gpuobj_info_pre(int fd,
 		struct kgsl_gpuobj_info *param)
 {
-	printf("\t\tid:\t%u\n", param->id);
+	log_printf("\t\tid:\t%u\n", param->id);
 }
 
 static void kgsl_ioclt_gpuobj_info_post(int fd,
@@ -1190,16 +1801,21 @@ static void kgsl_ioclt_gpuobj_info_post(int fd,
 	struct buffer *buf = find_buffer((void *)-1, 0, 0, 0, param->id);
 #ifdef FAKE
 	param->size = buf->len;
-	param->gpuaddr = alloc_gpuaddr(ALIGN(buf->len, 0x1000));
+	/* info can be queried more than once: */
+	if (buf->gpuaddr)
+		param->gpuaddr = buf->gpuaddr;
+	else
+		param->gpuaddr = alloc_gpuaddr(ALIGN(buf->len, 0x1000),
+				flags_align(buf->flags));
 	param->va_addr = param->gpuaddr;
 	param->va_len = buf->len;
 #endif
 
 	log_gpuaddr(param->gpuaddr, param->size);
-	printf("\t\tid:\t%u\n", param->id);
-	printf("\t\tgpuaddr:\t%08lx\n", param->gpuaddr);
-	buf->gpuaddr = param->gpuaddr;
-	buf->offset = param->gpuaddr;
+	log_printf("\t\tid:\t%u\n", param->id);
+	log_printf("\t\tgpuaddr:\t%08lx\n", param->gpuaddr);
+	buffer_set_gpuaddr(buf, param->gpuaddr);
+	buffer_set_offset(buf, param->gpuaddr);
 }
 
 static void kgls_ioctl_gpuobj_gpu_command_pre(int fd,
@@ -1212,14 +1828,14 @@ static void kgls_ioctl_gpuobj_gpu_command_pre(int fd,
 
 	cmdobj = (struct kgsl_command_object *)param->cmdlist;
 
-	printf("\t\tdrawctxt_id:\t%08x\n", param->context_id);
-	printf("\t\tflags:\t\t%08x %08x\n", (uint32_t)(param->flags >> 32), (uint32_t)param->flags);
-	printf("\t\tnumcmds:\t\t%08x\n", param->numcmds);
+	log_printf("\t\tdrawctxt_id:\t%08x\n", param->context_id);
+	log_printf("\t\tflags:\t\t%08x %08x\n", (uint32_t)(param->flags >> 32), (uint32_t)param->flags);
+	log_printf("\t\tnumcmds:\t\t%08x\n", param->numcmds);
 
 	for (i = 0; i < param->numcmds; i++) {
-		printf("\t\tcmd[%d].flags:\t\t%08x\n", i, cmdobj[i].flags);
-		printf("\t\tcmd[%d].sizedwords:\t%08x\n", i, (uint32_t)cmdobj[i].size / 4);
-		printf("\t\tcmd[%d].gpuaddr:\t%08x\n", i, cmdobj[i].gpuaddr);
+		log_printf("\t\tcmd[%d].flags:\t\t%08x\n", i, cmdobj[i].flags);
+		log_printf("\t\tcmd[%d].sizedwords:\t%08x\n", i, (uint32_t)cmdobj[i].size / 4);
+		log_printf("\t\tcmd[%d].gpuaddr:\t%08x\n", i, cmdobj[i].gpuaddr);
 		dump_cmd(&cmdobj[i]);
 	}
 }
@@ -1227,7 +1843,7 @@ static void kgls_ioctl_gpuobj_gpu_command_pre(int fd,
 static void kgls_ioctl_gpuobj_gpu_command_post(int fd,
 		struct kgsl_gpu_command *param)
 {
-	printf("\t\ttimestamp:\t%08x\n", param->timestamp);
+	log_printf("\t\ttimestamp:\t%08x\n", param->timestamp);
 }
 
 static void kgsl_ioctl_pre(int fd, unsigned long int request, void *ptr)
@@ -1326,7 +1942,7 @@ static void kgsl_ioctl_post(int fd, unsigned long int request, void *ptr, int re
 int ioctl(int fd, int request, ...)
 {
 	int ioc_size = _IOC_SIZE(request);
-	int ret;
+	int ret, timedout;
 	PROLOG(ioctl);
 	void *ptr;
 
@@ -1361,10 +1977,24 @@ int ioctl(int fd, int request, ...)
 		}
 	}
 
+	rd_flight_check();
+
 	if (get_kgsl_info(fd))
 		kgsl_ioctl_pre(fd, request, ptr);
 	else
-		printf("> [%4d]         : <unknown> (%08lx)\n", fd, (long)request);
+		log_printf("> [%4d]         : <unknown> (%08lx)\n", fd, (long)request);
+
+	/* make sure the log is on disk before handing cmds to the gpu, or
+	 * waiting on it, in case it hangs:
+	 */
+	if (((_IOC_NR(request) == _IOC_NR(IOCTL_KGSL_RINGBUFFER_ISSUEIBCMDS)) ||
+			(_IOC_NR(request) == _IOC_NR(IOCTL_KGSL_SUBMIT_COMMANDS)) ||
+			(_IOC_NR(request) == _IOC_NR(IOCTL_KGSL_GPU_COMMAND)) ||
+			(_IOC_NR(request) == _IOC_NR(IOCTL_KGSL_DEVICE_WAITTIMESTAMP)) ||
+			(_IOC_NR(request) == _IOC_NR(IOCTL_KGSL_DEVICE_WAITTIMESTAMP_CTXTID))) &&
+			get_kgsl_info(fd) && wrap_safe()) {
+		rd_sync();
+	}
 
 	if ((_IOC_NR(request) == _IOC_NR(IOCTL_KGSL_RINGBUFFER_ISSUEIBCMDS)) &&
 			get_kgsl_info(fd) && wrap_safe()) {
@@ -1392,12 +2022,27 @@ int ioctl(int fd, int request, ...)
 		ret = orig_ioctl(fd, request, ptr);
 	}
 
+	timedout = (ret < 0) && (errno == ETIMEDOUT);
+
 	LOCK();
 
 	if (get_kgsl_info(fd))
 		kgsl_ioctl_post(fd, request, ptr, ret);
 	else
-		printf("< [%4d]         : <unknown> (%08lx) (%d)\n", fd, (long)request, ret);
+		log_printf("< [%4d]         : <unknown> (%08lx) (%d)\n", fd, (long)request, ret);
+
+	/* flight recorder triggers: */
+	if (get_kgsl_info(fd) && wrap_flight()) {
+		if (timedout &&
+				((_IOC_NR(request) == _IOC_NR(IOCTL_KGSL_DEVICE_WAITTIMESTAMP)) ||
+				(_IOC_NR(request) == _IOC_NR(IOCTL_KGSL_DEVICE_WAITTIMESTAMP_CTXTID))))
+			rd_flight_flush("WAITTIMESTAMP timeout");
+		else if (wrap_flight_trigger() && (submit_cnt == wrap_flight_trigger()) &&
+				((_IOC_NR(request) == _IOC_NR(IOCTL_KGSL_RINGBUFFER_ISSUEIBCMDS)) ||
+				(_IOC_NR(request) == _IOC_NR(IOCTL_KGSL_SUBMIT_COMMANDS)) ||
+				(_IOC_NR(request) == _IOC_NR(IOCTL_KGSL_GPU_COMMAND))))
+			rd_flight_flush("submit count");
+	}
 
 	UNLOCK();
 
@@ -1413,6 +2058,7 @@ int ioctl(int fd, int request, ...)
 void * mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
 {
 	void *ret = NULL;
+	int memfd = -1;
 	PROLOG(mmap);
 
 	LOCK();
@@ -1421,7 +2067,7 @@ void * mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset
 		//struct buffer *buf = find_buffer(NULL, 0, offset, 0, 0);
 		struct buffer *buf = find_buffer(NULL, 0, 0, 0, offset >> 12); // XXX only id's are used now
 
-		printf("< [%4d]         : mmap: addr=%p, length=%u, prot=%x, flags=%x, offset=%08lx\n",
+		log_printf("< [%4d]         : mmap: addr=%p, length=%u, prot=%x, flags=%x, offset=%08lx\n",
 				fd, addr, (uint32_t)length, prot, flags, offset);
 
 		if (buf && buf->hostptr) {
@@ -1433,7 +2079,7 @@ void * mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset
 	if (!ret) {
 #ifdef FAKE
 		if ((fd >= 0) && file_table[fd].is_emulated) {
-			ret = malloc(length);
+			ret = emulated_mmap(length, &memfd);
 		} else {
 			ret = orig_mmap(addr, length, prot, flags, fd, offset);
 		}
@@ -1446,7 +2092,7 @@ void * mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset
 		//struct buffer *buf = find_buffer(NULL, 0, offset, 0, 0);
 		struct buffer *buf = find_buffer(NULL, 0, 0, 0, offset >> 12); // XXX only id's are used now
 		if (buf)
-			buf->hostptr = ret;
+			buffer_set_hostptr(buf, ret);
 		else {
 			/*
 			 * when a buffer is allocated using IOCTL_KGSL_GPUMEM_ALLOC_ID
@@ -1455,11 +2101,23 @@ void * mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset
 			 */
 			buf = find_buffer(NULL, 0, 0, 0, offset >> 12);
 			if (buf)
-				buf->hostptr = ret;
+				buffer_set_hostptr(buf, ret);
+		}
+		if (buf && (memfd >= 0)) {
+			if (buf->memfd >= 0)
+				close(buf->memfd);
+			buf->memfd = memfd;
+			memfd = -1;
 		}
-		printf("< [%4d]         : mmap: -> (%p)\n", fd, ret);
+		if (buf && wrap_dirty_pages() && (prot & PROT_WRITE))
+			dirty_track(buf);
+		log_printf("< [%4d]         : mmap: -> (%p)\n", fd, ret);
 	}
 
+	/* if nothing is tracking it, the mapping keeps it alive: */
+	if (memfd >= 0)
+		close(memfd);
+
 	UNLOCK();
 
 	return ret;
@@ -1468,6 +2126,7 @@ void * mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset
 void *mmap64(void *addr, size_t length, int prot, int flags, int fd, int64_t offset)
 {
 	void *ret = NULL;
+	int memfd = -1;
 	PROLOG(mmap64);
 
 	LOCK();
@@ -1476,11 +2135,11 @@ void *mmap64(void *addr, size_t length, int prot, int flags, int fd, int64_t off
 		//struct buffer *buf = find_buffer(NULL, 0, offset, 0, 0);
 		struct buffer *buf = find_buffer(NULL, 0, 0, 0, offset >> 12); // XXX only id's are used now
 
-		printf("< [%4d]         : mmap64: addr=%p, length=%u, prot=%x, flags=%x, offset=%08lx\n",
+		log_printf("< [%4d]         : mmap64: addr=%p, length=%u, prot=%x, flags=%x, offset=%08lx\n",
 				fd, addr, (uint32_t)length, prot, flags, offset);
 
 		if (buf && buf->hostptr) {
-			printf("  [%4d]	    : (recycled from buf=%p)\n", fd, buf);
+			log_printf("  [%4d]	    : (recycled from buf=%p)\n", fd, buf);
 			buf->munmap = 0;
 			ret = buf->hostptr;
 		}
@@ -1489,7 +2148,7 @@ void *mmap64(void *addr, size_t length, int prot, int flags, int fd, int64_t off
 	if (!ret) {
 #ifdef FAKE
 		if ((fd >= 0) && file_table[fd].is_emulated) {
-			ret = calloc(1, length);
+			ret = emulated_mmap(length, &memfd);
 		} else {
 			ret = orig_mmap64(addr, length, prot, flags, fd, offset);
 		}
@@ -1502,7 +2161,7 @@ void *mmap64(void *addr, size_t length, int prot, int flags, int fd, int64_t off
 		//struct buffer *buf = find_buffer(NULL, 0, offset, 0, 0);
 		struct buffer *buf = find_buffer(NULL, 0, 0, 0, offset >> 12); // XXX only id's are used now
 		if (buf)
-			buf->hostptr = ret;
+			buffer_set_hostptr(buf, ret);
 		else {
 			/*
 			 * when a buffer is allocated using IOCTL_KGSL_GPUMEM_ALLOC_ID
@@ -1511,11 +2170,23 @@ void *mmap64(void *addr, size_t length, int prot, int flags, int fd, int64_t off
 			 */
 			buf = find_buffer(NULL, 0, 0, 0, offset >> 12);
 			if (buf)
-				buf->hostptr = ret;
+				buffer_set_hostptr(buf, ret);
+		}
+		if (buf && (memfd >= 0)) {
+			if (buf->memfd >= 0)
+				close(buf->memfd);
+			buf->memfd = memfd;
+			memfd = -1;
 		}
-		printf("< [%4d]         : mmap64: -> (%p), buf=%p\n", fd, ret, buf);
+		if (buf && wrap_dirty_pages() && (prot & PROT_WRITE))
+			dirty_track(buf);
+		log_printf("< [%4d]         : mmap64: -> (%p), buf=%p\n", fd, ret, buf);
 	}
 
+	/* if nothing is tracking it, the mapping keeps it alive: */
+	if (memfd >= 0)
+		close(memfd);
+
 	UNLOCK();
 
 	return ret;
@@ -1532,7 +2203,7 @@ int munmap(void *addr, size_t length)
 	buf = find_buffer(addr, 0, 0, 0, 0);
 	if (buf) {
 		/* we need the contents at submit ioctl: */
-printf("fake munmap: buf=%p\n", buf);
+log_printf("fake munmap: buf=%p\n", buf);
 		buf->munmap = 1;
 		ret = 0;
 		goto out;
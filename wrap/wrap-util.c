@@ -21,10 +21,18 @@
  * SOFTWARE.
  */
 
+#include <sys/uio.h>
+#include <sys/syscall.h>
+
 #include "wrap.h"
+#include "rdz.h"
+#include "rdidx.h"
 
 static int fd = -1;
 static unsigned int gpu_id;
+static unsigned int generation;
+static uint64_t offset;            /* in the (uncompressed) rd stream */
+static struct rd_index idx;
 
 #ifdef USE_PTHREADS
 static pthread_mutex_t l = PTHREAD_RECURSIVE_MUTEX_INITIALIZER;
@@ -69,14 +77,24 @@ int wrap_printf(const char *format, ...)
 }
 
 
+static void rd_flush(void);
+static void rd_writev(struct iovec *iov, int iovcnt);
+static void rd_flight_init(void);
+static void rd_write_index(void);
+
 void rd_start(const char *name, const char *fmt, ...)
 {
 	char buf[256];
-	static int cnt = 0;
+	static int cnt = 0, initialized;
 	int n = cnt++;
 	const char *testnum;
 	va_list  args;
 
+	/* anything still queued belongs to the previous file: */
+	rd_flight_flush("new rd file");
+	rd_write_index();
+	rd_flush();
+
 	testnum = getenv("TESTNUM");
 	if (testnum) {
 		n = strtol(testnum, NULL, 0);
@@ -86,6 +104,25 @@ void rd_start(const char *name, const char *fmt, ...)
 	}
 
 	fd = open(buf, O_WRONLY| O_TRUNC | O_CREAT, 0644);
+	generation++;
+
+	/* not keyed on generation, which rd_flight_submit() bumps too, maybe
+	 * before the first rd file is started:
+	 */
+	if (!initialized) {
+		initialized = 1;
+		/* don't lose the tail of the log on normal exit: */
+		atexit(rd_flush);
+		atexit(rd_write_index);
+		if (wrap_flight())
+			rd_flight_init();
+	}
+
+	if (wrap_compress()) {
+		uint32_t hdr[2] = { RDZ_MAGIC, RDZ_VERSION };
+		struct iovec iov = { hdr, sizeof(hdr) };
+		rd_writev(&iov, 1);
+	}
 
 	va_start(args, fmt);
 	vsprintf(buf, fmt, args);
@@ -104,6 +141,9 @@ void rd_start(const char *name, const char *fmt, ...)
 
 void rd_end(void)
 {
+	rd_flight_flush("end of capture");
+	rd_write_index();
+	rd_flush();
 	close(fd);
 	fd = -1;
 }
@@ -114,25 +154,451 @@ volatile int*  __errno( void );
 #define errno (*__errno())
 #endif
 
-static void rd_write(const void *buf, int sz)
+static void rd_writev(struct iovec *iov, int iovcnt)
 {
-	const uint8_t *cbuf = buf;
-	while (sz > 0) {
-		int ret = write(fd, cbuf, sz);
+	while (iovcnt > 0) {
+		int ret = writev(fd, iov, iovcnt);
 		if (ret < 0) {
 			printf("error: %d (%s)\n", ret, strerror(errno));
-			printf("fd=%d, buf=%p, sz=%d\n", fd, buf, sz);
+			printf("fd=%d, iovcnt=%d\n", fd, iovcnt);
 			exit(-1);
 		}
-		cbuf += ret;
-		sz -= ret;
+		/* skip over what was written, in case of short write: */
+		while ((iovcnt > 0) && (ret >= iov->iov_len)) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (uint8_t *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
 	}
 }
 
-void rd_write_section(enum rd_sect_type type, const void *buf, int sz)
+/*
+ * Compression: with $WRAP_COMPRESS set, the rd byte stream is collected
+ * into blocks which are compressed independently (see rdz.h).  Readers
+ * (redump, zdump) detect this and decompress transparently.
+ */
+
+static struct {
+	uint8_t *raw, *comp;
+	unsigned int len;
+} rdz;
+
+static void rd_compress_block(void)
+{
+	uint32_t hdr[3] = { RDZ_BLOCK_MAGIC, rdz.len, rdz.len };
+	struct iovec iov[2] = {
+			{ hdr, sizeof(hdr) },
+			{ rdz.raw, rdz.len },
+	};
+	int compsz;
+
+	if (!rdz.len)
+		return;
+
+	compsz = rdz_compress(rdz.raw, rdz.len, rdz.comp, RDZ_BOUND(rdz.len));
+	if ((compsz > 0) && (compsz < rdz.len)) {
+		hdr[2] = compsz;
+		iov[1].iov_base = rdz.comp;
+		iov[1].iov_len  = compsz;
+	}
+
+	rd_writev(iov, 2);
+	rdz.len = 0;
+}
+
+/* write (or compress) to the rd file: */
+static void rd_output(struct iovec *iov, int iovcnt)
+{
+	int i;
+
+	if (!wrap_compress()) {
+		rd_writev(iov, iovcnt);
+		return;
+	}
+
+	if (!rdz.raw) {
+		rdz.raw  = malloc(RDZ_BLOCK_SIZE);
+		rdz.comp = malloc(RDZ_BOUND(RDZ_BLOCK_SIZE));
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		const uint8_t *ptr = iov[i].iov_base;
+		unsigned int len = iov[i].iov_len;
+
+		while (len > 0) {
+			unsigned int n = min(len, RDZ_BLOCK_SIZE - rdz.len);
+			memcpy(rdz.raw + rdz.len, ptr, n);
+			rdz.len += n;
+			ptr += n;
+			len -= n;
+			if (rdz.len == RDZ_BLOCK_SIZE)
+				rd_compress_block();
+		}
+	}
+}
+
+/*
+ * Async writer: with $WRAP_ASYNC set, sections are copied into large
+ * chunks which are handed off to a background thread to write, so the
+ * app's submit path only pays for a memcpy.  Once all chunks are queued
+ * the app blocks until the writer thread catches up.
+ */
+
+#define RD_CHUNK_SIZE  (4 * 1024 * 1024)
+#define RD_NUM_CHUNKS  4
+
+static struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int started;
+	/* chunks [tail, head) are queued for writing, chunk head is the one
+	 * currently being filled:
+	 */
+	unsigned int head, tail;
+	struct {
+		uint8_t *buf;
+		unsigned int len;
+	} chunks[RD_NUM_CHUNKS];
+} writer = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+#define CHUNK(n) (&writer.chunks[(n) % RD_NUM_CHUNKS])
+
+static void * rd_writer_thread(void *arg)
+{
+	pthread_mutex_lock(&writer.lock);
+	while (1) {
+		struct iovec iov[RD_NUM_CHUNKS];
+		unsigned int i, n;
+
+		while (writer.tail == writer.head)
+			pthread_cond_wait(&writer.cond, &writer.lock);
+
+		n = writer.head - writer.tail;
+		for (i = 0; i < n; i++) {
+			iov[i].iov_base = CHUNK(writer.tail + i)->buf;
+			iov[i].iov_len  = CHUNK(writer.tail + i)->len;
+		}
+
+		pthread_mutex_unlock(&writer.lock);
+		rd_output(iov, n);
+		pthread_mutex_lock(&writer.lock);
+
+		for (i = 0; i < n; i++)
+			CHUNK(writer.tail + i)->len = 0;
+		writer.tail += n;
+		pthread_cond_broadcast(&writer.cond);
+	}
+	return NULL;
+}
+
+/* queue up the current chunk, waiting for a free one if needed: */
+static void rd_queue_chunk(void)
+{
+	pthread_mutex_lock(&writer.lock);
+	while ((writer.head + 1 - writer.tail) >= RD_NUM_CHUNKS)
+		pthread_cond_wait(&writer.cond, &writer.lock);
+	writer.head++;
+	pthread_cond_broadcast(&writer.cond);
+	pthread_mutex_unlock(&writer.lock);
+}
+
+/* wait for everything written so far to hit the file: */
+static void rd_flush(void)
+{
+	if (writer.started) {
+		if (CHUNK(writer.head)->len)
+			rd_queue_chunk();
+
+		pthread_mutex_lock(&writer.lock);
+		while (writer.tail != writer.head)
+			pthread_cond_wait(&writer.cond, &writer.lock);
+		pthread_mutex_unlock(&writer.lock);
+	}
+
+	/* writer thread is idle now, so safe to finish the partial block: */
+	rd_compress_block();
+}
+
+static void rd_writer_start(void)
+{
+	int i;
+
+	for (i = 0; i < RD_NUM_CHUNKS; i++)
+		writer.chunks[i].buf = malloc(RD_CHUNK_SIZE);
+
+	pthread_create(&writer.thread, NULL, rd_writer_thread, NULL);
+	writer.started = 1;
+}
+
+static void rd_write_async(struct iovec *iov, int iovcnt, unsigned int total)
+{
+	int i;
+
+	if (!writer.started)
+		rd_writer_start();
+
+	if ((CHUNK(writer.head)->len + total) > RD_CHUNK_SIZE)
+		rd_queue_chunk();
+
+	if (total > RD_CHUNK_SIZE) {
+		/* too big to buffer, so just write it directly: */
+		rd_flush();
+		rd_output(iov, iovcnt);
+		return;
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(CHUNK(writer.head)->buf + CHUNK(writer.head)->len,
+				iov[i].iov_base, iov[i].iov_len);
+		CHUNK(writer.head)->len += iov[i].iov_len;
+	}
+}
+
+static void rd_emit(struct iovec *iov, int iovcnt, unsigned int total)
+{
+	if (wrap_async()) {
+		rd_write_async(iov, iovcnt, total);
+	} else {
+		rd_output(iov, iovcnt);
+	}
+}
+
+/*
+ * Index: with $WRAP_INDEX set, the offset and type of each section is
+ * collected as it is written, and an RD_INDEX section is appended when
+ * the rd file is finished (see rdidx.h).  If the app crashes before that
+ * happens, rdindex can rebuild it.
+ */
+
+static void index_section(uint32_t type, uint32_t sz)
+{
+	if (wrap_index())
+		rd_index_add(&idx, offset, type, sz);
+	offset += 16 + sz;
+}
+
+static void rd_write_index(void)
+{
+	uint32_t hdr[4] = { ~0, ~0, RD_INDEX, 0 };
+
+	if ((fd != -1) && idx.nsections) {
+		struct iovec iov[2];
+		void *buf;
+
+		idx.end = offset;
+		buf = rd_index_section(&idx, offset, &hdr[3]);
+		iov[0] = (struct iovec){ hdr, sizeof(hdr) };
+		iov[1] = (struct iovec){ buf, hdr[3] };
+		rd_emit(iov, 2, sizeof(hdr) + hdr[3]);
+		free(buf);
+	}
+
+	rd_index_fini(&idx);
+	offset = 0;
+}
+
+/*
+ * Flight recorder: with $WRAP_FLIGHT=n, sections are not written as they
+ * are logged, but collected in memory per submit, keeping only the last n
+ * submits (and at most $WRAP_FLIGHT_MAX MB).  They are written out when
+ * something interesting happens, see rd_flight_flush().  RD_TEST and
+ * RD_GPU_ID still go straight to the file, so what is flushed is always
+ * a valid rd file.
+ */
+
+struct flight_rec {
+	uint8_t *data;
+	size_t len, size;
+	int truncated;     /* sections were dropped to stay under the cap */
+};
+
+static struct {
+	struct flight_rec *ring;     /* completed submits */
+	unsigned int first, cnt;
+	struct flight_rec cur;       /* the submit currently being recorded */
+	size_t total;                /* allocated, across ring and cur */
+	int flushing;
+	volatile sig_atomic_t requested;
+} flight;
+
+static size_t flight_max(void)
+{
+	unsigned int mb = wrap_flight_max();
+	return (size_t)(mb ? mb : 256) << 20;
+}
+
+static void flight_free(struct flight_rec *rec)
+{
+	flight.total -= rec->size;
+	free(rec->data);
+	memset(rec, 0, sizeof(*rec));
+}
+
+static void flight_evict(void)
+{
+	flight_free(&flight.ring[flight.first]);
+	flight.first = (flight.first + 1) % wrap_flight();
+	flight.cnt--;
+}
+
+static void flight_record(struct iovec *iov, int iovcnt, unsigned int total)
+{
+	struct flight_rec *rec = &flight.cur;
+	int i;
+
+	if (rec->truncated)
+		return;
+
+	if ((rec->len + total) > rec->size) {
+		size_t size = max(max(rec->size * 2, rec->len + total), 0x10000);
+		uint8_t *data;
+
+		if (size > flight_max())
+			size = rec->len + total;
+
+		/* make room by dropping the oldest submits, but if this submit
+		 * alone is too big, drop the rest of it instead:
+		 */
+		while (flight.cnt && ((flight.total - rec->size + size) > flight_max()))
+			flight_evict();
+
+		if (((flight.total - rec->size + size) > flight_max()) ||
+				!(data = realloc(rec->data, size))) {
+			rec->truncated = 1;
+			return;
+		}
+
+		flight.total += size - rec->size;
+		rec->data = data;
+		rec->size = size;
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(rec->data + rec->len, iov[i].iov_base, iov[i].iov_len);
+		rec->len += iov[i].iov_len;
+	}
+}
+
+static void flight_write(struct flight_rec *rec)
+{
+	struct iovec iov = { rec->data, rec->len };
+	size_t off;
+
+	if (rec->truncated) {
+		const char *msg = "flight recorder: submit truncated";
+		rd_write_section(RD_CMD, msg, strlen(msg));
+	}
+
+	for (off = 0; off < rec->len; ) {
+		uint32_t *hdr = (uint32_t *)(rec->data + off);
+		index_section(hdr[2], hdr[3]);
+		off += 16 + hdr[3];
+	}
+
+	rd_emit(&iov, 1, rec->len);
+	flight_free(rec);
+}
+
+static void flight_signal(int sig)
+{
+	flight.requested = 1;
+}
+
+static void flight_exit(void)
+{
+	rd_flight_flush("exit");
+}
+
+static void rd_flight_init(void)
+{
+	/* no SA_RESTART, so that a wait on a hung gpu gets interrupted and
+	 * we get a chance to flush:
+	 */
+	struct sigaction sa = {
+			.sa_handler = flight_signal,
+	};
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR1, &sa, NULL);
+
+	flight.ring = calloc(wrap_flight(), sizeof(*flight.ring));
+
+	/* runs before rd_flush(), which was registered first: */
+	atexit(flight_exit);
+}
+
+/* start recording the next submit: */
+void rd_flight_submit(void)
+{
+	/* nothing to record into before rd_flight_init(): */
+	if (!wrap_flight() || !flight.ring || flight.flushing)
+		return;
+
+	/* the ring holds the n-1 submits before the current one: */
+	if (flight.cur.len || flight.cur.truncated) {
+		unsigned int n = wrap_flight();
+		while (flight.cnt && ((flight.cnt + 1) >= n))
+			flight_evict();
+		if (n > 1) {
+			flight.ring[(flight.first + flight.cnt) % n] = flight.cur;
+			flight.cnt++;
+			memset(&flight.cur, 0, sizeof(flight.cur));
+		} else {
+			flight_free(&flight.cur);
+		}
+	}
+
+	/* each submit needs to stand on it's own, since the ones before it
+	 * may be gone by the time it is written:
+	 */
+	generation++;
+}
+
+/* write out everything recorded so far: */
+void rd_flight_flush(const char *reason)
+{
+	char buf[128];
+
+	if (!wrap_flight() || flight.flushing || (fd == -1) ||
+			!(flight.cnt || flight.cur.len || flight.cur.truncated))
+		return;
+
+	flight.flushing = 1;
+
+	rd_write_section(RD_CMD, buf, snprintf(buf, sizeof(buf),
+			"flight recorder: %s, last %u submits", reason,
+			flight.cnt + !!flight.cur.len));
+
+	while (flight.cnt) {
+		flight_write(&flight.ring[flight.first]);
+		flight.first = (flight.first + 1) % wrap_flight();
+		flight.cnt--;
+	}
+	flight_write(&flight.cur);
+
+	flight.flushing = 0;
+
+	rd_sync();
+}
+
+/* flush if requested by signal, called at the start of each ioctl: */
+void rd_flight_check(void)
 {
-	uint32_t val = ~0;
+	if (flight.requested) {
+		flight.requested = 0;
+		rd_flight_flush("signal");
+	}
+}
 
+static void rd_open(void)
+{
 	if (fd == -1) {
 		const char *name = getenv("TESTNAME");
 		if (!name)
@@ -140,24 +606,175 @@ void rd_write_section(enum rd_sect_type type, const void *buf, int sz)
 		rd_start(name, "");
 		printf("opened rd, %d\n", fd);
 	}
+}
+
+/* write a section whose payload is gathered from multiple pieces, ie. a
+ * small header followed by buffer contents, without copying:
+ */
+void rd_write_sectionv(enum rd_sect_type type, const struct iovec *data, int n)
+{
+	struct iovec iov[2 + n];
+	uint32_t hdr[4] = { ~0, ~0, type, 0 };
+	uint32_t pad = 0;
+	int i, sz = 0;
+
+	for (i = 0; i < n; i++) {
+		iov[1 + i] = data[i];
+		sz += data[i].iov_len;
+	}
+
+	hdr[3] = ALIGN(sz, 4);
+	iov[0] = (struct iovec){ hdr, sizeof(hdr) };
+	iov[1 + n] = (struct iovec){ &pad, ALIGN(sz, 4) - sz };
+
+	rd_open();
 
 	if (type == RD_GPU_ID) {
-		gpu_id = *(unsigned int *)buf;
+		gpu_id = *(unsigned int *)data[0].iov_base;
+	}
+
+	if (wrap_flight() && !flight.flushing &&
+			(type != RD_TEST) && (type != RD_GPU_ID)) {
+		flight_record(iov, 2 + n, sizeof(hdr) + ALIGN(sz, 4));
+		return;
+	}
+
+	index_section(type, ALIGN(sz, 4));
+	rd_emit(iov, 2 + n, sizeof(hdr) + ALIGN(sz, 4));
+}
+
+void rd_write_section(enum rd_sect_type type, const void *buf, int sz)
+{
+	struct iovec iov = { (void *)buf, sz };
+	rd_write_sectionv(type, &iov, 1);
+}
+
+/* copy sz bytes at off in srcfd straight into the rd file, without going
+ * through userspace.  Returns the number of bytes copied, which is less
+ * than sz if the kernel can't do it for these files (ie. EXDEV, since
+ * newer kernels don't copy_file_range() across filesystems).
+ *
+ * Note that sendfile()/splice() are not used as a fallback, since for a
+ * regular file they still copy the data and measure slower than write().
+ */
+#ifdef __NR_copy_file_range
+static int copy_broken;    /* once it fails, don't bother trying again */
+#else
+static int copy_broken = 1;
+#endif
+
+static int rd_copy_fd(int srcfd, off_t off, int sz)
+{
+	int done = 0;
+
+#ifdef __NR_copy_file_range
+	while (done < sz) {
+		loff_t in = off + done;
+		long ret = syscall(__NR_copy_file_range, srcfd, &in, fd, NULL,
+				(size_t)(sz - done), 0);
+		if (ret <= 0) {
+			copy_broken = (ret < 0);
+			break;
+		}
+		done += ret;
+	}
+#endif
+
+	return done;
+}
+
+/* like rd_write_section(), but the contents can also be read from srcfd
+ * at off (ie. a memfd backing buf), which lets the kernel move them into
+ * the rd file.  When the rd file isn't written directly (compression,
+ * flight recorder or the async writer), or the kernel can't do it, buf is
+ * written instead.  The async writer would otherwise have to be drained
+ * for every section.
+ */
+void rd_write_section_fd(enum rd_sect_type type, const void *buf, int sz,
+		int srcfd, off_t off)
+{
+	uint32_t hdr[4] = { ~0, ~0, type, ALIGN(sz, 4) };
+	uint32_t pad = 0;
+	struct iovec iov[2];
+	int done;
+
+	if ((srcfd < 0) || copy_broken || wrap_compress() || wrap_flight() ||
+			wrap_async()) {
+		rd_write_section(type, buf, sz);
+		return;
 	}
 
-	rd_write(&val, 4);
-	rd_write(&val, 4);
+	rd_open();
+
+	index_section(type, ALIGN(sz, 4));
 
-	rd_write(&type, 4);
-	val = ALIGN(sz, 4);
-	rd_write(&val, 4);
-	rd_write(buf, sz);
+	iov[0] = (struct iovec){ hdr, sizeof(hdr) };
+	rd_writev(iov, 1);
 
-	val = 0;
-	rd_write(&val, ALIGN(sz, 4) - sz);
+	done = rd_copy_fd(srcfd, off, sz);
 
-	if (wrap_safe())
-		fsync(fd);
+	iov[0] = (struct iovec){ (uint8_t *)buf + done, sz - done };
+	iov[1] = (struct iovec){ &pad, ALIGN(sz, 4) - sz };
+	rd_writev(iov, 2);
+}
+
+/* called at submit boundaries in safe mode, so that everything logged
+ * up to the point where we hand cmds to the gpu makes it to disk, even
+ * if the gpu hangs (and takes the rest of the system with it):
+ */
+void rd_sync(void)
+{
+	if (fd == -1)
+		return;
+	rd_flush();
+	fsync(fd);
+}
+
+/* incremented each time a new rd file is started (or, for the flight
+ * recorder, a new submit), so that anything which refers back to earlier
+ * sections (ie. RD_BUFFER_UNCHANGED) knows when it needs to start over:
+ */
+unsigned int rd_generation(void)
+{
+	return generation;
+}
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+/* fast non-cryptographic content hash, used to detect buffers which have
+ * not changed since the last time they were dumped.  Consumes 64b at a
+ * time (xxhash style multiply/rotate), which is fast enough that hashing
+ * a buffer is much cheaper than writing it out:
+ */
+uint64_t rd_hash(const void *buf, unsigned int sz)
+{
+	static const uint64_t p1 = 0x9e3779b185ebca87ull;
+	static const uint64_t p2 = 0xc2b2ae3d27d4eb4full;
+	const uint8_t *ptr = buf;
+	const uint8_t *end = ptr + sz;
+	uint64_t h = p2 ^ (sz * p1);
+
+	while ((ptr + 8) <= end) {
+		uint64_t v;
+		memcpy(&v, ptr, 8);
+		h ^= rotl64(v * p2, 31) * p1;
+		h = rotl64(h, 27) * p1 + p2;
+		ptr += 8;
+	}
+
+	while (ptr < end) {
+		h ^= (*ptr++) * p1;
+		h = rotl64(h, 11) * p2;
+	}
+
+	h ^= h >> 33;
+	h *= p2;
+	h ^= h >> 29;
+
+	return h;
 }
 
 unsigned int env2u(const char *name)
@@ -168,9 +785,9 @@ unsigned int env2u(const char *name)
 	return strtol(str, NULL, 0);
 }
 
-/* in safe mode, sync log file frequently, and insert delays before/after
- * issueibcmds.. useful when we are crashing things and want to be sure to
- * capture as much of the log as possible
+/* in safe mode, sync log file before each submit, and insert delays
+ * before/after issueibcmds.. useful when we are crashing things and want
+ * to be sure to capture as much of the log as possible
  */
 unsigned int wrap_safe(void)
 {
@@ -181,6 +798,126 @@ unsigned int wrap_safe(void)
 	return val;
 }
 
+/* in incremental mode, buffers whose contents have not changed since the
+ * last submit are not dumped again, instead an RD_BUFFER_UNCHANGED section
+ * refers back to the submit where the contents were last written.  This
+ * keeps long captures from growing quadratically.
+ */
+unsigned int wrap_incremental(void)
+{
+	static unsigned int val = -1;
+	if (val == -1) {
+		val = env2u("WRAP_INCREMENTAL");
+	}
+	return val;
+}
+
+/* if non-zero, only dump buffers which the submitted cmdstream (appears
+ * to) reference, rather than every buffer
+ */
+unsigned int wrap_referenced(void)
+{
+	static unsigned int val = -1;
+	if (val == -1) {
+		val = env2u("WRAP_REFERENCED");
+	}
+	return val;
+}
+
+/* if non-zero, the host mappings of gpu buffers are write-protected so
+ * that the pages the app writes can be tracked, and only the dirty pages
+ * of buffers already dumped are written out again (RD_BUFFER_PARTIAL)
+ */
+unsigned int wrap_dirty_pages(void)
+{
+	static unsigned int val = -1;
+	if (val == -1) {
+		val = env2u("WRAP_DIRTY_PAGES");
+	}
+	return val;
+}
+
+/* how intercepted ioctls are logged, $WRAP_IOCTL_LOG is one of:
+ *   text   - decoded to stdout (the default)
+ *   binary - RD_IOCTL records in the rd file, see ioctldump
+ *   off    - not at all
+ * anything other than text also skips the rest of the printf logging.
+ */
+unsigned int wrap_ioctl_log(void)
+{
+	static unsigned int val = -1;
+	if (val == -1) {
+		const char *str = getenv("WRAP_IOCTL_LOG");
+		if (str && !strcmp(str, "binary"))
+			val = WRAP_IOCTL_LOG_BINARY;
+		else if (str && !strcmp(str, "off"))
+			val = WRAP_IOCTL_LOG_OFF;
+		else
+			val = WRAP_IOCTL_LOG_TEXT;
+	}
+	return val;
+}
+
+/* if non-zero, the number of submits for the flight recorder to keep */
+unsigned int wrap_flight(void)
+{
+	static unsigned int val = -1;
+	if (val == -1) {
+		val = env2u("WRAP_FLIGHT");
+	}
+	return val;
+}
+
+/* flight recorder memory limit, in MB (defaults to 256) */
+unsigned int wrap_flight_max(void)
+{
+	static unsigned int val = -1;
+	if (val == -1) {
+		val = env2u("WRAP_FLIGHT_MAX");
+	}
+	return val;
+}
+
+/* if non-zero, flush the flight recorder after this many submits */
+unsigned int wrap_flight_trigger(void)
+{
+	static unsigned int val = -1;
+	if (val == -1) {
+		val = env2u("WRAP_FLIGHT_TRIGGER");
+	}
+	return val;
+}
+
+/* if non-zero, an RD_INDEX section is written at the end of rd files */
+unsigned int wrap_index(void)
+{
+	static unsigned int val = -1;
+	if (val == -1) {
+		val = env2u("WRAP_INDEX");
+	}
+	return val;
+}
+
+/* if non-zero, rd files are written in compressed (rdz) format */
+unsigned int wrap_compress(void)
+{
+	static unsigned int val = -1;
+	if (val == -1) {
+		val = env2u("WRAP_COMPRESS");
+	}
+	return val;
+}
+
+/* if non-zero, rd sections are written from a background thread */
+unsigned int wrap_async(void)
+{
+	static unsigned int val = -1;
+	if (val == -1) {
+		val = env2u("WRAP_ASYNC");
+	}
+	return val;
+}
+
 /* if non-zero, emulate a different gpu-id.  The issueibcmds will be stubbed
  * so we don't actually submit cmds to the gpu.  This is useful to generate
  * cmdstream dumps for different gpu versions for comparision.
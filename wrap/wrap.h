@@ -36,12 +36,14 @@
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <dlfcn.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <errno.h>
 #include <stdio.h>
 #include <assert.h>
+#include <signal.h>
 #include <unistd.h>
 
 #define __user
@@ -65,8 +67,33 @@ void * __rd_dlsym_helper(const char *name);
 		orig_##func = __rd_dlsym_helper(#func);	\
 
 
+void rd_write_sectionv(enum rd_sect_type type, const struct iovec *data, int n);
+void rd_write_section_fd(enum rd_sect_type type, const void *buf, int sz,
+		int srcfd, off_t off);
+void rd_sync(void);
+void rd_flight_submit(void);
+void rd_flight_flush(const char *reason);
+void rd_flight_check(void);
+unsigned int rd_generation(void);
+uint64_t rd_hash(const void *buf, unsigned int sz);
+
 unsigned int env2u(const char *name);
 unsigned int wrap_safe(void);
+unsigned int wrap_incremental(void);
+unsigned int wrap_async(void);
+unsigned int wrap_compress(void);
+unsigned int wrap_index(void);
+unsigned int wrap_referenced(void);
+unsigned int wrap_dirty_pages(void);
+enum {
+	WRAP_IOCTL_LOG_TEXT,
+	WRAP_IOCTL_LOG_BINARY,
+	WRAP_IOCTL_LOG_OFF,
+};
+unsigned int wrap_ioctl_log(void);
+unsigned int wrap_flight(void);
+unsigned int wrap_flight_max(void);
+unsigned int wrap_flight_trigger(void);
 unsigned int wrap_gpu_id(void);
 unsigned int wrap_gpu_id_patchid(void);
 unsigned int wrap_gmem_size(void);